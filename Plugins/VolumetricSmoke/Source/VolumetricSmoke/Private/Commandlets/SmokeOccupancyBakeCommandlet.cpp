@@ -0,0 +1,145 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Commandlets/SmokeOccupancyBakeCommandlet.h"
+
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "Misc/PackageName.h"
+#include "UObject/Package.h"
+#include "UObject/SavePackage.h"
+#include "Voxel/SmokeOccupancyAsset.h"
+
+namespace
+{
+	/** Cell size used when -CellSize is not given, a typical smoke voxel */
+	constexpr float DefaultBakeCellSize = 25.0f;
+}
+
+USmokeOccupancyBakeCommandlet::USmokeOccupancyBakeCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 USmokeOccupancyBakeCommandlet::Main(const FString& Params)
+{
+#if WITH_EDITOR
+	float CellSize = DefaultBakeCellSize;
+	FParse::Value(*Params, TEXT("CellSize="), CellSize);
+	if (CellSize <= 0.0f)
+	{
+		UE_LOG(LogTemp, Error, TEXT("VolumetricSmoke: -CellSize must be positive"));
+		return 1;
+	}
+
+	TArray<FString> MapPackageNames;
+	FString MapsParam;
+	if (FParse::Value(*Params, TEXT("Maps="), MapsParam, false))
+	{
+		MapsParam.ParseIntoArray(MapPackageNames, TEXT("+"));
+	}
+	else
+	{
+		IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(TEXT("AssetRegistry")).Get();
+		AssetRegistry.SearchAllAssets(true);
+
+		TArray<FAssetData> MapAssets;
+		AssetRegistry.GetAssetsByClass(UWorld::StaticClass()->GetClassPathName(), MapAssets);
+		for (const FAssetData& MapAsset : MapAssets)
+		{
+			const FString PackageName = MapAsset.PackageName.ToString();
+			if (PackageName.StartsWith(TEXT("/Game/")))
+			{
+				MapPackageNames.Add(PackageName);
+			}
+		}
+	}
+
+	int32 NumFailed = 0;
+	for (const FString& MapPackageName : MapPackageNames)
+	{
+		if (!BakeMap(MapPackageName, CellSize))
+		{
+			++NumFailed;
+		}
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("VolumetricSmoke: Baked occupancy of %d maps, %d failed"), MapPackageNames.Num() - NumFailed, NumFailed);
+	return NumFailed > 0 ? 1 : 0;
+#else
+	UE_LOG(LogTemp, Error, TEXT("VolumetricSmoke: Occupancy can only be baked by an editor build"));
+	return 1;
+#endif
+}
+
+bool USmokeOccupancyBakeCommandlet::BakeMap(const FString& MapPackageName, float CellSize)
+{
+#if WITH_EDITOR
+	UPackage* MapPackage = LoadPackage(nullptr, *MapPackageName, LOAD_None);
+	UWorld* World = MapPackage ? UWorld::FindWorldInPackage(MapPackage) : nullptr;
+	if (!World)
+	{
+		UE_LOG(LogTemp, Error, TEXT("VolumetricSmoke: Could not load map %s"), *MapPackageName);
+		return false;
+	}
+
+	// Physics queries need the world initialized with a physics scene and its components registered
+	World->AddToRoot();
+	World->WorldType = EWorldType::Editor;
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Editor);
+	WorldContext.SetCurrentWorld(World);
+
+	const bool bInitializedWorld = !World->bIsWorldInitialized;
+	if (bInitializedWorld)
+	{
+		World->InitWorld(UWorld::InitializationValues()
+			.ShouldSimulatePhysics(false)
+			.EnableTraceCollision(true)
+			.CreatePhysicsScene(true)
+			.CreateNavigation(false)
+			.CreateAISystem(false)
+			.AllowAudioPlayback(false)
+			.RequiresHitProxies(false));
+	}
+	World->UpdateWorldComponents(true, false);
+
+	const FString AssetPackageName = USmokeOccupancyAsset::GetPackageNameForMap(MapPackageName);
+	const FString AssetName = FPackageName::GetShortName(AssetPackageName);
+	UPackage* AssetPackage = CreatePackage(*AssetPackageName);
+	AssetPackage->FullyLoad();
+
+	USmokeOccupancyAsset* Asset = FindObject<USmokeOccupancyAsset>(AssetPackage, *AssetName);
+	if (!Asset)
+	{
+		Asset = NewObject<USmokeOccupancyAsset>(AssetPackage, *AssetName, RF_Public | RF_Standalone);
+		FAssetRegistryModule::AssetCreated(Asset);
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	Asset->Bake(World, CellSize);
+	Asset->MarkPackageDirty();
+
+	FSavePackageArgs SaveArgs;
+	SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+	const FString Filename = FPackageName::LongPackageNameToFilename(AssetPackageName, FPackageName::GetAssetPackageExtension());
+	const bool bSaved = UPackage::SavePackage(AssetPackage, Asset, *Filename, SaveArgs);
+
+	UE_LOG(LogTemp, Display, TEXT("VolumetricSmoke: Baked %s in %.1f s, %.1f KB%s"),
+		*MapPackageName, FPlatformTime::Seconds() - StartTime, Asset->GetAllocatedSize() / 1024.0f, bSaved ? TEXT("") : TEXT(", FAILED TO SAVE"));
+
+	if (bInitializedWorld)
+	{
+		World->CleanupWorld();
+	}
+	GEngine->DestroyWorldContext(World);
+	World->RemoveFromRoot();
+	CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+
+	return bSaved;
+#else
+	return false;
+#endif
+}
@@ -8,12 +8,30 @@
 #include "Materials/Material.h"
 #include "DynamicMeshBuilder.h"
 #include "Math/UnrealMathUtility.h"
+#include "Misc/MemStack.h"
+#include "RenderingThread.h"
 #include "MeshMaterialShader.h"
 #include "MeshPassProcessor.h"
 
 #include "CollisionQueryParams.h"
 #include "CollisionShape.h"
 #include "Engine/OverlapResult.h" 
+#include "Async/ParallelFor.h"
+#include "HAL/IConsoleManager.h"
+#include "Subsystems/SmokeVolumeSubsystem.h"
+#include "Voxel/SmokeHash.h"
+#include "Voxel/SmokeObstacleQuery.h"
+#include "Voxel/SmokeOccupancyAsset.h"
+#include "Voxel/SmokeVolume.h"
+
+namespace
+{
+	TAutoConsoleVariable<bool> CVarSmokeValidateBakedOccupancy(
+		TEXT("VolumetricSmoke.ValidateBakedOccupancy"),
+		false,
+		TEXT("Also query physics for static geometry when baked occupancy is used, and log where the two disagree."),
+		ECVF_Cheat);
+}
 
 UVolumetricSmokeComponent::UVolumetricSmokeComponent(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
@@ -21,11 +39,9 @@ UVolumetricSmokeComponent::UVolumetricSmokeComponent(const FObjectInitializer& O
 	, VoxelResolution(32)
 	, bShowDebugVisualization(true)
 	, DebugColor(FColor::Red)
-	, CurrentResolution(0)
-	, CurrentSphereRadius(0.0f)
 {
-	PrimaryComponentTick.bCanEverTick = true;
-	PrimaryComponentTick.TickGroup = TG_PostUpdateWork;
+	// Volumes are ticked in one batch by USmokeVolumeSubsystem
+	PrimaryComponentTick.bCanEverTick = false;
 	
 	// Enable collision and rendering
 	SetCollisionEnabled(ECollisionEnabled::NoCollision);
@@ -35,17 +51,34 @@ UVolumetricSmokeComponent::UVolumetricSmokeComponent(const FObjectInitializer& O
 void UVolumetricSmokeComponent::OnRegister()
 {
 	Super::OnRegister();
+
+	if (USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem())
+	{
+		Volume = Subsystem->RegisterVolume(this);
+	}
 	
 	// Generate voxels when component is registered (works in editor and game)
 	RegenerateVoxels();
 }
 
+void UVolumetricSmokeComponent::OnUnregister()
+{
+	if (USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem())
+	{
+		Subsystem->CancelRegeneration(this);
+		Subsystem->UnregisterVolume(Volume);
+	}
+	Volume = nullptr;
+
+	Super::OnUnregister();
+}
+
 void UVolumetricSmokeComponent::BeginPlay()
 {
 	Super::BeginPlay();
 	
 	// Regenerate voxels in case they weren't generated in editor
-	if (VoxelGrid.Num() == 0)
+	if (Volume && Volume->GetResolution() == 0)
 	{
 		RegenerateVoxels();
 	}
@@ -60,9 +93,16 @@ void UVolumetricSmokeComponent::PostEditChangeProperty(FPropertyChangedEvent& Pr
 	{
 		const FName PropertyName = PropertyChangedEvent.Property->GetFName();
 		if (PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, SphereRadius) ||
-			PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, VoxelResolution))
+			PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, VoxelResolution) ||
+			PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, FillMode) ||
+			PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, FloodFillVolumeScale) ||
+			PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, DensityFormat) ||
+			PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, SmokeLifetime) ||
+			PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, DissipationDuration) ||
+			PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, AttributeSeed))
 		{
-			RegenerateVoxels();
+			// Built in the background once the value rests, the current voxels stay visible while dragging
+			RequestRegenerate();
 		}
 		else if (PropertyName == GET_MEMBER_NAME_CHECKED(UVolumetricSmokeComponent, SmokeMaterial))
 		{
@@ -72,69 +112,224 @@ void UVolumetricSmokeComponent::PostEditChangeProperty(FPropertyChangedEvent& Pr
 	}
 }
 
-void UVolumetricSmokeComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+USmokeVolumeSubsystem* UVolumetricSmokeComponent::GetSmokeSubsystem() const
+{
+	const UWorld* World = GetWorld();
+	return World ? World->GetSubsystem<USmokeVolumeSubsystem>() : nullptr;
+}
+
+const FSmokeVolume* UVolumetricSmokeComponent::GetReadableVolume() const
+{
+	const USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem();
+	return Volume && !(Subsystem && Subsystem->IsVolumeBuilding(Volume)) ? Volume : nullptr;
+}
+
+void UVolumetricSmokeComponent::WakeUp()
+{
+	USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem();
+	if (Subsystem && Volume)
+	{
+		Subsystem->ActivateVolume(Volume);
+	}
+}
+
+bool UVolumetricSmokeComponent::IsAwake() const
+{
+	const USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem();
+	return Subsystem && Volume && Subsystem->IsVolumeActive(Volume);
+}
+
+int32 UVolumetricSmokeComponent::GetVoxelCount() const
+{
+	const FSmokeVolume* ReadableVolume = GetReadableVolume();
+	return ReadableVolume ? ReadableVolume->SmokeVoxels.Num() : 0;
+}
+
+void UVolumetricSmokeComponent::SetSphereRadius(float InRadius)
+{
+	SphereRadius = InRadius;
+	RequestRegenerate();
+}
+
+void UVolumetricSmokeComponent::SetVoxelResolution(int32 InResolution)
+{
+	VoxelResolution = InResolution;
+	RequestRegenerate();
+}
+
+void UVolumetricSmokeComponent::RequestRegenerate()
 {
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	WorldToGridFrame = MAX_uint64;
 
-	// Regenerate if parameters changed
-	if (CurrentResolution != VoxelResolution || !FMath::IsNearlyEqual(CurrentSphereRadius, SphereRadius))
+	if (USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem())
+	{
+		Subsystem->RequestRegenerate(this);
+	}
+	else
 	{
 		RegenerateVoxels();
 	}
+}
 
-	// Draw debug visualization
-	if (bShowDebugVisualization)
+FSmokeFadeParams UVolumetricSmokeComponent::GetFadeParams() const
+{
+	const UWorld* World = GetWorld();
+	if (!World || !Volume)
 	{
-		//DrawDebugVisualization();
+		FSmokeFadeParams FadeParams;
+		FadeParams.SpawnSpeed = SmokeSpawnSpeed;
+		return FadeParams;
 	}
 
-	UpdateVoxelsVisibility(DeltaTime);
+	return Volume->GetFadeParams(World->GetTimeSeconds(), SmokeSpawnSpeed);
 }
 
-void UVolumetricSmokeComponent::UpdateVoxelsVisibility(float DeltaTime)
+uint32 UVolumetricSmokeComponent::GetResolvedAttributeSeed() const
 {
-	for (FSmokeVoxel& Voxel : SmokeVoxelArray)
+	if (AttributeSeed != 0)
 	{
-		const float OldVisibility = Voxel.Visibility;
-		Voxel.Visibility = FMath::FInterpTo(OldVisibility, 1.0, DeltaTime, SmokeSpawnSpeed * Voxel.Density);
+		return static_cast<uint32>(AttributeSeed);
 	}
+
+	// Rounded to whole units so clients agree on it despite tiny differences in replicated locations
+	const FVector Location = GetComponentLocation();
+	return SmokeHash::HashCell(FIntVector(FMath::RoundToInt(Location.X), FMath::RoundToInt(Location.Y), FMath::RoundToInt(Location.Z)));
 }
 
+FSmokeSimulationSettings UVolumetricSmokeComponent::GetSimulationSettings() const
+{
+	FSmokeSimulationSettings Settings;
+	const UWorld* World = GetWorld();
+	if (!bSimulate || !World || !World->IsGameWorld())
+	{
+		return Settings;
+	}
+
+	// The solver works in voxels, the grid spacing depends on radius and resolution
+	const float VoxelSize = (SphereRadius * 2.0f) / VoxelResolution;
+	Settings.Diffusion = Diffusion / FMath::Square(VoxelSize);
+	Settings.Decay = DecayRate;
+	Settings.bAdvect = bAdvect;
+	Settings.VelocityDamping = VelocityDamping;
+	Settings.bProjectPressure = bProjectPressure;
+	Settings.Pressure.MaxCycles = PressureCycles;
+	Settings.Pressure.Tolerance = PressureTolerance;
+	Settings.SubStepSeconds = 1.0f / FMath::Max(SimulationRate, 1.0f);
+	return Settings;
+}
+
+void UVolumetricSmokeComponent::HandleDissipated()
+{
+	VoxelDataVersion++;
+	MarkRenderDynamicDataDirty();
+	OnSmokeDissipated.Broadcast(this);
+}
+
+FSmokeVolume* UVolumetricSmokeComponent::PublishVolume(FSmokeVolume* NewVolume, const FSmokeObstacleQueryStats& Stats)
+{
+	FSmokeVolume* OldVolume = Volume;
+	Volume = NewVolume;
+	ObstacleQueryStats = Stats;
+	bSendAllVoxels = true;
+
+	// The proxy is sent every voxel of the new volume at the end of the frame
+	NotifyVoxelDataChanged();
+
+	if (Volume->IsFloodFillRunning() || Volume->IsSimulating())
+	{
+		WakeUp();
+	}
+
+	return OldVolume;
+}
 
 void UVolumetricSmokeComponent::RegenerateVoxels()
 {
-	CurrentResolution = VoxelResolution;
-	CurrentSphereRadius = SphereRadius;
+	if (!Volume)
+	{
+		return;
+	}
 
-	// Resize voxel grid
-	const int32 TotalVoxels = VoxelResolution * VoxelResolution * VoxelResolution;
-	VoxelGrid.SetNum(TotalVoxels);
-	VoxelColors.SetNum(TotalVoxels);
+	// Anything building in the background is outdated now, and explosions must be done writing the voxels
+	if (USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem())
+	{
+		Subsystem->CancelRegeneration(this);
+		Subsystem->WaitForClearing(Volume);
+	}
 
-	// Clear the smoke voxel array before regenerating
-	SmokeVoxelArray.Empty();
+	// Clear the voxel grid, bricks are allocated again as voxels get written.
+	// Fade-in is measured from here.
+	const UWorld* World = GetWorld();
+	Volume->Reset(VoxelResolution, DensityFormat, World ? World->GetTimeSeconds() : 0.0);
+	Volume->Lifetime = SmokeLifetime;
+	Volume->DissipationDuration = DissipationDuration;
+	Volume->Seed = GetResolvedAttributeSeed();
+	Volume->SimulationSettings = GetSimulationSettings();
 
-	// Initialize all voxels to empty
-	for (FSmokeVoxel& Voxel : VoxelGrid)
+	if (FillMode == ESmokeFillMode::FloodFill)
+	{
+		BeginFloodFill();
+	}
+	else
 	{
-		Voxel.Density = 0.0f;
+		// Generate sphere shape
+		GenerateSphereVoxels();
 	}
 
-	// Generate sphere shape
-	GenerateSphereVoxels();
+	// Generate randomized colors for each voxel, the flood fill colours the voxels it adds later itself
+	Volume->GenerateVoxelColors();
 
-	// Generate randomized colors for each voxel
-	GenerateVoxelColors();
+	NotifyVoxelDataChanged();
 
+	// The simulation starts from the finished fill
+	if (Volume->IsSimulating())
+	{
+		WakeUp();
+	}
+
+	const SIZE_T AllocatedSize = Volume->GetAllocatedSize();
+	UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Generated %d voxels in sphere (Radius: %f, Resolution: %d, Bricks: %d, %.1f KB, %.1f bytes per voxel)"), 
+		GetVoxelCount(), SphereRadius, VoxelResolution, Volume->VoxelBricks.GetNumBricks(), AllocatedSize / 1024.0f,
+		GetVoxelCount() > 0 ? static_cast<float>(AllocatedSize) / GetVoxelCount() : 0.0f);
+}
+
+void UVolumetricSmokeComponent::NotifyVoxelDataChanged()
+{
 	// Increment version to indicate voxel data changed
 	VoxelDataVersion++;
 
-	// Update bounds and mark render state dirty (this recreates the scene proxy)
+	// The grid may have a new radius or resolution
+	WorldToGridFrame = MAX_uint64;
+
+	// On the grid it was created for the proxy only needs the new bounds and a copy of the voxels.
+	// Anything else recreates it.
 	UpdateBounds();
-	MarkRenderStateDirty();
+	if (ProxyVoxelResolution == VoxelResolution && ProxySphereRadius == SphereRadius)
+	{
+		MarkRenderTransformDirty();
+		MarkRenderDynamicDataDirty();
+	}
+	else
+	{
+		MarkRenderStateDirty();
+	}
 
-	UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Generated %d voxels in sphere (Radius: %f, Resolution: %d)"), 
-		GetVoxelCount(), SphereRadius, VoxelResolution);
+	UpdateIndexedBounds();
+}
+
+void UVolumetricSmokeComponent::UpdateIndexedBounds()
+{
+	// An unregistered component has handed its volume back, or is about to
+	if (!Volume || !IsRegistered())
+	{
+		return;
+	}
+
+	// Bounds are only updated after OnUpdateTransform(), so compute them from the transform
+	if (USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem())
+	{
+		Subsystem->UpdateVolumeBounds(Volume, CalcBounds(GetComponentTransform()).GetBox());
+	}
 }
 
 void UVolumetricSmokeComponent::GenerateVoxelsAtLocation(const FVector& WorldLocation, float InRadius, int32 InResolution)
@@ -146,129 +341,296 @@ void UVolumetricSmokeComponent::GenerateVoxelsAtLocation(const FVector& WorldLoc
 	SphereRadius = InRadius;
 	VoxelResolution = InResolution;
 	
-	// Generate voxels once
-	RegenerateVoxels();
+	// Generate voxels once. In game worlds the volume is rebuilt in place on the worker pool and shows up once it is
+	// done, so several detonations in one frame do not stall it and none takes a second volume from the pool. A pooled
+	// volume regenerates into its preallocated buffers and the existing scene proxy is kept, as long as radius and
+	// resolution match the previous detonation.
+	USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem();
+	const UWorld* World = GetWorld();
+	if (Subsystem && World && World->IsGameWorld())
+	{
+		Subsystem->StartRegeneration(this);
+	}
+	else
+	{
+		RegenerateVoxels();
+	}
 	
 	UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Generated smoke at location %s"), *WorldLocation.ToString());
 }
 
-void UVolumetricSmokeComponent::GenerateSphereVoxels()
+void UVolumetricSmokeComponent::ProbeObstacles(float RegionRadius)
 {
 	const float VoxelSize = (SphereRadius * 2.0f) / VoxelResolution;
-	const float SphereRadiusSquared = SphereRadius * SphereRadius;
-	const FVector SphereCenter = FVector::ZeroVector; // Local space center
-	const FVector Offset = FVector(SphereRadius); // Offset to center the grid
+	const FTransform& ComponentTransform = GetComponentTransform();
 
+	// Every buffer of the probe comes from the subsystem's scratch memory, reused across regenerations
+	USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem();
+	FSmokeScratchMemory LocalScratchMemory;
+	FSmokeScratchMemory& ScratchMemory = Subsystem ? Subsystem->AcquireScratchMemory() : LocalScratchMemory;
 
-	if (bShowDebugVisualization)
+	// Static geometry comes from baked occupancy or the world's obstacle cache when there is one, only movable
+	// bodies are queried with the rest then
+	const USmokeOccupancyAsset* StaticOccupancy = Subsystem ? Subsystem->GetStaticOccupancy() : nullptr;
+	FSmokeObstacleCache* ObstacleCache = Subsystem && !StaticOccupancy ? Subsystem->GetObstacleCache() : nullptr;
+	const ESmokeObstacleMobility QueryMobility = StaticOccupancy || ObstacleCache ? ESmokeObstacleMobility::MovableOnly : ESmokeObstacleMobility::All;
+
+	// Broad phase: one overlap for the whole volume, padded by the per-voxel probe radius
+	const FBox WorldBounds = CalcBounds(ComponentTransform).GetBox().ExpandBy(VoxelSize);
+	FSmokeObstacleQuery ObstacleQuery(ScratchMemory);
+	ObstacleQuery.Gather(GetWorld(), WorldBounds, QueryMobility);
+
+	// Narrow phase: octree blocks against the gathered bodies, subdividing only where they touch geometry
+	FSmokeObstacleGrid ObstacleGrid;
+	ObstacleGrid.LocalToWorld = ComponentTransform;
+	ObstacleGrid.Origin = -FVector(SphereRadius);
+	ObstacleGrid.Resolution = VoxelResolution;
+	ObstacleGrid.VoxelSize = VoxelSize;
+	ObstacleGrid.ProbeRadius = VoxelSize;
+	ObstacleGrid.RegionRadius = RegionRadius;
+
+	TSmokeScratchArray<int32>& BlockedVoxels = ScratchMemory.BlockedVoxels;
+	ObstacleQuery.ClassifyGrid(ObstacleGrid, BlockedVoxels, ObstacleQueryStats);
+
+	auto MarkBlocked = [this, VoxelSize](TConstArrayView<int32> Blocked)
 	{
-		DrawDebugSphere(GetWorld(),GetComponentTransform().TransformPosition(SphereCenter), SphereRadius, 12, FColor::Green, false, 5.0f , 0, 1.0f);
-	}
+		Volume->MarkBlocked(Blocked);
+
+		if (bShowDebugVisualization)
+		{
+			for (const int32 Index : Blocked)
+			{
+				DrawDebugBox(GetWorld(), VoxelToWorld(Volume->IndexToVoxel(Index)), FVector(VoxelSize * 0.5f), GetComponentQuat(), FColor::Red, false, 5.0f , 0, 5.0f);
+			}
+		}
+	};
+	MarkBlocked(BlockedVoxels);
+
+	ObstacleQueryStats.BakedStaticVoxels = 0;
+	ObstacleQueryStats.ValidationBakedOnly = 0;
+	ObstacleQueryStats.ValidationLiveOnly = 0;
+	ObstacleQueryStats.CacheHits = 0;
+	ObstacleQueryStats.CacheMisses = 0;
 
-	// Iterate through all voxel positions
-	for (int32 Z = 0; Z < VoxelResolution; ++Z)
+	if (StaticOccupancy)
 	{
-		for (int32 Y = 0; Y < VoxelResolution; ++Y)
+		TSmokeScratchArray<int32>& StaticBlockedVoxels = ScratchMemory.StaticBlockedVoxels;
+		ObstacleQuery.ClassifyGridBaked(ObstacleGrid, *StaticOccupancy, StaticBlockedVoxels);
+		MarkBlocked(StaticBlockedVoxels);
+		ObstacleQueryStats.BakedStaticVoxels = StaticBlockedVoxels.Num();
+
+		if (CVarSmokeValidateBakedOccupancy.GetValueOnGameThread())
+		{
+			ValidateBakedOccupancy(ObstacleGrid, WorldBounds, ScratchMemory);
+		}
+	}
+	else if (ObstacleCache)
+	{
+		// Cells another smoke already probed are answered by the cache, physics is only queried for the others
+		FSmokeObstacleQuery StaticQuery(ScratchMemory);
+		StaticQuery.Gather(GetWorld(), WorldBounds, ESmokeObstacleMobility::StaticOnly);
+
+		TSmokeScratchArray<int32>& StaticBlockedVoxels = ScratchMemory.StaticBlockedVoxels;
+		TSmokeScratchArray<FSmokeObstacleCacheUpdate>& CacheUpdates = ScratchMemory.CacheUpdates;
+		StaticQuery.ClassifyGridCached(ObstacleGrid, ObstacleCache, StaticBlockedVoxels, CacheUpdates, StaticQueryStats);
+		MarkBlocked(StaticBlockedVoxels);
+
+		for (const FSmokeObstacleCacheUpdate& Update : CacheUpdates)
 		{
-			for (int32 X = 0; X < VoxelResolution; ++X)
+			if (Update.bHit)
 			{
-				// Convert voxel coordinates to local space position directly
-				const FVector LocalPos = FVector(X, Y, Z) * VoxelSize - Offset;
-
-				const FVector WorldPos = GetComponentTransform().TransformPosition(LocalPos);
-				
-				// Check if position is inside sphere
-				const float DistanceSquared = FVector::DistSquared(LocalPos, SphereCenter);
-				
-				if (DistanceSquared <= SphereRadiusSquared)
-				{
-
-
-
-					if (IsVoxelNearStaticMesh(GetWorld(), WorldPos, VoxelSize))
-					{
-						if (bShowDebugVisualization)
-						{
-							DrawDebugBox(GetWorld(),WorldPos, FVector(VoxelSize * 0.5f), GetComponentQuat(), FColor::Red, false, 5.0f , 0, 5.0f);
-						}
-						continue;
-					}
-					
-					// Calculate density based on distance from center (1.0 at center, 0.0 at edge)
-					const float Distance = FMath::Sqrt(DistanceSquared);
-					const float NormalizedDistance = Distance / SphereRadius;
-					const float Density = 1.0f - FMath::Clamp(NormalizedDistance, 0.0f, 1.0f);
-					
-					// Store voxel
-					const int32 Index = X + Y * VoxelResolution + Z * VoxelResolution * VoxelResolution;
-					VoxelGrid[Index].Density = Density;
-					// Start all voxels with visibility 0 so they all fade in gradually
-					// This prevents edge voxels from appearing instantly
-					VoxelGrid[Index].Visibility = 0.0f;
-					VoxelGrid[Index].LocalPosition = LocalPos;
-
-					// Store Smoke filled Voxels - explicitly ensure visibility is 0
-					FSmokeVoxel SmokeVoxel = VoxelGrid[Index];
-					SmokeVoxel.Visibility = 0.0f; // Explicitly set to 0 to prevent any instant appearance
-					SmokeVoxelArray.Add(SmokeVoxel);
-				}
+				++ObstacleQueryStats.CacheHits;
+			}
+			else
+			{
+				++ObstacleQueryStats.CacheMisses;
 			}
 		}
+		ObstacleCache->Apply(CacheUpdates);
+
+		// Report both passes together
+		ObstacleQueryStats.BroadPhaseBodies += StaticQueryStats.BroadPhaseBodies;
+		ObstacleQueryStats.TotalQueries += StaticQueryStats.TotalQueries;
+		for (int32 Level = 0; Level < ObstacleQueryStats.QueriesPerLevel.Num() && Level < StaticQueryStats.QueriesPerLevel.Num(); ++Level)
+		{
+			ObstacleQueryStats.QueriesPerLevel[Level] += StaticQueryStats.QueriesPerLevel[Level];
+		}
 	}
-}
 
-bool UVolumetricSmokeComponent::IsVoxelNearStaticMesh(UWorld* World, const FVector& VoxelPos, float Radius)
-{
-	TArray<FOverlapResult> OverlapResults;
-	FCollisionObjectQueryParams ObjectTypes(ECollisionChannel::ECC_WorldStatic);
-	FCollisionQueryParams Params;
-	Params.bTraceComplex = true;
- 
-	bool bOverlap = World->OverlapMultiByChannel(
-		OverlapResults, VoxelPos, FQuat::Identity,
-		ECC_Visibility, FCollisionShape::MakeSphere(Radius), Params);
- 
-	return bOverlap;
+	if (Subsystem)
+	{
+		Subsystem->ReleaseScratchMemory();
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Obstacle probe found %d bodies, issued %d queries (%d without octree culling), %d voxels from baked occupancy, %d cache hits, %d cache misses"),
+		ObstacleQueryStats.BroadPhaseBodies, ObstacleQueryStats.TotalQueries, ObstacleQueryStats.DenseQueries, ObstacleQueryStats.BakedStaticVoxels,
+		ObstacleQueryStats.CacheHits, ObstacleQueryStats.CacheMisses);
 }
 
-void UVolumetricSmokeComponent::GenerateVoxelColors()
+void UVolumetricSmokeComponent::ValidateBakedOccupancy(const FSmokeObstacleGrid& ObstacleGrid, const FBox& WorldBounds, FSmokeScratchMemory& ScratchMemory)
 {
-	// Generate randomized colors for each voxel
-	for (int32 Index = 0; Index < SmokeVoxelArray.Num(); ++Index)
+	// Live queries against static geometry only, over the same grid the baked lookup ran on
+	FSmokeObstacleQuery StaticQuery(ScratchMemory);
+	StaticQuery.Gather(GetWorld(), WorldBounds, ESmokeObstacleMobility::StaticOnly);
+
+	FSmokeObstacleQueryStats ValidationStats;
+	TSmokeScratchArray<int32>& LiveBlocked = ScratchMemory.ValidationVoxels;
+	StaticQuery.ClassifyGrid(ObstacleGrid, LiveBlocked, ValidationStats);
+
+	TSmokeScratchArray<int32>& BakedBlocked = ScratchMemory.StaticBlockedVoxels;
+	LiveBlocked.Sort();
+	BakedBlocked.Sort();
+
+	// Walk both sorted lists side by side
+	int32 BakedOnly = 0;
+	int32 LiveOnly = 0;
+	int32 BakedIndex = 0;
+	int32 LiveIndex = 0;
+	while (BakedIndex < BakedBlocked.Num() || LiveIndex < LiveBlocked.Num())
 	{
-		if (SmokeVoxelArray[Index].Density > 0.0f)
+		if (LiveIndex == LiveBlocked.Num() || (BakedIndex < BakedBlocked.Num() && BakedBlocked[BakedIndex] < LiveBlocked[LiveIndex]))
+		{
+			++BakedOnly;
+			++BakedIndex;
+		}
+		else if (BakedIndex == BakedBlocked.Num() || LiveBlocked[LiveIndex] < BakedBlocked[BakedIndex])
 		{
-			// Generate random color components
-			const uint8 R = FMath::RandRange(50, 255);
-			const uint8 G = FMath::RandRange(50, 255);
-			const uint8 B = FMath::RandRange(50, 255);
-			SmokeVoxelArray[Index].Colour = FColor(R, G, B, 255);
+			++LiveOnly;
+			++LiveIndex;
 		}
 		else
 		{
-			SmokeVoxelArray[Index].Colour = FColor::Black;
+			++BakedIndex;
+			++LiveIndex;
 		}
 	}
+
+	ObstacleQueryStats.ValidationBakedOnly = BakedOnly;
+	ObstacleQueryStats.ValidationLiveOnly = LiveOnly;
+
+	if (BakedOnly + LiveOnly > 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("VolumetricSmoke: Baked occupancy differs from live queries, %d voxels blocked by both, %d only baked, %d only live. Rebake the level or use smaller cells."),
+			BakedBlocked.Num() - BakedOnly, BakedOnly, LiveOnly);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Baked occupancy matches live queries, %d voxels blocked"), BakedBlocked.Num());
+	}
+}
+
+void UVolumetricSmokeComponent::GenerateSphereVoxels()
+{
+	const FVector SphereCenter = FVector::ZeroVector; // Local space center
+
+	if (bShowDebugVisualization)
+	{
+		DrawDebugSphere(GetWorld(),GetComponentTransform().TransformPosition(SphereCenter), SphereRadius, 12, FColor::Green, false, 5.0f , 0, 1.0f);
+	}
+
+	ProbeObstacles(SphereRadius);
+
+	// Fill every free voxel inside the sphere, in grid order
+	USmokeVolumeSubsystem* Subsystem = GetSmokeSubsystem();
+	FSmokeScratchMemory LocalScratchMemory;
+	FSmokeScratchMemory& ScratchMemory = Subsystem ? Subsystem->AcquireScratchMemory() : LocalScratchMemory;
+	Volume->FillSphere(ScratchMemory);
+	if (Subsystem)
+	{
+		Subsystem->ReleaseScratchMemory();
+	}
+}
+
+void UVolumetricSmokeComponent::BeginFloodFill()
+{
+	// Smoke may pour anywhere in the grid, so the whole grid is probed
+	ProbeObstacles(0.0f);
+
+	const int32 Capacity = FSmokeVolume::GetFloodFillCapacity(VoxelResolution, FloodFillVolumeScale);
+
+	Volume->FloodFillBudgetSeconds = FloodFillBudgetMs * 0.001;
+	if (!Volume->BeginFloodFill(Capacity))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("VolumetricSmoke: No free voxel to start the flood fill from"));
+		return;
+	}
+
+	// Nothing ticks outside of game worlds, so fill the whole volume right away there
+	const UWorld* World = GetWorld();
+	if (!World || !World->IsGameWorld())
+	{
+		Volume->StepFloodFill(TNumericLimits<double>::Max(), 0.0f);
+	}
+	else
+	{
+		WakeUp();
+	}
 }
 
 FSmokeVoxel UVolumetricSmokeComponent::GetVoxel(int32 X, int32 Y, int32 Z) const
 {
-	if (!IsValidVoxelCoord(FIntVector(X, Y, Z)))
+	const FIntVector Coord(X, Y, Z);
+	const FSmokeVolume* ReadableVolume = GetReadableVolume();
+	if (!IsValidVoxelCoord(Coord) || !ReadableVolume || ReadableVolume->GetResolution() != VoxelResolution)
+	{
+		return FSmokeVoxel(0.0f);
+	}
+
+	// Voxels without smoke are empty
+	const int32 Slot = ReadableVolume->VoxelBricks.GetFilledSlot(Coord);
+	if (Slot == INDEX_NONE)
 	{
 		return FSmokeVoxel(0.0f);
 	}
 
-	const int32 Index = X + Y * VoxelResolution + Z * VoxelResolution * VoxelResolution;
-	return VoxelGrid[Index];
+	const FSmokeFilledVoxels& SmokeVoxels = ReadableVolume->SmokeVoxels;
+	FSmokeVoxel Voxel(SmokeVoxels.Density.Get(Slot));
+	Voxel.Visibility = SmokeFadeKernel::EvaluateVoxel(Voxel.Density, SmokeVoxels.ArrivalTime.Get(Slot), GetFadeParams());
+	Voxel.Colour = SmokeVoxels.Colour[Slot];
+	Voxel.LocalPosition = VoxelToLocal(Coord);
+	return Voxel;
+}
+
+void UVolumetricSmokeComponent::SampleDensities(TConstArrayView<FVector> WorldPositions, TArrayView<float> OutDensities) const
+{
+	check(OutDensities.Num() == WorldPositions.Num());
+
+	for (float& Density : OutDensities)
+	{
+		Density = 0.0f;
+	}
+
+	// Same grid as GetVoxel(), a volume still being rebuilt for another resolution reads as empty
+	const FSmokeVolume* ReadableVolume = GetReadableVolume();
+	if (!ReadableVolume || ReadableVolume->GetResolution() != VoxelResolution)
+	{
+		return;
+	}
+
+	ReadableVolume->SampleDensities(WorldPositions, GetWorldToGrid(), OutDensities, GetFadeParams());
+}
+
+void UVolumetricSmokeComponent::K2_SampleDensities(const TArray<FVector>& WorldPositions, TArray<float>& OutDensities) const
+{
+	OutDensities.SetNumUninitialized(WorldPositions.Num());
+	SampleDensities(WorldPositions, OutDensities);
+}
+
+const FSmokeGridTransform& UVolumetricSmokeComponent::GetWorldToGrid() const
+{
+	check(IsInGameThread());
+
+	if (WorldToGridFrame != GFrameCounter)
+	{
+		CachedWorldToGrid = FSmokeGridTransform::Make(GetComponentTransform(), SphereRadius, VoxelResolution);
+		WorldToGridFrame = GFrameCounter;
+	}
+	return CachedWorldToGrid;
 }
 
 FIntVector UVolumetricSmokeComponent::WorldToVoxel(const FVector& WorldPos) const
 {
-	const FVector LocalPos = GetComponentTransform().InverseTransformPosition(WorldPos);
-	const float VoxelSize = (SphereRadius * 2.0f) / VoxelResolution;
-	const FVector Offset = FVector(SphereRadius); // Offset to center the grid
-	
-	const FVector GridPos = (LocalPos + Offset) / VoxelSize;
+	const FVector3f GridPos = GetWorldToGrid().TransformPosition(WorldPos);
 	return FIntVector(
 		FMath::FloorToInt(GridPos.X),
 		FMath::FloorToInt(GridPos.Y),
@@ -277,12 +639,16 @@ FIntVector UVolumetricSmokeComponent::WorldToVoxel(const FVector& WorldPos) cons
 }
 
 FVector UVolumetricSmokeComponent::VoxelToWorld(const FIntVector& VoxelCoord) const
+{
+	return GetComponentTransform().TransformPosition(VoxelToLocal(VoxelCoord));
+}
+
+FVector UVolumetricSmokeComponent::VoxelToLocal(const FIntVector& VoxelCoord) const
 {
 	const float VoxelSize = (SphereRadius * 2.0f) / VoxelResolution;
 	const FVector Offset = FVector(SphereRadius); // Offset to center the grid
-	
-	const FVector LocalPos = FVector(VoxelCoord) * VoxelSize - Offset;
-	return GetComponentTransform().TransformPosition(LocalPos);
+
+	return FVector(VoxelCoord) * VoxelSize - Offset;
 }
 
 bool UVolumetricSmokeComponent::IsValidVoxelCoord(const FIntVector& Coord) const
@@ -294,22 +660,24 @@ bool UVolumetricSmokeComponent::IsValidVoxelCoord(const FIntVector& Coord) const
 
 void UVolumetricSmokeComponent::DrawDebugVisualization() const
 {
-	if (!GetWorld() || VoxelGrid.Num() == 0)
+	const FSmokeVolume* ReadableVolume = GetReadableVolume();
+	if (!GetWorld() || !ReadableVolume || ReadableVolume->SmokeVoxels.Num() == 0)
 	{
 		return;
 	}
+
+	const FSmokeFilledVoxels& SmokeVoxels = ReadableVolume->SmokeVoxels;
 	
 	const float VoxelSize = (SphereRadius * 2.0f) / VoxelResolution;
-	for (const FSmokeVoxel& SmokeVoxel : SmokeVoxelArray)
+	const FSmokeFadeParams FadeParams = GetFadeParams();
+	for (int32 Slot = 0; Slot < SmokeVoxels.Num(); ++Slot)
 	{
-		if (SmokeVoxel.Visibility < 0.5)
+		if (SmokeFadeKernel::EvaluateVoxel(SmokeVoxels.Density.Get(Slot), SmokeVoxels.ArrivalTime.Get(Slot), FadeParams) < 0.5f)
 		{
 			continue;
 		}
 
-		const FVector LocalPos = SmokeVoxel.LocalPosition;
-		const FVector WorldPos = GetComponentTransform().TransformPosition(LocalPos);
-		;
+		const FVector WorldPos = VoxelToWorld(ReadableVolume->IndexToVoxel(SmokeVoxels.VoxelIndex[Slot]));
 		const FVector BoxExtent = FVector(VoxelSize * 0.5f);
 					
 		// Color intensity based on density
@@ -317,7 +685,7 @@ void UVolumetricSmokeComponent::DrawDebugVisualization() const
 			DebugColor.R,
 			DebugColor.G,
 			DebugColor.B,
-			FMath::Clamp(FMath::RoundToInt(SmokeVoxel.Density * 255.0f), 0, 255)
+			FMath::Clamp(FMath::RoundToInt(SmokeVoxels.Density.Get(Slot) * 255.0f), 0, 255)
 		);
 
 		DrawDebugBox(
@@ -334,11 +702,91 @@ void UVolumetricSmokeComponent::DrawDebugVisualization() const
 	}
 }
 
+void UVolumetricSmokeComponent::OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	Super::OnUpdateTransform(UpdateTransformFlags, Teleport);
+	WorldToGridFrame = MAX_uint64;
+
+	// Smoke moved with its actor is found where it is now
+	UpdateIndexedBounds();
+}
+
 FPrimitiveSceneProxy* UVolumetricSmokeComponent::CreateSceneProxy()
 {
+	ProxyVoxelResolution = VoxelResolution;
+	ProxySphereRadius = SphereRadius;
 	return new FVolumetricSmokeSceneProxy(this);
 }
 
+void UVolumetricSmokeComponent::SendRenderDynamicData_Concurrent()
+{
+	Super::SendRenderDynamicData_Concurrent();
+
+	if (!SceneProxy)
+	{
+		return;
+	}
+
+	TSharedPtr<FSmokeRenderUpdate, ESPMode::ThreadSafe> Update = GatherRenderUpdate();
+	if (!Update)
+	{
+		return;
+	}
+
+	// The command holds on to the update, the component may be gone by the time it runs
+	FVolumetricSmokeSceneProxy* SmokeProxy = static_cast<FVolumetricSmokeSceneProxy*>(SceneProxy);
+	Update->bQueued.store(true, std::memory_order_relaxed);
+	ENQUEUE_RENDER_COMMAND(UpdateSmokeRenderData)([SmokeProxy, Update = MoveTemp(Update)](FRHICommandListImmediate& RHICmdList)
+	{
+		SmokeProxy->UpdateRenderData_RenderThread(*Update);
+		Update->bQueued.store(false, std::memory_order_release);
+	});
+}
+
+TSharedPtr<FSmokeRenderUpdate, ESPMode::ThreadSafe> UVolumetricSmokeComponent::GatherRenderUpdate()
+{
+	// Runs during the end of frame updates, the snapshot of the background writers stands in for the subsystem
+	if (Volume && bVolumeClearing)
+	{
+		return nullptr;
+	}
+
+	// The render thread lags one frame behind at most, so an update sent two frames ago is free again
+	TSharedRef<FSmokeRenderUpdate, ESPMode::ThreadSafe>* FreeUpdate = RenderUpdates.FindByPredicate([](const TSharedRef<FSmokeRenderUpdate, ESPMode::ThreadSafe>& Update)
+	{
+		return !Update->bQueued.load(std::memory_order_acquire);
+	});
+	const TSharedRef<FSmokeRenderUpdate, ESPMode::ThreadSafe> UpdateRef = FreeUpdate ? *FreeUpdate : RenderUpdates.Add_GetRef(MakeShared<FSmokeRenderUpdate, ESPMode::ThreadSafe>());
+	FSmokeRenderUpdate& Update = UpdateRef.Get();
+
+	// A volume regenerating in place is drawn as empty until it is published
+	if (!Volume || bVolumeBuilding)
+	{
+		Update.SetEmpty();
+		bSendAllVoxels = true;
+	}
+	else
+	{
+		Update.Gather(*Volume, SmokeSpawnSpeed, bSendAllVoxels);
+		bSendAllVoxels = false;
+	}
+	return UpdateRef;
+}
+
+void UVolumetricSmokeComponent::CopyRenderData(FSmokeRenderData& OutRenderData)
+{
+	if (!Volume || bVolumeBuilding || bVolumeClearing)
+	{
+		OutRenderData = FSmokeRenderData();
+		bSendAllVoxels = true;
+		return;
+	}
+
+	OutRenderData.CopyFrom(*Volume, SmokeSpawnSpeed);
+	Volume->VoxelBricks.ClearChanged();
+	bSendAllVoxels = false;
+}
+
 FBoxSphereBounds UVolumetricSmokeComponent::CalcBounds(const FTransform& LocalToWorld) const
 {
 	const FBoxSphereBounds LocalBounds = GetLocalBounds();
@@ -371,13 +819,20 @@ FVolumetricSmokeSceneProxy::FVolumetricSmokeSceneProxy(UVolumetricSmokeComponent
 	, VoxelSize(0.0f)
 	, VoxelResolution(0)
 	, SphereRadius(0.0f)
-	, CachedVoxelDataVersion(0)
 {
 	// Copy voxel data from component
 	VoxelResolution = InComponent->VoxelResolution;
 	SphereRadius = InComponent->SphereRadius;
-	CachedVoxelDataVersion = InComponent->VoxelDataVersion;
-	SmokeComp = InComponent;
+	RenderData = MakeUnique<FSmokeRenderData>();
+	InComponent->CopyRenderData(*RenderData);
+
+	// Use assigned smoke material, or fall back to default material
+	Material = InComponent->SmokeMaterial;
+	if (!Material)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("VolumetricSmoke: No material assigned, using default material"));
+		Material = UMaterial::GetDefaultMaterial(MD_Surface);
+	}
 	
 	// Calculate voxel size (critical - without this, cubes have zero size!)
 	if (VoxelResolution > 0)
@@ -396,30 +851,17 @@ void FVolumetricSmokeSceneProxy::GetDynamicMeshElements(const TArray<const FScen
 {
 
 	// NOTE: This is called every frame, but it's efficient because:
-	// 1. Voxel data (positions/colors) is cached in the scene proxy (copied once when proxy is created)
+	// 1. Voxel data is a copy owned by the scene proxy, only the bricks that changed are sent over
 	// 2. We only rebuild the mesh geometry here, not the voxel data
 	// 3. For smoke grenade: voxels are generated ONCE on explosion, mesh is built from cached data each frame
-	if (IsValid(SmokeComp) == false)
-	{
-		return;
-	}
-
-	TArray<FSmokeVoxel>& SmokeVoxelArray = SmokeComp->SmokeVoxelArray;
+	const FSmokeRenderData& SmokeVoxels = *RenderData;
 	
 	// Early return if no voxels to render
-	if (SmokeVoxelArray.Num() == 0)
+	if (SmokeVoxels.Num() == 0)
 	{
 		return;
 	}
 	
-	
-	// Use assigned smoke material, or fall back to default material
-	UMaterialInterface* Material = SmokeComp->SmokeMaterial;
-	if (!Material)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("VolumetricSmoke: No material assigned, using default material"));
-		Material = UMaterial::GetDefaultMaterial(MD_Surface);
-	}
 	if (!Material)
 	{
 		UE_LOG(LogTemp, Error, TEXT("VolumetricSmoke: Failed to get material"));
@@ -428,36 +870,66 @@ void FVolumetricSmokeSceneProxy::GetDynamicMeshElements(const TArray<const FScen
 	
 	// Debug: Log material info
 	// UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Rendering %d voxels with material %s"), 
-	// 	SmokeVoxelArray.Num(), *Material->GetName());
+	// 	SmokeVoxels.Num(), *Material->GetName());
 	
 	const float HalfVoxelSize = VoxelSize * 0.5f;
 	
 	// Create a single mesh builder for all cubes (batched - one draw call!)
-	// This builds mesh geometry from cached voxel data
+	// This builds mesh geometry from cached voxel data. Which voxels are drawn follows the fade of the rendered frame,
+	// so the geometry changes every frame anyway: the builder's GPU buffers come from the per-frame dynamic buffer pool
+	// and its CPU arrays are reserved once below, at the exact size. Persistent buffers would need a vertex factory
+	// owned by the proxy and resized with the smoke.
 	FDynamicMeshBuilder MeshBuilder(GetScene().GetFeatureLevel());
 	const FMaterialRenderProxy* MaterialRenderProxy = Material->GetRenderProxy();
 	
+	// Fade-in is evaluated at the time of the rendered frame, so it does not depend on the tick rate
+	const FSmokeFadeParams FadeParams = SmokeVoxels.GetFadeParams(ViewFamily.Time.GetWorldTimeSeconds());
+
+	// Per-frame arrays come from the render thread's linear allocator and are released together when Mark goes out of scope
+	FMemMark Mark(FMemStack::Get());
+	const int32 NumVoxels = SmokeVoxels.Num();
+	TArray<float, TMemStackAllocator<>> DensityValues;
+	TArray<float, TMemStackAllocator<>> ArrivalTimes;
+	TArray<float, TMemStackAllocator<>> Visibilities;
+	DensityValues.SetNumUninitialized(NumVoxels);
+	ArrivalTimes.SetNumUninitialized(NumVoxels);
+	Visibilities.SetNumUninitialized(NumVoxels);
+
+	// Decode and evaluate every voxel up front, then size the mesh for the visible ones so it is allocated once
+	SmokeVoxels.Density.Load(0, NumVoxels, DensityValues.GetData());
+	SmokeVoxels.ArrivalTime.Load(0, NumVoxels, ArrivalTimes.GetData());
+	SmokeFadeKernel::Evaluate(Visibilities.GetData(), DensityValues.GetData(), ArrivalTimes.GetData(), NumVoxels, FadeParams);
+
+	int32 NumVisible = 0;
+	for (const float Visibility : Visibilities)
+	{
+		NumVisible += Visibility >= 0.5f ? 1 : 0;
+	}
+	if (NumVisible == 0)
+	{
+		return;
+	}
+
+	// 6 faces of 4 vertices and 2 triangles per cube
+	MeshBuilder.ReserveVertices(NumVisible * 24);
+	MeshBuilder.ReserveTriangles(NumVisible * 12);
+	
 	// Generate cube geometry for each voxel - all added to the same mesh builder
-	for (int32 VoxelIndex = 0; VoxelIndex < SmokeVoxelArray.Num(); ++VoxelIndex)
+	// Walks the attribute arrays in slot order, so reads are contiguous
+	for (int32 Slot = 0; Slot < NumVoxels; ++Slot)
 	{
-		// Bounds check
-		if (VoxelIndex >= SmokeVoxelArray.Num())
-		{
-			continue;
-		}
-		
-		if (SmokeVoxelArray[VoxelIndex].Visibility < 0.5)
+		if (Visibilities[Slot] < 0.5f)
 		{
 			continue;
 		}
 		
-		const FVector& VoxelPos = SmokeVoxelArray[VoxelIndex].LocalPosition;
+		// Positions are not stored, they follow from the grid index
+		const FIntVector VoxelCoord = SmokeVoxels.IndexToVoxel(SmokeVoxels.VoxelIndex[Slot]);
+		const FVector VoxelPos = FVector(VoxelCoord) * VoxelSize - FVector(SphereRadius);
 		
 		// Calculate vertex color based on density and visibility for proper smoke appearance
 		// Use density to control opacity/intensity, visibility for fade-in effect
-		const float Density = SmokeVoxelArray[VoxelIndex].Density;
-		const float Visibility = SmokeVoxelArray[VoxelIndex].Visibility;
-		const float FinalAlpha = FMath::Clamp(Density, 0.0f, 1.0f);
+		const float Density = DensityValues[Slot];
 		
 		// Use a smoke-like color (grayish white) with density-based variation
 		// You can adjust these values or use the stored Colour if preferred
@@ -598,6 +1070,12 @@ void FVolumetricSmokeSceneProxy::GetDynamicMeshElements(const TArray<const FScen
 	}
 }
 
+void FVolumetricSmokeSceneProxy::UpdateRenderData_RenderThread(FSmokeRenderUpdate& Update)
+{
+	check(IsInRenderingThread());
+	RenderData->Apply(Update);
+}
+
 FPrimitiveViewRelevance FVolumetricSmokeSceneProxy::GetViewRelevance(const FSceneView* View) const
 {
 
@@ -0,0 +1,1108 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/SmokeVolumeSubsystem.h"
+
+#include "Async/ParallelFor.h"
+#include "CollisionQueryParams.h"
+#include "CollisionShape.h"
+#include "Components/PrimitiveComponent.h"
+#include "Components/VolumetricSmokeComponent.h"
+#include "Engine/Engine.h"
+#include "Engine/OverlapResult.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "GameFramework/Pawn.h"
+#include "HAL/IConsoleManager.h"
+#include "RenderingThread.h"
+#include "VolumetricSmokeStats.h"
+#include "Voxel/SmokeOccupancyAsset.h"
+
+namespace
+{
+	TAutoConsoleVariable<int32> CVarSmokePoolSize(
+		TEXT("VolumetricSmoke.PoolSize"),
+		8,
+		TEXT("Smoke volumes preallocated per game world. Read when the world starts."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<int32> CVarSmokePoolResolution(
+		TEXT("VolumetricSmoke.PoolResolution"),
+		64,
+		TEXT("Grid resolution the buffers of pooled smoke volumes are allocated for. Larger grids reallocate when generated."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<bool> CVarSmokeUseBakedOccupancy(
+		TEXT("VolumetricSmoke.UseBakedOccupancy"),
+		true,
+		TEXT("Look static obstacles up in the level's baked occupancy asset instead of querying physics for them."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<int32> CVarSmokeObstacleCacheSize(
+		TEXT("VolumetricSmoke.ObstacleCacheSize"),
+		128 * 1024,
+		TEXT("Static obstacle cells cached per world, shared by every smoke volume. 0 disables the cache. Changing it empties the cache."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<float> CVarSmokeRegenerateDelay(
+		TEXT("VolumetricSmoke.RegenerateDelay"),
+		0.1f,
+		TEXT("Seconds a component's parameters must stay unchanged before its volume is regenerated in the background."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<float> CVarSmokePawnAirPush(
+		TEXT("VolumetricSmoke.PawnAirPush"),
+		1.0f,
+		TEXT("Share of their velocity moving pawns push the air of simulated smoke with. Pawns are found by their Pawn object channel. 0 lets pawns pass without stirring it."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<float> CVarSmokeCarveRegrowDelay(
+		TEXT("VolumetricSmoke.CarveRegrowDelay"),
+		1.0f,
+		TEXT("Seconds smoke carved away by a projectile stays clear before it fades back in."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<float> CVarSmokeExtinction(
+		TEXT("VolumetricSmoke.Extinction"),
+		0.03f,
+		TEXT("Optical depth per unit of length of fully dense smoke, for visibility queries. At 0.03 a metre of it lets 5% of the light through."),
+		ECVF_Default);
+
+	/** Rays queried per batch below which QueryOpticalDepth() stays on the game thread */
+	constexpr int32 MinParallelOpticalDepthRays = 64;
+
+	/** Positions sampled per parallel batch by SampleDensities(), smaller batches stay on the game thread */
+	constexpr int32 DensitySampleBatchSize = 256;
+
+	/** Pawns slower than this, in units per second, do not stir the smoke */
+	constexpr float MinPawnAirPushSpeed = 10.0f;
+
+	/**
+	 * Bounds of the static and stationary primitives of Actor the obstacle probe collides with, the only geometry the
+	 * obstacle cache holds. Invalid if the actor has none, as most actors destroyed during play do.
+	 */
+	FBox GetCachedObstacleBounds(const AActor& Actor)
+	{
+		FBox Bounds(ForceInit);
+		Actor.ForEachComponent<UPrimitiveComponent>(false, [&Bounds](const UPrimitiveComponent* Component)
+		{
+			if (Component->Mobility != EComponentMobility::Movable && Component->IsRegistered() && Component->IsCollisionEnabled() &&
+				Component->GetCollisionResponseToChannel(ECC_Visibility) != ECR_Ignore)
+			{
+				Bounds += Component->Bounds.GetBox();
+			}
+		});
+		return Bounds;
+	}
+}
+
+void USmokeVolumeSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	UWorld* World = GetWorld();
+	if (!World)
+	{
+		return;
+	}
+
+	// Cached obstacle cells are dropped when the static geometry around them changes
+	ActorDestroyedHandle = World->AddOnActorDestroyedHandler(FOnActorDestroyed::FDelegate::CreateUObject(this, &USmokeVolumeSubsystem::HandleActorDestroyed));
+	LevelAddedHandle = FWorldDelegates::LevelAddedToWorld.AddUObject(this, &USmokeVolumeSubsystem::HandleLevelChanged);
+	LevelRemovedHandle = FWorldDelegates::LevelRemovedFromWorld.AddUObject(this, &USmokeVolumeSubsystem::HandleLevelChanged);
+#if WITH_EDITOR
+	if (GEngine)
+	{
+		ActorMovedHandle = GEngine->OnActorMoved().AddUObject(this, &USmokeVolumeSubsystem::HandleActorMoved);
+	}
+#endif
+
+	// Optional, a level without one probes static geometry with physics
+	StaticOccupancy = LoadObject<USmokeOccupancyAsset>(nullptr, *USmokeOccupancyAsset::GetObjectPathForWorld(World), nullptr, LOAD_NoWarn | LOAD_Quiet);
+	if (StaticOccupancy)
+	{
+		UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Loaded baked occupancy %s (%.1f KB)"),
+			*StaticOccupancy->GetPathName(), StaticOccupancy->GetAllocatedSize() / 1024.0f);
+	}
+
+	// Editor worlds regenerate rarely and would hold the memory for nothing, only game worlds get a pool
+	if (!World->IsGameWorld())
+	{
+		return;
+	}
+
+	PoolSize = FMath::Max(CVarSmokePoolSize.GetValueOnGameThread(), 0);
+	PoolResolution = FMath::Clamp(CVarSmokePoolResolution.GetValueOnGameThread(), 8, 256);
+	PoolDensityFormat = GetDefault<UVolumetricSmokeComponent>()->DensityFormat;
+
+	Volumes.Reserve(PoolSize);
+	FreeVolumes.Reserve(PoolSize);
+	ActiveVolumes.Reserve(PoolSize);
+	PendingRegenerations.Reserve(PoolSize);
+	for (int32 Index = 0; Index < PoolSize; ++Index)
+	{
+		TUniquePtr<FSmokeVolume>& Volume = Volumes.Add_GetRef(MakeUnique<FSmokeVolume>());
+		Volume->Preallocate(PoolResolution, PoolDensityFormat);
+		FreeVolumes.Add(Volume.Get());
+	}
+
+	UpdateStats(0.0);
+	UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Preallocated %d smoke volumes at resolution %d (%.1f MB)"),
+		PoolSize, PoolResolution, Stats.AllocatedBytes / (1024.0 * 1024.0));
+}
+
+void USmokeVolumeSubsystem::Deinitialize()
+{
+	if (UWorld* World = GetWorld())
+	{
+		World->RemoveOnActorDestroyededHandler(ActorDestroyedHandle);
+	}
+	FWorldDelegates::LevelAddedToWorld.Remove(LevelAddedHandle);
+	FWorldDelegates::LevelRemovedFromWorld.Remove(LevelRemovedHandle);
+#if WITH_EDITOR
+	if (GEngine)
+	{
+		GEngine->OnActorMoved().Remove(ActorMovedHandle);
+	}
+#endif
+
+	// Jobs wait for their worker threads, after that nothing writes to the volumes
+	RegenerationJobs.Reset();
+	FreeJobScratchMemory.Reset();
+	CompleteClearing();
+	PendingRegenerations.Reset();
+
+	ActiveVolumes.Reset();
+	PendingAirImpulses.Reset();
+	PawnOverlaps.Empty();
+	VolumeIndex.Reset();
+	FreeVolumes.Reset();
+	Volumes.Reset();
+	ScratchMemory.Empty();
+	StaticOccupancy = nullptr;
+	ObstacleCache.SetCapacity(0);
+
+	Super::Deinitialize();
+}
+
+TStatId USmokeVolumeSubsystem::GetStatId() const
+{
+	return GET_STATID(STAT_SmokeSubsystemTick);
+}
+
+FSmokeVolume* USmokeVolumeSubsystem::RegisterVolume(UVolumetricSmokeComponent* Component)
+{
+	FSmokeVolume* Volume = nullptr;
+	if (FreeVolumes.Num() > 0)
+	{
+		Volume = FreeVolumes.Pop(EAllowShrinking::No);
+	}
+	else
+	{
+		// Pool exhausted, or no pool outside of game worlds
+		Volume = Volumes.Add_GetRef(MakeUnique<FSmokeVolume>()).Get();
+		if (PoolSize > 0)
+		{
+			Volume->Preallocate(PoolResolution, PoolDensityFormat);
+			++PoolOverflows;
+			UE_LOG(LogTemp, Warning, TEXT("VolumetricSmoke: Smoke volume pool of %d exhausted, raise VolumetricSmoke.PoolSize"), PoolSize);
+		}
+	}
+
+	Volume->Owner = Component;
+	PoolHighWaterMark = FMath::Max(PoolHighWaterMark, Volumes.Num() - FreeVolumes.Num());
+	return Volume;
+}
+
+void USmokeVolumeSubsystem::UnregisterVolume(FSmokeVolume* Volume)
+{
+	if (!Volume)
+	{
+		return;
+	}
+
+	WaitForClearing(Volume);
+	VolumeIndex.Remove(Volume);
+	ActiveVolumes.RemoveSingleSwap(Volume);
+	Volume->Owner.Reset();
+
+	// Its finished clears are only counted from here on, the volume may be freed below
+	for (FClearTask& ClearTask : ClearTasks)
+	{
+		if (ClearTask.Volume == Volume)
+		{
+			ClearTask.Volume = nullptr;
+		}
+	}
+
+	// Pooled volumes are interchangeable, keep PoolSize of them and free the rest
+	if (Volumes.Num() <= PoolSize)
+	{
+		Volume->Clear();
+		FreeVolumes.Add(Volume);
+		return;
+	}
+
+	const int32 Index = Volumes.IndexOfByPredicate([Volume](const TUniquePtr<FSmokeVolume>& Entry) { return Entry.Get() == Volume; });
+	if (Index != INDEX_NONE)
+	{
+		Volumes.RemoveAtSwap(Index);
+	}
+}
+
+void USmokeVolumeSubsystem::ActivateVolume(FSmokeVolume* Volume)
+{
+	// A volume regenerating in place is activated when it is published
+	if (!IsVolumeBuilding(Volume))
+	{
+		ActiveVolumes.AddUnique(Volume);
+	}
+}
+
+void USmokeVolumeSubsystem::UpdateVolumeBounds(FSmokeVolume* Volume, const FBox& WorldBounds)
+{
+	check(IsInGameThread());
+
+	// Volumes being built, retired or back in the pool are not shown, the component indexes them once it switches
+	// to them
+	const UVolumetricSmokeComponent* Component = Volume->Owner.Get();
+	if (!Component || Component->GetVolume() != Volume || IsVolumeBuilding(Volume))
+	{
+		return;
+	}
+
+	// Dissipated smoke was cleared and stays out until it is generated again. Clears and carves keep the voxels,
+	// and a flood fill may start out empty.
+	if (Volume->SmokeVoxels.Num() == 0 && !Volume->IsFloodFillRunning())
+	{
+		VolumeIndex.Remove(Volume);
+		return;
+	}
+
+	VolumeIndex.Update(Volume, WorldBounds);
+}
+
+void USmokeVolumeSubsystem::RequestRegenerate(UVolumetricSmokeComponent* Component)
+{
+	// A build for older parameters is superseded, it would only be replaced again
+	CancelRegenerationJobs(Component);
+
+	// Every request restarts the wait, so dragging a slider only regenerates once it rests
+	const double Now = FPlatformTime::Seconds();
+	for (FPendingRegeneration& Pending : PendingRegenerations)
+	{
+		if (Pending.Component == Component)
+		{
+			Pending.RequestTime = Now;
+			return;
+		}
+	}
+
+	FPendingRegeneration& Pending = PendingRegenerations.AddDefaulted_GetRef();
+	Pending.Component = Component;
+	Pending.RequestTime = Now;
+}
+
+void USmokeVolumeSubsystem::StartRegeneration(UVolumetricSmokeComponent* Component)
+{
+	CancelRegeneration(Component);
+	LaunchRegenerationJob(Component, true);
+}
+
+void USmokeVolumeSubsystem::CancelRegeneration(UVolumetricSmokeComponent* Component)
+{
+	PendingRegenerations.RemoveAll([Component](const FPendingRegeneration& Pending) { return Pending.Component == Component; });
+	CancelRegenerationJobs(Component);
+}
+
+void USmokeVolumeSubsystem::CancelRegenerationJobs(UVolumetricSmokeComponent* Component)
+{
+	for (int32 Index = 0; Index < RegenerationJobs.Num(); ++Index)
+	{
+		FSmokeRegenerationJob& Job = *RegenerationJobs[Index];
+		if (!Job.IsFor(Component))
+		{
+			continue;
+		}
+
+		// The spare volumes of cancelled jobs are freed once their workers return
+		Job.Cancel();
+		if (Job.GetVolume() != Component->GetVolume())
+		{
+			continue;
+		}
+
+		// A build into the component's own volume is waited for, its remaining stages return right away. The
+		// component shows what was built so far as nothing until it writes to the volume again.
+		Job.Wait();
+		FSmokeVolume* Volume = Job.GetVolume();
+		Volume->Clear();
+		FreeJobScratchMemory.Add(Job.ReleaseScratchMemory());
+		RegenerationJobs.RemoveAt(Index--, 1, EAllowShrinking::No);
+		MarkRenderDataDirty(Volume);
+	}
+}
+
+void USmokeVolumeSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	const double StartTime = FPlatformTime::Seconds();
+	const double WorldTime = GetWorld()->GetTimeSeconds();
+
+	// Explosions of the last frame have cleared their smoke by now, the steps below write to the same volumes
+	CompleteClearing();
+	ReleaseDissipatedVolumes(WorldTime);
+
+	// Finished builds first, so a volume swapped in this frame takes part in the flood step below
+	PublishFinishedRegenerations(WorldTime);
+	StartPendingRegenerations(StartTime);
+	ApplyAirMotion();
+
+	const int32 NumActive = ActiveVolumes.Num();
+
+	// Volumes only touch their own data, so their flood fills grow side by side, each within its own budget.
+	// A simulation starts once its fill is done and fans out over its bricks itself.
+	ParallelFor(NumActive, [this, WorldTime, DeltaTime](int32 Index)
+	{
+		FSmokeVolume& Volume = *ActiveVolumes[Index];
+		const float ElapsedTime = static_cast<float>(WorldTime - Volume.SpawnTime);
+		Volume.StepFloodFill(Volume.FloodFillBudgetSeconds, ElapsedTime);
+		Volume.StepSimulation(DeltaTime, ElapsedTime);
+	});
+
+	// Scene proxies draw copies of the voxels, taken once the steps are done
+	for (const FSmokeVolume* Volume : ActiveVolumes)
+	{
+		MarkRenderDataDirty(Volume);
+	}
+
+	// Visibility is evaluated from arrival times where it is needed, so a volume whose fill is done and whose
+	// simulation has settled does not change until it is regenerated or modified, which activates it again
+	ActiveVolumes.RemoveAllSwap([](const FSmokeVolume* Volume) { return !Volume->IsFloodFillRunning() && !Volume->IsSimulating(); });
+
+	UpdateStats(FPlatformTime::Seconds() - StartTime);
+	Stats.NumActiveVolumes = NumActive;
+	SET_DWORD_STAT(STAT_SmokeActiveVolumes, NumActive);
+}
+
+void USmokeVolumeSubsystem::AddAirImpulse(const FVector& WorldLocation, float Radius, const FVector& Velocity, float RadialSpeed)
+{
+	if (Radius > 0.0f)
+	{
+		PendingAirImpulses.Add({ WorldLocation, Radius, Velocity, RadialSpeed });
+	}
+}
+
+void USmokeVolumeSubsystem::CarveRay(const FVector& WorldStart, const FVector& WorldEnd)
+{
+	check(IsInGameThread());
+
+	const double WorldTime = GetWorld()->GetTimeSeconds();
+	const float RegrowDelay = FMath::Max(CVarSmokeCarveRegrowDelay.GetValueOnGameThread(), 0.0f);
+
+	TArray<FSmokeVolume*, TInlineAllocator<8>> HitVolumes;
+	VolumeIndex.QueryRay(WorldStart, WorldEnd, HitVolumes);
+
+	for (FSmokeVolume* Volume : HitVolumes)
+	{
+		// Skips volumes an explosion is clearing, the blast takes the smoke along the ray anyway
+		if (!IsVolumeReadable(Volume))
+		{
+			continue;
+		}
+
+		const UVolumetricSmokeComponent* Component = Volume->Owner.Get();
+
+		// Grid coordinates as in ApplyAirMotion(), shifted by half a voxel because voxel X is drawn centred on X
+		const FTransform& ComponentTransform = Component->GetComponentTransform();
+		const float VoxelSize = (Component->SphereRadius * 2.0f) / Volume->GetResolution();
+		const FVector GridOffset(Component->SphereRadius + 0.5f * VoxelSize);
+		const FVector3f GridStart((ComponentTransform.InverseTransformPosition(WorldStart) + GridOffset) / VoxelSize);
+		const FVector3f GridEnd((ComponentTransform.InverseTransformPosition(WorldEnd) + GridOffset) / VoxelSize);
+
+		const float RegrowTime = static_cast<float>(WorldTime - Volume->SpawnTime) + RegrowDelay;
+		const FSmokeCarveResult Result = Volume->CarveRay(GridStart, GridEnd, RegrowTime);
+		CarvedVoxels += Result.ClearedVoxels;
+		CarvedBricks += Result.TouchedBricks;
+		if (Result.ClearedVoxels > 0)
+		{
+			MarkRenderDataDirty(Volume);
+		}
+	}
+
+	++CarvedRays;
+}
+
+void USmokeVolumeSubsystem::ClearSphere(const FVector& WorldLocation, float Radius, float HoldSeconds, float RefillSeconds)
+{
+	check(IsInGameThread());
+
+	if (Radius <= 0.0f)
+	{
+		return;
+	}
+
+	const double WorldTime = GetWorld()->GetTimeSeconds();
+
+	TArray<FSmokeVolume*, TInlineAllocator<8>> HitVolumes;
+	VolumeIndex.QueryBox(FBox(WorldLocation - FVector(Radius), WorldLocation + FVector(Radius)), HitVolumes);
+
+	for (FSmokeVolume* Volume : HitVolumes)
+	{
+		// Clears of a volume that is clearing already are queued behind it below
+		const UVolumetricSmokeComponent* Component = Volume->Owner.Get();
+		if (!Component || Component->GetVolume() != Volume || Volume->SmokeVoxels.Num() == 0 || IsVolumeBuilding(Volume))
+		{
+			continue;
+		}
+
+		if (Component->Bounds.GetBox().ComputeSquaredDistanceToPoint(WorldLocation) >= FMath::Square(Radius))
+		{
+			continue;
+		}
+
+		// Grid coordinates as in ApplyAirMotion(), voxel X is centred on X
+		const FTransform& ComponentTransform = Component->GetComponentTransform();
+		const float VoxelSize = (Component->SphereRadius * 2.0f) / Volume->GetResolution();
+		const FVector3f Center((ComponentTransform.InverseTransformPosition(WorldLocation) + FVector(Component->SphereRadius)) / VoxelSize);
+		const float VoxelRadius = Radius / (VoxelSize * ComponentTransform.GetMaximumAxisScale());
+		const float RefillStart = static_cast<float>(WorldTime - Volume->SpawnTime) + FMath::Max(HoldSeconds, 0.0f);
+		const float Refill = FMath::Max(RefillSeconds, 0.0f);
+
+		FSmokeVolume* VolumePtr = Volume;
+		auto Clear = [VolumePtr, Center, VoxelRadius, RefillStart, Refill]()
+		{
+			return VolumePtr->ClearSphere(Center, VoxelRadius, RefillStart, Refill);
+		};
+
+		// Clears of the same volume run one after the other, they write the same arrival times
+		const int32 Previous = ClearTasks.FindLastByPredicate([VolumePtr](const FClearTask& ClearTask) { return ClearTask.Volume == VolumePtr; });
+
+		FClearTask ClearTask;
+		ClearTask.Volume = VolumePtr;
+		ClearTask.Task = Previous != INDEX_NONE
+			? UE::Tasks::Launch(UE_SOURCE_LOCATION, MoveTemp(Clear), UE::Tasks::Prerequisites(ClearTasks[Previous].Task))
+			: UE::Tasks::Launch(UE_SOURCE_LOCATION, MoveTemp(Clear));
+		ClearTasks.Add(MoveTemp(ClearTask));
+
+		// Holds back the updates of the scene proxy until CompleteClearing()
+		MarkRenderDataDirty(VolumePtr);
+	}
+}
+
+void USmokeVolumeSubsystem::WaitForClearing(const FSmokeVolume* Volume)
+{
+	for (FClearTask& ClearTask : ClearTasks)
+	{
+		if (ClearTask.Volume == Volume)
+		{
+			ClearTask.Task.Wait();
+		}
+	}
+}
+
+void USmokeVolumeSubsystem::CompleteClearing()
+{
+	for (FClearTask& ClearTask : ClearTasks)
+	{
+		const FSmokeClearResult& Result = ClearTask.Task.GetResult();
+		++ExplosionClears;
+		ExplosionClearedVoxels += Result.ClearedVoxels;
+		ExplosionClearSeconds += Result.Seconds;
+
+		UE_LOG(LogTemp, Verbose, TEXT("VolumetricSmoke: Explosion cleared %d voxels over %d bricks in %.3f ms"),
+			Result.ClearedVoxels, Result.ScannedBricks, Result.Seconds * 1000.0);
+
+		// The scene proxy was not sent anything while the clear was running
+		if (ClearTask.Volume)
+		{
+			MarkRenderDataDirty(ClearTask.Volume);
+		}
+	}
+	ClearTasks.Reset();
+}
+
+bool USmokeVolumeSubsystem::IsVolumeReadable(const FSmokeVolume* Volume) const
+{
+	const UVolumetricSmokeComponent* Component = Volume->Owner.Get();
+	return Component && Component->GetVolume() == Volume && Volume->SmokeVoxels.Num() > 0 && !IsVolumeBuilding(Volume) && !IsVolumeClearing(Volume);
+}
+
+bool USmokeVolumeSubsystem::IsVolumeClearing(const FSmokeVolume* Volume) const
+{
+	return ClearTasks.ContainsByPredicate([Volume](const FClearTask& ClearTask) { return ClearTask.Volume == Volume && !ClearTask.Task.IsCompleted(); });
+}
+
+void USmokeVolumeSubsystem::MarkRenderDataDirty(const FSmokeVolume* Volume) const
+{
+	UVolumetricSmokeComponent* Component = Volume->Owner.Get();
+	if (Component && Component->GetVolume() == Volume)
+	{
+		// The update runs concurrently at the end of the frame, where the job and task lists may not be read
+		Component->SetVolumeTaskState(IsVolumeBuilding(Volume), IsVolumeClearing(Volume));
+		Component->MarkRenderDynamicDataDirty();
+	}
+}
+
+void USmokeVolumeSubsystem::QueryOpticalDepth(TConstArrayView<FSmokeRay> Rays, TArrayView<float> OutOpticalDepth, float MinTransmittance)
+{
+	check(IsInGameThread());
+	check(Rays.Num() == OutOpticalDepth.Num());
+
+	const double StartTime = FPlatformTime::Seconds();
+	const double WorldTime = GetWorld()->GetTimeSeconds();
+	const float Extinction = FMath::Max(CVarSmokeExtinction.GetValueOnGameThread(), 0.0f);
+	const float MaxOpticalDepth = MinTransmittance > 0.0f ? -FMath::Loge(FMath::Min(MinTransmittance, 1.0f)) : TNumericLimits<float>::Max();
+
+	// What every ray needs from a volume, gathered once per batch
+	struct FVolumeQuery
+	{
+		const FSmokeVolume* Volume = nullptr;
+		FBox WorldBounds;
+		FTransform ComponentTransform;
+		float VoxelSize = 0.0f;
+		FVector GridOffset;
+		FSmokeFadeParams FadeParams;
+	};
+	TArray<FVolumeQuery, TInlineAllocator<8>> VolumeQueries;
+
+	// Only the volumes overlapping the box around the whole batch, each ray tests their bounds on its own below
+	FBox BatchBounds(ForceInit);
+	for (const FSmokeRay& Ray : Rays)
+	{
+		BatchBounds += Ray.Start;
+		BatchBounds += Ray.End;
+	}
+
+	TArray<const FSmokeVolume*, TInlineAllocator<8>> HitVolumes;
+	if (BatchBounds.IsValid)
+	{
+		VolumeIndex.QueryBox(BatchBounds, HitVolumes);
+	}
+
+	for (const FSmokeVolume* Volume : HitVolumes)
+	{
+		// Volumes an explosion is clearing are left out like in CarveRay(), the blast has just blown their smoke away
+		if (!IsVolumeReadable(Volume))
+		{
+			continue;
+		}
+
+		// Grid coordinates as in CarveRay()
+		const UVolumetricSmokeComponent* Component = Volume->Owner.Get();
+		FVolumeQuery& Query = VolumeQueries.AddDefaulted_GetRef();
+		Query.Volume = Volume;
+		Query.WorldBounds = Component->Bounds.GetBox();
+		Query.ComponentTransform = Component->GetComponentTransform();
+		Query.VoxelSize = (Component->SphereRadius * 2.0f) / Volume->GetResolution();
+		Query.GridOffset = FVector(Component->SphereRadius + 0.5f * Query.VoxelSize);
+		Query.FadeParams = Volume->GetFadeParams(WorldTime, Component->SmokeSpawnSpeed);
+	}
+
+	ParallelFor(Rays.Num(), [&Rays, &OutOpticalDepth, &VolumeQueries, Extinction, MaxOpticalDepth](int32 RayIndex)
+	{
+		const FSmokeRay& Ray = Rays[RayIndex];
+		const FVector Direction = Ray.End - Ray.Start;
+		const float RayExtinction = Extinction * static_cast<float>(Direction.Size());
+
+		float OpticalDepth = 0.0f;
+		for (const FVolumeQuery& Query : VolumeQueries)
+		{
+			if (OpticalDepth >= MaxOpticalDepth)
+			{
+				break;
+			}
+
+			if (!FMath::LineBoxIntersection(Query.WorldBounds, Ray.Start, Ray.End, Direction))
+			{
+				continue;
+			}
+
+			const FVector3f GridStart((Query.ComponentTransform.InverseTransformPosition(Ray.Start) + Query.GridOffset) / Query.VoxelSize);
+			const FVector3f GridEnd((Query.ComponentTransform.InverseTransformPosition(Ray.End) + Query.GridOffset) / Query.VoxelSize);
+			OpticalDepth += Query.Volume->IntegrateOpticalDepth(GridStart, GridEnd, RayExtinction, MaxOpticalDepth - OpticalDepth, Query.FadeParams);
+		}
+		OutOpticalDepth[RayIndex] = OpticalDepth;
+	}, Rays.Num() < MinParallelOpticalDepthRays || VolumeQueries.Num() == 0 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+
+	OpticalDepthRays += Rays.Num();
+	OpticalDepthQuerySeconds += FPlatformTime::Seconds() - StartTime;
+}
+
+float USmokeVolumeSubsystem::GetSmokeTransmittance(const FVector& Start, const FVector& End, float MinTransmittance)
+{
+	const FSmokeRay Ray{ Start, End };
+	float OpticalDepth = 0.0f;
+	QueryOpticalDepth(MakeArrayView(&Ray, 1), MakeArrayView(&OpticalDepth, 1), MinTransmittance);
+	return FMath::Exp(-OpticalDepth);
+}
+
+void USmokeVolumeSubsystem::SampleDensities(TConstArrayView<FVector> WorldPositions, TArrayView<float> OutDensities)
+{
+	check(IsInGameThread());
+	check(WorldPositions.Num() == OutDensities.Num());
+
+	const double StartTime = FPlatformTime::Seconds();
+	const double WorldTime = GetWorld()->GetTimeSeconds();
+
+	for (float& Density : OutDensities)
+	{
+		Density = 0.0f;
+	}
+
+	// What every position needs from a volume, copied so the workers do not read the components
+	struct FVolumeSample
+	{
+		const FSmokeVolume* Volume = nullptr;
+		FSmokeGridTransform WorldToGrid;
+		FSmokeFadeParams FadeParams;
+	};
+	TArray<FVolumeSample, TInlineAllocator<8>> VolumeSamples;
+
+	// Only the volumes overlapping the box around the whole batch, positions outside a grid cost a transform there
+	const FBox BatchBounds(WorldPositions.GetData(), WorldPositions.Num());
+	TArray<const FSmokeVolume*, TInlineAllocator<8>> HitVolumes;
+	if (BatchBounds.IsValid)
+	{
+		VolumeIndex.QueryBox(BatchBounds, HitVolumes);
+	}
+
+	for (const FSmokeVolume* Volume : HitVolumes)
+	{
+		// Volumes being cleared are left out like in QueryOpticalDepth(), and like in GetVoxel() those rebuilt for another resolution
+		const UVolumetricSmokeComponent* Component = Volume->Owner.Get();
+		if (!IsVolumeReadable(Volume) || Volume->GetResolution() != Component->VoxelResolution)
+		{
+			continue;
+		}
+
+		FVolumeSample& Sample = VolumeSamples.AddDefaulted_GetRef();
+		Sample.Volume = Volume;
+		Sample.WorldToGrid = Component->GetWorldToGrid();
+		Sample.FadeParams = Volume->GetFadeParams(WorldTime, Component->SmokeSpawnSpeed);
+	}
+
+	if (VolumeSamples.Num() > 0)
+	{
+		const int32 NumBatches = FMath::DivideAndRoundUp(WorldPositions.Num(), DensitySampleBatchSize);
+		ParallelFor(NumBatches, [&WorldPositions, &OutDensities, &VolumeSamples](int32 BatchIndex)
+		{
+			const int32 First = BatchIndex * DensitySampleBatchSize;
+			const int32 Count = FMath::Min(DensitySampleBatchSize, WorldPositions.Num() - First);
+			for (const FVolumeSample& Sample : VolumeSamples)
+			{
+				Sample.Volume->SampleDensities(WorldPositions.Slice(First, Count), Sample.WorldToGrid, OutDensities.Slice(First, Count), Sample.FadeParams);
+			}
+		}, NumBatches == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+	}
+
+	DensitySamples += WorldPositions.Num();
+	DensitySampleSeconds += FPlatformTime::Seconds() - StartTime;
+}
+
+void USmokeVolumeSubsystem::GetSmokeDensities(const TArray<FVector>& WorldPositions, TArray<float>& OutDensities)
+{
+	OutDensities.SetNumUninitialized(WorldPositions.Num());
+	SampleDensities(WorldPositions, OutDensities);
+}
+
+void USmokeVolumeSubsystem::ApplyAirMotion()
+{
+	const bool bAnySimulation = ActiveVolumes.ContainsByPredicate([](const FSmokeVolume* Volume) { return Volume->GetSimulation().IsRunning(); });
+	if (!bAnySimulation)
+	{
+		PendingAirImpulses.Reset();
+		return;
+	}
+
+	// Pawns walking through smoke drag the air along. Only pawns overlapping the bounds of a running simulation are
+	// found, one query per volume, instead of walking every pawn of the world.
+	const float PawnAirPush = CVarSmokePawnAirPush.GetValueOnGameThread();
+	if (PawnAirPush > 0.0f)
+	{
+		const FCollisionQueryParams Params(SCENE_QUERY_STAT(SmokePawnAirPush));
+		const FCollisionObjectQueryParams ObjectParams(ECC_Pawn);
+
+		TArray<const APawn*, TInlineAllocator<16>> Pawns;
+		for (const FSmokeVolume* Volume : ActiveVolumes)
+		{
+			const UVolumetricSmokeComponent* Component = Volume->Owner.Get();
+			if (!Volume->GetSimulation().IsRunning() || !Component)
+			{
+				continue;
+			}
+
+			const FBox WorldBounds = Component->Bounds.GetBox();
+			PawnOverlaps.Reset();
+			GetWorld()->OverlapMultiByObjectType(
+				PawnOverlaps, WorldBounds.GetCenter(), FQuat::Identity,
+				ObjectParams, FCollisionShape::MakeBox(WorldBounds.GetExtent()), Params);
+
+			for (const FOverlapResult& Overlap : PawnOverlaps)
+			{
+				// Overlapping several volumes, or with several components, a pawn still pushes once
+				if (const APawn* Pawn = Cast<APawn>(Overlap.GetActor()))
+				{
+					Pawns.AddUnique(Pawn);
+				}
+			}
+		}
+
+		for (const APawn* Pawn : Pawns)
+		{
+			const FVector PawnVelocity = Pawn->GetVelocity();
+			if (PawnVelocity.SizeSquared() >= FMath::Square(MinPawnAirPushSpeed))
+			{
+				PendingAirImpulses.Add({ Pawn->GetActorLocation(), Pawn->GetSimpleCollisionRadius() * 2.0f, PawnVelocity * PawnAirPush, 0.0f });
+			}
+		}
+	}
+
+	for (FSmokeVolume* Volume : ActiveVolumes)
+	{
+		FSmokeSimulation& Simulation = Volume->GetSimulation();
+		const UVolumetricSmokeComponent* Component = Volume->Owner.Get();
+		if (!Simulation.IsRunning() || !Component)
+		{
+			continue;
+		}
+
+		// The simulation works in grid coordinates of the volume, see UVolumetricSmokeComponent::WorldToVoxel()
+		const FTransform& ComponentTransform = Component->GetComponentTransform();
+		const float VoxelSize = (Component->SphereRadius * 2.0f) / Volume->GetResolution();
+		const float WorldVoxelSize = VoxelSize * ComponentTransform.GetMaximumAxisScale();
+		const FVector GridOffset(Component->SphereRadius);
+		Simulation.SetWind(FVector3f(ComponentTransform.InverseTransformVector(WindVelocity) / VoxelSize));
+
+		const FBox WorldBounds = Component->Bounds.GetBox();
+		for (const FAirImpulse& Impulse : PendingAirImpulses)
+		{
+			if (WorldBounds.ComputeSquaredDistanceToPoint(Impulse.Location) >= FMath::Square(Impulse.Radius))
+			{
+				continue;
+			}
+
+			FSmokeVelocityImpulse VoxelImpulse;
+			VoxelImpulse.Center = FVector3f((ComponentTransform.InverseTransformPosition(Impulse.Location) + GridOffset) / VoxelSize);
+			VoxelImpulse.Radius = Impulse.Radius / WorldVoxelSize;
+			VoxelImpulse.Velocity = FVector3f(ComponentTransform.InverseTransformVector(Impulse.Velocity) / VoxelSize);
+			VoxelImpulse.RadialSpeed = Impulse.RadialSpeed / WorldVoxelSize;
+			Simulation.AddImpulse(VoxelImpulse);
+		}
+	}
+
+	PendingAirImpulses.Reset();
+}
+
+FSmokeScratchMemory& USmokeVolumeSubsystem::AcquireScratchMemory()
+{
+	check(IsInGameThread());
+	checkf(!bScratchMemoryInUse, TEXT("Smoke scratch memory is already in use"));
+
+	bScratchMemoryInUse = true;
+	ScratchBytesAtAcquire = ScratchMemory.GetAllocatedSize();
+	ScratchHeapAllocationsAtAcquire = ScratchMemory.GetNumHeapAllocations();
+	return ScratchMemory;
+}
+
+void USmokeVolumeSubsystem::ReleaseScratchMemory()
+{
+	check(bScratchMemoryInUse);
+
+	bScratchMemoryInUse = false;
+
+	// Resetting the arena grows its block if the pass did not fit, that counts towards this pass too
+	ScratchMemory.Reset();
+	if (ScratchMemory.GetAllocatedSize() != ScratchBytesAtAcquire || ScratchMemory.GetNumHeapAllocations() != ScratchHeapAllocationsAtAcquire)
+	{
+		++ScratchGrowths;
+	}
+}
+
+const USmokeOccupancyAsset* USmokeVolumeSubsystem::GetStaticOccupancy() const
+{
+	return CVarSmokeUseBakedOccupancy.GetValueOnGameThread() ? StaticOccupancy.Get() : nullptr;
+}
+
+FSmokeObstacleCache* USmokeVolumeSubsystem::GetObstacleCache()
+{
+	check(IsInGameThread());
+
+	// Sized on first use, so worlds without smoke never allocate it
+	const int32 Capacity = FMath::Max(CVarSmokeObstacleCacheSize.GetValueOnGameThread(), 0);
+	if (Capacity != ObstacleCache.GetCapacity())
+	{
+		ObstacleCache.SetCapacity(Capacity);
+	}
+
+	return Capacity > 0 ? &ObstacleCache : nullptr;
+}
+
+void USmokeVolumeSubsystem::HandleActorDestroyed(AActor* Actor)
+{
+	if (Actor && ObstacleCache.Num() > 0)
+	{
+		ObstacleCache.Invalidate(GetCachedObstacleBounds(*Actor));
+	}
+}
+
+void USmokeVolumeSubsystem::HandleLevelChanged(ULevel* Level, UWorld* InWorld)
+{
+	if (InWorld == GetWorld())
+	{
+		ObstacleCache.Empty();
+	}
+}
+
+#if WITH_EDITOR
+void USmokeVolumeSubsystem::HandleActorMoved(AActor* Actor)
+{
+	if (Actor && Actor->GetWorld() == GetWorld() && ObstacleCache.Num() > 0 && GetCachedObstacleBounds(*Actor).IsValid)
+	{
+		ObstacleCache.Empty();
+	}
+}
+#endif
+
+void USmokeVolumeSubsystem::StartPendingRegenerations(double Now)
+{
+	const double Delay = FMath::Max(CVarSmokeRegenerateDelay.GetValueOnGameThread(), 0.0f);
+
+	for (int32 Index = 0; Index < PendingRegenerations.Num(); ++Index)
+	{
+		const FPendingRegeneration& Pending = PendingRegenerations[Index];
+		if (Now - Pending.RequestTime < Delay)
+		{
+			continue;
+		}
+
+		UVolumetricSmokeComponent* Component = Pending.Component.Get();
+		PendingRegenerations.RemoveAt(Index--, 1, EAllowShrinking::No);
+		if (Component)
+		{
+			LaunchRegenerationJob(Component, false);
+		}
+	}
+}
+
+void USmokeVolumeSubsystem::LaunchRegenerationJob(UVolumetricSmokeComponent* Component, bool bInPlace)
+{
+	UWorld* World = GetWorld();
+	if (!Component->IsRegistered())
+	{
+		return;
+	}
+
+	// Nothing ticks a flood fill outside of game worlds, so there it is grown to the end on the worker
+	FSmokeGenerationSettings Settings = FSmokeGenerationSettings::FromComponent(*Component);
+	Settings.bCompleteFloodFill = !World->IsGameWorld();
+
+	// In place, the component's volume is taken out of the tick and the index until the job publishes it again.
+	// Otherwise built into a second volume, the component's current one stays visible until this one is done.
+	FSmokeVolume* Volume = bInPlace ? Component->GetVolume() : nullptr;
+	if (Volume)
+	{
+		WaitForClearing(Volume);
+		VolumeIndex.Remove(Volume);
+		ActiveVolumes.RemoveSingleSwap(Volume);
+	}
+	else
+	{
+		Volume = RegisterVolume(Component);
+	}
+	Volume->Reset(Settings.VoxelResolution, Settings.DensityFormat, 0.0);
+
+	TUniquePtr<FSmokeScratchMemory> JobScratchMemory = FreeJobScratchMemory.Num() > 0 ? FreeJobScratchMemory.Pop(EAllowShrinking::No) : MakeUnique<FSmokeScratchMemory>();
+	TUniquePtr<FSmokeRegenerationJob>& Job = RegenerationJobs.Add_GetRef(MakeUnique<FSmokeRegenerationJob>(Component, Volume, Settings, MoveTemp(JobScratchMemory)));
+	Job->Start(World, GetStaticOccupancy());
+
+	// The proxy shows the emptied volume until the job is done
+	if (bInPlace)
+	{
+		MarkRenderDataDirty(Volume);
+	}
+}
+
+void USmokeVolumeSubsystem::PublishFinishedRegenerations(double WorldTime)
+{
+	for (int32 Index = 0; Index < RegenerationJobs.Num(); ++Index)
+	{
+		if (!RegenerationJobs[Index]->IsDone())
+		{
+			continue;
+		}
+
+		// Out of the list first, the volume is no longer building once it is published
+		TUniquePtr<FSmokeRegenerationJob> FinishedJob = MoveTemp(RegenerationJobs[Index]);
+		RegenerationJobs.RemoveAt(Index--, 1, EAllowShrinking::No);
+		FreeJobScratchMemory.Add(FinishedJob->ReleaseScratchMemory());
+
+		const FSmokeRegenerationJob& Job = *FinishedJob;
+		FSmokeVolume* Volume = Job.GetVolume();
+		UVolumetricSmokeComponent* Component = Job.GetComponent();
+		if (Job.IsCancelled() || !Component || !Component->IsRegistered())
+		{
+			// Never seen by the renderer, so it goes back to the pool right away. Jobs building in place are not
+			// cancelled here, CancelRegenerationJobs() waits for them.
+			UnregisterVolume(Volume);
+		}
+		else
+		{
+			// Fade-in and lifetime start when the smoke shows up, not when the build started
+			const FSmokeGenerationSettings& Settings = Job.GetSettings();
+			Volume->SpawnTime = WorldTime;
+			Volume->Lifetime = Settings.SmokeLifetime;
+			Volume->DissipationDuration = Settings.DissipationDuration;
+
+			// The scene proxy draws its own copy of the voxels, so the previous volume is free right away. A volume
+			// regenerated in place is its own previous volume.
+			FSmokeVolume* OldVolume = Component->PublishVolume(Volume, Job.GetObstacleQueryStats());
+			if (OldVolume != Volume)
+			{
+				UnregisterVolume(OldVolume);
+			}
+			MarkRenderDataDirty(Volume);
+
+			UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Regenerated %d voxels in the background (Radius: %f, Resolution: %d), %.2f ms after the start: gather %.2f ms, obstacles %.2f ms, fill %.2f ms, attributes %.2f ms"),
+				Volume->SmokeVoxels.Num(), Settings.SphereRadius, Settings.VoxelResolution, Job.GetLatencySeconds() * 1000.0,
+				Job.GetStageSeconds(ESmokeRegenerationStage::Gather) * 1000.0, Job.GetStageSeconds(ESmokeRegenerationStage::Obstacles) * 1000.0,
+				Job.GetStageSeconds(ESmokeRegenerationStage::Fill) * 1000.0, Job.GetStageSeconds(ESmokeRegenerationStage::Attributes) * 1000.0);
+		}
+	}
+}
+
+bool USmokeVolumeSubsystem::IsVolumeBuilding(const FSmokeVolume* Volume) const
+{
+	return RegenerationJobs.ContainsByPredicate([Volume](const TUniquePtr<FSmokeRegenerationJob>& Job) { return Job->GetVolume() == Volume; });
+}
+
+void USmokeVolumeSubsystem::ReleaseDissipatedVolumes(double WorldTime)
+{
+	// Components are told after the loop, their handlers may destroy them and unregister volumes
+	TArray<TWeakObjectPtr<UVolumetricSmokeComponent>, TInlineAllocator<8>> DissipatedOwners;
+
+	for (const TUniquePtr<FSmokeVolume>& Volume : Volumes)
+	{
+		if (!IsVolumeBuilding(Volume.Get()) && Volume->HasDissipated(WorldTime))
+		{
+			// Keeps the buffers, the volume stays with its component until it is regenerated or unregistered
+			Volume->Clear();
+			VolumeIndex.Remove(Volume.Get());
+			ActiveVolumes.RemoveSingleSwap(Volume.Get());
+			DissipatedOwners.Add(Volume->Owner);
+		}
+	}
+
+	for (const TWeakObjectPtr<UVolumetricSmokeComponent>& Owner : DissipatedOwners)
+	{
+		if (UVolumetricSmokeComponent* Component = Owner.Get())
+		{
+			Component->HandleDissipated();
+		}
+	}
+}
+
+void USmokeVolumeSubsystem::UpdateStats(double TickSeconds)
+{
+	Stats = FSmokeVolumeStats();
+	Stats.NumVolumes = Volumes.Num() - FreeVolumes.Num();
+	Stats.PoolSize = PoolSize;
+	Stats.PoolInUse = FMath::Min(Stats.NumVolumes, PoolSize);
+	Stats.PoolHighWaterMark = PoolHighWaterMark;
+	Stats.PoolOverflows = PoolOverflows;
+	Stats.ScratchBytes = ScratchMemory.GetAllocatedSize();
+	Stats.ScratchGrowths = ScratchGrowths;
+
+	const FSmokeObstacleCache::FStats& CacheStats = ObstacleCache.GetStats();
+	const int64 CacheLookups = CacheStats.Hits + CacheStats.Misses;
+	Stats.ObstacleCacheEntries = ObstacleCache.Num();
+	Stats.ObstacleCacheCapacity = ObstacleCache.GetCapacity();
+	Stats.ObstacleCacheHitRate = CacheLookups > 0 ? static_cast<float>(static_cast<double>(CacheStats.Hits) / CacheLookups) : 0.0f;
+	Stats.ObstacleCacheEvictions = CacheStats.Evictions;
+	Stats.ObstacleCacheInvalidations = CacheStats.Invalidations;
+	Stats.ObstacleCacheBytes = ObstacleCache.GetAllocatedSize();
+	Stats.PendingRegenerations = PendingRegenerations.Num();
+	Stats.RunningRegenerations = RegenerationJobs.Num();
+	Stats.TickMs = static_cast<float>(TickSeconds * 1000.0);
+	Stats.IndexedVolumes = VolumeIndex.Num();
+	Stats.CarvedRays = CarvedRays;
+	Stats.CarvedVoxels = CarvedVoxels;
+	Stats.CarvedBricks = CarvedBricks;
+	CarvedRays = 0;
+	CarvedVoxels = 0;
+	CarvedBricks = 0;
+	Stats.ExplosionClears = ExplosionClears;
+	Stats.ExplosionClearedVoxels = ExplosionClearedVoxels;
+	Stats.ExplosionClearMs = static_cast<float>(ExplosionClearSeconds * 1000.0);
+	ExplosionClears = 0;
+	ExplosionClearedVoxels = 0;
+	ExplosionClearSeconds = 0.0;
+	Stats.OpticalDepthRays = OpticalDepthRays;
+	Stats.OpticalDepthQueryMs = static_cast<float>(OpticalDepthQuerySeconds * 1000.0);
+	OpticalDepthRays = 0;
+	OpticalDepthQuerySeconds = 0.0;
+	Stats.DensitySamples = DensitySamples;
+	Stats.DensitySampleMs = static_cast<float>(DensitySampleSeconds * 1000.0);
+	DensitySamples = 0;
+	DensitySampleSeconds = 0.0;
+
+	int64 SimulationVoxelUpdates = 0;
+	double SimulationSeconds = 0.0;
+	float PressureConvergenceSum = 0.0f;
+	int32 NumPressureVolumes = 0;
+
+	for (const TUniquePtr<FSmokeVolume>& Volume : Volumes)
+	{
+		// Worker threads are still writing to these
+		if (IsVolumeBuilding(Volume.Get()))
+		{
+			continue;
+		}
+
+		Stats.NumVoxels += Volume->SmokeVoxels.Num();
+		Stats.NumBricks += Volume->VoxelBricks.GetNumBricks();
+		Stats.AllocatedBytes += Volume->GetAllocatedSize();
+
+		const FSmokeSimulation& Simulation = Volume->GetSimulation();
+		if (Simulation.IsRunning())
+		{
+			++Stats.SimulatedVolumes;
+			SimulationVoxelUpdates += Simulation.GetStats().VoxelUpdates;
+			SimulationSeconds += Simulation.GetStats().ComputeSeconds;
+			if (Simulation.GetStats().PressureSolves > 0)
+			{
+				PressureConvergenceSum += Simulation.GetStats().PressureConvergenceRate;
+				++NumPressureVolumes;
+			}
+		}
+	}
+	Stats.SimulationVoxelUpdatesPerSecond = SimulationSeconds > 0.0 ? static_cast<float>(SimulationVoxelUpdates / SimulationSeconds) : 0.0f;
+	Stats.PressureConvergenceRate = NumPressureVolumes > 0 ? PressureConvergenceSum / NumPressureVolumes : 0.0f;
+
+	SET_DWORD_STAT(STAT_SmokeVolumes, Stats.NumVolumes);
+	SET_DWORD_STAT(STAT_SmokeFilledVoxels, Stats.NumVoxels);
+	SET_DWORD_STAT(STAT_SmokePoolSize, Stats.PoolSize);
+	SET_DWORD_STAT(STAT_SmokePoolInUse, Stats.PoolInUse);
+	SET_DWORD_STAT(STAT_SmokePoolHighWaterMark, Stats.PoolHighWaterMark);
+	SET_DWORD_STAT(STAT_SmokePoolOverflows, Stats.PoolOverflows);
+	SET_MEMORY_STAT(STAT_SmokeVoxelMemory, Stats.AllocatedBytes);
+	SET_MEMORY_STAT(STAT_SmokeScratchMemory, Stats.ScratchBytes);
+	SET_DWORD_STAT(STAT_SmokeScratchGrowths, Stats.ScratchGrowths);
+	SET_DWORD_STAT(STAT_SmokeObstacleCacheEntries, Stats.ObstacleCacheEntries);
+	SET_FLOAT_STAT(STAT_SmokeObstacleCacheHitRate, Stats.ObstacleCacheHitRate * 100.0f);
+	SET_DWORD_STAT(STAT_SmokeObstacleCacheEvictions, Stats.ObstacleCacheEvictions);
+	SET_DWORD_STAT(STAT_SmokeObstacleCacheInvalidations, Stats.ObstacleCacheInvalidations);
+	SET_MEMORY_STAT(STAT_SmokeObstacleCacheMemory, Stats.ObstacleCacheBytes);
+	SET_DWORD_STAT(STAT_SmokeSimulatedVolumes, Stats.SimulatedVolumes);
+	SET_FLOAT_STAT(STAT_SmokeSimulationThroughput, Stats.SimulationVoxelUpdatesPerSecond / 1.0e6f);
+	SET_FLOAT_STAT(STAT_SmokePressureConvergenceRate, Stats.PressureConvergenceRate);
+	SET_DWORD_STAT(STAT_SmokeCarvedRays, Stats.CarvedRays);
+	SET_DWORD_STAT(STAT_SmokeCarvedVoxels, Stats.CarvedVoxels);
+	SET_DWORD_STAT(STAT_SmokeCarvedBricks, Stats.CarvedBricks);
+	SET_DWORD_STAT(STAT_SmokeExplosionClearedVoxels, Stats.ExplosionClearedVoxels);
+	SET_DWORD_STAT(STAT_SmokeOpticalDepthRays, Stats.OpticalDepthRays);
+	SET_FLOAT_STAT(STAT_SmokeOpticalDepthQueryMs, Stats.OpticalDepthQueryMs);
+	SET_DWORD_STAT(STAT_SmokeDensitySamples, Stats.DensitySamples);
+	SET_FLOAT_STAT(STAT_SmokeDensitySampleMs, Stats.DensitySampleMs);
+	SET_FLOAT_STAT(STAT_SmokeExplosionClearMs, Stats.ExplosionClears > 0 ? Stats.ExplosionClearMs / Stats.ExplosionClears : 0.0f);
+}
@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Misc/AutomationTest.h"
+#include "Math/RandomStream.h"
+#include "Voxel/SmokeBrickGrid.h"
+#include "Voxel/SmokeFadeKernel.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSmokeFadeKernelPerfTest, "VolumetricSmoke.FadeKernel.Perf",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FSmokeFadeKernelPerfTest::RunTest(const FString& Parameters)
+{
+	// Times the closed form as the scene proxy runs it per frame, decoding its inputs from the stored channels
+	constexpr int32 VoxelCounts[] = { 16 * 1024, 64 * 1024, 256 * 1024 };
+	constexpr int32 Iterations = 200;
+	constexpr float DeltaTime = 1.0f / 60.0f;
+
+	for (const int32 NumVoxels : VoxelCounts)
+	{
+		FRandomStream Random(NumVoxels);
+		FSmokeFilledVoxels Voxels;
+		Voxels.SetFormats(ESmokeChannelFormat::UNorm8);
+		Voxels.Reserve(NumVoxels);
+		for (int32 Index = 0; Index < NumVoxels; ++Index)
+		{
+			Voxels.Add(Index, Random.FRand(), Random.FRand() * 0.5f);
+		}
+
+		TArray<float> Density;
+		TArray<float> ArrivalTime;
+		TArray<float> ScalarVisibility;
+		TArray<float> VectorVisibility;
+		Density.SetNumUninitialized(NumVoxels);
+		ArrivalTime.SetNumUninitialized(NumVoxels);
+		ScalarVisibility.SetNumUninitialized(NumVoxels);
+		VectorVisibility.SetNumUninitialized(NumVoxels);
+
+		FSmokeFadeParams Params;
+
+		double StartTime = FPlatformTime::Seconds();
+		for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+		{
+			Params.ElapsedTime = Iteration * DeltaTime;
+			Voxels.Density.Load(0, NumVoxels, Density.GetData());
+			Voxels.ArrivalTime.Load(0, NumVoxels, ArrivalTime.GetData());
+			SmokeFadeKernel::EvaluateScalar(ScalarVisibility.GetData(), Density.GetData(), ArrivalTime.GetData(), NumVoxels, Params);
+		}
+		const double ScalarMs = (FPlatformTime::Seconds() - StartTime) * 1000.0 / Iterations;
+
+		StartTime = FPlatformTime::Seconds();
+		for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+		{
+			Params.ElapsedTime = Iteration * DeltaTime;
+			Voxels.Density.Load(0, NumVoxels, Density.GetData());
+			Voxels.ArrivalTime.Load(0, NumVoxels, ArrivalTime.GetData());
+			SmokeFadeKernel::Evaluate(VectorVisibility.GetData(), Density.GetData(), ArrivalTime.GetData(), NumVoxels, Params);
+		}
+		const double VectorMs = (FPlatformTime::Seconds() - StartTime) * 1000.0 / Iterations;
+
+		AddInfo(FString::Printf(TEXT("Fade %7d voxels: scalar %.3f ms, vector %.3f ms"), NumVoxels, ScalarMs, VectorMs));
+		TestTrue(FString::Printf(TEXT("Scalar and vector fade of %d voxels are bit-identical"), NumVoxels),
+			FMemory::Memcmp(ScalarVisibility.GetData(), VectorVisibility.GetData(), NumVoxels * sizeof(float)) == 0);
+	}
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
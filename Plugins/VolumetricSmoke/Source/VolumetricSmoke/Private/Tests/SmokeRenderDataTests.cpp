@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Misc/AutomationTest.h"
+#include "Math/RandomStream.h"
+#include "Voxel/SmokeRenderData.h"
+#include "Voxel/SmokeVolume.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	bool HasSameVoxels(const FSmokeRenderData& A, const FSmokeRenderData& B)
+	{
+		if (A.Num() != B.Num() || A.Density.Num() != B.Density.Num() || A.ArrivalTime.Num() != B.ArrivalTime.Num())
+		{
+			return false;
+		}
+
+		for (int32 Slot = 0; Slot < A.Num(); ++Slot)
+		{
+			if (A.VoxelIndex[Slot] != B.VoxelIndex[Slot] || A.Density.Get(Slot) != B.Density.Get(Slot) || A.ArrivalTime.Get(Slot) != B.ArrivalTime.Get(Slot))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSmokeRenderUpdateTest, "VolumetricSmoke.RenderData.Update",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSmokeRenderUpdateTest::RunTest(const FString& Parameters)
+{
+	// A proxy's copy kept up to date by updates must match a fresh copy of the volume after every change
+	constexpr int32 Resolution = 32;
+	FRandomStream Random(7);
+
+	FSmokeVolume Volume;
+	Volume.Reset(Resolution, ESmokeChannelFormat::UNorm16, 0.0);
+	for (int32 Index = 0; Index < FMath::Cube(Resolution); Index += 3)
+	{
+		Volume.AddVoxel(Index, Random.FRand(), Random.FRand());
+	}
+
+	FSmokeRenderData Proxy;
+	FSmokeRenderUpdate Update;
+	Update.Gather(Volume, 1.0f, false);
+	TestTrue(TEXT("A reset volume sends every voxel"), Update.bAllVoxels);
+	Proxy.Apply(Update);
+
+	FSmokeRenderData Expected;
+	Expected.CopyFrom(Volume, 1.0f);
+	TestTrue(TEXT("Full update matches a copy"), HasSameVoxels(Proxy, Expected));
+
+	// Removing voxels moves others into their slots, adding appends. Both only touch a few bricks.
+	for (int32 Step = 0; Step < 50; ++Step)
+	{
+		Volume.RemoveVoxel(Random.RandRange(0, Volume.SmokeVoxels.Num() - 1));
+	}
+	for (int32 Index = 1; Index < 512; Index += 3)
+	{
+		Volume.AddVoxel(Index, Random.FRand(), 2.0f);
+	}
+	Update.Gather(Volume, 1.0f, false);
+	TestFalse(TEXT("Changes after the full update send bricks"), Update.bAllVoxels);
+	TestTrue(TEXT("Only changed bricks are sent"), Update.Slots.Num() < Volume.SmokeVoxels.Num());
+	Proxy.Apply(Update);
+	Expected.CopyFrom(Volume, 1.0f);
+	TestTrue(TEXT("Update after removing and adding voxels matches a copy"), HasSameVoxels(Proxy, Expected));
+
+	// Carves and clears write arrival times in place
+	const FSmokeCarveResult Carve = Volume.CarveRay(FVector3f(0.0f, 16.5f, 16.5f), FVector3f(32.0f, 16.5f, 16.5f), 5.0f);
+	Volume.ClearSphere(FVector3f(8.0f), 4.0f, 6.0f, 1.0f);
+	Update.Gather(Volume, 1.0f, false);
+	TestTrue(TEXT("Carved voxels are sent"), Carve.ClearedVoxels > 0 && Update.Slots.Num() >= Carve.ClearedVoxels);
+	Proxy.Apply(Update);
+	Expected.CopyFrom(Volume, 1.0f);
+	TestTrue(TEXT("Update after a carve and a clear matches a copy"), HasSameVoxels(Proxy, Expected));
+
+	Update.Gather(Volume, 1.0f, false);
+	TestEqual(TEXT("Nothing is sent without changes"), Update.Slots.Num(), 0);
+
+	// A reset switching the density format sends every voxel again
+	Volume.Reset(Resolution, ESmokeChannelFormat::UNorm8, 0.0);
+	Volume.AddVoxel(100, 0.5f, 0.0f);
+	Update.Gather(Volume, 1.0f, false);
+	TestTrue(TEXT("A reset sends every voxel"), Update.bAllVoxels);
+	Proxy.Apply(Update);
+	Expected.CopyFrom(Volume, 1.0f);
+	TestTrue(TEXT("Update after a reset matches a copy"), HasSameVoxels(Proxy, Expected));
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
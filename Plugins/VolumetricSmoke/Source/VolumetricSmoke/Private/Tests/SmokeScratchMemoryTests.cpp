@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Misc/AutomationTest.h"
+#include "Voxel/SmokeObstacleQuery.h"
+#include "Voxel/SmokeOccupancyAsset.h"
+#include "Voxel/SmokeScratchMemory.h"
+#include "Voxel/SmokeVolume.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	constexpr int32 TestResolution = 32;
+	constexpr float TestVoxelSize = 10.0f;
+
+	/** Occupancy with a wall across the grid off centre, so both fills stop at it */
+	USmokeOccupancyAsset* MakeWallOccupancy()
+	{
+		const float CellSize = 20.0f;
+		const int32 NumCells = 20;
+
+		USmokeOccupancyAsset* Occupancy = NewObject<USmokeOccupancyAsset>();
+		Occupancy->Initialize(FVector(-CellSize * NumCells * 0.5f), CellSize, FIntVector(NumCells));
+
+		const int32 WallX = NumCells / 2 + 3;
+		for (int32 Z = 0; Z < NumCells; ++Z)
+		{
+			for (int32 Y = 0; Y < NumCells; ++Y)
+			{
+				Occupancy->SetCellOccupied(FIntVector(WallX, Y, Z));
+			}
+		}
+		return Occupancy;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSmokeScratchMemorySecondRegenerationTest, "VolumetricSmoke.ScratchMemory.SecondRegenerationDoesNotAllocate",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSmokeScratchMemorySecondRegenerationTest::RunTest(const FString& Parameters)
+{
+	const USmokeOccupancyAsset* Occupancy = MakeWallOccupancy();
+
+	FSmokeVolume Volume;
+	Volume.Preallocate(TestResolution, ESmokeChannelFormat::UNorm8);
+
+	FSmokeScratchMemory ScratchMemory;
+
+	FSmokeObstacleGrid Grid;
+	Grid.Origin = -FVector(TestResolution * TestVoxelSize * 0.5f);
+	Grid.Resolution = TestResolution;
+	Grid.VoxelSize = TestVoxelSize;
+	Grid.ProbeRadius = TestVoxelSize;
+
+	// The path a pooled volume takes through regeneration, ending the pass as USmokeVolumeSubsystem does
+	auto Regenerate = [&](ESmokeFillMode FillMode)
+	{
+		Volume.Reset(TestResolution, ESmokeChannelFormat::UNorm8, 0.0);
+
+		const FSmokeObstacleQuery ObstacleQuery(ScratchMemory);
+		ObstacleQuery.ClassifyGridBaked(Grid, *Occupancy, ScratchMemory.StaticBlockedVoxels);
+		Volume.MarkBlocked(ScratchMemory.StaticBlockedVoxels);
+
+		if (FillMode == ESmokeFillMode::Sphere)
+		{
+			Volume.FillSphere(ScratchMemory);
+		}
+		else if (Volume.BeginFloodFill(FSmokeVolume::GetFloodFillCapacity(TestResolution, 1.5f)))
+		{
+			Volume.StepFloodFill(TNumericLimits<double>::Max(), 0.0f);
+		}
+		Volume.GenerateVoxelColors();
+
+		ScratchMemory.Reset();
+	};
+
+	// The first regeneration of each kind may grow the arena
+	Regenerate(ESmokeFillMode::Sphere);
+	Regenerate(ESmokeFillMode::FloodFill);
+
+	const int32 NumVoxels = Volume.SmokeVoxels.Num();
+	const int32 HeapAllocations = ScratchMemory.GetNumHeapAllocations();
+	const SIZE_T ScratchBytes = ScratchMemory.GetAllocatedSize();
+	const SIZE_T VolumeBytes = Volume.GetAllocatedSize();
+
+	Regenerate(ESmokeFillMode::Sphere);
+	Regenerate(ESmokeFillMode::FloodFill);
+
+	TestTrue(TEXT("Regeneration filled voxels"), NumVoxels > 0);
+	TestEqual(TEXT("Flood fill is deterministic"), Volume.SmokeVoxels.Num(), NumVoxels);
+	TestEqual(TEXT("Scratch heap allocations of the second regeneration"), ScratchMemory.GetNumHeapAllocations() - HeapAllocations, 0);
+	TestEqual(TEXT("Scratch bytes after the second regeneration"), static_cast<int64>(ScratchMemory.GetAllocatedSize()), static_cast<int64>(ScratchBytes));
+	TestEqual(TEXT("Volume bytes after the second regeneration"), static_cast<int64>(Volume.GetAllocatedSize()), static_cast<int64>(VolumeBytes));
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,160 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Misc/AutomationTest.h"
+#include "Voxel/SmokeBrickGrid.h"
+#include "Voxel/SmokeVoxelChannel.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	/** Values swept per test, odd so the sweep does not line up with the 8- and 16-bit grids */
+	constexpr int32 NumTestValues = 10007;
+
+	/** Float slack on top of the format's own error, for the rounding of the decode */
+	constexpr float ErrorSlack = 1.0e-7f;
+
+	const ESmokeChannelFormat AllFormats[] =
+	{
+		ESmokeChannelFormat::Float32,
+		ESmokeChannelFormat::Half16,
+		ESmokeChannelFormat::UNorm16,
+		ESmokeChannelFormat::UNorm8
+	};
+
+	/** Evenly spaced values from Min to Max, both included */
+	TArray<float> MakeTestValues(float Min, float Max)
+	{
+		TArray<float> Values;
+		Values.SetNumUninitialized(NumTestValues);
+		for (int32 Index = 0; Index < NumTestValues; ++Index)
+		{
+			Values[Index] = FMath::Lerp(Min, Max, static_cast<float>(Index) / (NumTestValues - 1));
+		}
+		return Values;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSmokeVoxelChannelDensityRoundTripTest, "VolumetricSmoke.VoxelChannel.DensityRoundTrip",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSmokeVoxelChannelDensityRoundTripTest::RunTest(const FString& Parameters)
+{
+	const TArray<float> Values = MakeTestValues(0.0f, 1.0f);
+
+	for (const ESmokeChannelFormat Format : AllFormats)
+	{
+		const FString FormatName = StaticEnum<ESmokeChannelFormat>()->GetNameStringByValue(static_cast<int64>(Format));
+		const float MaxError = FSmokeVoxelChannel::GetMaxError(Format) + ErrorSlack;
+
+		// Values written one at a time, read back one at a time
+		FSmokeVoxelChannel Scalar;
+		Scalar.SetFormat(Format);
+		for (const float Value : Values)
+		{
+			Scalar.Add(Value);
+		}
+
+		float WorstError = 0.0f;
+		for (int32 Index = 0; Index < Values.Num(); ++Index)
+		{
+			WorstError = FMath::Max(WorstError, FMath::Abs(Scalar.Get(Index) - Values[Index]));
+		}
+		TestTrue(FString::Printf(TEXT("%s scalar round trip error %g within %g"), *FormatName, WorstError, MaxError), WorstError <= MaxError);
+
+		// The vector Store() and Load() hold the same bound
+		FSmokeVoxelChannel Batched;
+		Batched.SetFormat(Format);
+		for (int32 Index = 0; Index < Values.Num(); ++Index)
+		{
+			Batched.Add(0.0f);
+		}
+		Batched.Store(0, Values.Num(), Values.GetData());
+
+		TArray<float> Decoded;
+		Decoded.SetNumUninitialized(Values.Num());
+		Batched.Load(0, Values.Num(), Decoded.GetData());
+
+		float WorstBatchedError = 0.0f;
+		for (int32 Index = 0; Index < Values.Num(); ++Index)
+		{
+			WorstBatchedError = FMath::Max(WorstBatchedError, FMath::Abs(Decoded[Index] - Values[Index]));
+		}
+		TestTrue(FString::Printf(TEXT("%s batched round trip error %g within %g"), *FormatName, WorstBatchedError, MaxError), WorstBatchedError <= MaxError);
+
+		// The ends of the range survive exactly, so empty smoke stays empty and full smoke stays full
+		TestEqual(FString::Printf(TEXT("%s stores 0 exactly"), *FormatName), Scalar.Get(0), 0.0f);
+		TestEqual(FString::Printf(TEXT("%s stores 1 exactly"), *FormatName), Scalar.Get(Values.Num() - 1), 1.0f);
+	}
+
+	// Normalized formats clamp instead of wrapping around
+	for (const ESmokeChannelFormat Format : { ESmokeChannelFormat::UNorm16, ESmokeChannelFormat::UNorm8 })
+	{
+		FSmokeVoxelChannel Channel;
+		Channel.SetFormat(Format);
+		Channel.Add(-0.5f);
+		Channel.Add(1.5f);
+		TestEqual(TEXT("Negative density clamps to 0"), Channel.Get(0), 0.0f);
+		TestEqual(TEXT("Density above 1 clamps to 1"), Channel.Get(1), 1.0f);
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSmokeVoxelChannelArrivalTimeRoundTripTest, "VolumetricSmoke.VoxelChannel.ArrivalTimeRoundTrip",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSmokeVoxelChannelArrivalTimeRoundTripTest::RunTest(const FString& Parameters)
+{
+	// Arrival times use the format FSmokeFilledVoxels picks for them
+	FSmokeFilledVoxels Voxels;
+	Voxels.SetFormats(ESmokeChannelFormat::UNorm8);
+
+	// Smoke without a lifetime never dissipates, so arrival times run on for as long as a session lasts
+	const float LateSeconds = 24.0f * 3600.0f;
+	const TArray<float> Times = MakeTestValues(0.0f, LateSeconds);
+	for (int32 Index = 0; Index < Times.Num(); ++Index)
+	{
+		Voxels.Add(Index, 1.0f, Times[Index]);
+	}
+
+	int32 Mismatches = 0;
+	for (int32 Index = 0; Index < Times.Num(); ++Index)
+	{
+		Mismatches += Voxels.ArrivalTime.Get(Index) != Times[Index] ? 1 : 0;
+	}
+	TestEqual(TEXT("Arrival times stored inexactly"), Mismatches, 0);
+
+	// Carves regrow after a second and clears refill over half a second, pushed onto the arrival times of voxels that
+	// may have been filled long ago. The shift has to survive storage, not round to nothing or to a jump.
+	const float MaxShiftError = 0.01f;
+	const float Shifts[] = { 0.5f, 1.0f, 2.0f };
+	float WorstShiftError = 0.0f;
+	for (const float Shift : Shifts)
+	{
+		for (int32 Index = 0; Index < Times.Num(); ++Index)
+		{
+			Voxels.ArrivalTime.Set(Index, Times[Index] + Shift);
+			const float StoredShift = Voxels.ArrivalTime.Get(Index) - Times[Index];
+			WorstShiftError = FMath::Max(WorstShiftError, FMath::Abs(StoredShift - Shift));
+		}
+	}
+	TestTrue(FString::Printf(TEXT("Arrival time shifts up to %g s after spawn within %g s, worst %g s"), LateSeconds, MaxShiftError, WorstShiftError),
+		WorstShiftError <= MaxShiftError);
+
+	// Batched decoding, as the fade kernel and the scene proxy read arrival times, decodes what Get() does
+	TArray<float> Decoded;
+	Decoded.SetNumUninitialized(Times.Num());
+	Voxels.ArrivalTime.Load(0, Times.Num(), Decoded.GetData());
+
+	Mismatches = 0;
+	for (int32 Index = 0; Index < Times.Num(); ++Index)
+	{
+		Mismatches += Decoded[Index] != Voxels.ArrivalTime.Get(Index) ? 1 : 0;
+	}
+	TestEqual(TEXT("Arrival times decoded differently by Load() and Get()"), Mismatches, 0);
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -3,6 +3,36 @@
 #include "VolumetricSmoke.h"
 
 #include "Interfaces/IPluginManager.h"
+#include "VolumetricSmokeStats.h"
+
+DEFINE_STAT(STAT_SmokeSubsystemTick);
+DEFINE_STAT(STAT_SmokeVolumes);
+DEFINE_STAT(STAT_SmokeActiveVolumes);
+DEFINE_STAT(STAT_SmokeFilledVoxels);
+DEFINE_STAT(STAT_SmokePoolSize);
+DEFINE_STAT(STAT_SmokePoolInUse);
+DEFINE_STAT(STAT_SmokePoolHighWaterMark);
+DEFINE_STAT(STAT_SmokePoolOverflows);
+DEFINE_STAT(STAT_SmokeVoxelMemory);
+DEFINE_STAT(STAT_SmokeScratchMemory);
+DEFINE_STAT(STAT_SmokeScratchGrowths);
+DEFINE_STAT(STAT_SmokeObstacleCacheEntries);
+DEFINE_STAT(STAT_SmokeObstacleCacheHitRate);
+DEFINE_STAT(STAT_SmokeObstacleCacheEvictions);
+DEFINE_STAT(STAT_SmokeObstacleCacheInvalidations);
+DEFINE_STAT(STAT_SmokeObstacleCacheMemory);
+DEFINE_STAT(STAT_SmokeSimulatedVolumes);
+DEFINE_STAT(STAT_SmokeSimulationThroughput);
+DEFINE_STAT(STAT_SmokePressureConvergenceRate);
+DEFINE_STAT(STAT_SmokeCarvedRays);
+DEFINE_STAT(STAT_SmokeCarvedVoxels);
+DEFINE_STAT(STAT_SmokeCarvedBricks);
+DEFINE_STAT(STAT_SmokeExplosionClearedVoxels);
+DEFINE_STAT(STAT_SmokeExplosionClearMs);
+DEFINE_STAT(STAT_SmokeOpticalDepthRays);
+DEFINE_STAT(STAT_SmokeOpticalDepthQueryMs);
+DEFINE_STAT(STAT_SmokeDensitySamples);
+DEFINE_STAT(STAT_SmokeDensitySampleMs);
 
 #define LOCTEXT_NAMESPACE "FVolumetricSmokeModule"
 
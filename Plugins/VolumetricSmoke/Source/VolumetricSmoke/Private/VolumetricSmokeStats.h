@@ -0,0 +1,37 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "Stats/Stats.h"
+
+// "stat VolumetricSmoke"
+DECLARE_STATS_GROUP(TEXT("VolumetricSmoke"), STATGROUP_VolumetricSmoke, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Smoke Subsystem Tick"), STAT_SmokeSubsystemTick, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Volumes"), STAT_SmokeVolumes, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Active Volumes"), STAT_SmokeActiveVolumes, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Filled Voxels"), STAT_SmokeFilledVoxels, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Pool Size"), STAT_SmokePoolSize, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Pool In Use"), STAT_SmokePoolInUse, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Pool High-Water Mark"), STAT_SmokePoolHighWaterMark, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Pool Overflows"), STAT_SmokePoolOverflows, STATGROUP_VolumetricSmoke, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Voxel Memory"), STAT_SmokeVoxelMemory, STATGROUP_VolumetricSmoke, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Scratch Memory"), STAT_SmokeScratchMemory, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Scratch Growths"), STAT_SmokeScratchGrowths, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Obstacle Cache Entries"), STAT_SmokeObstacleCacheEntries, STATGROUP_VolumetricSmoke, );
+DECLARE_FLOAT_ACCUMULATOR_STAT_EXTERN(TEXT("Obstacle Cache Hit Rate %"), STAT_SmokeObstacleCacheHitRate, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Obstacle Cache Evictions"), STAT_SmokeObstacleCacheEvictions, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Obstacle Cache Invalidations"), STAT_SmokeObstacleCacheInvalidations, STATGROUP_VolumetricSmoke, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Obstacle Cache Memory"), STAT_SmokeObstacleCacheMemory, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Simulated Volumes"), STAT_SmokeSimulatedVolumes, STATGROUP_VolumetricSmoke, );
+DECLARE_FLOAT_ACCUMULATOR_STAT_EXTERN(TEXT("Simulation M Voxel Updates/s"), STAT_SmokeSimulationThroughput, STATGROUP_VolumetricSmoke, );
+DECLARE_FLOAT_ACCUMULATOR_STAT_EXTERN(TEXT("Pressure Convergence Rate"), STAT_SmokePressureConvergenceRate, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Carved Rays"), STAT_SmokeCarvedRays, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Carved Voxels"), STAT_SmokeCarvedVoxels, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Carved Bricks"), STAT_SmokeCarvedBricks, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Explosion Cleared Voxels"), STAT_SmokeExplosionClearedVoxels, STATGROUP_VolumetricSmoke, );
+DECLARE_FLOAT_ACCUMULATOR_STAT_EXTERN(TEXT("Explosion Clear ms"), STAT_SmokeExplosionClearMs, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Optical Depth Rays"), STAT_SmokeOpticalDepthRays, STATGROUP_VolumetricSmoke, );
+DECLARE_FLOAT_ACCUMULATOR_STAT_EXTERN(TEXT("Optical Depth Query ms"), STAT_SmokeOpticalDepthQueryMs, STATGROUP_VolumetricSmoke, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Density Samples"), STAT_SmokeDensitySamples, STATGROUP_VolumetricSmoke, );
+DECLARE_FLOAT_ACCUMULATOR_STAT_EXTERN(TEXT("Density Sample ms"), STAT_SmokeDensitySampleMs, STATGROUP_VolumetricSmoke, );
@@ -0,0 +1,62 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeBrickGrid.h"
+
+void FSmokeBrickGrid::Reset(int32 InResolution)
+{
+	Resolution = InResolution;
+	BricksPerAxis = FMath::DivideAndRoundUp(InResolution, FSmokeVoxelBrick::Size);
+
+	// Keep the allocations, a pooled volume is reset for every detonation and must not touch the heap.
+	// Init() would reallocate whenever the brick count changes.
+	BrickIndex.SetNumUninitialized(BricksPerAxis * BricksPerAxis * BricksPerAxis, EAllowShrinking::No);
+	for (int32& Slot : BrickIndex)
+	{
+		Slot = INDEX_NONE;
+	}
+	NumBricks = 0;
+	ClearChanged();
+	bAllChanged = true;
+
+	// Only the page pointers are reserved for the whole grid, a few KB, so adding a page never moves them
+	Pages.Reserve(FMath::DivideAndRoundUp(BrickIndex.Num(), BricksPerPage));
+}
+
+void FSmokeBrickGrid::Reserve(int32 InNumBricks)
+{
+	const int32 NumPages = FMath::DivideAndRoundUp(FMath::Min(InNumBricks, BrickIndex.Num()), BricksPerPage);
+	while (Pages.Num() < NumPages)
+	{
+		Pages.Add(MakeUnique<FBrickPage>());
+	}
+}
+
+FSmokeVoxelBrick& FSmokeBrickGrid::FindOrAddBrick(const FIntVector& VoxelCoord)
+{
+	int32& Slot = BrickIndex[GetBrickIndex(VoxelCoord)];
+	if (Slot == INDEX_NONE)
+	{
+		// The grid never holds more than one brick per brick cell, so the page pointers never grow past Reset()
+		Slot = NumBricks++;
+		if ((Slot >> PageShift) == Pages.Num())
+		{
+			Pages.Add(MakeUnique<FBrickPage>());
+		}
+
+		// Zeroed brick: every voxel Free
+		static_assert(static_cast<uint8>(ESmokeVoxelCell::Free) == 0, "New bricks rely on Free being zero");
+		FMemory::Memzero(GetBrick(Slot));
+	}
+
+	return GetBrick(Slot);
+}
+
+void FSmokeBrickGrid::ClearChanged()
+{
+	// Pages past the bricks in use are cleared too, so bricks paged in again start unmarked
+	for (const TUniquePtr<FBrickPage>& Page : Pages)
+	{
+		Page->ChangedMask = 0;
+	}
+	bAllChanged = false;
+}
@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeFadeKernel.h"
+
+#include "Math/VectorRegister.h"
+
+namespace
+{
+	// Every multiply and add is its own statement and no fused multiply-add is used, so the scalar and
+	// vector paths round identically. Keep both in sync when changing either.
+
+	constexpr float OneThird = 1.0f / 3.0f;
+
+	FORCEINLINE float EvaluateOne(float Density, float ArrivalTime, const FSmokeFadeParams& Params)
+	{
+		const float Rate = Params.SpawnSpeed * Density;
+		const float Age = Params.ElapsedTime - ArrivalTime;
+		const float Scaled = Age * Rate;
+		const float Progress = FMath::Clamp(Scaled * OneThird, 0.0f, 1.0f);
+		const float Remaining = 1.0f - Progress;
+		const float RemainingSquared = Remaining * Remaining;
+		const float RemainingCubed = RemainingSquared * Remaining;
+		const float Visibility = 1.0f - RemainingCubed;
+		const float Dissipated = FMath::Clamp((Params.ElapsedTime - Params.DissipationStart) * Params.InvDissipationDuration, 0.0f, 1.0f);
+		const float RemainingSmoke = 1.0f - Dissipated;
+
+		// Like FInterpTo, a non-positive speed shows the voxel right away
+		return (Rate <= 0.0f ? 1.0f : Visibility) * RemainingSmoke;
+	}
+
+	struct FFadeConstants
+	{
+		VectorRegister4Float ElapsedTime;
+		VectorRegister4Float SpawnSpeed;
+		VectorRegister4Float OneThird;
+		VectorRegister4Float RemainingSmoke;
+	};
+
+	FORCEINLINE VectorRegister4Float Evaluate4(const VectorRegister4Float& Density, const VectorRegister4Float& ArrivalTime, const FFadeConstants& Constants)
+	{
+		const VectorRegister4Float One = VectorOneFloat();
+		const VectorRegister4Float Zero = VectorZeroFloat();
+
+		const VectorRegister4Float Rate = VectorMultiply(Constants.SpawnSpeed, Density);
+		const VectorRegister4Float Age = VectorSubtract(Constants.ElapsedTime, ArrivalTime);
+		const VectorRegister4Float Scaled = VectorMultiply(Age, Rate);
+		const VectorRegister4Float Progress = VectorMin(VectorMax(VectorMultiply(Scaled, Constants.OneThird), Zero), One);
+		const VectorRegister4Float Remaining = VectorSubtract(One, Progress);
+		const VectorRegister4Float RemainingSquared = VectorMultiply(Remaining, Remaining);
+		const VectorRegister4Float RemainingCubed = VectorMultiply(RemainingSquared, Remaining);
+		const VectorRegister4Float Visibility = VectorSubtract(One, RemainingCubed);
+
+		return VectorMultiply(VectorSelect(VectorCompareLE(Rate, Zero), One, Visibility), Constants.RemainingSmoke);
+	}
+}
+
+void SmokeFadeKernel::Evaluate(float* RESTRICT OutVisibility, const float* RESTRICT Density, const float* RESTRICT ArrivalTime, int32 Count, const FSmokeFadeParams& Params)
+{
+	// The fade-out is the same for every voxel, computed once like the scalar path computes it per voxel
+	const float Dissipated = FMath::Clamp((Params.ElapsedTime - Params.DissipationStart) * Params.InvDissipationDuration, 0.0f, 1.0f);
+
+	const FFadeConstants Constants
+	{
+		VectorSetFloat1(Params.ElapsedTime),
+		VectorSetFloat1(Params.SpawnSpeed),
+		VectorSetFloat1(OneThird),
+		VectorSetFloat1(1.0f - Dissipated)
+	};
+
+	// Four registers per iteration, independent so their latencies overlap
+	const int32 VectorCount = Count - Count % VectorWidth;
+	for (int32 Index = 0; Index < VectorCount; Index += VectorWidth)
+	{
+		const VectorRegister4Float V0 = Evaluate4(VectorLoad(Density + Index + 0), VectorLoad(ArrivalTime + Index + 0), Constants);
+		const VectorRegister4Float V1 = Evaluate4(VectorLoad(Density + Index + 4), VectorLoad(ArrivalTime + Index + 4), Constants);
+		const VectorRegister4Float V2 = Evaluate4(VectorLoad(Density + Index + 8), VectorLoad(ArrivalTime + Index + 8), Constants);
+		const VectorRegister4Float V3 = Evaluate4(VectorLoad(Density + Index + 12), VectorLoad(ArrivalTime + Index + 12), Constants);
+
+		VectorStore(V0, OutVisibility + Index + 0);
+		VectorStore(V1, OutVisibility + Index + 4);
+		VectorStore(V2, OutVisibility + Index + 8);
+		VectorStore(V3, OutVisibility + Index + 12);
+	}
+
+	EvaluateScalar(OutVisibility + VectorCount, Density + VectorCount, ArrivalTime + VectorCount, Count - VectorCount, Params);
+}
+
+void SmokeFadeKernel::EvaluateScalar(float* RESTRICT OutVisibility, const float* RESTRICT Density, const float* RESTRICT ArrivalTime, int32 Count, const FSmokeFadeParams& Params)
+{
+	for (int32 Index = 0; Index < Count; ++Index)
+	{
+		OutVisibility[Index] = EvaluateOne(Density[Index], ArrivalTime[Index], Params);
+	}
+}
+
+float SmokeFadeKernel::EvaluateVoxel(float Density, float ArrivalTime, const FSmokeFadeParams& Params)
+{
+	return EvaluateOne(Density, ArrivalTime, Params);
+}
@@ -0,0 +1,19 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeGridTransform.h"
+
+FSmokeGridTransform FSmokeGridTransform::Make(const FTransform& ComponentTransform, float SphereRadius, int32 Resolution)
+{
+	const double VoxelSize = (SphereRadius * 2.0) / Resolution;
+
+	// Rotation and scale are undone in double precision, only the grid position is narrowed
+	FTransform RotationScale = ComponentTransform;
+	RotationScale.SetTranslation(FVector::ZeroVector);
+	FMatrix WorldToGrid = RotationScale.ToInverseMatrixWithScale() * FScaleMatrix(1.0 / VoxelSize);
+	WorldToGrid.SetOrigin(FVector(SphereRadius / VoxelSize));
+
+	FSmokeGridTransform Result;
+	Result.Origin = ComponentTransform.GetTranslation();
+	Result.RelativeToGrid = FMatrix44f(WorldToGrid);
+	return Result;
+}
@@ -0,0 +1,274 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeObstacleCache.h"
+
+namespace
+{
+	/**
+	 * Range of cells of the given size whose probe reaches into WorldBounds, both ends included. A cell's occupancy is
+	 * probed with a sphere as large as the cell, so geometry up to a cell away affects it.
+	 */
+	void GetReachedCells(const FBox& WorldBounds, float CellSize, FVector& OutMin, FVector& OutMax)
+	{
+		OutMin = FVector(
+			FMath::CeilToDouble(WorldBounds.Min.X / CellSize),
+			FMath::CeilToDouble(WorldBounds.Min.Y / CellSize),
+			FMath::CeilToDouble(WorldBounds.Min.Z / CellSize)) - FVector(2.0);
+		OutMax = FVector(
+			FMath::FloorToDouble(WorldBounds.Max.X / CellSize),
+			FMath::FloorToDouble(WorldBounds.Max.Y / CellSize),
+			FMath::FloorToDouble(WorldBounds.Max.Z / CellSize)) + FVector(1.0);
+	}
+}
+
+FSmokeObstacleCacheKey FSmokeObstacleCache::MakeKey(const FVector& WorldPos, float CellSize)
+{
+	const float SafeCellSize = FMath::Max(CellSize, 1.0f);
+
+	FSmokeObstacleCacheKey Key;
+	Key.SetCellSize(SafeCellSize);
+	Key.Cell = FIntVector(
+		FMath::FloorToInt(WorldPos.X / SafeCellSize),
+		FMath::FloorToInt(WorldPos.Y / SafeCellSize),
+		FMath::FloorToInt(WorldPos.Z / SafeCellSize));
+	return Key;
+}
+
+FVector FSmokeObstacleCache::GetCellCenter(const FSmokeObstacleCacheKey& Key)
+{
+	return (FVector(Key.Cell) + FVector(0.5)) * Key.GetCellSize();
+}
+
+void FSmokeObstacleCache::SetCapacity(int32 InCapacity)
+{
+	Capacity = FMath::Max(InCapacity, 0);
+
+	Index.Empty(Capacity);
+	CellSizeCounts.Reset();
+	Entries.Empty(Capacity);
+	Entries.SetNum(Capacity);
+	Head = INDEX_NONE;
+	Tail = INDEX_NONE;
+
+	// Every entry starts out free
+	FreeList = Capacity > 0 ? 0 : INDEX_NONE;
+	for (int32 EntryIndex = 0; EntryIndex < Capacity; ++EntryIndex)
+	{
+		Entries[EntryIndex].Next = EntryIndex + 1 < Capacity ? EntryIndex + 1 : INDEX_NONE;
+	}
+}
+
+void FSmokeObstacleCache::Apply(TConstArrayView<FSmokeObstacleCacheUpdate> Updates)
+{
+	for (const FSmokeObstacleCacheUpdate& Update : Updates)
+	{
+		const int32* EntryIndex = Index.Find(Update.Key);
+		if (EntryIndex)
+		{
+			Touch(*EntryIndex);
+		}
+		else
+		{
+			Add(Update.Key, Update.bBlocked);
+		}
+
+		if (Update.bHit)
+		{
+			++Stats.Hits;
+		}
+		else
+		{
+			++Stats.Misses;
+		}
+	}
+}
+
+void FSmokeObstacleCache::Invalidate(const FBox& WorldBounds)
+{
+	if (!WorldBounds.IsValid || Index.Num() == 0)
+	{
+		return;
+	}
+
+	// Counted in doubles, the bounds of a large actor hold more small cells than fit an int32
+	double NumReachedCells = 0.0;
+	for (const FCellSizeCount& CellSizeCount : CellSizeCounts)
+	{
+		FSmokeObstacleCacheKey Key;
+		Key.CellSizeBits = CellSizeCount.CellSizeBits;
+
+		FVector MinCell;
+		FVector MaxCell;
+		GetReachedCells(WorldBounds, Key.GetCellSize(), MinCell, MaxCell);
+		const FVector NumCells = (MaxCell - MinCell + FVector(1.0)).ComponentMax(FVector::ZeroVector);
+		NumReachedCells += NumCells.X * NumCells.Y * NumCells.Z;
+	}
+
+	if (NumReachedCells < Index.Num())
+	{
+		// Few cells in the bounds, look each of them up
+		for (const FCellSizeCount& CellSizeCount : CellSizeCounts)
+		{
+			FSmokeObstacleCacheKey Key;
+			Key.CellSizeBits = CellSizeCount.CellSizeBits;
+
+			FVector MinCell;
+			FVector MaxCell;
+			GetReachedCells(WorldBounds, Key.GetCellSize(), MinCell, MaxCell);
+
+			for (int32 Z = static_cast<int32>(MinCell.Z); Z <= static_cast<int32>(MaxCell.Z); ++Z)
+			{
+				for (int32 Y = static_cast<int32>(MinCell.Y); Y <= static_cast<int32>(MaxCell.Y); ++Y)
+				{
+					for (int32 X = static_cast<int32>(MinCell.X); X <= static_cast<int32>(MaxCell.X); ++X)
+					{
+						Key.Cell = FIntVector(X, Y, Z);
+						if (const int32* EntryIndex = Index.Find(Key))
+						{
+							Remove(*EntryIndex);
+							++Stats.Invalidations;
+						}
+					}
+				}
+			}
+		}
+	}
+	else
+	{
+		// Large bounds, test every entry instead
+		for (int32 EntryIndex = Head; EntryIndex != INDEX_NONE;)
+		{
+			const FEntry& Entry = Entries[EntryIndex];
+			const int32 Next = Entry.Next;
+
+			const float CellSize = Entry.Key.GetCellSize();
+			const FVector CellMin = FVector(Entry.Key.Cell) * CellSize;
+			const FBox CellBounds(CellMin, CellMin + FVector(CellSize));
+
+			// A cell's occupancy is probed with a sphere as large as the cell, geometry up to a cell away affects it
+			if (CellBounds.ExpandBy(CellSize).Intersect(WorldBounds))
+			{
+				Remove(EntryIndex);
+				++Stats.Invalidations;
+			}
+
+			EntryIndex = Next;
+		}
+	}
+
+	CellSizeCounts.RemoveAll([](const FCellSizeCount& CellSizeCount) { return CellSizeCount.Num == 0; });
+}
+
+void FSmokeObstacleCache::Empty()
+{
+	Stats.Invalidations += Index.Num();
+
+	// Cleared in place, the LRU list joins the free list as it is
+	Index.Reset();
+	CellSizeCounts.Reset();
+	if (Head != INDEX_NONE)
+	{
+		Entries[Tail].Next = FreeList;
+		FreeList = Head;
+	}
+	Head = INDEX_NONE;
+	Tail = INDEX_NONE;
+}
+
+void FSmokeObstacleCache::Add(const FSmokeObstacleCacheKey& Key, bool bBlocked)
+{
+	if (Capacity == 0)
+	{
+		return;
+	}
+
+	if (FreeList == INDEX_NONE)
+	{
+		Remove(Tail);
+		++Stats.Evictions;
+	}
+
+	const int32 EntryIndex = FreeList;
+	FreeList = Entries[EntryIndex].Next;
+
+	FEntry& Entry = Entries[EntryIndex];
+	Entry.Key = Key;
+	Entry.bBlocked = bBlocked;
+	LinkFront(EntryIndex);
+	Index.Add(Key, EntryIndex);
+
+	FCellSizeCount* CellSizeCount = CellSizeCounts.FindByPredicate([&Key](const FCellSizeCount& Count) { return Count.CellSizeBits == Key.CellSizeBits; });
+	if (!CellSizeCount)
+	{
+		CellSizeCount = &CellSizeCounts.AddDefaulted_GetRef();
+		CellSizeCount->CellSizeBits = Key.CellSizeBits;
+	}
+	++CellSizeCount->Num;
+}
+
+void FSmokeObstacleCache::Touch(int32 EntryIndex)
+{
+	if (EntryIndex != Head)
+	{
+		Unlink(EntryIndex);
+		LinkFront(EntryIndex);
+	}
+}
+
+void FSmokeObstacleCache::Unlink(int32 EntryIndex)
+{
+	FEntry& Entry = Entries[EntryIndex];
+
+	if (Entry.Prev != INDEX_NONE)
+	{
+		Entries[Entry.Prev].Next = Entry.Next;
+	}
+	else
+	{
+		Head = Entry.Next;
+	}
+
+	if (Entry.Next != INDEX_NONE)
+	{
+		Entries[Entry.Next].Prev = Entry.Prev;
+	}
+	else
+	{
+		Tail = Entry.Prev;
+	}
+
+	Entry.Prev = INDEX_NONE;
+	Entry.Next = INDEX_NONE;
+}
+
+void FSmokeObstacleCache::LinkFront(int32 EntryIndex)
+{
+	FEntry& Entry = Entries[EntryIndex];
+	Entry.Prev = INDEX_NONE;
+	Entry.Next = Head;
+
+	if (Head != INDEX_NONE)
+	{
+		Entries[Head].Prev = EntryIndex;
+	}
+	Head = EntryIndex;
+
+	if (Tail == INDEX_NONE)
+	{
+		Tail = EntryIndex;
+	}
+}
+
+void FSmokeObstacleCache::Remove(int32 EntryIndex)
+{
+	Unlink(EntryIndex);
+	Index.Remove(Entries[EntryIndex].Key);
+
+	// Counts reaching zero are dropped by Invalidate(), Remove() runs while it walks them
+	FCellSizeCount* CellSizeCount = CellSizeCounts.FindByPredicate([EntryIndex, this](const FCellSizeCount& Count) { return Count.CellSizeBits == Entries[EntryIndex].Key.CellSizeBits; });
+	check(CellSizeCount);
+	--CellSizeCount->Num;
+
+	Entries[EntryIndex].Next = FreeList;
+	FreeList = EntryIndex;
+}
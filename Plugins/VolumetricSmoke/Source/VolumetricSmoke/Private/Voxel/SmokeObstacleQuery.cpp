@@ -0,0 +1,306 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeObstacleQuery.h"
+
+#include <atomic>
+
+#include "Async/ParallelFor.h"
+#include "CollisionQueryParams.h"
+#include "CollisionShape.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/OverlapResult.h"
+#include "Engine/World.h"
+#include "PhysicsEngine/BodyInstance.h"
+#include "Voxel/SmokeOccupancyAsset.h"
+
+namespace
+{
+	/** Shared state for one ClassifyGrid() run */
+	struct FOctreeContext
+	{
+		const FSmokeObstacleQuery& Query;
+		const FSmokeObstacleGrid& Grid;
+		FQuat Rotation;
+		FVector AbsScale;
+		std::atomic<int32>* LevelQueries;
+
+		/** Leaf probes look cells up here first and record what they found, null to always probe */
+		const FSmokeObstacleCache* Cache;
+	};
+
+	/** True if no voxel centre of the block [Min, Max) lies inside the probed region */
+	bool IsBlockOutsideRegion(const FSmokeObstacleGrid& Grid, const FIntVector& Min, const FIntVector& Max)
+	{
+		if (Grid.RegionRadius <= 0.0f)
+		{
+			return false;
+		}
+
+		const FBox LocalBox(Grid.GetLocalPosition(Min.X, Min.Y, Min.Z), Grid.GetLocalPosition(Max.X - 1, Max.Y - 1, Max.Z - 1));
+		return LocalBox.ComputeSquaredDistanceToPoint(Grid.RegionCenter) > FMath::Square(Grid.RegionRadius);
+	}
+
+	void ClassifyBlock(const FOctreeContext& Context, const FIntVector& Min, int32 Size, int32 Level, TSmokeScratchArray<int32>& OutBlocked, TSmokeScratchArray<FSmokeObstacleCacheUpdate>& OutCacheUpdates)
+	{
+		const FSmokeObstacleGrid& Grid = Context.Grid;
+		const FIntVector Max(
+			FMath::Min(Min.X + Size, Grid.Resolution),
+			FMath::Min(Min.Y + Size, Grid.Resolution),
+			FMath::Min(Min.Z + Size, Grid.Resolution));
+
+		if (IsBlockOutsideRegion(Grid, Min, Max))
+		{
+			return;
+		}
+
+		// Leaf: the same sphere probe the dense pass used per voxel
+		if (Size == 1)
+		{
+			const FVector WorldPos = Grid.LocalToWorld.TransformPosition(Grid.GetLocalPosition(Min.X, Min.Y, Min.Z));
+			bool bBlocked = false;
+
+			if (Context.Cache)
+			{
+				// Cached cells are probed at their centre, so the result does not depend on which grid asked first
+				const FSmokeObstacleCacheKey Key = FSmokeObstacleCache::MakeKey(WorldPos, Grid.ProbeRadius);
+				if (const bool* bCachedBlocked = Context.Cache->Find(Key))
+				{
+					bBlocked = *bCachedBlocked;
+					OutCacheUpdates.Add({ Key, bBlocked, true });
+				}
+				else
+				{
+					Context.LevelQueries[Level].fetch_add(1, std::memory_order_relaxed);
+					bBlocked = Context.Query.OverlapsSphere(FSmokeObstacleCache::GetCellCenter(Key), Grid.ProbeRadius);
+					OutCacheUpdates.Add({ Key, bBlocked, false });
+				}
+			}
+			else
+			{
+				Context.LevelQueries[Level].fetch_add(1, std::memory_order_relaxed);
+				bBlocked = Context.Query.OverlapsSphere(WorldPos, Grid.ProbeRadius);
+			}
+
+			if (bBlocked)
+			{
+				OutBlocked.Add(Min.X + Min.Y * Grid.Resolution + Min.Z * Grid.Resolution * Grid.Resolution);
+			}
+			return;
+		}
+
+		// One box covering the probe sphere of every voxel in the block. If it touches nothing, the whole block is free.
+		const FVector LocalMin = Grid.GetLocalPosition(Min.X, Min.Y, Min.Z);
+		const FVector LocalMax = Grid.GetLocalPosition(Max.X - 1, Max.Y - 1, Max.Z - 1);
+		const FVector WorldCenter = Grid.LocalToWorld.TransformPosition((LocalMin + LocalMax) * 0.5f);
+		const FVector HalfExtent = (LocalMax - LocalMin) * 0.5f * Context.AbsScale + FVector(Grid.ProbeRadius);
+
+		Context.LevelQueries[Level].fetch_add(1, std::memory_order_relaxed);
+
+		if (!Context.Query.OverlapsBox(WorldCenter, Context.Rotation, HalfExtent))
+		{
+			return;
+		}
+
+		const int32 ChildSize = Size / 2;
+		for (int32 Child = 0; Child < 8; ++Child)
+		{
+			const FIntVector ChildMin = Min + FIntVector(Child & 1, (Child >> 1) & 1, (Child >> 2) & 1) * ChildSize;
+			if (ChildMin.X < Grid.Resolution && ChildMin.Y < Grid.Resolution && ChildMin.Z < Grid.Resolution)
+			{
+				ClassifyBlock(Context, ChildMin, ChildSize, Level + 1, OutBlocked, OutCacheUpdates);
+			}
+		}
+	}
+}
+
+void FSmokeObstacleQuery::Gather(UWorld* World, const FBox& WorldBounds, ESmokeObstacleMobility Mobility)
+{
+	check(IsInGameThread());
+
+	Bodies.Reset();
+
+	if (!World || !WorldBounds.IsValid)
+	{
+		return;
+	}
+
+	// Same channel and complexity as the old per-voxel query, just issued once for the whole volume
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(SmokeObstacleGather));
+	Params.bTraceComplex = true;
+
+	TArray<FOverlapResult>& OverlapResults = Scratch.OverlapResults;
+	OverlapResults.Reset();
+	World->OverlapMultiByChannel(
+		OverlapResults, WorldBounds.GetCenter(), FQuat::Identity,
+		ECC_Visibility, FCollisionShape::MakeBox(WorldBounds.GetExtent()), Params);
+
+	for (const FOverlapResult& Overlap : OverlapResults)
+	{
+		const UPrimitiveComponent* Component = Overlap.GetComponent();
+		if (!Component)
+		{
+			continue;
+		}
+
+		const bool bMovable = Component->Mobility == EComponentMobility::Movable;
+		if ((Mobility == ESmokeObstacleMobility::StaticOnly && bMovable) || (Mobility == ESmokeObstacleMobility::MovableOnly && !bMovable))
+		{
+			continue;
+		}
+
+		// Instanced meshes report one overlap per instance, each with its own body
+		if (const FBodyInstance* Body = Component->GetBodyInstance(NAME_None, true, Overlap.ItemIndex))
+		{
+			Bodies.AddUnique(Body);
+		}
+	}
+}
+
+bool FSmokeObstacleQuery::OverlapsSphere(const FVector& WorldPos, float Radius) const
+{
+	const FCollisionShape Sphere = FCollisionShape::MakeSphere(Radius);
+
+	for (const FBodyInstance* Body : Bodies)
+	{
+		if (Body->OverlapTest(WorldPos, FQuat::Identity, Sphere, nullptr, true))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool FSmokeObstacleQuery::OverlapsBox(const FVector& WorldCenter, const FQuat& Rotation, const FVector& HalfExtent) const
+{
+	const FCollisionShape Box = FCollisionShape::MakeBox(HalfExtent);
+
+	for (const FBodyInstance* Body : Bodies)
+	{
+		if (Body->OverlapTest(WorldCenter, Rotation, Box, nullptr, true))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void FSmokeObstacleQuery::ClassifyGrid(const FSmokeObstacleGrid& Grid, TSmokeScratchArray<int32>& OutBlocked, FSmokeObstacleQueryStats& OutStats) const
+{
+	ClassifyGridCached(Grid, nullptr, OutBlocked, Scratch.CacheUpdates, OutStats);
+}
+
+void FSmokeObstacleQuery::ClassifyGridCached(const FSmokeObstacleGrid& Grid, const FSmokeObstacleCache* Cache, TSmokeScratchArray<int32>& OutBlocked,
+	TSmokeScratchArray<FSmokeObstacleCacheUpdate>& OutCacheUpdates, FSmokeObstacleQueryStats& OutStats) const
+{
+	const int32 Resolution = Grid.Resolution;
+	const int32 TopBlockSize = FMath::Min<int32>(MaxBlockSize, FMath::RoundUpToPowerOfTwo(Resolution));
+	const int32 NumLevels = FMath::FloorLog2(TopBlockSize) + 1;
+	const int32 BlocksPerAxis = FMath::DivideAndRoundUp(Resolution, TopBlockSize);
+	const int32 NumBlocks = BlocksPerAxis * BlocksPerAxis * BlocksPerAxis;
+
+	OutBlocked.Reset();
+	OutCacheUpdates.Reset();
+
+	std::atomic<int32> LevelQueries[MaxLevels];
+	for (std::atomic<int32>& Count : LevelQueries)
+	{
+		Count.store(0);
+	}
+
+	if (!IsEmpty())
+	{
+		const FOctreeContext Context{ *this, Grid, Grid.LocalToWorld.GetRotation(), Grid.LocalToWorld.GetScale3D().GetAbs(), LevelQueries, Cache };
+
+		// Each top-level block collects its blocked voxels separately, they are concatenated afterwards.
+		// The per-block arrays grow in the scratch arena from the worker threads.
+		TArray<TSmokeScratchArray<int32>>& BlockedPerBlock = Scratch.BlockedPerBlock;
+		Scratch.SetMinNumArrays(BlockedPerBlock, NumBlocks);
+		TArray<TSmokeScratchArray<FSmokeObstacleCacheUpdate>>& CacheUpdatesPerBlock = Scratch.CacheUpdatesPerBlock;
+		Scratch.SetMinNumArrays(CacheUpdatesPerBlock, NumBlocks);
+		for (int32 BlockIndex = 0; BlockIndex < NumBlocks; ++BlockIndex)
+		{
+			BlockedPerBlock[BlockIndex].Reset();
+			CacheUpdatesPerBlock[BlockIndex].Reset();
+		}
+
+		ParallelFor(NumBlocks, [&](int32 BlockIndex)
+		{
+			const FIntVector BlockCoord(
+				BlockIndex % BlocksPerAxis,
+				(BlockIndex / BlocksPerAxis) % BlocksPerAxis,
+				BlockIndex / (BlocksPerAxis * BlocksPerAxis));
+
+			ClassifyBlock(Context, BlockCoord * TopBlockSize, TopBlockSize, 0, BlockedPerBlock[BlockIndex], CacheUpdatesPerBlock[BlockIndex]);
+		});
+
+		for (int32 BlockIndex = 0; BlockIndex < NumBlocks; ++BlockIndex)
+		{
+			OutBlocked.Append(BlockedPerBlock[BlockIndex]);
+			OutCacheUpdates.Append(CacheUpdatesPerBlock[BlockIndex]);
+		}
+	}
+
+	OutStats.BroadPhaseBodies = Bodies.Num();
+	OutStats.QueriesPerLevel.SetNumZeroed(NumLevels, EAllowShrinking::No);
+	OutStats.BlockSizePerLevel.SetNumZeroed(NumLevels, EAllowShrinking::No);
+	OutStats.TotalQueries = 0;
+
+	for (int32 Level = 0; Level < NumLevels; ++Level)
+	{
+		OutStats.QueriesPerLevel[Level] = LevelQueries[Level].load();
+		OutStats.BlockSizePerLevel[Level] = TopBlockSize >> Level;
+		OutStats.TotalQueries += OutStats.QueriesPerLevel[Level];
+	}
+
+	// Voxels in the region, i.e. what a per-voxel probe would have issued
+	const double RegionRadiusInVoxels = Grid.RegionRadius / Grid.VoxelSize;
+	OutStats.DenseQueries = Grid.RegionRadius > 0.0f
+		? FMath::Min(FMath::CeilToInt((4.0 / 3.0) * UE_DOUBLE_PI * FMath::Cube(RegionRadiusInVoxels)), FMath::Cube(Resolution))
+		: FMath::Cube(Resolution);
+}
+
+void FSmokeObstacleQuery::ClassifyGridBaked(const FSmokeObstacleGrid& Grid, const USmokeOccupancyAsset& Occupancy, TSmokeScratchArray<int32>& OutBlocked) const
+{
+	const int32 Resolution = Grid.Resolution;
+
+	OutBlocked.Reset();
+
+	if (Occupancy.IsEmpty())
+	{
+		return;
+	}
+
+	// One Z slice per task, each collects its blocked voxels separately
+	TArray<TSmokeScratchArray<int32>>& BlockedPerSlice = Scratch.BlockedPerBlock;
+	Scratch.SetMinNumArrays(BlockedPerSlice, Resolution);
+
+	ParallelFor(Resolution, [&](int32 Z)
+	{
+		TSmokeScratchArray<int32>& Blocked = BlockedPerSlice[Z];
+		Blocked.Reset();
+
+		for (int32 Y = 0; Y < Resolution; ++Y)
+		{
+			for (int32 X = 0; X < Resolution; ++X)
+			{
+				const FVector LocalPos = Grid.GetLocalPosition(X, Y, Z);
+				if (Grid.RegionRadius > 0.0f && FVector::DistSquared(LocalPos, Grid.RegionCenter) > FMath::Square(Grid.RegionRadius))
+				{
+					continue;
+				}
+
+				if (Occupancy.IsSphereOccupied(Grid.LocalToWorld.TransformPosition(LocalPos), Grid.ProbeRadius))
+				{
+					Blocked.Add(X + Y * Resolution + Z * Resolution * Resolution);
+				}
+			}
+		}
+	});
+
+	for (int32 Z = 0; Z < Resolution; ++Z)
+	{
+		OutBlocked.Append(BlockedPerSlice[Z]);
+	}
+}
@@ -0,0 +1,122 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/VolumetricSmokeComponent.h"
+#include "Voxel/SmokeScratchMemory.h"
+
+class UWorld;
+class USmokeOccupancyAsset;
+struct FBodyInstance;
+
+/** Which bodies Gather() keeps */
+enum class ESmokeObstacleMobility : uint8
+{
+	/** Every body */
+	All,
+
+	/** Static and stationary bodies only, what USmokeOccupancyAsset bakes */
+	StaticOnly,
+
+	/** Movable bodies only, for when static geometry comes from a baked USmokeOccupancyAsset */
+	MovableOnly
+};
+
+/** Layout of the voxel grid the obstacle probe runs over */
+struct FSmokeObstacleGrid
+{
+	/** Component transform, voxel positions are transformed by it before probing */
+	FTransform LocalToWorld;
+
+	/** Local position of voxel (0, 0, 0) */
+	FVector Origin = FVector::ZeroVector;
+
+	/** Voxels per axis */
+	int32 Resolution = 0;
+
+	/** Edge length of a voxel in local units */
+	float VoxelSize = 0.0f;
+
+	/** Radius of the sphere probed around each voxel, in world units */
+	float ProbeRadius = 0.0f;
+
+	/** Only voxels within RegionRadius of RegionCenter (local space) are probed. <= 0 probes the whole grid. */
+	float RegionRadius = 0.0f;
+
+	/** Local centre of the probed region */
+	FVector RegionCenter = FVector::ZeroVector;
+
+	FVector GetLocalPosition(int32 X, int32 Y, int32 Z) const
+	{
+		return Origin + FVector(X, Y, Z) * VoxelSize;
+	}
+};
+
+/**
+ * Obstacle probe used while generating smoke voxels.
+ *
+ * Gather() runs one broad-phase overlap over the whole smoke bounds on the game thread and keeps the
+ * bodies it found. The per-voxel tests then only run narrow-phase checks against those bodies, so they
+ * are cheap and can be issued from worker threads. Every buffer lives in the scratch memory passed in.
+ */
+class FSmokeObstacleQuery
+{
+public:
+
+	/** Edge length, in voxels, of the coarsest octree blocks tested by ClassifyGrid() */
+	static constexpr int32 MaxBlockSize = 16;
+
+	/** Number of octree levels from MaxBlockSize blocks down to single voxels */
+	static constexpr int32 MaxLevels = 5;
+	static_assert(1 << (MaxLevels - 1) == MaxBlockSize, "MaxLevels must match MaxBlockSize");
+
+	explicit FSmokeObstacleQuery(FSmokeScratchMemory& InScratch)
+		: Scratch(InScratch)
+		, Bodies(InScratch.Bodies)
+	{
+	}
+
+	/** Collects every body overlapping WorldBounds that matches Mobility. Must be called on the game thread. */
+	void Gather(UWorld* World, const FBox& WorldBounds, ESmokeObstacleMobility Mobility = ESmokeObstacleMobility::All);
+
+	/** True if no body was found by the last Gather(), meaning every voxel is free */
+	bool IsEmpty() const { return Bodies.Num() == 0; }
+
+	/** Number of bodies found by the broad phase */
+	int32 GetNumBodies() const { return Bodies.Num(); }
+
+	/** Narrow-phase sphere test against the gathered bodies. Safe to call from worker threads. */
+	bool OverlapsSphere(const FVector& WorldPos, float Radius) const;
+
+	/** Narrow-phase oriented box test against the gathered bodies. Safe to call from worker threads. */
+	bool OverlapsBox(const FVector& WorldCenter, const FQuat& Rotation, const FVector& HalfExtent) const;
+
+	/**
+	 * Finds the voxels of the probed region that overlap geometry, as grid indices (X + Y * Res + Z * Res^2).
+	 * Coarse octree blocks are tested with a single box overlap first and only blocks touching geometry
+	 * are subdivided, down to the per-voxel sphere probe. Blocks run in parallel on worker threads.
+	 */
+	void ClassifyGrid(const FSmokeObstacleGrid& Grid, TSmokeScratchArray<int32>& OutBlocked, FSmokeObstacleQueryStats& OutStats) const;
+
+	/**
+	 * ClassifyGrid() with per-voxel probes answered from Cache where possible. Voxels are snapped to the
+	 * world-aligned cache cell they fall in. Every lookup and every newly probed cell is returned in
+	 * OutCacheUpdates, for FSmokeObstacleCache::Apply() once the worker threads are done.
+	 */
+	void ClassifyGridCached(const FSmokeObstacleGrid& Grid, const FSmokeObstacleCache* Cache, TSmokeScratchArray<int32>& OutBlocked,
+		TSmokeScratchArray<FSmokeObstacleCacheUpdate>& OutCacheUpdates, FSmokeObstacleQueryStats& OutStats) const;
+
+	/**
+	 * Finds the voxels of the probed region whose probe sphere touches an occupied cell of a baked occupancy
+	 * volume. Lookups only, no physics. Slices of the grid run in parallel on worker threads.
+	 */
+	void ClassifyGridBaked(const FSmokeObstacleGrid& Grid, const USmokeOccupancyAsset& Occupancy, TSmokeScratchArray<int32>& OutBlocked) const;
+
+private:
+
+	FSmokeScratchMemory& Scratch;
+
+	/** Bodies overlapping the gathered bounds (one per component, or per instance for instanced meshes) */
+	TArray<const FBodyInstance*>& Bodies;
+};
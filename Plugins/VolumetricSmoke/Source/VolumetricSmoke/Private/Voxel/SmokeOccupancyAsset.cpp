@@ -0,0 +1,205 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeOccupancyAsset.h"
+
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "Misc/PackageName.h"
+#include "Voxel/SmokeObstacleQuery.h"
+#include "Voxel/SmokeScratchMemory.h"
+
+namespace
+{
+	/** Content folder baked occupancy assets are saved to */
+	const TCHAR* OccupancyFolder = TEXT("/Game/SmokeOccupancy");
+
+	/** Cells per axis of the chunks the bake probes at a time, each chunk is one broad-phase query */
+	constexpr int32 BakeChunkSize = 128;
+	static_assert(BakeChunkSize % USmokeOccupancyAsset::BlockSize == 0, "Chunks must hold whole blocks");
+}
+
+FString USmokeOccupancyAsset::GetPackageNameForMap(const FString& MapPackageName)
+{
+	return FString::Printf(TEXT("%s/%s_SmokeOccupancy"), OccupancyFolder, *FPackageName::GetShortName(MapPackageName));
+}
+
+FString USmokeOccupancyAsset::GetObjectPathForWorld(const UWorld* World)
+{
+	// PIE worlds live in renamed copies of the map package
+	const FString MapPackageName = UWorld::RemovePIEPrefix(World->GetOutermost()->GetName());
+	const FString PackageName = GetPackageNameForMap(MapPackageName);
+	return FString::Printf(TEXT("%s.%s"), *PackageName, *FPackageName::GetShortName(PackageName));
+}
+
+void USmokeOccupancyAsset::Initialize(const FVector& InOrigin, float InCellSize, const FIntVector& InResolution)
+{
+	Origin = InOrigin;
+	CellSize = InCellSize;
+	Resolution = InResolution;
+	BlocksPerAxis = FIntVector(
+		FMath::DivideAndRoundUp(InResolution.X, BlockSize),
+		FMath::DivideAndRoundUp(InResolution.Y, BlockSize),
+		FMath::DivideAndRoundUp(InResolution.Z, BlockSize));
+	NumOccupiedCells = 0;
+
+	BlockIndex.Init(INDEX_NONE, BlocksPerAxis.X * BlocksPerAxis.Y * BlocksPerAxis.Z);
+	BlockBits.Reset();
+}
+
+void USmokeOccupancyAsset::SetCellOccupied(const FIntVector& Cell)
+{
+	check(Cell.X >= 0 && Cell.Y >= 0 && Cell.Z >= 0 && Cell.X < Resolution.X && Cell.Y < Resolution.Y && Cell.Z < Resolution.Z);
+
+	int32& Block = BlockIndex[GetBlockIndex(Cell)];
+	if (Block == INDEX_NONE)
+	{
+		Block = BlockBits.AddZeroed(WordsPerBlock);
+	}
+
+	const int32 LocalIndex = (Cell.X & BlockMask) | ((Cell.Y & BlockMask) << BlockShift) | ((Cell.Z & BlockMask) << (2 * BlockShift));
+	uint64& Word = BlockBits[Block + (LocalIndex >> 6)];
+	const uint64 Bit = uint64(1) << (LocalIndex & 63);
+	if (!(Word & Bit))
+	{
+		Word |= Bit;
+		++NumOccupiedCells;
+	}
+}
+
+bool USmokeOccupancyAsset::IsSphereOccupied(const FVector& WorldPos, float Radius) const
+{
+	if (NumOccupiedCells == 0)
+	{
+		return false;
+	}
+
+	const FVector MinCell = (WorldPos - FVector(Radius) - Origin) / CellSize;
+	const FVector MaxCell = (WorldPos + FVector(Radius) - Origin) / CellSize;
+
+	const FIntVector Min(
+		FMath::Max(FMath::FloorToInt(MinCell.X), 0),
+		FMath::Max(FMath::FloorToInt(MinCell.Y), 0),
+		FMath::Max(FMath::FloorToInt(MinCell.Z), 0));
+	const FIntVector Max(
+		FMath::Min(FMath::FloorToInt(MaxCell.X), Resolution.X - 1),
+		FMath::Min(FMath::FloorToInt(MaxCell.Y), Resolution.Y - 1),
+		FMath::Min(FMath::FloorToInt(MaxCell.Z), Resolution.Z - 1));
+
+	// A probe sphere about one cell across touches at most 27 cells, usually in one or two blocks
+	for (int32 Z = Min.Z; Z <= Max.Z; ++Z)
+	{
+		for (int32 Y = Min.Y; Y <= Max.Y; ++Y)
+		{
+			for (int32 X = Min.X; X <= Max.X; ++X)
+			{
+				if (IsCellOccupied(FIntVector(X, Y, Z)))
+				{
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+void USmokeOccupancyAsset::Bake(UWorld* World, float InCellSize)
+{
+	check(IsInGameThread());
+
+	// Bounds of everything that can block smoke and never moves
+	FBox StaticBounds(ForceInit);
+	for (TActorIterator<AActor> It(World); It; ++It)
+	{
+		TInlineComponentArray<UPrimitiveComponent*> Components(*It);
+		for (const UPrimitiveComponent* Component : Components)
+		{
+			if (Component->IsRegistered() && Component->Mobility != EComponentMobility::Movable &&
+				Component->IsQueryCollisionEnabled() && Component->GetCollisionResponseToChannel(ECC_Visibility) != ECR_Ignore)
+			{
+				StaticBounds += Component->Bounds.GetBox();
+			}
+		}
+	}
+
+	if (!StaticBounds.IsValid)
+	{
+		Initialize(FVector::ZeroVector, InCellSize, FIntVector::ZeroValue);
+		return;
+	}
+
+	// Very large levels are baked coarser rather than running out of memory
+	const FVector Size = StaticBounds.GetSize();
+	const float LargestExtent = static_cast<float>(Size.GetMax());
+	if (LargestExtent / InCellSize > MaxResolution)
+	{
+		const float CoarserCellSize = LargestExtent / MaxResolution;
+		UE_LOG(LogTemp, Warning, TEXT("VolumetricSmoke: Level is %.0f units across, baking occupancy with %.1f unit cells instead of %.1f"),
+			LargestExtent, CoarserCellSize, InCellSize);
+		InCellSize = CoarserCellSize;
+	}
+
+	Initialize(StaticBounds.Min, InCellSize, FIntVector(
+		FMath::Max(FMath::CeilToInt(Size.X / InCellSize), 1),
+		FMath::Max(FMath::CeilToInt(Size.Y / InCellSize), 1),
+		FMath::Max(FMath::CeilToInt(Size.Z / InCellSize), 1)));
+
+	FSmokeScratchMemory ScratchMemory;
+	FSmokeObstacleQuery ObstacleQuery(ScratchMemory);
+	FSmokeObstacleQueryStats QueryStats;
+
+	const FIntVector NumChunks(
+		FMath::DivideAndRoundUp(Resolution.X, BakeChunkSize),
+		FMath::DivideAndRoundUp(Resolution.Y, BakeChunkSize),
+		FMath::DivideAndRoundUp(Resolution.Z, BakeChunkSize));
+
+	for (int32 ChunkZ = 0; ChunkZ < NumChunks.Z; ++ChunkZ)
+	{
+		for (int32 ChunkY = 0; ChunkY < NumChunks.Y; ++ChunkY)
+		{
+			for (int32 ChunkX = 0; ChunkX < NumChunks.X; ++ChunkX)
+			{
+				const FIntVector FirstCell = FIntVector(ChunkX, ChunkY, ChunkZ) * BakeChunkSize;
+				const FVector ChunkMin = Origin + FVector(FirstCell) * CellSize;
+				const FBox ChunkBounds(ChunkMin, ChunkMin + FVector(BakeChunkSize * CellSize));
+
+				ObstacleQuery.Gather(World, ChunkBounds.ExpandBy(CellSize), ESmokeObstacleMobility::StaticOnly);
+				if (ObstacleQuery.IsEmpty())
+				{
+					continue;
+				}
+
+				// The sphere inscribed in a cell stands in for the cell, the same probe smoke voxels use
+				FSmokeObstacleGrid Grid;
+				Grid.LocalToWorld = FTransform(ChunkMin);
+				Grid.Origin = FVector(CellSize * 0.5f);
+				Grid.Resolution = BakeChunkSize;
+				Grid.VoxelSize = CellSize;
+				Grid.ProbeRadius = CellSize * 0.5f;
+
+				TSmokeScratchArray<int32>& Blocked = ScratchMemory.BlockedVoxels;
+				ObstacleQuery.ClassifyGrid(Grid, Blocked, QueryStats);
+
+				for (const int32 Index : Blocked)
+				{
+					const FIntVector Cell = FirstCell + FIntVector(
+						Index % BakeChunkSize,
+						(Index / BakeChunkSize) % BakeChunkSize,
+						Index / (BakeChunkSize * BakeChunkSize));
+
+					if (Cell.X < Resolution.X && Cell.Y < Resolution.Y && Cell.Z < Resolution.Z)
+					{
+						SetCellOccupied(Cell);
+					}
+				}
+
+				// Chunks are the same size, so every chunk after the first reuses the arena of the one before
+				ScratchMemory.Reset();
+			}
+		}
+	}
+
+	BlockIndex.Shrink();
+	BlockBits.Shrink();
+}
@@ -0,0 +1,373 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokePressureSolver.h"
+
+#include "Async/ParallelFor.h"
+
+namespace
+{
+	/** Levels below this many cells are smoothed on one thread, fanning out costs more than it saves */
+	constexpr int32 MinParallelCells = 4096;
+
+	/** A flow with less divergence than this is left alone */
+	constexpr float MinResidual = 1.0e-5f;
+
+	EParallelForFlags GetParallelFlags(int32 NumCells)
+	{
+		return NumCells < MinParallelCells ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None;
+	}
+}
+
+void FSmokePressureSolver::Resize(const FIntVector& InSize)
+{
+	check(InSize.X % 8 == 0 && InSize.Y % 8 == 0 && InSize.Z % 8 == 0 && InSize.GetMin() > 0);
+
+	// Halve the grid while every axis stays even and the coarsest level keeps some cells per axis
+	int32 NumLevels = 1;
+	for (FIntVector Size = InSize; Size.X % 2 == 0 && Size.Y % 2 == 0 && Size.Z % 2 == 0 && Size.GetMin() > 2; Size /= 2)
+	{
+		++NumLevels;
+	}
+
+	Levels.SetNum(NumLevels);
+	FIntVector Size = InSize;
+	for (FLevel& Level : Levels)
+	{
+		Level.Size = Size;
+		Level.Pressure.SetNumUninitialized(Level.Num(), EAllowShrinking::No);
+		Level.Rhs.SetNumUninitialized(Level.Num(), EAllowShrinking::No);
+		Level.Residual.SetNumUninitialized(Level.Num(), EAllowShrinking::No);
+		Level.Fluid.SetNumUninitialized(Level.Num(), EAllowShrinking::No);
+		Size /= 2;
+	}
+
+	const int32 NumCells = Levels[0].Num();
+	for (TArray<float>& Axis : Velocity)
+	{
+		Axis.SetNumZeroed(NumCells, EAllowShrinking::No);
+	}
+	Fluid.SetNumUninitialized(NumCells, EAllowShrinking::No);
+	FMemory::Memset(Fluid.GetData(), 1, NumCells);
+}
+
+const FSmokePressureStats& FSmokePressureSolver::Project(const FSmokePressureSettings& Settings)
+{
+	const double StartTime = FPlatformTime::Seconds();
+
+	Stats = FSmokePressureStats();
+	Stats.NumCells = Levels[0].Num();
+	Stats.NumLevels = Levels.Num();
+
+	FMemory::Memcpy(Levels[0].Fluid.GetData(), Fluid.GetData(), Fluid.Num());
+	BuildCoarseMasks();
+	ComputeDivergence();
+
+	FLevel& Finest = Levels[0];
+	FMemory::Memzero(Finest.Pressure.GetData(), Finest.Pressure.Num() * sizeof(float));
+	Stats.InitialResidual = ComputeResidual(0);
+	Stats.FinalResidual = Stats.InitialResidual;
+
+	if (Stats.InitialResidual > MinResidual)
+	{
+		const float TargetResidual = Stats.InitialResidual * Settings.Tolerance;
+		while (Stats.Cycles < Settings.MaxCycles && Stats.FinalResidual > TargetResidual)
+		{
+			VCycle(0, Settings);
+			Stats.FinalResidual = ComputeResidual(0);
+			++Stats.Cycles;
+		}
+
+		Stats.ConvergenceRate = Stats.Cycles > 0 ? FMath::Pow(Stats.FinalResidual / Stats.InitialResidual, 1.0f / Stats.Cycles) : 0.0f;
+		SubtractGradient();
+	}
+
+	Stats.SolveSeconds = FPlatformTime::Seconds() - StartTime;
+	return Stats;
+}
+
+void FSmokePressureSolver::BuildCoarseMasks()
+{
+	for (int32 LevelIndex = 1; LevelIndex < Levels.Num(); ++LevelIndex)
+	{
+		const FLevel& Fine = Levels[LevelIndex - 1];
+		FLevel& Coarse = Levels[LevelIndex];
+		for (int32 Z = 0; Z < Coarse.Size.Z; ++Z)
+		{
+			for (int32 Y = 0; Y < Coarse.Size.Y; ++Y)
+			{
+				for (int32 X = 0; X < Coarse.Size.X; ++X)
+				{
+					uint8 bAnyFluid = 0;
+					for (int32 Child = 0; Child < 8; ++Child)
+					{
+						bAnyFluid |= Fine.Fluid[Fine.GetIndex(2 * X + (Child & 1), 2 * Y + ((Child >> 1) & 1), 2 * Z + (Child >> 2))];
+					}
+					Coarse.Fluid[Coarse.GetIndex(X, Y, Z)] = bAnyFluid;
+				}
+			}
+		}
+	}
+}
+
+void FSmokePressureSolver::ComputeDivergence()
+{
+	FLevel& Finest = Levels[0];
+	const FIntVector Size = Finest.Size;
+	const int32 Strides[3] = { 1, Size.X, Size.X * Size.Y };
+
+	ParallelFor(Size.Z, [this, &Finest, Size, &Strides](int32 Z)
+	{
+		for (int32 Y = 0; Y < Size.Y; ++Y)
+		{
+			for (int32 X = 0; X < Size.X; ++X)
+			{
+				const int32 Index = Finest.GetIndex(X, Y, Z);
+				if (!Finest.Fluid[Index])
+				{
+					Finest.Rhs[Index] = 0.0f;
+					continue;
+				}
+
+				// Central differences. Obstacles let no air through, beyond the faces the flow carries on unchanged.
+				const int32 Coords[3] = { X, Y, Z };
+				float Divergence = 0.0f;
+				for (int32 Axis = 0; Axis < 3; ++Axis)
+				{
+					const float Own = Velocity[Axis][Index];
+					const bool bHasLower = Coords[Axis] > 0;
+					const bool bHasUpper = Coords[Axis] < Size[Axis] - 1;
+					const float Lower = !bHasLower ? Own : (Finest.Fluid[Index - Strides[Axis]] ? Velocity[Axis][Index - Strides[Axis]] : 0.0f);
+					const float Upper = !bHasUpper ? Own : (Finest.Fluid[Index + Strides[Axis]] ? Velocity[Axis][Index + Strides[Axis]] : 0.0f);
+					Divergence += 0.5f * (Upper - Lower);
+				}
+				Finest.Rhs[Index] = Divergence;
+			}
+		}
+	}, GetParallelFlags(Finest.Num()));
+}
+
+void FSmokePressureSolver::Smooth(int32 LevelIndex, int32 Sweeps)
+{
+	FLevel& Level = Levels[LevelIndex];
+	const FIntVector Size = Level.Size;
+
+	for (int32 Sweep = 0; Sweep < Sweeps; ++Sweep)
+	{
+		// Cells of one colour only have neighbours of the other, so a colour updates in any order and in parallel
+		for (int32 Colour = 0; Colour < 2; ++Colour)
+		{
+			ParallelFor(Size.Z, [&Level, Size, Colour](int32 Z)
+			{
+				for (int32 Y = 0; Y < Size.Y; ++Y)
+				{
+					for (int32 X = (Y + Z + Colour) & 1; X < Size.X; X += 2)
+					{
+						const int32 Index = Level.GetIndex(X, Y, Z);
+						if (!Level.Fluid[Index])
+						{
+							continue;
+						}
+
+						// Sum(p_n - p) = Rhs over the air neighbours, the faces of the grid hold pressure 0
+						float NeighbourSum = 0.0f;
+						int32 NumNeighbours = 0;
+						auto AddNeighbour = [&](bool bInside, int32 NeighbourIndex)
+						{
+							if (!bInside)
+							{
+								++NumNeighbours;
+							}
+							else if (Level.Fluid[NeighbourIndex])
+							{
+								NeighbourSum += Level.Pressure[NeighbourIndex];
+								++NumNeighbours;
+							}
+						};
+						AddNeighbour(X > 0, Index - 1);
+						AddNeighbour(X < Size.X - 1, Index + 1);
+						AddNeighbour(Y > 0, Index - Size.X);
+						AddNeighbour(Y < Size.Y - 1, Index + Size.X);
+						AddNeighbour(Z > 0, Index - Size.X * Size.Y);
+						AddNeighbour(Z < Size.Z - 1, Index + Size.X * Size.Y);
+
+						Level.Pressure[Index] = NumNeighbours > 0 ? (NeighbourSum - Level.Rhs[Index]) / NumNeighbours : 0.0f;
+					}
+				}
+			}, GetParallelFlags(Level.Num()));
+		}
+	}
+}
+
+float FSmokePressureSolver::ComputeResidual(int32 LevelIndex)
+{
+	FLevel& Level = Levels[LevelIndex];
+	const FIntVector Size = Level.Size;
+
+	TArray<double, TInlineAllocator<256>> SliceSquares;
+	SliceSquares.SetNumZeroed(Size.Z);
+
+	ParallelFor(Size.Z, [&Level, Size, &SliceSquares](int32 Z)
+	{
+		double SumSquares = 0.0;
+		for (int32 Y = 0; Y < Size.Y; ++Y)
+		{
+			for (int32 X = 0; X < Size.X; ++X)
+			{
+				const int32 Index = Level.GetIndex(X, Y, Z);
+				if (!Level.Fluid[Index])
+				{
+					Level.Residual[Index] = 0.0f;
+					continue;
+				}
+
+				const float Pressure = Level.Pressure[Index];
+				float Laplacian = 0.0f;
+				auto AddNeighbour = [&](bool bInside, int32 NeighbourIndex)
+				{
+					if (!bInside)
+					{
+						Laplacian -= Pressure;
+					}
+					else if (Level.Fluid[NeighbourIndex])
+					{
+						Laplacian += Level.Pressure[NeighbourIndex] - Pressure;
+					}
+				};
+				AddNeighbour(X > 0, Index - 1);
+				AddNeighbour(X < Size.X - 1, Index + 1);
+				AddNeighbour(Y > 0, Index - Size.X);
+				AddNeighbour(Y < Size.Y - 1, Index + Size.X);
+				AddNeighbour(Z > 0, Index - Size.X * Size.Y);
+				AddNeighbour(Z < Size.Z - 1, Index + Size.X * Size.Y);
+
+				const float Residual = Level.Rhs[Index] - Laplacian;
+				Level.Residual[Index] = Residual;
+				SumSquares += static_cast<double>(Residual) * Residual;
+			}
+		}
+		SliceSquares[Z] = SumSquares;
+	}, GetParallelFlags(Level.Num()));
+
+	// Summed in slice order, so the norm does not depend on scheduling
+	double SumSquares = 0.0;
+	for (const double SliceSum : SliceSquares)
+	{
+		SumSquares += SliceSum;
+	}
+	return static_cast<float>(FMath::Sqrt(SumSquares));
+}
+
+void FSmokePressureSolver::Restrict(int32 LevelIndex)
+{
+	const FLevel& Fine = Levels[LevelIndex];
+	FLevel& Coarse = Levels[LevelIndex + 1];
+
+	// The mean residual of the 8 children, times 4 as the coarse cells are twice as wide
+	for (int32 Z = 0; Z < Coarse.Size.Z; ++Z)
+	{
+		for (int32 Y = 0; Y < Coarse.Size.Y; ++Y)
+		{
+			for (int32 X = 0; X < Coarse.Size.X; ++X)
+			{
+				float Sum = 0.0f;
+				for (int32 Child = 0; Child < 8; ++Child)
+				{
+					Sum += Fine.Residual[Fine.GetIndex(2 * X + (Child & 1), 2 * Y + ((Child >> 1) & 1), 2 * Z + (Child >> 2))];
+				}
+
+				const int32 Index = Coarse.GetIndex(X, Y, Z);
+				Coarse.Rhs[Index] = Coarse.Fluid[Index] ? 0.5f * Sum : 0.0f;
+				Coarse.Pressure[Index] = 0.0f;
+			}
+		}
+	}
+}
+
+void FSmokePressureSolver::Prolongate(int32 LevelIndex)
+{
+	FLevel& Fine = Levels[LevelIndex];
+	const FLevel& Coarse = Levels[LevelIndex + 1];
+
+	for (int32 Z = 0; Z < Fine.Size.Z; ++Z)
+	{
+		for (int32 Y = 0; Y < Fine.Size.Y; ++Y)
+		{
+			for (int32 X = 0; X < Fine.Size.X; ++X)
+			{
+				const int32 Index = Fine.GetIndex(X, Y, Z);
+				if (Fine.Fluid[Index])
+				{
+					Fine.Pressure[Index] += Coarse.Pressure[Coarse.GetIndex(X / 2, Y / 2, Z / 2)];
+				}
+			}
+		}
+	}
+}
+
+void FSmokePressureSolver::VCycle(int32 LevelIndex, const FSmokePressureSettings& Settings)
+{
+	if (LevelIndex == Levels.Num() - 1)
+	{
+		Smooth(LevelIndex, Settings.CoarseSweeps);
+		return;
+	}
+
+	Smooth(LevelIndex, Settings.SmoothingSweeps);
+	ComputeResidual(LevelIndex);
+	Restrict(LevelIndex);
+	VCycle(LevelIndex + 1, Settings);
+	Prolongate(LevelIndex);
+	Smooth(LevelIndex, Settings.SmoothingSweeps);
+}
+
+void FSmokePressureSolver::SubtractGradient()
+{
+	const FLevel& Finest = Levels[0];
+	const FIntVector Size = Finest.Size;
+	const int32 Strides[3] = { 1, Size.X, Size.X * Size.Y };
+
+	ParallelFor(Size.Z, [this, &Finest, Size, &Strides](int32 Z)
+	{
+		for (int32 Y = 0; Y < Size.Y; ++Y)
+		{
+			for (int32 X = 0; X < Size.X; ++X)
+			{
+				const int32 Index = Finest.GetIndex(X, Y, Z);
+				if (!Finest.Fluid[Index])
+				{
+					for (TArray<float>& Axis : Velocity)
+					{
+						Axis[Index] = 0.0f;
+					}
+					continue;
+				}
+
+				// Obstacles mirror the pressure of the cell, so no gradient pushes air into them
+				const float Own = Finest.Pressure[Index];
+				const int32 Coords[3] = { X, Y, Z };
+				for (int32 Axis = 0; Axis < 3; ++Axis)
+				{
+					const bool bHasLower = Coords[Axis] > 0;
+					const bool bHasUpper = Coords[Axis] < Size[Axis] - 1;
+					const float Lower = !bHasLower ? 0.0f : (Finest.Fluid[Index - Strides[Axis]] ? Finest.Pressure[Index - Strides[Axis]] : Own);
+					const float Upper = !bHasUpper ? 0.0f : (Finest.Fluid[Index + Strides[Axis]] ? Finest.Pressure[Index + Strides[Axis]] : Own);
+					Velocity[Axis][Index] -= 0.5f * (Upper - Lower);
+				}
+			}
+		}
+	}, GetParallelFlags(Finest.Num()));
+}
+
+SIZE_T FSmokePressureSolver::GetAllocatedSize() const
+{
+	SIZE_T Size = Fluid.GetAllocatedSize() + Levels.GetAllocatedSize();
+	for (const TArray<float>& Axis : Velocity)
+	{
+		Size += Axis.GetAllocatedSize();
+	}
+	for (const FLevel& Level : Levels)
+	{
+		Size += Level.Pressure.GetAllocatedSize() + Level.Rhs.GetAllocatedSize() + Level.Residual.GetAllocatedSize() + Level.Fluid.GetAllocatedSize();
+	}
+	return Size;
+}
@@ -0,0 +1,184 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeRegenerationJob.h"
+
+#include "Voxel/SmokeObstacleQuery.h"
+#include "Voxel/SmokeVolume.h"
+
+namespace
+{
+	/** A flood fill run to the end checks for cancellation this often */
+	constexpr double FloodFillSliceSeconds = 0.002;
+}
+
+FSmokeGenerationSettings FSmokeGenerationSettings::FromComponent(const UVolumetricSmokeComponent& Component)
+{
+	FSmokeGenerationSettings Settings;
+	Settings.ComponentTransform = Component.GetComponentTransform();
+	Settings.SphereRadius = Component.SphereRadius;
+	Settings.VoxelResolution = Component.VoxelResolution;
+	Settings.DensityFormat = Component.DensityFormat;
+	Settings.FillMode = Component.FillMode;
+	Settings.FloodFillVolumeScale = Component.FloodFillVolumeScale;
+	Settings.FloodFillBudgetSeconds = Component.FloodFillBudgetMs * 0.001;
+	Settings.SmokeLifetime = Component.SmokeLifetime;
+	Settings.DissipationDuration = Component.DissipationDuration;
+	Settings.AttributeSeed = Component.GetResolvedAttributeSeed();
+	Settings.Simulation = Component.GetSimulationSettings();
+	return Settings;
+}
+
+FSmokeRegenerationJob::FSmokeRegenerationJob(UVolumetricSmokeComponent* InComponent, FSmokeVolume* InVolume, const FSmokeGenerationSettings& InSettings,
+	TUniquePtr<FSmokeScratchMemory> InScratchMemory)
+	: Component(InComponent)
+	, Volume(InVolume)
+	, Settings(InSettings)
+	, ScratchMemory(MoveTemp(InScratchMemory))
+{
+	check(Volume && Volume->GetResolution() == Settings.VoxelResolution);
+	check(ScratchMemory);
+	Volume->Seed = Settings.AttributeSeed;
+	Volume->SimulationSettings = Settings.Simulation;
+}
+
+FSmokeRegenerationJob::~FSmokeRegenerationJob()
+{
+	if (Completion.IsValid())
+	{
+		Cancel();
+		Completion.Wait();
+	}
+}
+
+void FSmokeRegenerationJob::Wait()
+{
+	if (Completion.IsValid())
+	{
+		Completion.Wait();
+	}
+}
+
+TUniquePtr<FSmokeScratchMemory> FSmokeRegenerationJob::ReleaseScratchMemory()
+{
+	check(IsDone());
+
+	// A cancelled job skips the stages that would have ended the pass
+	ScratchMemory->Reset();
+	return MoveTemp(ScratchMemory);
+}
+
+void FSmokeRegenerationJob::Start(UWorld* World, const USmokeOccupancyAsset* InStaticOccupancy)
+{
+	check(IsInGameThread());
+	check(!Completion.IsValid());
+
+	StaticOccupancy = InStaticOccupancy;
+	StartTime = FPlatformTime::Seconds();
+
+	// Broad phase: one overlap for the whole volume, padded by the per-voxel probe radius
+	const FBox LocalBox(-FVector(Settings.SphereRadius), FVector(Settings.SphereRadius));
+	const FBox WorldBounds = LocalBox.TransformBy(Settings.ComponentTransform).ExpandBy(Settings.GetVoxelSize());
+	FSmokeObstacleQuery ObstacleQuery(*ScratchMemory);
+	ObstacleQuery.Gather(World, WorldBounds, StaticOccupancy ? ESmokeObstacleMobility::MovableOnly : ESmokeObstacleMobility::All);
+	const double GatherEndTime = FPlatformTime::Seconds();
+	StageSeconds[static_cast<int32>(ESmokeRegenerationStage::Gather)] = GatherEndTime - StartTime;
+
+	// The narrow phase tests the gathered bodies, which are only safe to use until game code runs again. So it runs
+	// here, fanned out over the workers, and the bodies are forgotten before anything else could destroy them.
+	ResolveObstacles();
+	ScratchMemory->Bodies.Reset();
+	StageSeconds[static_cast<int32>(ESmokeRegenerationStage::Obstacles)] = FPlatformTime::Seconds() - GatherEndTime;
+
+	// Each stage needs the whole output of the previous one, so they are chained. Jobs of other volumes run in between.
+	const UE::Tasks::FTask FillStage = LaunchStage(ESmokeRegenerationStage::Fill, &FSmokeRegenerationJob::FillVoxels, UE::Tasks::FTask());
+	Completion = LaunchStage(ESmokeRegenerationStage::Attributes, &FSmokeRegenerationJob::FillAttributes, FillStage);
+}
+
+UE::Tasks::FTask FSmokeRegenerationJob::LaunchStage(ESmokeRegenerationStage Stage, void (FSmokeRegenerationJob::*Body)(), const UE::Tasks::FTask& Prerequisite)
+{
+	auto RunStage = [this, Stage, Body]()
+	{
+		const double StageStartTime = FPlatformTime::Seconds();
+		if (!IsCancelled())
+		{
+			(this->*Body)();
+		}
+
+		const double StageEndTime = FPlatformTime::Seconds();
+		StageSeconds[static_cast<int32>(Stage)] = StageEndTime - StageStartTime;
+		FinishTime = StageEndTime;
+	};
+
+	if (!Prerequisite.IsValid())
+	{
+		return UE::Tasks::Launch(UE_SOURCE_LOCATION, MoveTemp(RunStage));
+	}
+	return UE::Tasks::Launch(UE_SOURCE_LOCATION, MoveTemp(RunStage), UE::Tasks::Prerequisites(Prerequisite));
+}
+
+double FSmokeRegenerationJob::GetBuildSeconds() const
+{
+	double Seconds = 0.0;
+	for (const double Stage : StageSeconds)
+	{
+		Seconds += Stage;
+	}
+	return Seconds;
+}
+
+void FSmokeRegenerationJob::ResolveObstacles()
+{
+	const float VoxelSize = Settings.GetVoxelSize();
+
+	// Narrow phase against the bodies Gather() just collected into the scratch memory
+	FSmokeObstacleGrid ObstacleGrid;
+	ObstacleGrid.LocalToWorld = Settings.ComponentTransform;
+	ObstacleGrid.Origin = -FVector(Settings.SphereRadius);
+	ObstacleGrid.Resolution = Settings.VoxelResolution;
+	ObstacleGrid.VoxelSize = VoxelSize;
+	ObstacleGrid.ProbeRadius = VoxelSize;
+
+	// Smoke may pour anywhere in the grid, so a flood fill probes the whole grid
+	ObstacleGrid.RegionRadius = Settings.FillMode == ESmokeFillMode::FloodFill ? 0.0f : Settings.SphereRadius;
+
+	const FSmokeObstacleQuery ObstacleQuery(*ScratchMemory);
+	ObstacleQuery.ClassifyGrid(ObstacleGrid, ScratchMemory->BlockedVoxels, ObstacleQueryStats);
+	Volume->MarkBlocked(ScratchMemory->BlockedVoxels);
+
+	if (StaticOccupancy)
+	{
+		ObstacleQuery.ClassifyGridBaked(ObstacleGrid, *StaticOccupancy, ScratchMemory->StaticBlockedVoxels);
+		Volume->MarkBlocked(ScratchMemory->StaticBlockedVoxels);
+		ObstacleQueryStats.BakedStaticVoxels = ScratchMemory->StaticBlockedVoxels.Num();
+	}
+}
+
+void FSmokeRegenerationJob::FillVoxels()
+{
+	if (Settings.FillMode == ESmokeFillMode::Sphere)
+	{
+		Volume->FillSphere(*ScratchMemory);
+		return;
+	}
+
+	Volume->FloodFillBudgetSeconds = Settings.FloodFillBudgetSeconds;
+	if (!Volume->BeginFloodFill(FSmokeVolume::GetFloodFillCapacity(Settings.VoxelResolution, Settings.FloodFillVolumeScale)))
+	{
+		return;
+	}
+
+	// Every voxel is there from the start, as with a synchronous fill outside of game worlds
+	while (Settings.bCompleteFloodFill && Volume->IsFloodFillRunning() && !IsCancelled())
+	{
+		Volume->StepFloodFill(FloodFillSliceSeconds, 0.0f);
+	}
+}
+
+void FSmokeRegenerationJob::FillAttributes()
+{
+	// Obstacles and fill are done with the scratch arena, release all of it at once
+	ScratchMemory->Reset();
+
+	// The flood fill colours the voxels it adds later itself
+	Volume->GenerateVoxelColors();
+}
@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeRenderData.h"
+
+#include "Voxel/SmokeVolume.h"
+
+void FSmokeRenderData::CopyFrom(const FSmokeVolume& Volume, float SpawnSpeed)
+{
+	Resolution = Volume.GetResolution();
+	SpawnTime = Volume.SpawnTime;
+	FadeParams = Volume.GetFadeParams(Volume.SpawnTime, SpawnSpeed);
+
+	// Only what the proxy draws, colours are not used by it
+	Density = Volume.SmokeVoxels.Density;
+	ArrivalTime = Volume.SmokeVoxels.ArrivalTime;
+	VoxelIndex = Volume.SmokeVoxels.VoxelIndex;
+}
+
+void FSmokeRenderData::Apply(FSmokeRenderUpdate& Update)
+{
+	Resolution = Update.Resolution;
+	SpawnTime = Update.SpawnTime;
+	FadeParams = Update.FadeParams;
+
+	if (Update.bAllVoxels)
+	{
+		// Swapped rather than copied, the update gathers into the previous arrays next time
+		Swap(Density, Update.Density);
+		Swap(ArrivalTime, Update.ArrivalTime);
+		Swap(VoxelIndex, Update.VoxelIndex);
+		return;
+	}
+
+	// Slots past the new end were freed, slots past the old end were filled since and are among the sent voxels
+	checkf(Density.GetFormat() == Update.Density.GetFormat(), TEXT("Changing the density format resets the volume, which sends every voxel"));
+	Density.SetNumUninitialized(Update.NumVoxels);
+	ArrivalTime.SetNumUninitialized(Update.NumVoxels);
+	VoxelIndex.SetNumUninitialized(Update.NumVoxels, EAllowShrinking::No);
+
+	for (int32 Index = 0; Index < Update.Slots.Num(); ++Index)
+	{
+		const int32 Slot = Update.Slots[Index];
+		Density.SetFrom(Slot, Update.Density, Index);
+		ArrivalTime.SetFrom(Slot, Update.ArrivalTime, Index);
+		VoxelIndex[Slot] = Update.VoxelIndex[Index];
+	}
+}
+
+void FSmokeRenderUpdate::Gather(FSmokeVolume& Volume, float SpawnSpeed, bool bInAllVoxels)
+{
+	Resolution = Volume.GetResolution();
+	SpawnTime = Volume.SpawnTime;
+	FadeParams = Volume.GetFadeParams(Volume.SpawnTime, SpawnSpeed);
+
+	const FSmokeFilledVoxels& SmokeVoxels = Volume.SmokeVoxels;
+	NumVoxels = SmokeVoxels.Num();
+	bAllVoxels = bInAllVoxels || Volume.VoxelBricks.IsAllChanged();
+	Slots.Reset();
+
+	if (bAllVoxels)
+	{
+		Density.CopyFrom(SmokeVoxels.Density);
+		ArrivalTime.CopyFrom(SmokeVoxels.ArrivalTime);
+		VoxelIndex.Reset();
+		VoxelIndex.Append(SmokeVoxels.VoxelIndex);
+	}
+	else
+	{
+		// The filled voxels of each changed brick, which covers voxels filled, moved to another slot, carved,
+		// cleared or given a new density since the last update
+		Density.SetFormat(SmokeVoxels.Density.GetFormat());
+		ArrivalTime.SetFormat(SmokeVoxels.ArrivalTime.GetFormat());
+		VoxelIndex.Reset();
+		Volume.VoxelBricks.ForEachChangedBrick([this, &SmokeVoxels](const FSmokeVoxelBrick& Brick)
+		{
+			for (int32 LocalIndex = 0; LocalIndex < FSmokeVoxelBrick::NumVoxels; ++LocalIndex)
+			{
+				if (Brick.Cells[LocalIndex] == ESmokeVoxelCell::Filled)
+				{
+					const int32 Slot = Brick.Slots[LocalIndex];
+					Slots.Add(Slot);
+					Density.AddFrom(SmokeVoxels.Density, Slot);
+					ArrivalTime.AddFrom(SmokeVoxels.ArrivalTime, Slot);
+					VoxelIndex.Add(SmokeVoxels.VoxelIndex[Slot]);
+				}
+			}
+		});
+	}
+
+	Volume.VoxelBricks.ClearChanged();
+}
+
+void FSmokeRenderUpdate::SetEmpty()
+{
+	Resolution = 0;
+	SpawnTime = 0.0;
+	FadeParams = FSmokeFadeParams();
+	NumVoxels = 0;
+	bAllVoxels = true;
+	Slots.Reset();
+	Density.Reset();
+	ArrivalTime.Reset();
+	VoxelIndex.Reset();
+}
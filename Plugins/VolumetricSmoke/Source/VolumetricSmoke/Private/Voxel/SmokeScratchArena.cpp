@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeScratchArena.h"
+
+#include "Misc/ScopeLock.h"
+
+namespace
+{
+	/** Blocks grow in steps of this, so a pass slightly larger than the last does not grow the block again */
+	constexpr SIZE_T BlockGranularity = 64 * 1024;
+}
+
+FSmokeScratchArena::~FSmokeScratchArena()
+{
+	Empty();
+}
+
+void* FSmokeScratchArena::Allocate(SIZE_T Size)
+{
+	// Padded to the alignment, so every range handed out starts aligned
+	const SIZE_T AlignedSize = Align(FMath::Max<SIZE_T>(Size, 1), Alignment);
+	const SIZE_T Offset = Used.fetch_add(AlignedSize, std::memory_order_relaxed);
+	if (Offset + AlignedSize <= BlockSize)
+	{
+		return Block + Offset;
+	}
+
+	// Did not fit, Reset() grows the block for the next pass
+	void* Overflow = FMemory::Malloc(AlignedSize, Alignment);
+	NumHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+	FScopeLock Lock(&OverflowLock);
+	Overflows.Add(Overflow);
+	OverflowBytes += AlignedSize;
+	return Overflow;
+}
+
+void FSmokeScratchArena::Reset()
+{
+	for (void* Overflow : Overflows)
+	{
+		FMemory::Free(Overflow);
+	}
+	Overflows.Reset();
+	OverflowBytes = 0;
+
+	const SIZE_T Requested = Used.exchange(0, std::memory_order_relaxed);
+	if (Requested > BlockSize)
+	{
+		FMemory::Free(Block);
+		BlockSize = Align(Requested, BlockGranularity);
+		Block = static_cast<uint8*>(FMemory::Malloc(BlockSize, Alignment));
+		NumHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void FSmokeScratchArena::Empty()
+{
+	Reset();
+	FMemory::Free(Block);
+	Block = nullptr;
+	BlockSize = 0;
+	Overflows.Empty();
+}
+
+SIZE_T FSmokeScratchArena::GetAllocatedSize() const
+{
+	FScopeLock Lock(&OverflowLock);
+	return BlockSize + OverflowBytes;
+}
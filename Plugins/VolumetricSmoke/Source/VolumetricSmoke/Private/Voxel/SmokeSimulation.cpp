@@ -0,0 +1,960 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeSimulation.h"
+
+#include "Async/ParallelFor.h"
+#include "Math/VectorRegister.h"
+#include "Voxel/SmokeVolume.h"
+
+namespace
+{
+	constexpr int32 BrickSize = FSmokeVoxelBrick::Size;
+	constexpr int32 BrickVoxels = FSmokeVoxelBrick::NumVoxels;
+
+	/** A brick with a one voxel border of its neighbours, what the stencil reads */
+	constexpr int32 PaddedSize = BrickSize + 2;
+	constexpr int32 PaddedVoxels = PaddedSize * PaddedSize * PaddedSize;
+
+	constexpr int32 NumFaces = 6;
+
+	/** Bricks woken around smoke in every direction for advection, which bounds how far it travels per step */
+	constexpr int32 MaxAdvectBricks = 2;
+
+	/** Field speed in voxels per second below which the velocity field counts as at rest */
+	constexpr float MinFieldSpeed = 0.01f;
+
+	/** Voxels the pressure boxes of one step may add up to, the cost budget. Boxes beyond it are advected as is. */
+	constexpr int64 MaxProjectionVoxels = 128 * 128 * 128;
+
+	/** Brick offsets in face order -X, +X, -Y, +Y, -Z, +Z */
+	const FIntVector FaceOffsets[NumFaces] =
+	{
+		FIntVector(-1, 0, 0), FIntVector(1, 0, 0),
+		FIntVector(0, -1, 0), FIntVector(0, 1, 0),
+		FIntVector(0, 0, -1), FIntVector(0, 0, 1)
+	};
+
+	/** Padded index offsets of the 6 stencil neighbours */
+	constexpr int32 StencilOffsets[NumFaces] =
+	{
+		-1, 1,
+		-PaddedSize, PaddedSize,
+		-PaddedSize * PaddedSize, PaddedSize * PaddedSize
+	};
+
+	FORCEINLINE int32 GetPaddedIndex(int32 X, int32 Y, int32 Z)
+	{
+		return X + Y * PaddedSize + Z * PaddedSize * PaddedSize;
+	}
+
+	FORCEINLINE int32 GetLocalIndex(int32 X, int32 Y, int32 Z)
+	{
+		return X | (Y << FSmokeVoxelBrick::Shift) | (Z << (2 * FSmokeVoxelBrick::Shift));
+	}
+}
+
+void FSmokeSimulation::Initialize(const FSmokeVolume& Volume, const FSmokeSimulationSettings& InSettings)
+{
+	Reset();
+
+	Settings = InSettings;
+	Resolution = Volume.GetResolution();
+	BricksPerAxis = FMath::DivideAndRoundUp(Resolution, BrickSize);
+	BrickSlots.SetNumUninitialized(BricksPerAxis * BricksPerAxis * BricksPerAxis, EAllowShrinking::No);
+	for (int32& Slot : BrickSlots)
+	{
+		Slot = INDEX_NONE;
+	}
+
+	// The filled voxels are the initial field
+	const FSmokeFilledVoxels& SmokeVoxels = Volume.SmokeVoxels;
+	for (int32 FilledSlot = 0; FilledSlot < SmokeVoxels.Num(); ++FilledSlot)
+	{
+		const FIntVector Coord = Volume.IndexToVoxel(SmokeVoxels.VoxelIndex[FilledSlot]);
+		const int32 Slot = FindOrAddSlot(FIntVector(Coord.X >> FSmokeVoxelBrick::Shift, Coord.Y >> FSmokeVoxelBrick::Shift, Coord.Z >> FSmokeVoxelBrick::Shift));
+		Density[Slot * BrickVoxels + FSmokeVoxelBrick::GetLocalIndex(Coord)] = SmokeVoxels.Density.Get(FilledSlot);
+	}
+
+	const float SleepDensity = Settings.MinDensity * 0.5f;
+	for (int32 Slot = 0; Slot < SlotBricks.Num(); ++Slot)
+	{
+		UpdateMaxima(Slot, &Density[Slot * BrickVoxels]);
+		if (SlotMaxDensity[Slot] >= SleepDensity)
+		{
+			SlotAwake[Slot] = true;
+			++NumAwake;
+		}
+	}
+
+	Stats.NumBricks = SlotBricks.Num();
+	bInitialized = true;
+}
+
+void FSmokeSimulation::Reset()
+{
+	BrickSlots.Reset();
+	SlotBricks.Reset();
+	Density.Reset();
+	NextDensity.Reset();
+	for (TArray<float>& Axis : Velocity)
+	{
+		Axis.Reset();
+	}
+	SlotMaxDensity.Reset();
+	SlotFaceMaxDensity.Reset();
+	SlotAwake.Reset();
+	SlotDirty.Reset();
+	AwakeSlots.Reset();
+	ClusterSlots.Reset();
+	ClusterStarts.Reset();
+	SlotClustered.Reset();
+	NumAwake = 0;
+	PendingImpulses.Reset();
+	Wind = FVector3f::ZeroVector;
+	MaxFieldSpeed = 0.0f;
+	PendingSeconds = 0.0f;
+	bInitialized = false;
+	Stats = FSmokeSimulationStats();
+}
+
+void FSmokeSimulation::AddImpulse(const FSmokeVelocityImpulse& Impulse)
+{
+	if (IsRunning() && Settings.bAdvect && Impulse.Radius > 0.0f)
+	{
+		PendingImpulses.Add(Impulse);
+	}
+}
+
+void FSmokeSimulation::Advance(FSmokeVolume& Volume, float DeltaTime, float ElapsedTime)
+{
+	if (!IsRunning())
+	{
+		return;
+	}
+
+	// Fixed steps, so the result does not depend on the frame rate
+	const float StepSeconds = Settings.SubStepSeconds;
+	PendingSeconds += DeltaTime;
+	int32 NumSteps = FMath::FloorToInt(PendingSeconds / StepSeconds);
+	if (NumSteps > Settings.MaxSubSteps)
+	{
+		NumSteps = Settings.MaxSubSteps;
+		PendingSeconds = NumSteps * StepSeconds;
+	}
+	PendingSeconds -= NumSteps * StepSeconds;
+
+	if (NumSteps == 0)
+	{
+		return;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	for (int32 StepIndex = 0; StepIndex < NumSteps && NumAwake > 0; ++StepIndex)
+	{
+		Step(Volume.VoxelBricks, StepSeconds);
+	}
+	Stats.ComputeSeconds += FPlatformTime::Seconds() - StartTime;
+	Stats.NumBricks = SlotBricks.Num();
+	Stats.NumAwakeBricks = AwakeSlots.Num();
+
+	WriteBack(Volume, ElapsedTime);
+
+	if (!IsRunning())
+	{
+		UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: Simulation at resolution %d settled over %d bricks, %lld voxel updates at %.1f M updates/s"),
+			Resolution, Stats.NumBricks, Stats.VoxelUpdates, Stats.GetVoxelUpdatesPerSecond() / 1.0e6);
+		if (Stats.PressureSolves > 0)
+		{
+			UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: %d pressure projections, %.1f V-cycles each, last converged at %.3f per cycle, %.2f ms each"),
+				Stats.PressureSolves, static_cast<float>(Stats.PressureCycles) / Stats.PressureSolves, Stats.PressureConvergenceRate,
+				Stats.PressureSeconds * 1000.0 / Stats.PressureSolves);
+		}
+		if (Stats.PressureSkippedBoxes > 0)
+		{
+			UE_LOG(LogTemp, Log, TEXT("VolumetricSmoke: %d pressure boxes skipped over the budget of %lld voxels per step"),
+				Stats.PressureSkippedBoxes, MaxProjectionVoxels);
+		}
+	}
+}
+
+void FSmokeSimulation::Step(const FSmokeBrickGrid& Cells, float StepSeconds)
+{
+	const float SleepDensity = Settings.MinDensity * 0.5f;
+
+	ApplyImpulses(SleepDensity);
+
+	// Bricks smoke may be carried across this step. Advection traces back no further than that, so every brick
+	// it can reach is awake.
+	const float MaxSpeed = Settings.bAdvect ? Wind.Size() + MaxFieldSpeed : 0.0f;
+	const int32 AdvectBricks = FMath::Min(FMath::CeilToInt(MaxSpeed * StepSeconds / BrickSize), MaxAdvectBricks);
+
+	// Wake the neighbours smoke is about to flow into. Slots added here start out asleep-and-empty and are awake
+	// from this step on, their own faces are checked the next step.
+	const int32 NumSlots = SlotBricks.Num();
+	for (int32 Slot = 0; Slot < NumSlots; ++Slot)
+	{
+		if (!SlotAwake[Slot])
+		{
+			continue;
+		}
+
+		if (AdvectBricks > 0)
+		{
+			if (SlotMaxDensity[Slot] >= SleepDensity)
+			{
+				WakeAround(Slot, AdvectBricks);
+			}
+			continue;
+		}
+
+		for (int32 Face = 0; Face < NumFaces; ++Face)
+		{
+			if (SlotFaceMaxDensity[Slot * NumFaces + Face] < SleepDensity)
+			{
+				continue;
+			}
+
+			const FIntVector Neighbour = SlotBricks[Slot] + FaceOffsets[Face];
+			if (Neighbour.GetMin() < 0 || Neighbour.GetMax() >= BricksPerAxis)
+			{
+				continue;
+			}
+
+			const int32 NeighbourSlot = FindOrAddSlot(Neighbour);
+			if (!SlotAwake[NeighbourSlot])
+			{
+				SlotAwake[NeighbourSlot] = true;
+				++NumAwake;
+			}
+		}
+	}
+
+	AwakeSlots.Reset();
+	for (int32 Slot = 0; Slot < SlotBricks.Num(); ++Slot)
+	{
+		if (SlotAwake[Slot])
+		{
+			AwakeSlots.Add(Slot);
+		}
+	}
+
+	if (AdvectBricks > 0 && Settings.bProjectPressure)
+	{
+		ProjectVelocity(Cells);
+	}
+
+	if (AdvectBricks > 0)
+	{
+		const float DampingFactor = FMath::Exp(-Settings.VelocityDamping * StepSeconds);
+		const float MaxDisplacement = static_cast<float>(AdvectBricks * BrickSize);
+		ParallelFor(AwakeSlots.Num(), [this, &Cells, StepSeconds, MaxDisplacement, DampingFactor](int32 Index)
+		{
+			AdvectBrick(Cells, AwakeSlots[Index], StepSeconds, MaxDisplacement, DampingFactor);
+		});
+		Swap(Density, NextDensity);
+		Stats.VoxelUpdates += static_cast<int64>(AwakeSlots.Num()) * BrickVoxels;
+
+		MaxFieldSpeed *= DampingFactor;
+		if (MaxFieldSpeed < MinFieldSpeed)
+		{
+			MaxFieldSpeed = 0.0f;
+		}
+	}
+
+	if (Settings.Diffusion <= 0.0f && Settings.Decay <= 0.0f)
+	{
+		// Still air and nothing else to do, the smoke waits for wind or an impulse
+		if (AdvectBricks > 0)
+		{
+			SleepSettledBricks(SleepDensity);
+		}
+		return;
+	}
+
+	// Explicit diffusion is stable for Alpha <= 1/6, so a step with fast diffusion runs several passes
+	const int32 NumPasses = FMath::Max(1, FMath::CeilToInt(Settings.Diffusion * StepSeconds * 6.0f));
+	const float PassSeconds = StepSeconds / NumPasses;
+	const float Alpha = Settings.Diffusion * PassSeconds;
+	const float DecayFactor = FMath::Exp(-Settings.Decay * PassSeconds);
+
+	for (int32 Pass = 0; Pass < NumPasses; ++Pass)
+	{
+		// Bricks read the previous pass and write only their own slot, so they run in parallel.
+		// Sleeping slots are zero in both buffers, swapping keeps them that way.
+		ParallelFor(AwakeSlots.Num(), [this, &Cells, Alpha, DecayFactor](int32 Index)
+		{
+			UpdateBrick(Cells, AwakeSlots[Index], Alpha, DecayFactor);
+		});
+		Swap(Density, NextDensity);
+	}
+	Stats.VoxelUpdates += static_cast<int64>(AwakeSlots.Num()) * BrickVoxels * NumPasses;
+
+	SleepSettledBricks(SleepDensity);
+}
+
+void FSmokeSimulation::SleepSettledBricks(float SleepDensity)
+{
+	// Bricks whose smoke has thinned out stop being simulated. They keep no velocity, air without smoke in it
+	// does not matter.
+	for (const int32 Slot : AwakeSlots)
+	{
+		SlotDirty[Slot] = true;
+		if (SlotMaxDensity[Slot] < SleepDensity)
+		{
+			FMemory::Memzero(&Density[Slot * BrickVoxels], BrickVoxels * sizeof(float));
+			FMemory::Memzero(&NextDensity[Slot * BrickVoxels], BrickVoxels * sizeof(float));
+			for (TArray<float>& Axis : Velocity)
+			{
+				FMemory::Memzero(&Axis[Slot * BrickVoxels], BrickVoxels * sizeof(float));
+			}
+			SlotMaxDensity[Slot] = 0.0f;
+			FMemory::Memzero(&SlotFaceMaxDensity[Slot * NumFaces], NumFaces * sizeof(float));
+			SlotAwake[Slot] = false;
+			--NumAwake;
+		}
+	}
+}
+
+void FSmokeSimulation::ApplyImpulses(float SleepDensity)
+{
+	if (!Settings.bAdvect)
+	{
+		PendingImpulses.Reset();
+		return;
+	}
+
+	// Air only matters where smoke is or can flow into this step, bricks of empty air stay unallocated
+	auto HoldsSmoke = [this, SleepDensity](const FIntVector& Brick)
+	{
+		if (Brick.GetMin() < 0 || Brick.GetMax() >= BricksPerAxis)
+		{
+			return false;
+		}
+		const int32 Slot = BrickSlots[Brick.X + Brick.Y * BricksPerAxis + Brick.Z * BricksPerAxis * BricksPerAxis];
+		return Slot != INDEX_NONE && SlotMaxDensity[Slot] >= SleepDensity;
+	};
+
+	const VectorRegister4Float LaneOffsets = MakeVectorRegisterFloat(0.0f, 1.0f, 2.0f, 3.0f);
+	const VectorRegister4Float MinDistance = VectorSetFloat1(UE_KINDA_SMALL_NUMBER);
+	const VectorRegister4Float One = VectorOneFloat();
+	const VectorRegister4Float Zero = VectorZeroFloat();
+
+	for (const FSmokeVelocityImpulse& Impulse : PendingImpulses)
+	{
+		const FVector3f MinCorner = Impulse.Center - FVector3f(Impulse.Radius);
+		const FVector3f MaxCorner = Impulse.Center + FVector3f(Impulse.Radius);
+		if (Impulse.Radius <= 0.0f || MaxCorner.GetMin() < 0.0f || MinCorner.GetMax() >= Resolution)
+		{
+			continue;
+		}
+
+		const FIntVector MinBrick(
+			FMath::Clamp(FMath::FloorToInt(MinCorner.X) >> FSmokeVoxelBrick::Shift, 0, BricksPerAxis - 1),
+			FMath::Clamp(FMath::FloorToInt(MinCorner.Y) >> FSmokeVoxelBrick::Shift, 0, BricksPerAxis - 1),
+			FMath::Clamp(FMath::FloorToInt(MinCorner.Z) >> FSmokeVoxelBrick::Shift, 0, BricksPerAxis - 1));
+		const FIntVector MaxBrick(
+			FMath::Clamp(FMath::FloorToInt(MaxCorner.X) >> FSmokeVoxelBrick::Shift, 0, BricksPerAxis - 1),
+			FMath::Clamp(FMath::FloorToInt(MaxCorner.Y) >> FSmokeVoxelBrick::Shift, 0, BricksPerAxis - 1),
+			FMath::Clamp(FMath::FloorToInt(MaxCorner.Z) >> FSmokeVoxelBrick::Shift, 0, BricksPerAxis - 1));
+
+		// The air blends towards the impulse's velocity, fully at the centre, so a pawn pushing every frame drags it
+		// along at its own speed instead of accelerating it without bound. Voxels past the radius get a zero weight.
+		const VectorRegister4Float CenterX = VectorSetFloat1(Impulse.Center.X);
+		const VectorRegister4Float InvRadius = VectorSetFloat1(1.0f / Impulse.Radius);
+		const VectorRegister4Float RadialSpeed = VectorSetFloat1(Impulse.RadialSpeed);
+		const VectorRegister4Float ImpulseVelocity[3] =
+		{
+			VectorSetFloat1(Impulse.Velocity.X), VectorSetFloat1(Impulse.Velocity.Y), VectorSetFloat1(Impulse.Velocity.Z)
+		};
+
+		bool bTouchedSmoke = false;
+		for (int32 BrickZ = MinBrick.Z; BrickZ <= MaxBrick.Z; ++BrickZ)
+		{
+			for (int32 BrickY = MinBrick.Y; BrickY <= MaxBrick.Y; ++BrickY)
+			{
+				for (int32 BrickX = MinBrick.X; BrickX <= MaxBrick.X; ++BrickX)
+				{
+					const FIntVector Brick(BrickX, BrickY, BrickZ);
+					const FIntVector Origin = Brick * BrickSize;
+
+					// The corners of the box overlap the box but not the sphere
+					const FVector3f Closest = FVector3f(
+						FMath::Clamp(Impulse.Center.X, static_cast<float>(Origin.X), static_cast<float>(Origin.X + BrickSize - 1)),
+						FMath::Clamp(Impulse.Center.Y, static_cast<float>(Origin.Y), static_cast<float>(Origin.Y + BrickSize - 1)),
+						FMath::Clamp(Impulse.Center.Z, static_cast<float>(Origin.Z), static_cast<float>(Origin.Z + BrickSize - 1)));
+					if (FVector3f::DistSquared(Closest, Impulse.Center) >= FMath::Square(Impulse.Radius))
+					{
+						continue;
+					}
+
+					bool bNearSmoke = HoldsSmoke(Brick);
+					for (int32 Face = 0; Face < NumFaces && !bNearSmoke; ++Face)
+					{
+						bNearSmoke = HoldsSmoke(Brick + FaceOffsets[Face]);
+					}
+					if (!bNearSmoke)
+					{
+						continue;
+					}
+					bTouchedSmoke = true;
+
+					const int32 Slot = FindOrAddSlot(Brick);
+					if (!SlotAwake[Slot])
+					{
+						SlotAwake[Slot] = true;
+						++NumAwake;
+					}
+
+					// Rows of four voxels along X at once
+					for (int32 Z = 0; Z < BrickSize; ++Z)
+					{
+						const VectorRegister4Float OffsetZ = VectorSetFloat1(static_cast<float>(Origin.Z + Z) - Impulse.Center.Z);
+						for (int32 Y = 0; Y < BrickSize; ++Y)
+						{
+							const VectorRegister4Float OffsetY = VectorSetFloat1(static_cast<float>(Origin.Y + Y) - Impulse.Center.Y);
+							const VectorRegister4Float DistanceYZ = VectorMultiplyAdd(OffsetY, OffsetY, VectorMultiply(OffsetZ, OffsetZ));
+							for (int32 X = 0; X < BrickSize; X += 4)
+							{
+								const VectorRegister4Float OffsetX = VectorSubtract(VectorAdd(VectorSetFloat1(static_cast<float>(Origin.X + X)), LaneOffsets), CenterX);
+								const VectorRegister4Float Distance = VectorSqrt(VectorMultiplyAdd(OffsetX, OffsetX, DistanceYZ));
+								const VectorRegister4Float Weight = VectorMax(VectorSubtract(One, VectorMultiply(Distance, InvRadius)), Zero);
+
+								// Near the centre the offset vanishes along with the radial push
+								const VectorRegister4Float RadialScale = VectorDivide(RadialSpeed, VectorMax(Distance, MinDistance));
+								const VectorRegister4Float Offsets[3] = { OffsetX, OffsetY, OffsetZ };
+
+								const int32 Index = Slot * BrickVoxels + GetLocalIndex(X, Y, Z);
+								for (int32 Axis = 0; Axis < 3; ++Axis)
+								{
+									float* AxisVelocity = Velocity[Axis].GetData() + Index;
+									const VectorRegister4Float Current = VectorLoad(AxisVelocity);
+									const VectorRegister4Float Target = VectorMultiplyAdd(Offsets[Axis], RadialScale, ImpulseVelocity[Axis]);
+									VectorStore(VectorMultiplyAdd(VectorSubtract(Target, Current), Weight, Current), AxisVelocity);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+
+		if (bTouchedSmoke)
+		{
+			MaxFieldSpeed = FMath::Max(MaxFieldSpeed, Impulse.Velocity.Size() + FMath::Abs(Impulse.RadialSpeed));
+		}
+	}
+
+	PendingImpulses.Reset();
+}
+
+void FSmokeSimulation::ProjectVelocity(const FSmokeBrickGrid& Cells)
+{
+	if (AwakeSlots.Num() == 0)
+	{
+		return;
+	}
+
+	// Air only couples through the faces of touching bricks, so every cluster of them is projected over its own
+	// box. Puffs far apart do not solve the still air between them.
+	GroupAwakeClusters();
+
+	int64 BudgetVoxels = MaxProjectionVoxels;
+	float ProjectedMaxSpeed = 0.0f;
+	bool bProjectedAll = true;
+	for (int32 Cluster = 0; Cluster + 1 < ClusterStarts.Num(); ++Cluster)
+	{
+		const TConstArrayView<int32> Slots(ClusterSlots.GetData() + ClusterStarts[Cluster], ClusterStarts[Cluster + 1] - ClusterStarts[Cluster]);
+
+		FIntVector MinBrick = SlotBricks[Slots[0]];
+		FIntVector MaxBrick = MinBrick;
+		for (const int32 Slot : Slots)
+		{
+			MinBrick = MinBrick.ComponentMin(SlotBricks[Slot]);
+			MaxBrick = MaxBrick.ComponentMax(SlotBricks[Slot]);
+		}
+
+		// Smaller clusters after one that does not fit may still fit
+		const FIntVector Size = (MaxBrick - MinBrick + FIntVector(1)) * BrickSize;
+		const int64 NumVoxels = static_cast<int64>(Size.X) * Size.Y * Size.Z;
+		if (NumVoxels > BudgetVoxels)
+		{
+			if (Stats.PressureSkippedBoxes == 0)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("VolumetricSmoke: Pressure budget of %lld voxels per step spent, a box of %lld voxels over %d bricks is advected without projection"),
+					MaxProjectionVoxels, NumVoxels, Slots.Num());
+			}
+			++Stats.PressureSkippedBoxes;
+			bProjectedAll = false;
+			continue;
+		}
+
+		BudgetVoxels -= NumVoxels;
+		ProjectedMaxSpeed = FMath::Max(ProjectedMaxSpeed, ProjectBox(Cells, Slots, MinBrick * BrickSize, Size));
+	}
+
+	// Sleeping bricks hold no velocity, so the awake ones bound the field. Skipped clusters keep the old bound.
+	MaxFieldSpeed = bProjectedAll ? ProjectedMaxSpeed : FMath::Max(MaxFieldSpeed, ProjectedMaxSpeed);
+}
+
+void FSmokeSimulation::GroupAwakeClusters()
+{
+	ClusterSlots.Reset();
+	ClusterStarts.Reset();
+	SlotClustered.Reset();
+	SlotClustered.SetNumZeroed(SlotBricks.Num());
+
+	for (const int32 Seed : AwakeSlots)
+	{
+		if (SlotClustered[Seed])
+		{
+			continue;
+		}
+
+		// Breadth first over face neighbours, the cluster's own slots are the queue
+		const int32 Start = ClusterSlots.Num();
+		ClusterStarts.Add(Start);
+		SlotClustered[Seed] = true;
+		ClusterSlots.Add(Seed);
+		for (int32 Next = Start; Next < ClusterSlots.Num(); ++Next)
+		{
+			const FIntVector Brick = SlotBricks[ClusterSlots[Next]];
+			for (int32 Face = 0; Face < NumFaces; ++Face)
+			{
+				const FIntVector Neighbour = Brick + FaceOffsets[Face];
+				if (Neighbour.GetMin() < 0 || Neighbour.GetMax() >= BricksPerAxis)
+				{
+					continue;
+				}
+
+				const int32 NeighbourSlot = BrickSlots[Neighbour.X + Neighbour.Y * BricksPerAxis + Neighbour.Z * BricksPerAxis * BricksPerAxis];
+				if (NeighbourSlot != INDEX_NONE && SlotAwake[NeighbourSlot] && !SlotClustered[NeighbourSlot])
+				{
+					SlotClustered[NeighbourSlot] = true;
+					ClusterSlots.Add(NeighbourSlot);
+				}
+			}
+		}
+	}
+	ClusterStarts.Add(ClusterSlots.Num());
+}
+
+float FSmokeSimulation::ProjectBox(const FSmokeBrickGrid& Cells, TConstArrayView<int32> Slots, const FIntVector& Origin, const FIntVector& Size)
+{
+	// Air between the bricks, and beyond the grid, moves with the wind
+	PressureSolver.Resize(Size);
+	ParallelFor(Size.Z, [this, &Cells, Size, Origin](int32 Z)
+	{
+		for (int32 Y = 0; Y < Size.Y; ++Y)
+		{
+			for (int32 X = 0; X < Size.X; ++X)
+			{
+				const FIntVector Coord = Origin + FIntVector(X, Y, Z);
+				const int32 SolverIndex = PressureSolver.GetIndex(X, Y, Z);
+				const bool bInGrid = Coord.GetMax() < Resolution;
+
+				FVector3f CellVelocity = Wind;
+				if (bInGrid)
+				{
+					const int32 Slot = BrickSlots[(Coord.X >> FSmokeVoxelBrick::Shift) + (Coord.Y >> FSmokeVoxelBrick::Shift) * BricksPerAxis + (Coord.Z >> FSmokeVoxelBrick::Shift) * BricksPerAxis * BricksPerAxis];
+					if (Slot != INDEX_NONE)
+					{
+						const int32 Index = Slot * BrickVoxels + FSmokeVoxelBrick::GetLocalIndex(Coord);
+						CellVelocity += FVector3f(Velocity[0][Index], Velocity[1][Index], Velocity[2][Index]);
+					}
+				}
+
+				PressureSolver.Fluid[SolverIndex] = !bInGrid || Cells.GetCell(Coord) != ESmokeVoxelCell::Blocked;
+				for (int32 Axis = 0; Axis < 3; ++Axis)
+				{
+					PressureSolver.Velocity[Axis][SolverIndex] = CellVelocity[Axis];
+				}
+			}
+		}
+	});
+
+	const FSmokePressureStats& PressureStats = PressureSolver.Project(Settings.Pressure);
+
+	// Back into the cluster's bricks, the wind is kept apart. What the projection did to the air between them is lost.
+	TArray<float, TInlineAllocator<256>> SlotMaxSpeed;
+	SlotMaxSpeed.SetNumZeroed(Slots.Num());
+	ParallelFor(Slots.Num(), [this, Slots, Origin, &SlotMaxSpeed](int32 ClusterIndex)
+	{
+		const int32 Slot = Slots[ClusterIndex];
+		const FIntVector BrickOrigin = SlotBricks[Slot] * BrickSize;
+		float MaxSpeedSquared = 0.0f;
+		for (int32 Local = 0; Local < BrickVoxels; ++Local)
+		{
+			const FIntVector Cell = BrickOrigin - Origin + FIntVector(Local & FSmokeVoxelBrick::Mask, (Local >> FSmokeVoxelBrick::Shift) & FSmokeVoxelBrick::Mask, Local >> (2 * FSmokeVoxelBrick::Shift));
+			const int32 SolverIndex = PressureSolver.GetIndex(Cell.X, Cell.Y, Cell.Z);
+			const int32 Index = Slot * BrickVoxels + Local;
+			FVector3f FieldVelocity;
+			for (int32 Axis = 0; Axis < 3; ++Axis)
+			{
+				FieldVelocity[Axis] = PressureSolver.Velocity[Axis][SolverIndex] - Wind[Axis];
+				Velocity[Axis][Index] = FieldVelocity[Axis];
+			}
+			MaxSpeedSquared = FMath::Max(MaxSpeedSquared, FieldVelocity.SizeSquared());
+		}
+		SlotMaxSpeed[ClusterIndex] = FMath::Sqrt(MaxSpeedSquared);
+	});
+
+	++Stats.PressureSolves;
+	Stats.PressureCycles += PressureStats.Cycles;
+	Stats.PressureConvergenceRate = PressureStats.ConvergenceRate;
+	Stats.PressureSeconds += PressureStats.SolveSeconds;
+
+	float MaxSpeed = 0.0f;
+	for (const float Speed : SlotMaxSpeed)
+	{
+		MaxSpeed = FMath::Max(MaxSpeed, Speed);
+	}
+	return MaxSpeed;
+}
+
+void FSmokeSimulation::AdvectBrick(const FSmokeBrickGrid& Cells, int32 Slot, float StepSeconds, float MaxDisplacement, float DampingFactor)
+{
+	const FIntVector Origin = SlotBricks[Slot] * BrickSize;
+	const int32 FirstIndex = Slot * BrickVoxels;
+	float* Next = &NextDensity[FirstIndex];
+
+	for (int32 Local = 0; Local < BrickVoxels; ++Local)
+	{
+		const int32 Index = FirstIndex + Local;
+		const FIntVector Coord = Origin + FIntVector(Local & FSmokeVoxelBrick::Mask, (Local >> FSmokeVoxelBrick::Shift) & FSmokeVoxelBrick::Mask, Local >> (2 * FSmokeVoxelBrick::Shift));
+		if (Coord.GetMax() >= Resolution || Cells.GetCell(Coord) == ESmokeVoxelCell::Blocked)
+		{
+			Next[Local] = 0.0f;
+			continue;
+		}
+
+		// Trace back to where the air in this voxel came from and take the density there. Never reads further
+		// than the step could carry smoke, and never extrapolates, hence stable at any step length.
+		const FVector3f VoxelVelocity(Velocity[0][Index], Velocity[1][Index], Velocity[2][Index]);
+		const FVector3f Displacement = ((Wind + VoxelVelocity) * StepSeconds).GetClampedToMaxSize(MaxDisplacement);
+		Next[Local] = Displacement.IsNearlyZero() ? Density[Index] : SampleDensity(Cells, FVector3f(Coord) - Displacement, Density[Index]);
+
+		for (TArray<float>& Axis : Velocity)
+		{
+			Axis[Index] *= DampingFactor;
+		}
+	}
+
+	UpdateMaxima(Slot, Next);
+}
+
+float FSmokeSimulation::SampleDensity(const FSmokeBrickGrid& Cells, const FVector3f& Position, float Fallback) const
+{
+	const FIntVector Base(FMath::FloorToInt(Position.X), FMath::FloorToInt(Position.Y), FMath::FloorToInt(Position.Z));
+	const FVector3f Fraction = Position - FVector3f(Base);
+
+	// Blocked corners hold no smoke and are left out, so smoke along a wall does not thin out. Corners outside
+	// the grid count as empty air, smoke blown out of the grid is gone.
+	float WeightedDensity = 0.0f;
+	float TotalWeight = 0.0f;
+	for (int32 Corner = 0; Corner < 8; ++Corner)
+	{
+		const FIntVector Offset(Corner & 1, (Corner >> 1) & 1, Corner >> 2);
+		const float Weight = (Offset.X ? Fraction.X : 1.0f - Fraction.X)
+			* (Offset.Y ? Fraction.Y : 1.0f - Fraction.Y)
+			* (Offset.Z ? Fraction.Z : 1.0f - Fraction.Z);
+		if (Weight <= 0.0f)
+		{
+			continue;
+		}
+
+		const FIntVector Coord = Base + Offset;
+		const bool bInGrid = Coord.GetMin() >= 0 && Coord.GetMax() < Resolution;
+		if (bInGrid && Cells.GetCell(Coord) == ESmokeVoxelCell::Blocked)
+		{
+			continue;
+		}
+
+		WeightedDensity += Weight * GetDensity(Coord);
+		TotalWeight += Weight;
+	}
+
+	return TotalWeight > 0.0f ? WeightedDensity / TotalWeight : Fallback;
+}
+
+void FSmokeSimulation::WakeAround(int32 Slot, int32 Radius)
+{
+	// By value, waking allocates slots and may move SlotBricks
+	const FIntVector Center = SlotBricks[Slot];
+	for (int32 OffsetZ = -Radius; OffsetZ <= Radius; ++OffsetZ)
+	{
+		for (int32 OffsetY = -Radius; OffsetY <= Radius; ++OffsetY)
+		{
+			for (int32 OffsetX = -Radius; OffsetX <= Radius; ++OffsetX)
+			{
+				const FIntVector Neighbour = Center + FIntVector(OffsetX, OffsetY, OffsetZ);
+				if (Neighbour.GetMin() < 0 || Neighbour.GetMax() >= BricksPerAxis)
+				{
+					continue;
+				}
+
+				const int32 NeighbourSlot = FindOrAddSlot(Neighbour);
+				if (!SlotAwake[NeighbourSlot])
+				{
+					SlotAwake[NeighbourSlot] = true;
+					++NumAwake;
+				}
+			}
+		}
+	}
+}
+
+void FSmokeSimulation::UpdateBrick(const FSmokeBrickGrid& Cells, int32 Slot, float Alpha, float DecayFactor)
+{
+	// Gather the brick and its border. Open is 1 where smoke may flow: free voxels, and outside the grid, where the
+	// density is 0 so smoke escapes. Keep masks the voxels of the brick that hold smoke: free and inside the grid.
+	alignas(16) float Padded[PaddedVoxels];
+	alignas(16) float Open[PaddedVoxels];
+	alignas(16) float Keep[BrickVoxels];
+
+	const FIntVector Origin = SlotBricks[Slot] * BrickSize;
+	const float* Current = &Density[Slot * BrickVoxels];
+
+	for (int32 Z = 0; Z < PaddedSize; ++Z)
+	{
+		for (int32 Y = 0; Y < PaddedSize; ++Y)
+		{
+			for (int32 X = 0; X < PaddedSize; ++X)
+			{
+				const FIntVector Coord = Origin + FIntVector(X - 1, Y - 1, Z - 1);
+				const int32 PaddedIndex = GetPaddedIndex(X, Y, Z);
+
+				if (Coord.GetMin() < 0 || Coord.GetMax() >= Resolution)
+				{
+					Padded[PaddedIndex] = 0.0f;
+					Open[PaddedIndex] = 1.0f;
+					continue;
+				}
+
+				const bool bBlocked = Cells.GetCell(Coord) == ESmokeVoxelCell::Blocked;
+				const bool bInBrick = X >= 1 && X <= BrickSize && Y >= 1 && Y <= BrickSize && Z >= 1 && Z <= BrickSize;
+				Open[PaddedIndex] = bBlocked ? 0.0f : 1.0f;
+				Padded[PaddedIndex] = bBlocked ? 0.0f : (bInBrick ? Current[GetLocalIndex(X - 1, Y - 1, Z - 1)] : GetDensity(Coord));
+			}
+		}
+	}
+
+	for (int32 Local = 0; Local < BrickVoxels; ++Local)
+	{
+		const int32 X = Local & FSmokeVoxelBrick::Mask;
+		const int32 Y = (Local >> FSmokeVoxelBrick::Shift) & FSmokeVoxelBrick::Mask;
+		const int32 Z = Local >> (2 * FSmokeVoxelBrick::Shift);
+		const FIntVector Coord = Origin + FIntVector(X, Y, Z);
+		const bool bInGrid = Coord.GetMax() < Resolution;
+		Keep[Local] = bInGrid ? Open[GetPaddedIndex(X + 1, Y + 1, Z + 1)] : 0.0f;
+	}
+
+	// 7-point stencil, a row of the brick as two vectors of four.
+	// Next = (Centre + Alpha * sum(Open_n * (Neighbour_n - Centre))) * DecayFactor * Keep
+	const VectorRegister4Float AlphaVector = VectorSetFloat1(Alpha);
+	const VectorRegister4Float DecayVector = VectorSetFloat1(DecayFactor);
+	float* Next = &NextDensity[Slot * BrickVoxels];
+
+	for (int32 Z = 0; Z < BrickSize; ++Z)
+	{
+		for (int32 Y = 0; Y < BrickSize; ++Y)
+		{
+			for (int32 X = 0; X < BrickSize; X += 4)
+			{
+				const int32 PaddedIndex = GetPaddedIndex(X + 1, Y + 1, Z + 1);
+				const int32 Local = GetLocalIndex(X, Y, Z);
+
+				const VectorRegister4Float Centre = VectorLoad(Padded + PaddedIndex);
+				VectorRegister4Float Flux = VectorZeroFloat();
+				for (const int32 Offset : StencilOffsets)
+				{
+					const VectorRegister4Float Difference = VectorSubtract(VectorLoad(Padded + PaddedIndex + Offset), Centre);
+					Flux = VectorMultiplyAdd(VectorLoad(Open + PaddedIndex + Offset), Difference, Flux);
+				}
+
+				const VectorRegister4Float Diffused = VectorMultiplyAdd(AlphaVector, Flux, Centre);
+				VectorStore(VectorMultiply(VectorMultiply(Diffused, DecayVector), VectorLoad(Keep + Local)), Next + Local);
+			}
+		}
+	}
+
+	UpdateMaxima(Slot, Next);
+}
+
+void FSmokeSimulation::UpdateMaxima(int32 Slot, const float* Values)
+{
+	float MaxDensity = 0.0f;
+	float FaceMaxDensity[NumFaces] = {};
+
+	for (int32 Local = 0; Local < BrickVoxels; ++Local)
+	{
+		const float Value = Values[Local];
+		MaxDensity = FMath::Max(MaxDensity, Value);
+
+		const int32 X = Local & FSmokeVoxelBrick::Mask;
+		const int32 Y = (Local >> FSmokeVoxelBrick::Shift) & FSmokeVoxelBrick::Mask;
+		const int32 Z = Local >> (2 * FSmokeVoxelBrick::Shift);
+		const int32 Coords[3] = { X, Y, Z };
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			if (Coords[Axis] == 0)
+			{
+				FaceMaxDensity[Axis * 2] = FMath::Max(FaceMaxDensity[Axis * 2], Value);
+			}
+			else if (Coords[Axis] == BrickSize - 1)
+			{
+				FaceMaxDensity[Axis * 2 + 1] = FMath::Max(FaceMaxDensity[Axis * 2 + 1], Value);
+			}
+		}
+	}
+
+	SlotMaxDensity[Slot] = MaxDensity;
+	FMemory::Memcpy(&SlotFaceMaxDensity[Slot * NumFaces], FaceMaxDensity, sizeof(FaceMaxDensity));
+}
+
+int32 FSmokeSimulation::FindOrAddSlot(const FIntVector& BrickCoord)
+{
+	int32& Slot = BrickSlots[BrickCoord.X + BrickCoord.Y * BricksPerAxis + BrickCoord.Z * BricksPerAxis * BricksPerAxis];
+	if (Slot == INDEX_NONE)
+	{
+		Slot = SlotBricks.Add(BrickCoord);
+		Density.AddZeroed(BrickVoxels);
+		NextDensity.AddZeroed(BrickVoxels);
+		SlotMaxDensity.Add(0.0f);
+		SlotFaceMaxDensity.AddZeroed(NumFaces);
+		SlotAwake.Add(false);
+		SlotDirty.Add(false);
+		for (TArray<float>& Axis : Velocity)
+		{
+			Axis.AddZeroed(BrickVoxels);
+		}
+	}
+	return Slot;
+}
+
+float FSmokeSimulation::GetDensity(const FIntVector& VoxelCoord) const
+{
+	if (VoxelCoord.GetMin() < 0 || VoxelCoord.GetMax() >= Resolution)
+	{
+		return 0.0f;
+	}
+
+	const FIntVector BrickCoord(VoxelCoord.X >> FSmokeVoxelBrick::Shift, VoxelCoord.Y >> FSmokeVoxelBrick::Shift, VoxelCoord.Z >> FSmokeVoxelBrick::Shift);
+	const int32 Slot = BrickSlots[BrickCoord.X + BrickCoord.Y * BricksPerAxis + BrickCoord.Z * BricksPerAxis * BricksPerAxis];
+	return Slot != INDEX_NONE ? Density[Slot * BrickVoxels + FSmokeVoxelBrick::GetLocalIndex(VoxelCoord)] : 0.0f;
+}
+
+void FSmokeSimulation::WriteBack(FSmokeVolume& Volume, float ElapsedTime)
+{
+	TArray<int32, TInlineAllocator<64>> DirtySlots;
+	for (int32 Slot = 0; Slot < SlotBricks.Num(); ++Slot)
+	{
+		if (SlotDirty[Slot])
+		{
+			DirtySlots.Add(Slot);
+			SlotDirty[Slot] = false;
+		}
+	}
+
+	if (NewVoxelsPerSlot.Num() < DirtySlots.Num())
+	{
+		NewVoxelsPerSlot.SetNum(DirtySlots.Num());
+		EmptiedSlotsPerSlot.SetNum(DirtySlots.Num());
+	}
+
+	// Filled voxels are updated in place, each brick writes its own voxels' slots. Voxels the smoke spread into
+	// need new slots, so they are only collected here.
+	FSmokeFilledVoxels& SmokeVoxels = Volume.SmokeVoxels;
+	const FSmokeBrickGrid& Cells = Volume.VoxelBricks;
+	ParallelFor(DirtySlots.Num(), [this, &DirtySlots, &SmokeVoxels, &Cells, &Volume](int32 Index)
+	{
+		const int32 Slot = DirtySlots[Index];
+		const FIntVector Origin = SlotBricks[Slot] * BrickSize;
+		const float* Values = &Density[Slot * BrickVoxels];
+		TArray<int32>& NewVoxels = NewVoxelsPerSlot[Index];
+		NewVoxels.Reset();
+		TArray<int32>& EmptiedSlots = EmptiedSlotsPerSlot[Index];
+		EmptiedSlots.Reset();
+
+		// Sleeping bricks were zeroed, their filled voxels are kept no longer
+		const bool bAsleep = !SlotAwake[Slot];
+
+		for (int32 Local = 0; Local < BrickVoxels; ++Local)
+		{
+			const FIntVector Coord = Origin + FIntVector(Local & FSmokeVoxelBrick::Mask, (Local >> FSmokeVoxelBrick::Shift) & FSmokeVoxelBrick::Mask, Local >> (2 * FSmokeVoxelBrick::Shift));
+			if (Coord.GetMax() >= Resolution)
+			{
+				continue;
+			}
+
+			const int32 FilledSlot = Cells.GetFilledSlot(Coord);
+			if (FilledSlot != INDEX_NONE)
+			{
+				SmokeVoxels.Density.Set(FilledSlot, Values[Local]);
+				if (bAsleep)
+				{
+					EmptiedSlots.Add(FilledSlot);
+				}
+			}
+			else if (Values[Local] >= Settings.MinDensity && Cells.GetCell(Coord) != ESmokeVoxelCell::Blocked)
+			{
+				NewVoxels.Add(Volume.VoxelToIndex(Coord));
+			}
+		}
+	});
+
+	// Emptied voxels are freed from the highest slot down, so the last voxel moved into a freed slot is never one
+	// that is still to be freed
+	EmptiedSlots.Reset();
+	int32 NumNewVoxels = 0;
+	for (int32 Index = 0; Index < DirtySlots.Num(); ++Index)
+	{
+		// Densities were written in place, the scene proxy is sent the brick again
+		Volume.VoxelBricks.MarkChanged(SlotBricks[DirtySlots[Index]] * BrickSize);
+		EmptiedSlots.Append(EmptiedSlotsPerSlot[Index]);
+		NumNewVoxels += NewVoxelsPerSlot[Index].Num();
+	}
+	EmptiedSlots.Sort(TGreater<int32>());
+	for (const int32 FilledSlot : EmptiedSlots)
+	{
+		Volume.RemoveVoxel(FilledSlot);
+	}
+
+	// Filled voxels only lie in simulated bricks, so the slots grow to every voxel of them once the smoke outgrows them,
+	// rather than to the whole grid. That happens only after the smoke spread into new bricks.
+	if (SmokeVoxels.Num() + NumNewVoxels > SmokeVoxels.GetMax())
+	{
+		SmokeVoxels.Reserve(SlotBricks.Num() * BrickVoxels);
+	}
+
+	// New voxels start fading in now, in brick order
+	const int32 FirstNewSlot = SmokeVoxels.Num();
+	for (int32 Index = 0; Index < DirtySlots.Num(); ++Index)
+	{
+		for (const int32 VoxelIndex : NewVoxelsPerSlot[Index])
+		{
+			Volume.AddVoxel(VoxelIndex, GetDensity(Volume.IndexToVoxel(VoxelIndex)), ElapsedTime);
+		}
+	}
+	Volume.GenerateVoxelColors(FirstNewSlot);
+}
+
+SIZE_T FSmokeSimulation::GetAllocatedSize() const
+{
+	SIZE_T Size = BrickSlots.GetAllocatedSize() + SlotBricks.GetAllocatedSize() + Density.GetAllocatedSize() + NextDensity.GetAllocatedSize()
+		+ SlotMaxDensity.GetAllocatedSize() + SlotFaceMaxDensity.GetAllocatedSize() + SlotAwake.GetAllocatedSize() + SlotDirty.GetAllocatedSize()
+		+ AwakeSlots.GetAllocatedSize() + NewVoxelsPerSlot.GetAllocatedSize() + EmptiedSlotsPerSlot.GetAllocatedSize() + EmptiedSlots.GetAllocatedSize()
+		+ PendingImpulses.GetAllocatedSize() + PressureSolver.GetAllocatedSize();
+	for (const TArray<float>& Axis : Velocity)
+	{
+		Size += Axis.GetAllocatedSize();
+	}
+	for (const TArray<int32>& NewVoxels : NewVoxelsPerSlot)
+	{
+		Size += NewVoxels.GetAllocatedSize();
+	}
+	for (const TArray<int32>& Emptied : EmptiedSlotsPerSlot)
+	{
+		Size += Emptied.GetAllocatedSize();
+	}
+	return Size;
+}
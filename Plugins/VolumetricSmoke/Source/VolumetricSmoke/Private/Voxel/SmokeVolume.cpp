@@ -0,0 +1,710 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeVolume.h"
+
+#include "Async/ParallelFor.h"
+#include "Math/VectorRegister.h"
+#include "Voxel/SmokeGridTraversal.h"
+#include "Voxel/SmokeHash.h"
+#include "Voxel/SmokeScratchMemory.h"
+
+namespace
+{
+	/** Density floor for flood fill voxels far from the centre, so smoke poured down a corridor stays visible */
+	constexpr float MinFloodFillDensity = 0.1f;
+
+	/** Largest UVolumetricSmokeComponent::FloodFillVolumeScale */
+	constexpr float MaxFloodFillVolumeScale = 1.5f;
+
+	/** Voxels coloured per parallel batch. Flood fill steps usually add fewer and stay on the calling thread. */
+	constexpr int32 ColourBatchSize = 4096;
+
+	/** Bricks cleared per parallel batch by ClearSphere(), small blasts stay on the calling thread */
+	constexpr int32 ClearBatchSize = 16;
+
+	/** Bricks ClearSphere() lists on the stack, a blast across 5 bricks per axis. Only larger ones allocate. */
+	constexpr int32 ClearInlineBricks = 128;
+
+	/**
+	 * Bricks a fill of Capacity voxels is expected to touch. A compact fill touches about twice as many bricks as it
+	 * fills, plus the shell of deferred and blocked voxels around it. More are paged in as needed.
+	 */
+	int32 GetExpectedBrickCount(int32 Capacity)
+	{
+		return 2 * FMath::DivideAndRoundUp(Capacity, FSmokeVoxelBrick::NumVoxels) + 64;
+	}
+
+	/** Flood fill checks the clock every this many expanded cells */
+	constexpr int32 FloodFillTimeCheckInterval = 32;
+
+	/**
+	 * Most cells a flood fill of Capacity voxels can defer. A cell is deferred at most once and only next to a
+	 * filled one, so there are no more than six per filled voxel and no more than the grid holds.
+	 */
+	int32 GetFloodDeferredCapacity(int32 Resolution, int32 Capacity)
+	{
+		return static_cast<int32>(FMath::Min(6 * static_cast<int64>(Capacity), static_cast<int64>(FMath::Cube(Resolution))));
+	}
+
+	const FIntVector FloodFillNeighbours[6] =
+	{
+		FIntVector(-1, 0, 0), FIntVector(1, 0, 0),
+		FIntVector(0, -1, 0), FIntVector(0, 1, 0),
+		FIntVector(0, 0, -1), FIntVector(0, 0, 1)
+	};
+}
+
+void FSmokeVolume::Reset(int32 InResolution, ESmokeChannelFormat DensityFormat, double InSpawnTime)
+{
+	Resolution = InResolution;
+	SpawnTime = InSpawnTime;
+
+	// Clear the voxel grid, bricks are allocated again as voxels get written
+	VoxelBricks.Reset(InResolution);
+	SmokeVoxels.SetFormats(DensityFormat);
+
+	FloodQueue.Reset();
+	FloodDeferred.Reset();
+	FloodQueueHead = 0;
+	FloodRoundEnd = 0;
+	FloodRound = 0;
+	FloodFillCapacity = 0;
+	bFloodFillRunning = false;
+
+	Simulation.Reset();
+}
+
+void FSmokeVolume::Preallocate(int32 MaxResolution, ESmokeChannelFormat DensityFormat)
+{
+	// Sized for the largest fill, a flood fill at the largest volume scale also holds a whole sphere
+	const int32 Capacity = GetFloodFillCapacity(MaxResolution, MaxFloodFillVolumeScale);
+
+	// Brick pages for what such a fill is expected to touch, obstacles and the smoke may page in more.
+	// Smoke a simulation spreads past the fill gets slots with the bricks it reaches, see FSmokeSimulation::WriteBack().
+	Reset(MaxResolution, DensityFormat, SpawnTime);
+	VoxelBricks.Reserve(GetExpectedBrickCount(Capacity));
+	SmokeVoxels.Reserve(Capacity);
+	FloodQueue.Reserve(Capacity);
+	FloodDeferred.Reserve(GetFloodDeferredCapacity(MaxResolution, Capacity));
+}
+
+void FSmokeVolume::Clear()
+{
+	Reset(Resolution, SmokeVoxels.Density.GetFormat(), SpawnTime);
+	Lifetime = 0.0f;
+	DissipationDuration = 0.0f;
+	SimulationSettings = FSmokeSimulationSettings();
+}
+
+int32 FSmokeVolume::GetFloodFillCapacity(int32 InResolution, float VolumeScale)
+{
+	const float RadiusInVoxels = InResolution * 0.5f;
+	return FMath::Min(FMath::Cube(InResolution),
+		FMath::CeilToInt(VolumeScale * (4.0f / 3.0f) * UE_PI * FMath::Cube(RadiusInVoxels)));
+}
+
+FSmokeFadeParams FSmokeVolume::GetFadeParams(double WorldTime, float SpawnSpeed) const
+{
+	FSmokeFadeParams FadeParams;
+	FadeParams.ElapsedTime = static_cast<float>(WorldTime - SpawnTime);
+	FadeParams.SpawnSpeed = SpawnSpeed;
+
+	if (Lifetime > 0.0f)
+	{
+		FadeParams.DissipationStart = Lifetime;
+		FadeParams.InvDissipationDuration = 1.0f / FMath::Max(DissipationDuration, UE_KINDA_SMALL_NUMBER);
+	}
+	return FadeParams;
+}
+
+void FSmokeVolume::AddVoxel(int32 Index, float Density, float ArrivalTime)
+{
+	// Voxels start fading in when they are filled, so a time-sliced flood fill fades in as it spreads.
+	// Filled voxels are appended in fill order.
+	const int32 Slot = SmokeVoxels.Add(Index, Density, ArrivalTime);
+	VoxelBricks.SetFilled(IndexToVoxel(Index), Slot);
+}
+
+void FSmokeVolume::RemoveVoxel(int32 Slot)
+{
+	// Free again, the smoke may spread back into it later
+	VoxelBricks.SetCell(IndexToVoxel(SmokeVoxels.VoxelIndex[Slot]), ESmokeVoxelCell::Free);
+
+	const int32 LastSlot = SmokeVoxels.Num() - 1;
+	SmokeVoxels.RemoveAtSwap(Slot);
+	if (Slot != LastSlot)
+	{
+		VoxelBricks.SetFilled(IndexToVoxel(SmokeVoxels.VoxelIndex[Slot]), Slot);
+	}
+}
+
+void FSmokeVolume::MarkBlocked(TConstArrayView<int32> Indices)
+{
+	for (const int32 Index : Indices)
+	{
+		VoxelBricks.SetCell(IndexToVoxel(Index), ESmokeVoxelCell::Blocked);
+	}
+}
+
+void FSmokeVolume::FillSphere(FSmokeScratchMemory& ScratchMemory)
+{
+	// In voxel units the sphere is centred on the grid with a radius of half the resolution
+	const float RadiusInVoxels = Resolution * 0.5f;
+	const FVector GridCenter(RadiusInVoxels);
+
+	TArray<TSmokeScratchArray<int32>>& SliceVoxels = ScratchMemory.SphereVoxelsPerSlice;
+	ScratchMemory.SetMinNumArrays(SliceVoxels, Resolution);
+
+	// Classification only reads the bricks, so slices run in parallel
+	ParallelFor(Resolution, [this, &SliceVoxels, RadiusInVoxels, GridCenter](int32 Z)
+	{
+		TSmokeScratchArray<int32>& Slice = SliceVoxels[Z];
+		Slice.Reset();
+
+		for (int32 Y = 0; Y < Resolution; ++Y)
+		{
+			for (int32 X = 0; X < Resolution; ++X)
+			{
+				const FIntVector Coord(X, Y, Z);
+
+				// Check if position is inside sphere
+				const float Distance = FVector::Dist(FVector(Coord), GridCenter);
+				if (Distance <= RadiusInVoxels && VoxelBricks.GetCell(Coord) != ESmokeVoxelCell::Blocked)
+				{
+					Slice.Add(VoxelToIndex(Coord));
+				}
+			}
+		}
+	});
+
+	// Appending allocates bricks and slots, in grid order
+	int32 NumVoxels = 0;
+	for (int32 Z = 0; Z < Resolution; ++Z)
+	{
+		NumVoxels += SliceVoxels[Z].Num();
+	}
+	SmokeVoxels.Reserve(SmokeVoxels.Num() + NumVoxels);
+
+	for (int32 Z = 0; Z < Resolution; ++Z)
+	{
+		for (const int32 Index : SliceVoxels[Z])
+		{
+			// Calculate density based on distance from center (1.0 at center, 0.0 at edge)
+			const float Distance = FVector::Dist(FVector(IndexToVoxel(Index)), GridCenter);
+			const float Density = 1.0f - FMath::Clamp(Distance / RadiusInVoxels, 0.0f, 1.0f);
+			AddVoxel(Index, Density, 0.0f);
+		}
+	}
+}
+
+bool FSmokeVolume::BeginFloodFill(int32 Capacity)
+{
+	FloodFillCapacity = Capacity;
+
+	// Warm-up: size everything the fill touches up front so StepFloodFill() never allocates.
+	VoxelBricks.Reserve(GetExpectedBrickCount(FloodFillCapacity));
+	SmokeVoxels.Reserve(FloodFillCapacity);
+	FloodQueue.Reset();
+	FloodQueue.Reserve(FloodFillCapacity);
+	FloodDeferred.Reset();
+	FloodDeferred.Reserve(GetFloodDeferredCapacity(Resolution, FloodFillCapacity));
+	FloodQueueHead = 0;
+	FloodRoundEnd = 0;
+	FloodRound = 0;
+	bFloodFillRunning = false;
+
+	const int32 SeedIndex = FindFloodFillSeed();
+	if (SeedIndex == INDEX_NONE || FloodFillCapacity <= 0)
+	{
+		return false;
+	}
+
+	AddVoxel(SeedIndex, 1.0f, 0.0f);
+	FloodQueue.Add(SeedIndex);
+	FloodRoundEnd = FloodQueue.Num();
+	bFloodFillRunning = true;
+	return true;
+}
+
+void FSmokeVolume::StepFloodFill(double BudgetSeconds, float ElapsedTime)
+{
+	const float RadiusInVoxels = Resolution * 0.5f;
+	const FVector GridCenter(RadiusInVoxels);
+	const double EndTime = FPlatformTime::Seconds() + BudgetSeconds;
+	const int32 FirstNewVoxel = SmokeVoxels.Num();
+
+	auto GetDistanceSquared = [&](int32 Index)
+	{
+		return FVector::DistSquared(FVector(IndexToVoxel(Index)), GridCenter);
+	};
+
+	// Arrival round drives density, so open-air smoke matches the sphere falloff and thins out down corridors
+	auto FillCell = [&](int32 Index, int32 Round)
+	{
+		AddVoxel(Index, FMath::Max(1.0f - Round / RadiusInVoxels, MinFloodFillDensity), ElapsedTime);
+		FloodQueue.Add(Index);
+
+		if (SmokeVoxels.Num() >= FloodFillCapacity)
+		{
+			bFloodFillRunning = false;
+		}
+	};
+
+	int32 ExpandedCells = 0;
+	while (bFloodFillRunning)
+	{
+		if (FloodQueueHead == FloodRoundEnd)
+		{
+			if (FloodQueueHead == FloodQueue.Num() && FloodDeferred.Num() == 0)
+			{
+				bFloodFillRunning = false;
+				break;
+			}
+
+			// Round finished: the fill radius grows by one voxel, admit deferred cells that now fall inside it
+			++FloodRound;
+			const double RoundRadiusSquared = FMath::Square(static_cast<double>(FloodRound));
+
+			int32 NumStillDeferred = 0;
+			for (const int32 DeferredIndex : FloodDeferred)
+			{
+				if (!bFloodFillRunning || GetDistanceSquared(DeferredIndex) > RoundRadiusSquared)
+				{
+					FloodDeferred[NumStillDeferred++] = DeferredIndex;
+				}
+				else
+				{
+					FillCell(DeferredIndex, FloodRound);
+				}
+			}
+			FloodDeferred.SetNum(NumStillDeferred, EAllowShrinking::No);
+
+			FloodRoundEnd = FloodQueue.Num();
+			continue;
+		}
+
+		const int32 CellIndex = FloodQueue[FloodQueueHead++];
+		const FIntVector Cell = IndexToVoxel(CellIndex);
+		const int32 NextRound = FloodRound + 1;
+		const double NextRoundRadiusSquared = FMath::Square(static_cast<double>(NextRound));
+
+		for (const FIntVector& Offset : FloodFillNeighbours)
+		{
+			const FIntVector Neighbour = Cell + Offset;
+			if (!IsValidVoxelCoord(Neighbour))
+			{
+				continue;
+			}
+
+			if (VoxelBricks.GetCell(Neighbour) != ESmokeVoxelCell::Free)
+			{
+				continue;
+			}
+
+			const int32 NeighbourIndex = VoxelToIndex(Neighbour);
+
+			// Plain 6-connected BFS grows an octahedron in open air, gating on euclidean distance keeps it round
+			if (GetDistanceSquared(NeighbourIndex) <= NextRoundRadiusSquared)
+			{
+				FillCell(NeighbourIndex, NextRound);
+				if (!bFloodFillRunning)
+				{
+					break;
+				}
+			}
+			else
+			{
+				// Reserved for the worst case by BeginFloodFill(), growing here would allocate mid-fill
+				checkSlow(FloodDeferred.Num() < FloodDeferred.Max());
+				VoxelBricks.SetCell(Neighbour, ESmokeVoxelCell::Deferred);
+				FloodDeferred.Add(NeighbourIndex);
+			}
+		}
+
+		if (++ExpandedCells % FloodFillTimeCheckInterval == 0 && FPlatformTime::Seconds() >= EndTime)
+		{
+			break;
+		}
+	}
+
+	GenerateVoxelColors(FirstNewVoxel);
+}
+
+int32 FSmokeVolume::FindFloodFillSeed() const
+{
+	const FVector GridCenter(Resolution * 0.5f);
+	const FIntVector CenterVoxel(Resolution / 2);
+
+	int32 SeedIndex = INDEX_NONE;
+	double SeedDistanceSquared = TNumericLimits<double>::Max();
+
+	// The detonation point usually sits on the floor, so search shells of growing size around the centre voxel
+	// for the closest free voxel. A shell further out than the best distance found cannot hold a closer one.
+	for (int32 Shell = 0; Shell <= Resolution / 2 + 1; ++Shell)
+	{
+		if (SeedIndex != INDEX_NONE && FMath::Square(Shell - 1.0) > SeedDistanceSquared)
+		{
+			break;
+		}
+
+		for (int32 Z = -Shell; Z <= Shell; ++Z)
+		{
+			for (int32 Y = -Shell; Y <= Shell; ++Y)
+			{
+				// Inside the shell only the two X faces belong to it
+				const bool bOnFace = FMath::Abs(Z) == Shell || FMath::Abs(Y) == Shell;
+				const int32 XStep = bOnFace ? 1 : FMath::Max(2 * Shell, 1);
+
+				for (int32 X = -Shell; X <= Shell; X += XStep)
+				{
+					const FIntVector Coord = CenterVoxel + FIntVector(X, Y, Z);
+					if (!IsValidVoxelCoord(Coord) || VoxelBricks.GetCell(Coord) != ESmokeVoxelCell::Free)
+					{
+						continue;
+					}
+
+					const double DistanceSquared = FVector::DistSquared(FVector(Coord), GridCenter);
+					if (DistanceSquared < SeedDistanceSquared)
+					{
+						SeedIndex = VoxelToIndex(Coord);
+						SeedDistanceSquared = DistanceSquared;
+					}
+				}
+			}
+		}
+	}
+
+	return SeedIndex;
+}
+
+void FSmokeVolume::GenerateVoxelColors(int32 FirstSlot)
+{
+	const int32 NumSlots = SmokeVoxels.Num() - FirstSlot;
+	if (NumSlots <= 0)
+	{
+		return;
+	}
+
+	// Every voxel only writes its own slot, so batches are independent
+	const int32 NumBatches = FMath::DivideAndRoundUp(NumSlots, ColourBatchSize);
+	ParallelFor(NumBatches, [this, FirstSlot](int32 Batch)
+	{
+		const int32 BeginSlot = FirstSlot + Batch * ColourBatchSize;
+		const int32 EndSlot = FMath::Min(BeginSlot + ColourBatchSize, SmokeVoxels.Num());
+
+		for (int32 Slot = BeginSlot; Slot < EndSlot; ++Slot)
+		{
+			if (SmokeVoxels.Density.Get(Slot) > 0.0f)
+			{
+				// One hash per voxel, chained for the other components
+				const uint32 RedHash = SmokeHash::Hash(Seed, static_cast<uint32>(SmokeVoxels.VoxelIndex[Slot]));
+				const uint32 GreenHash = SmokeHash::Pcg(RedHash);
+				const uint32 BlueHash = SmokeHash::Pcg(GreenHash);
+				SmokeVoxels.Colour[Slot] = FColor(
+					static_cast<uint8>(SmokeHash::ToRange(RedHash, 50, 255)),
+					static_cast<uint8>(SmokeHash::ToRange(GreenHash, 50, 255)),
+					static_cast<uint8>(SmokeHash::ToRange(BlueHash, 50, 255)),
+					255);
+			}
+			else
+			{
+				SmokeVoxels.Colour[Slot] = FColor::Black;
+			}
+		}
+	}, NumBatches == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+}
+
+void FSmokeVolume::StepSimulation(float DeltaTime, float ElapsedTime)
+{
+	if (!SimulationSettings.IsEnabled() || bFloodFillRunning)
+	{
+		return;
+	}
+
+	if (!Simulation.IsInitialized())
+	{
+		Simulation.Initialize(*this, SimulationSettings);
+	}
+	Simulation.Advance(*this, DeltaTime, ElapsedTime);
+}
+
+FSmokeCarveResult FSmokeVolume::CarveRay(const FVector3f& Start, const FVector3f& End, float RegrowTime)
+{
+	FSmokeCarveResult Result;
+
+	// Bricks are convex, so the walk leaves each one for good and the brick lookup is only redone on crossings
+	FIntVector BrickCoord(INDEX_NONE);
+	FSmokeVoxelBrick* Brick = nullptr;
+	bool bBrickTouched = false;
+
+	SmokeGridTraversal::Traverse(Start, End, Resolution, [&](const FIntVector& VoxelCoord, float, float)
+	{
+		const FIntVector VoxelBrickCoord(VoxelCoord.X >> FSmokeVoxelBrick::Shift, VoxelCoord.Y >> FSmokeVoxelBrick::Shift, VoxelCoord.Z >> FSmokeVoxelBrick::Shift);
+		if (VoxelBrickCoord != BrickCoord)
+		{
+			BrickCoord = VoxelBrickCoord;
+			Brick = VoxelBricks.FindBrick(VoxelCoord);
+			bBrickTouched = false;
+		}
+
+		const int32 LocalIndex = FSmokeVoxelBrick::GetLocalIndex(VoxelCoord);
+		if (!Brick || Brick->Cells[LocalIndex] != ESmokeVoxelCell::Filled)
+		{
+			return true;
+		}
+
+		// Voxels still hidden by an earlier carve only have their regrowth pushed back
+		const int32 Slot = Brick->Slots[LocalIndex];
+		if (SmokeVoxels.ArrivalTime.Get(Slot) < RegrowTime)
+		{
+			SmokeVoxels.ArrivalTime.Set(Slot, RegrowTime);
+			++Result.ClearedVoxels;
+			if (!bBrickTouched)
+			{
+				bBrickTouched = true;
+				++Result.TouchedBricks;
+				VoxelBricks.MarkChanged(VoxelCoord);
+			}
+		}
+		return true;
+	});
+
+	return Result;
+}
+
+FSmokeClearResult FSmokeVolume::ClearSphere(const FVector3f& Center, float Radius, float RefillStart, float RefillSeconds)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	FSmokeClearResult Result;
+
+	if (Radius <= 0.0f || Resolution == 0)
+	{
+		return Result;
+	}
+
+	// Allocated bricks whose box overlaps the sphere, the others hold no smoke
+	const int32 MaxBrickCoord = (Resolution - 1) >> FSmokeVoxelBrick::Shift;
+	FIntVector MinBrick;
+	FIntVector MaxBrick;
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		MinBrick[Axis] = FMath::Clamp(FMath::FloorToInt32(Center[Axis] - Radius) >> FSmokeVoxelBrick::Shift, 0, MaxBrickCoord);
+		MaxBrick[Axis] = FMath::Clamp(FMath::FloorToInt32(Center[Axis] + Radius) >> FSmokeVoxelBrick::Shift, 0, MaxBrickCoord);
+	}
+
+	TArray<FIntVector, TInlineAllocator<ClearInlineBricks>> BrickOrigins;
+	for (int32 Z = MinBrick.Z; Z <= MaxBrick.Z; ++Z)
+	{
+		for (int32 Y = MinBrick.Y; Y <= MaxBrick.Y; ++Y)
+		{
+			for (int32 X = MinBrick.X; X <= MaxBrick.X; ++X)
+			{
+				const FIntVector Origin(X << FSmokeVoxelBrick::Shift, Y << FSmokeVoxelBrick::Shift, Z << FSmokeVoxelBrick::Shift);
+				const FBox3f BrickBox(FVector3f(Origin), FVector3f(Origin + FIntVector(FSmokeVoxelBrick::Mask)));
+				if (BrickBox.ComputeSquaredDistanceToPoint(Center) < Radius * Radius && VoxelBricks.FindBrick(Origin))
+				{
+					BrickOrigins.Add(Origin);
+				}
+			}
+		}
+	}
+
+	Result.ScannedBricks = BrickOrigins.Num();
+	TArray<int32, TInlineAllocator<ClearInlineBricks>> ClearedPerBrick;
+	ClearedPerBrick.SetNumZeroed(BrickOrigins.Num());
+
+	const float RefillPerVoxel = RefillSeconds / Radius;
+	ParallelFor(BrickOrigins.Num(), [this, &BrickOrigins, &ClearedPerBrick, Center, Radius, RefillStart, RefillPerVoxel](int32 BrickIndex)
+	{
+		const FIntVector& Origin = BrickOrigins[BrickIndex];
+		const FSmokeVoxelBrick& Brick = *VoxelBricks.FindBrick(Origin);
+
+		// Regrowth time of every voxel of the brick, lowest float outside the sphere so it never wins
+		alignas(16) float RegrowTimes[FSmokeVoxelBrick::NumVoxels];
+		const VectorRegister4Float LaneOffsets = MakeVectorRegisterFloat(0.0f, 1.0f, 2.0f, 3.0f);
+		const VectorRegister4Float RadiusSquared = VectorSetFloat1(Radius * Radius);
+		const VectorRegister4Float RadiusVector = VectorSetFloat1(Radius);
+		const VectorRegister4Float Start = VectorSetFloat1(RefillStart);
+		const VectorRegister4Float PerVoxel = VectorSetFloat1(RefillPerVoxel);
+		const VectorRegister4Float Outside = VectorSetFloat1(TNumericLimits<float>::Lowest());
+
+		for (int32 Z = 0; Z < FSmokeVoxelBrick::Size; ++Z)
+		{
+			const float DeltaZ = Origin.Z + Z - Center.Z;
+			for (int32 Y = 0; Y < FSmokeVoxelBrick::Size; ++Y)
+			{
+				const float DeltaY = Origin.Y + Y - Center.Y;
+				const VectorRegister4Float DistanceSquaredYZ = VectorSetFloat1(DeltaY * DeltaY + DeltaZ * DeltaZ);
+				float* RESTRICT Row = RegrowTimes + (Y << FSmokeVoxelBrick::Shift) + (Z << (2 * FSmokeVoxelBrick::Shift));
+
+				for (int32 X = 0; X < FSmokeVoxelBrick::Size; X += 4)
+				{
+					// The rim refills first, the front reaches the centre RefillSeconds later
+					const VectorRegister4Float DeltaX = VectorAdd(VectorSetFloat1(Origin.X + X - Center.X), LaneOffsets);
+					const VectorRegister4Float DistanceSquared = VectorMultiplyAdd(DeltaX, DeltaX, DistanceSquaredYZ);
+					const VectorRegister4Float Depth = VectorSubtract(RadiusVector, VectorSqrt(DistanceSquared));
+					const VectorRegister4Float RegrowTime = VectorMultiplyAdd(Depth, PerVoxel, Start);
+					VectorStoreAligned(VectorSelect(VectorCompareLT(DistanceSquared, RadiusSquared), RegrowTime, Outside), Row + X);
+				}
+			}
+		}
+
+		// Slots are scattered over the fill order, so the arrival times are written one by one
+		int32 Cleared = 0;
+		for (int32 LocalIndex = 0; LocalIndex < FSmokeVoxelBrick::NumVoxels; ++LocalIndex)
+		{
+			if (Brick.Cells[LocalIndex] == ESmokeVoxelCell::Filled && RegrowTimes[LocalIndex] > SmokeVoxels.ArrivalTime.Get(Brick.Slots[LocalIndex]))
+			{
+				SmokeVoxels.ArrivalTime.Set(Brick.Slots[LocalIndex], RegrowTimes[LocalIndex]);
+				++Cleared;
+			}
+		}
+		ClearedPerBrick[BrickIndex] = Cleared;
+	}, BrickOrigins.Num() <= ClearBatchSize ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+
+	// Marked here, the bricks of a page share their change mask
+	for (int32 BrickIndex = 0; BrickIndex < BrickOrigins.Num(); ++BrickIndex)
+	{
+		if (ClearedPerBrick[BrickIndex] > 0)
+		{
+			Result.ClearedVoxels += ClearedPerBrick[BrickIndex];
+			VoxelBricks.MarkChanged(BrickOrigins[BrickIndex]);
+		}
+	}
+	Result.Seconds = FPlatformTime::Seconds() - StartTime;
+	return Result;
+}
+
+float FSmokeVolume::IntegrateOpticalDepth(const FVector3f& Start, const FVector3f& End, float Extinction, float MaxOpticalDepth, const FSmokeFadeParams& FadeParams) const
+{
+	float OpticalDepth = 0.0f;
+
+	// Same brick caching as CarveRay()
+	FIntVector BrickCoord(INDEX_NONE);
+	const FSmokeVoxelBrick* Brick = nullptr;
+
+	SmokeGridTraversal::Traverse(Start, End, Resolution, [&](const FIntVector& VoxelCoord, float EnterT, float ExitT)
+	{
+		const FIntVector VoxelBrickCoord(VoxelCoord.X >> FSmokeVoxelBrick::Shift, VoxelCoord.Y >> FSmokeVoxelBrick::Shift, VoxelCoord.Z >> FSmokeVoxelBrick::Shift);
+		if (VoxelBrickCoord != BrickCoord)
+		{
+			BrickCoord = VoxelBrickCoord;
+			Brick = VoxelBricks.FindBrick(VoxelCoord);
+		}
+
+		const int32 LocalIndex = FSmokeVoxelBrick::GetLocalIndex(VoxelCoord);
+		if (!Brick || Brick->Cells[LocalIndex] != ESmokeVoxelCell::Filled)
+		{
+			return true;
+		}
+
+		const int32 Slot = Brick->Slots[LocalIndex];
+		const float Density = SmokeVoxels.Density.Get(Slot);
+		const float Visibility = SmokeFadeKernel::EvaluateVoxel(Density, SmokeVoxels.ArrivalTime.Get(Slot), FadeParams);
+		OpticalDepth += Extinction * (ExitT - EnterT) * Density * Visibility;
+		return OpticalDepth < MaxOpticalDepth;
+	});
+
+	return OpticalDepth;
+}
+
+void FSmokeVolume::SampleDensities(TConstArrayView<FVector> WorldPositions, const FSmokeGridTransform& WorldToGrid, TArrayView<float> OutDensities, const FSmokeFadeParams& FadeParams) const
+{
+	check(OutDensities.Num() >= WorldPositions.Num());
+
+	if (Resolution == 0 || SmokeVoxels.Num() == 0)
+	{
+		return;
+	}
+
+	// One fade pass covers the corners of PositionsPerPass positions, X alternating fastest within each position
+	constexpr int32 NumCorners = 8;
+	constexpr int32 PositionsPerPass = SmokeFadeKernel::VectorWidth / NumCorners;
+	alignas(16) float CornerDensity[SmokeFadeKernel::VectorWidth];
+	alignas(16) float CornerArrival[SmokeFadeKernel::VectorWidth];
+	alignas(16) float CornerVisibility[SmokeFadeKernel::VectorWidth];
+	alignas(16) float Fractions[PositionsPerPass][4];
+
+	// Nearby positions mostly share a brick, same caching as CarveRay()
+	FIntVector BrickCoord(INDEX_NONE);
+	const FSmokeVoxelBrick* Brick = nullptr;
+
+	for (int32 First = 0; First < WorldPositions.Num(); First += PositionsPerPass)
+	{
+		const int32 Count = FMath::Min(PositionsPerPass, WorldPositions.Num() - First);
+		FMemory::Memzero(CornerDensity);
+		FMemory::Memzero(CornerArrival);
+
+		for (int32 Index = 0; Index < Count; ++Index)
+		{
+			const VectorRegister4Float GridPosition = WorldToGrid.TransformPositionVector(WorldPositions[First + Index]);
+			const VectorRegister4Float Base = VectorFloor(GridPosition);
+
+			alignas(16) float BaseCoord[4];
+			VectorStoreAligned(Base, BaseCoord);
+
+			// Positions without a corner in the grid stay empty, this also keeps the conversion to int in range
+			const float MaxBase = static_cast<float>(Resolution);
+			if (!(BaseCoord[0] >= -1.0f && BaseCoord[0] < MaxBase && BaseCoord[1] >= -1.0f && BaseCoord[1] < MaxBase && BaseCoord[2] >= -1.0f && BaseCoord[2] < MaxBase))
+			{
+				VectorStoreAligned(VectorZeroFloat(), Fractions[Index]);
+				continue;
+			}
+			VectorStoreAligned(VectorSubtract(GridPosition, Base), Fractions[Index]);
+
+			const FIntVector BaseVoxel(static_cast<int32>(BaseCoord[0]), static_cast<int32>(BaseCoord[1]), static_cast<int32>(BaseCoord[2]));
+			for (int32 Corner = 0; Corner < NumCorners; ++Corner)
+			{
+				const FIntVector VoxelCoord = BaseVoxel + FIntVector(Corner & 1, (Corner >> 1) & 1, Corner >> 2);
+				if (!IsValidVoxelCoord(VoxelCoord))
+				{
+					continue;
+				}
+
+				const FIntVector VoxelBrickCoord(VoxelCoord.X >> FSmokeVoxelBrick::Shift, VoxelCoord.Y >> FSmokeVoxelBrick::Shift, VoxelCoord.Z >> FSmokeVoxelBrick::Shift);
+				if (VoxelBrickCoord != BrickCoord)
+				{
+					BrickCoord = VoxelBrickCoord;
+					Brick = VoxelBricks.FindBrick(VoxelCoord);
+				}
+
+				const int32 LocalIndex = FSmokeVoxelBrick::GetLocalIndex(VoxelCoord);
+				if (Brick && Brick->Cells[LocalIndex] == ESmokeVoxelCell::Filled)
+				{
+					const int32 Slot = Brick->Slots[LocalIndex];
+					CornerDensity[Index * NumCorners + Corner] = SmokeVoxels.Density.Get(Slot);
+					CornerArrival[Index * NumCorners + Corner] = SmokeVoxels.ArrivalTime.Get(Slot);
+				}
+			}
+		}
+
+		// Unused corners have no density and come out empty whatever their visibility
+		SmokeFadeKernel::Evaluate(CornerVisibility, CornerDensity, CornerArrival, SmokeFadeKernel::VectorWidth, FadeParams);
+
+		for (int32 Index = 0; Index < Count; ++Index)
+		{
+			// Weights of the four corners at Z and of the four at Z + 1
+			const float* Fraction = Fractions[Index];
+			const VectorRegister4Float WeightX = MakeVectorRegisterFloat(1.0f - Fraction[0], Fraction[0], 1.0f - Fraction[0], Fraction[0]);
+			const VectorRegister4Float WeightY = MakeVectorRegisterFloat(1.0f - Fraction[1], 1.0f - Fraction[1], Fraction[1], Fraction[1]);
+			const VectorRegister4Float WeightXY = VectorMultiply(WeightX, WeightY);
+			const VectorRegister4Float LowerWeight = VectorMultiply(WeightXY, VectorSetFloat1(1.0f - Fraction[2]));
+			const VectorRegister4Float UpperWeight = VectorMultiply(WeightXY, VectorSetFloat1(Fraction[2]));
+
+			const float* Density = CornerDensity + Index * NumCorners;
+			const float* Visibility = CornerVisibility + Index * NumCorners;
+			const VectorRegister4Float Lower = VectorMultiply(VectorLoadAligned(Density), VectorLoadAligned(Visibility));
+			const VectorRegister4Float Upper = VectorMultiply(VectorLoadAligned(Density + 4), VectorLoadAligned(Visibility + 4));
+
+			float Sample;
+			VectorStoreFloat1(VectorAdd(VectorDot4(Lower, LowerWeight), VectorDot4(Upper, UpperWeight)), &Sample);
+			OutDensities[First + Index] += Sample;
+		}
+	}
+}
+
+SIZE_T FSmokeVolume::GetAllocatedSize() const
+{
+	return VoxelBricks.GetAllocatedSize() + SmokeVoxels.GetAllocatedSize() + FloodQueue.GetAllocatedSize() + FloodDeferred.GetAllocatedSize()
+		+ Simulation.GetAllocatedSize();
+}
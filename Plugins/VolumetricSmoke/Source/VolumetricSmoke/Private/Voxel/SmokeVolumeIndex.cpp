@@ -0,0 +1,194 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeVolumeIndex.h"
+
+namespace
+{
+	/** Share of its size a leaf box is enlarged by on every side, how far a volume may move before it is reinserted */
+	constexpr double LeafMargin = 0.1;
+
+	/** Surface area of a box, the cost the insertion minimizes */
+	double GetSurfaceArea(const FBox& Box)
+	{
+		const FVector Size = Box.GetSize();
+		return 2.0 * (Size.X * Size.Y + Size.Y * Size.Z + Size.Z * Size.X);
+	}
+}
+
+void FSmokeVolumeIndex::Update(FSmokeVolume* Volume, const FBox& Bounds)
+{
+	FWriteScopeLock WriteLock(Lock);
+
+	const FBox EnlargedBox = Bounds.ExpandBy(Bounds.GetSize() * LeafMargin);
+
+	if (const int32* ExistingLeaf = Leaves.Find(Volume))
+	{
+		const int32 Leaf = *ExistingLeaf;
+		Nodes[Leaf].Bounds = Bounds;
+
+		// Small moves stay within the enlarged box and leave the tree alone
+		if (Nodes[Leaf].Box.IsInsideOrOn(Bounds.Min) && Nodes[Leaf].Box.IsInsideOrOn(Bounds.Max))
+		{
+			return;
+		}
+
+		RemoveLeaf(Leaf);
+		Nodes[Leaf].Box = EnlargedBox;
+		InsertLeaf(Leaf);
+		return;
+	}
+
+	const int32 Leaf = AllocateNode();
+	Nodes[Leaf].Box = EnlargedBox;
+	Nodes[Leaf].Bounds = Bounds;
+	Nodes[Leaf].Volume = Volume;
+	Leaves.Add(Volume, Leaf);
+	InsertLeaf(Leaf);
+}
+
+void FSmokeVolumeIndex::Remove(const FSmokeVolume* Volume)
+{
+	FWriteScopeLock WriteLock(Lock);
+
+	int32 Leaf = INDEX_NONE;
+	if (Leaves.RemoveAndCopyValue(Volume, Leaf))
+	{
+		RemoveLeaf(Leaf);
+		FreeNode(Leaf);
+	}
+}
+
+void FSmokeVolumeIndex::Reset()
+{
+	FWriteScopeLock WriteLock(Lock);
+
+	Nodes.Reset();
+	FreeNodes.Reset();
+	Leaves.Reset();
+	Root = INDEX_NONE;
+}
+
+int32 FSmokeVolumeIndex::Num() const
+{
+	FReadScopeLock ReadLock(Lock);
+	return Leaves.Num();
+}
+
+bool FSmokeVolumeIndex::GetBounds(const FSmokeVolume* Volume, FBox& OutBounds) const
+{
+	FReadScopeLock ReadLock(Lock);
+
+	const int32* Leaf = Leaves.Find(Volume);
+	if (!Leaf)
+	{
+		return false;
+	}
+
+	OutBounds = Nodes[*Leaf].Bounds;
+	return true;
+}
+
+SIZE_T FSmokeVolumeIndex::GetAllocatedSize() const
+{
+	FReadScopeLock ReadLock(Lock);
+	return Nodes.GetAllocatedSize() + FreeNodes.GetAllocatedSize() + Leaves.GetAllocatedSize();
+}
+
+int32 FSmokeVolumeIndex::AllocateNode()
+{
+	if (FreeNodes.Num() > 0)
+	{
+		const int32 NodeIndex = FreeNodes.Pop(EAllowShrinking::No);
+		Nodes[NodeIndex] = FNode();
+		return NodeIndex;
+	}
+	return Nodes.AddDefaulted();
+}
+
+void FSmokeVolumeIndex::FreeNode(int32 NodeIndex)
+{
+	Nodes[NodeIndex].Volume = nullptr;
+	FreeNodes.Add(NodeIndex);
+}
+
+void FSmokeVolumeIndex::InsertLeaf(int32 Leaf)
+{
+	if (Root == INDEX_NONE)
+	{
+		Root = Leaf;
+		Nodes[Leaf].Parent = INDEX_NONE;
+		return;
+	}
+
+	// Descend into the child whose box grows the least by taking the leaf in
+	const FBox LeafBox = Nodes[Leaf].Box;
+	int32 Sibling = Root;
+	while (!Nodes[Sibling].IsLeaf())
+	{
+		const FNode& Node = Nodes[Sibling];
+		const FBox& Box0 = Nodes[Node.Children[0]].Box;
+		const FBox& Box1 = Nodes[Node.Children[1]].Box;
+		const double Growth0 = GetSurfaceArea(Box0 + LeafBox) - GetSurfaceArea(Box0);
+		const double Growth1 = GetSurfaceArea(Box1 + LeafBox) - GetSurfaceArea(Box1);
+		Sibling = Growth0 <= Growth1 ? Node.Children[0] : Node.Children[1];
+	}
+
+	// A new inner node takes the sibling's place and holds both
+	const int32 OldParent = Nodes[Sibling].Parent;
+	const int32 NewParent = AllocateNode();
+	Nodes[NewParent].Parent = OldParent;
+	Nodes[NewParent].Children[0] = Sibling;
+	Nodes[NewParent].Children[1] = Leaf;
+	Nodes[Sibling].Parent = NewParent;
+	Nodes[Leaf].Parent = NewParent;
+
+	if (OldParent == INDEX_NONE)
+	{
+		Root = NewParent;
+	}
+	else
+	{
+		FNode& Parent = Nodes[OldParent];
+		Parent.Children[Parent.Children[0] == Sibling ? 0 : 1] = NewParent;
+	}
+
+	Refit(NewParent);
+}
+
+void FSmokeVolumeIndex::RemoveLeaf(int32 Leaf)
+{
+	if (Leaf == Root)
+	{
+		Root = INDEX_NONE;
+		return;
+	}
+
+	const int32 Parent = Nodes[Leaf].Parent;
+	const int32 GrandParent = Nodes[Parent].Parent;
+	const int32 Sibling = Nodes[Parent].Children[0] == Leaf ? Nodes[Parent].Children[1] : Nodes[Parent].Children[0];
+
+	Nodes[Sibling].Parent = GrandParent;
+	if (GrandParent == INDEX_NONE)
+	{
+		Root = Sibling;
+	}
+	else
+	{
+		FNode& Node = Nodes[GrandParent];
+		Node.Children[Node.Children[0] == Parent ? 0 : 1] = Sibling;
+		Refit(GrandParent);
+	}
+
+	FreeNode(Parent);
+	Nodes[Leaf].Parent = INDEX_NONE;
+}
+
+void FSmokeVolumeIndex::Refit(int32 NodeIndex)
+{
+	while (NodeIndex != INDEX_NONE)
+	{
+		FNode& Node = Nodes[NodeIndex];
+		Node.Box = Nodes[Node.Children[0]].Box + Nodes[Node.Children[1]].Box;
+		NodeIndex = Node.Parent;
+	}
+}
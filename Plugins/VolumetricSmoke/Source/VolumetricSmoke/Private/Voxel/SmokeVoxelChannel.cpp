@@ -0,0 +1,193 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Voxel/SmokeVoxelChannel.h"
+
+#include "Math/VectorRegister.h"
+
+namespace
+{
+	constexpr float UNorm8Scale = 255.0f;
+	constexpr float UNorm16Scale = 65535.0f;
+
+	uint8 EncodeUNorm8(float Value)
+	{
+		return static_cast<uint8>(FMath::Clamp(Value, 0.0f, 1.0f) * UNorm8Scale + 0.5f);
+	}
+
+	uint16 EncodeUNorm16(float Value)
+	{
+		return static_cast<uint16>(FMath::Clamp(Value, 0.0f, 1.0f) * UNorm16Scale + 0.5f);
+	}
+}
+
+void FSmokeVoxelChannel::SetFormat(ESmokeChannelFormat InFormat)
+{
+	Format = InFormat;
+	Reset();
+}
+
+int32 FSmokeVoxelChannel::GetBytesPerValue(ESmokeChannelFormat InFormat)
+{
+	switch (InFormat)
+	{
+	case ESmokeChannelFormat::Half16:
+	case ESmokeChannelFormat::UNorm16:
+		return sizeof(uint16);
+	case ESmokeChannelFormat::UNorm8:
+		return sizeof(uint8);
+	default:
+		return sizeof(float);
+	}
+}
+
+float FSmokeVoxelChannel::GetQuantum(ESmokeChannelFormat InFormat)
+{
+	switch (InFormat)
+	{
+	case ESmokeChannelFormat::Half16:
+		// 10 mantissa bits, values in [0.5, 1) are 2^-11 apart
+		return 1.0f / 2048.0f;
+	case ESmokeChannelFormat::UNorm16:
+		return 1.0f / UNorm16Scale;
+	case ESmokeChannelFormat::UNorm8:
+		return 1.0f / UNorm8Scale;
+	default:
+		return 0.0f;
+	}
+}
+
+float FSmokeVoxelChannel::Get(int32 Index) const
+{
+	checkSlow(Index >= 0 && Index < NumValues);
+
+	switch (Format)
+	{
+	case ESmokeChannelFormat::Half16:
+		return FPlatformMath::LoadHalf(reinterpret_cast<const uint16*>(Data.GetData()) + Index);
+	case ESmokeChannelFormat::UNorm16:
+		return reinterpret_cast<const uint16*>(Data.GetData())[Index] * (1.0f / UNorm16Scale);
+	case ESmokeChannelFormat::UNorm8:
+		return Data[Index] * (1.0f / UNorm8Scale);
+	default:
+		return reinterpret_cast<const float*>(Data.GetData())[Index];
+	}
+}
+
+void FSmokeVoxelChannel::Set(int32 Index, float Value)
+{
+	checkSlow(Index >= 0 && Index < NumValues);
+
+	switch (Format)
+	{
+	case ESmokeChannelFormat::Half16:
+		FPlatformMath::StoreHalf(reinterpret_cast<uint16*>(Data.GetData()) + Index, Value);
+		break;
+	case ESmokeChannelFormat::UNorm16:
+		reinterpret_cast<uint16*>(Data.GetData())[Index] = EncodeUNorm16(Value);
+		break;
+	case ESmokeChannelFormat::UNorm8:
+		Data[Index] = EncodeUNorm8(Value);
+		break;
+	default:
+		reinterpret_cast<float*>(Data.GetData())[Index] = Value;
+		break;
+	}
+}
+
+void FSmokeVoxelChannel::Load(int32 First, int32 Count, float* RESTRICT Out) const
+{
+	check(First >= 0 && Count >= 0 && First + Count <= NumValues);
+
+	// Four values per iteration, the remainder goes through Get()
+	const int32 VectorCount = Count & ~3;
+
+	switch (Format)
+	{
+	case ESmokeChannelFormat::Half16:
+	{
+		const uint16* Src = reinterpret_cast<const uint16*>(Data.GetData()) + First;
+		for (int32 Index = 0; Index < VectorCount; Index += 4)
+		{
+			FPlatformMath::VectorLoadHalf(Out + Index, Src + Index);
+		}
+		break;
+	}
+	case ESmokeChannelFormat::UNorm16:
+	{
+		const uint16* Src = reinterpret_cast<const uint16*>(Data.GetData()) + First;
+		for (int32 Index = 0; Index < VectorCount; Index += 4)
+		{
+			VectorStore(VectorLoadURGBA16N(Src + Index), Out + Index);
+		}
+		break;
+	}
+	case ESmokeChannelFormat::UNorm8:
+	{
+		const uint8* Src = Data.GetData() + First;
+		const VectorRegister4Float InvScale = VectorSetFloat1(1.0f / UNorm8Scale);
+		for (int32 Index = 0; Index < VectorCount; Index += 4)
+		{
+			VectorStore(VectorMultiply(VectorLoadByte4(Src + Index), InvScale), Out + Index);
+		}
+		break;
+	}
+	default:
+		FMemory::Memcpy(Out, reinterpret_cast<const float*>(Data.GetData()) + First, Count * sizeof(float));
+		return;
+	}
+
+	for (int32 Index = VectorCount; Index < Count; ++Index)
+	{
+		Out[Index] = Get(First + Index);
+	}
+}
+
+void FSmokeVoxelChannel::Store(int32 First, int32 Count, const float* RESTRICT In)
+{
+	check(First >= 0 && Count >= 0 && First + Count <= NumValues);
+
+	const int32 VectorCount = Count & ~3;
+
+	switch (Format)
+	{
+	case ESmokeChannelFormat::Half16:
+	{
+		uint16* Dst = reinterpret_cast<uint16*>(Data.GetData()) + First;
+		for (int32 Index = 0; Index < VectorCount; Index += 4)
+		{
+			FPlatformMath::VectorStoreHalf(Dst + Index, In + Index);
+		}
+		break;
+	}
+	case ESmokeChannelFormat::UNorm16:
+	{
+		uint16* Dst = reinterpret_cast<uint16*>(Data.GetData()) + First;
+		for (int32 Index = 0; Index < VectorCount; Index += 4)
+		{
+			VectorStoreURGBA16N(VectorLoad(In + Index), Dst + Index);
+		}
+		break;
+	}
+	case ESmokeChannelFormat::UNorm8:
+	{
+		// Same clamp, scale and round-half-up as EncodeUNorm8(), the byte store truncates
+		uint8* Dst = Data.GetData() + First;
+		const VectorRegister4Float Scale = VectorSetFloat1(UNorm8Scale);
+		const VectorRegister4Float Half = VectorSetFloat1(0.5f);
+		for (int32 Index = 0; Index < VectorCount; Index += 4)
+		{
+			const VectorRegister4Float Clamped = VectorMin(VectorMax(VectorLoad(In + Index), VectorZeroFloat()), VectorOneFloat());
+			VectorStoreByte4(VectorAdd(VectorMultiply(Clamped, Scale), Half), Dst + Index);
+		}
+		break;
+	}
+	default:
+		FMemory::Memcpy(reinterpret_cast<float*>(Data.GetData()) + First, In, Count * sizeof(float));
+		return;
+	}
+
+	for (int32 Index = VectorCount; Index < Count; ++Index)
+	{
+		Set(First + Index, In[Index]);
+	}
+}
@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "SmokeOccupancyBakeCommandlet.generated.h"
+
+/**
+ * Bakes the static collision of maps into USmokeOccupancyAsset assets, saved next to each other under
+ * /Game/SmokeOccupancy.
+ *
+ * UnrealEditor-Cmd Project.uproject -run=SmokeOccupancyBake [-Maps=/Game/Maps/A+/Game/Maps/B] [-CellSize=25]
+ *
+ * Without -Maps every map under /Game is baked. Only the persistent level and the sublevels loaded with it
+ * are baked, streamed world partition cells are not.
+ */
+UCLASS()
+class VOLUMETRICSMOKE_API USmokeOccupancyBakeCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+
+	USmokeOccupancyBakeCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+
+	/** Loads a map, bakes it and saves its occupancy asset. Returns false on failure. */
+	bool BakeMap(const FString& MapPackageName, float CellSize);
+};
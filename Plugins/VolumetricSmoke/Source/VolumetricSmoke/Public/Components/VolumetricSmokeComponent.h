@@ -7,10 +7,20 @@
 #include "PrimitiveSceneProxy.h"
 #include "PrimitiveViewRelevance.h"
 #include "Materials/MaterialInterface.h"
+#include "Voxel/SmokeFadeKernel.h"
+#include "Voxel/SmokeGridTransform.h"
+#include "Voxel/SmokeRenderData.h"
+#include "Voxel/SmokeSimulation.h"
+#include "Voxel/SmokeVoxelChannel.h"
 #include "VolumetricSmokeComponent.generated.h"
 
 // Forward declarations
 class FVolumetricSmokeSceneProxy;
+class FSmokeVolume;
+class USmokeVolumeSubsystem;
+struct FSmokeObstacleGrid;
+struct FSmokeScratchMemory;
+class UVolumetricSmokeComponent;
 
 /**
  * Simple voxel data structure
@@ -44,10 +54,74 @@ struct FSmokeVoxel
 	}
 };
 
+/**
+ * How the smoke volume is filled
+ */
+UENUM(BlueprintType)
+enum class ESmokeFillMode : uint8
+{
+	/** Fixed sphere, voxels overlapping geometry are left empty */
+	Sphere,
+	/** Breadth-first flood fill from the centre through free voxels, grown over several frames */
+	FloodFill
+};
+
+/**
+ * Counters from the last obstacle probe pass, to check how much work the octree culling saves
+ */
+USTRUCT(BlueprintType)
+struct FSmokeObstacleQueryStats
+{
+	GENERATED_BODY()
+
+	/** Bodies found by the broad-phase overlap over the whole volume */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 BroadPhaseBodies = 0;
+
+	/** Narrow-phase queries issued per octree level. Level 0 is the coarsest block, the last level is per voxel. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	TArray<int32> QueriesPerLevel;
+
+	/** Block edge length in voxels for each entry of QueriesPerLevel */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	TArray<int32> BlockSizePerLevel;
+
+	/** Sum of QueriesPerLevel */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 TotalQueries = 0;
+
+	/** Queries a per-voxel probe would have issued over the same region */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 DenseQueries = 0;
+
+	/** Voxels blocked by the level's baked static occupancy, looked up instead of queried */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 BakedStaticVoxels = 0;
+
+	/** With VolumetricSmoke.ValidateBakedOccupancy: voxels blocked by baked occupancy but free by live queries */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 ValidationBakedOnly = 0;
+
+	/** With VolumetricSmoke.ValidateBakedOccupancy: voxels blocked by live queries but free in baked occupancy */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 ValidationLiveOnly = 0;
+
+	/** Static voxel probes answered by the world's obstacle cache */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 CacheHits = 0;
+
+	/** Static voxel probes that had to query physics and were added to the obstacle cache */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 CacheMisses = 0;
+};
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FSmokeDissipatedDelegate, UVolumetricSmokeComponent*, SmokeComponent);
+
 /**
  * Component that generates and manages a sphere-shaped voxel grid for volumetric smoke
  * Place this on an empty actor to create a smoke volume
  * Inherits from UPrimitiveComponent to support rendering
+ * The voxel data lives in USmokeVolumeSubsystem, which also grows the flood fill of all volumes in one batch
  */
 UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
 class VOLUMETRICSMOKE_API UVolumetricSmokeComponent : public UPrimitiveComponent
@@ -58,27 +132,98 @@ public:
 	UVolumetricSmokeComponent(const FObjectInitializer& ObjectInitializer);
 
 	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
 	virtual void BeginPlay() override;
-	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
 
+	// USceneComponent interface
+	virtual void OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport = ETeleportType::None) override;
+
 	// UPrimitiveComponent interface
 	virtual FPrimitiveSceneProxy* CreateSceneProxy() override;
+	virtual void SendRenderDynamicData_Concurrent() override;
 	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
 	virtual void GetUsedMaterials(TArray<UMaterialInterface*>& OutMaterials, bool bGetDebugMaterials = false) const override;
 
 	/** Radius of the sphere in world units */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Voxel Settings", meta = (ClampMin = "10.0", ClampMax = "1000.0"))
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter = SetSphereRadius, Category = "Voxel Settings", meta = (ClampMin = "10.0", ClampMax = "1000.0"))
 	float SphereRadius = 500.0f;
 
 	/** Resolution of the voxel grid (voxels per axis) */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Voxel Settings", meta = (ClampMin = "8", ClampMax = "128"))
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter = SetVoxelResolution, Category = "Voxel Settings", meta = (ClampMin = "8", ClampMax = "256"))
 	int32 VoxelResolution = 16;
 
-	/** Resolution of the voxel grid (voxels per axis) */
+	/** Storage precision of voxel density. Rendering uses 8 bits of it, so UNorm8 is enough. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Voxel Settings")
+	ESmokeChannelFormat DensityFormat = ESmokeChannelFormat::UNorm8;
+
+	/** Fade-in rate of fully dense smoke. A voxel takes 3 / (SmokeSpawnSpeed * Density) seconds to fade in. */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Settings")
 	float SmokeSpawnSpeed = 1.0f;
 
+	/** How the volume is filled with smoke. Flood fill lets the smoke pour around walls instead of stopping at them. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Settings")
+	ESmokeFillMode FillMode = ESmokeFillMode::Sphere;
+
+	/** Total volume the flood fill may occupy, relative to the volume of a sphere of SphereRadius.
+	 * Smoke blocked by walls keeps this volume and pours into the free space around them. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Settings", meta = (ClampMin = "0.1", ClampMax = "1.5", EditCondition = "FillMode == ESmokeFillMode::FloodFill"))
+	float FloodFillVolumeScale = 1.0f;
+
+	/** Game thread time the flood fill may spend per frame */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Settings", meta = (ClampMin = "0.01", Units = "ms", EditCondition = "FillMode == ESmokeFillMode::FloodFill"))
+	float FloodFillBudgetMs = 0.5f;
+
+	/** Seconds after generation the smoke starts to dissipate. 0 keeps it until it is regenerated. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Settings", meta = (ClampMin = "0.0", Units = "s"))
+	float SmokeLifetime = 0.0f;
+
+	/** Seconds the smoke takes to fade out once its lifetime is over */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Settings", meta = (ClampMin = "0.0", Units = "s", EditCondition = "SmokeLifetime > 0"))
+	float DissipationDuration = 2.0f;
+
+	/** Seed of per-voxel colours. 0 derives it from where the smoke is generated, so every client
+	 * generating smoke at the same spot gets the same colours without replicating them. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Settings")
+	int32 AttributeSeed = 0;
+
+	/** Let the smoke spread and thin out after it has been generated. Runs in game worlds only. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Simulation")
+	bool bSimulate = false;
+
+	/** How fast smoke spreads, in square world units per second. Obstacles stop it, it escapes at the faces of the grid. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Simulation", meta = (ClampMin = "0.0", EditCondition = "bSimulate"))
+	float Diffusion = 2000.0f;
+
+	/** Share of the density lost per second */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Simulation", meta = (ClampMin = "0.0", EditCondition = "bSimulate"))
+	float DecayRate = 0.1f;
+
+	/** Let the smoke drift with the wind of USmokeVolumeSubsystem and with air pushed by explosions and pawns */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Simulation", meta = (EditCondition = "bSimulate"))
+	bool bAdvect = true;
+
+	/** Share of the velocity of pushed air lost per second */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Simulation", meta = (ClampMin = "0.0", EditCondition = "bSimulate && bAdvect"))
+	float VelocityDamping = 2.0f;
+
+	/** Make the pushed air flow around obstacles and through openings instead of piling up against them */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Simulation", meta = (EditCondition = "bSimulate && bAdvect"))
+	bool bProjectPressure = true;
+
+	/** Most multigrid V-cycles of the pressure projection per step */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Simulation", meta = (ClampMin = "1", ClampMax = "32", EditCondition = "bSimulate && bAdvect && bProjectPressure"))
+	int32 PressureCycles = 4;
+
+	/** The projection stops early once the remaining divergence has dropped to this share */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Simulation", meta = (ClampMin = "0.0001", ClampMax = "1.0", EditCondition = "bSimulate && bAdvect && bProjectPressure"))
+	float PressureTolerance = 0.1f;
+
+	/** Fixed simulation steps per second, independent of the frame rate. Advection is stable at any rate,
+	 * low rates save time at the cost of smoke reaching fewer bricks per step. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Smoke Simulation", meta = (ClampMin = "5.0", ClampMax = "120.0", Units = "Hz", EditCondition = "bSimulate"))
+	float SimulationRate = 30.0f;
+
 	/** Material to use for rendering smoke voxels. 
 	 * The material will be rendered as translucent regardless of its blend mode setting.
 	 * Make sure to connect the Opacity input in your material (use Vertex Color Alpha for per-voxel opacity).
@@ -94,11 +239,15 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Debug")
 	FColor DebugColor = FColor::Red;
 
+	/** Broadcast once the smoke has faded out after its lifetime. The voxels are cleared, the component stays. */
+	UPROPERTY(BlueprintAssignable, Category = "Smoke Settings")
+	FSmokeDissipatedDelegate OnSmokeDissipated;
+
 	/** Regenerate the voxel grid */
 	UFUNCTION(BlueprintCallable, Category = "Voxel")
 	void RegenerateVoxels();
 
-	/** Generate voxels at a specific world location (for smoke grenade explosion) */
+	/** Generate voxels at a specific world location (for smoke grenade explosion). In game worlds they are built on the worker pool and appear once done. */
 	UFUNCTION(BlueprintCallable, Category = "Voxel")
 	void GenerateVoxelsAtLocation(const FVector& WorldLocation, float InRadius, int32 InResolution);
 
@@ -106,21 +255,120 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Voxel")
 	FSmokeVoxel GetVoxel(int32 X, int32 Y, int32 Z) const;
 
-	/** Get voxel count */
+	/**
+	 * Visible density of the smoke at each world position into OutDensities, trilinearly filtered between the voxel
+	 * centres, 0 outside the smoke. Fading, carved and cleared smoke counts as much as is visible. Game thread only.
+	 */
+	void SampleDensities(TConstArrayView<FVector> WorldPositions, TArrayView<float> OutDensities) const;
+
+	/** Visible density of the smoke at each world position, see SampleDensities() */
+	UFUNCTION(BlueprintCallable, Category = "Voxel", meta = (DisplayName = "Sample Densities"))
+	void K2_SampleDensities(const TArray<FVector>& WorldPositions, TArray<float>& OutDensities) const;
+
+	/**
+	 * World to grid transform of the voxels, voxel X centred on X. Built once per frame and again after the component
+	 * moved or regenerated, instead of inverting the component transform for every position. Game thread only.
+	 */
+	const FSmokeGridTransform& GetWorldToGrid() const;
+
+	/** Get the number of voxels filled with smoke */
 	UFUNCTION(BlueprintCallable, Category = "Voxel")
-	int32 GetVoxelCount() const { return VoxelGrid.Num(); }
+	int32 GetVoxelCount() const;
+
+	/** Seed the per-voxel attributes are hashed from, AttributeSeed or one derived from the location */
+	uint32 GetResolvedAttributeSeed() const;
+
+	/** Simulation parameters in voxel units, disabled unless bSimulate is set in a game world */
+	FSmokeSimulationSettings GetSimulationSettings() const;
+
+	/** Voxel data of this component, owned by USmokeVolumeSubsystem. Null while unregistered. */
+	const FSmokeVolume* GetVolume() const { return Volume; }
+
+	/** Set the sphere radius, the volume is regenerated in the background once the value has settled */
+	UFUNCTION(BlueprintSetter)
+	void SetSphereRadius(float InRadius);
+
+	/** Set the grid resolution, the volume is regenerated in the background once the value has settled */
+	UFUNCTION(BlueprintSetter)
+	void SetVoxelResolution(int32 InResolution);
+
+	/**
+	 * Resume ticking the volume after it went to sleep. USmokeVolumeSubsystem stops ticking a volume once its
+	 * flood fill is done, anything that changes voxel data afterwards must call this.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Voxel")
+	void WakeUp();
+
+	/** True while the volume is ticked, false once it has settled */
+	UFUNCTION(BlueprintCallable, Category = "Voxel")
+	bool IsAwake() const;
+
+	/** Get the obstacle query counters from the last regeneration */
+	UFUNCTION(BlueprintCallable, Category = "Voxel")
+	const FSmokeObstacleQueryStats& GetObstacleQueryStats() const { return ObstacleQueryStats; }
+
+	/** Called by USmokeVolumeSubsystem after it cleared the volume of dissipated smoke */
+	void HandleDissipated();
+
+	/**
+	 * Called by USmokeVolumeSubsystem when a background regeneration is done. Switches the component over to NewVolume
+	 * and returns the previous volume. The scene proxy draws its own copy of the voxels, so it may be reused right away.
+	 */
+	FSmokeVolume* PublishVolume(FSmokeVolume* NewVolume, const FSmokeObstacleQueryStats& Stats);
+
+	/**
+	 * Called by USmokeVolumeSubsystem on the game thread whenever a background job or an explosion starts or stops
+	 * writing the volume. The scene proxy updates run concurrently and go by these instead of the subsystem's lists.
+	 */
+	void SetVolumeTaskState(bool bBuilding, bool bClearing)
+	{
+		bVolumeBuilding = bBuilding;
+		bVolumeClearing = bClearing;
+	}
 
 protected:
 
-	void UpdateVoxelsVisibility(float DeltaTime);
+	/** Fade parameters for evaluating visibility now */
+	FSmokeFadeParams GetFadeParams() const;
 	
-	/** Generate voxels in a sphere shape */
+	/**
+	 * Classify voxels within RegionRadius of the centre as free or blocked. <= 0 probes the whole grid.
+	 * Static geometry comes from the level's baked occupancy when there is one, physics is only queried for movable bodies then.
+	 */
+	void ProbeObstacles(float RegionRadius);
+
+	/** Compare baked static occupancy against live physics queries over the same grid, logging the differences */
+	void ValidateBakedOccupancy(const FSmokeObstacleGrid& ObstacleGrid, const FBox& WorldBounds, FSmokeScratchMemory& ScratchMemory);
+
+	/** Generate voxels in a sphere shape, skipping voxels that overlap world geometry */
 	void GenerateSphereVoxels();
-	
-	bool IsVoxelNearStaticMesh(UWorld* World, const FVector& VoxelPos, float Radius);
 
-	/** Generate randomized colors for each voxel */
-	void GenerateVoxelColors();
+	/** Probe the whole grid and seed the flood fill, USmokeVolumeSubsystem grows it from there */
+	void BeginFloodFill();
+
+	/** Regenerate in the background through USmokeVolumeSubsystem, or right away without one */
+	void RequestRegenerate();
+
+	/** Bumps the data version and updates or recreates the scene proxy after the voxels changed */
+	void NotifyVoxelDataChanged();
+
+	/**
+	 * Copies the voxels a new scene proxy draws and clears the volume's change marks. Leaves OutRenderData empty while
+	 * a job regenerates the volume in place or an explosion clears it, the next update sends every voxel then.
+	 */
+	void CopyRenderData(FSmokeRenderData& OutRenderData);
+
+	/** Gathers the voxels changed since the last update into a free update. Returns null while an explosion clears the volume. */
+	TSharedPtr<FSmokeRenderUpdate, ESPMode::ThreadSafe> GatherRenderUpdate();
+
+	/** Hands the world bounds at the current transform to the subsystem's volume index */
+	void UpdateIndexedBounds();
+
+	/** World subsystem owning the voxel data, null outside of a world */
+	USmokeVolumeSubsystem* GetSmokeSubsystem() const;
+
+	/** The volume, null while a detonation regenerates it in place on the worker pool */
+	const FSmokeVolume* GetReadableVolume() const;
 
 	/** Convert world position to voxel grid coordinates */
 	FIntVector WorldToVoxel(const FVector& WorldPos) const;
@@ -131,6 +379,9 @@ protected:
 	/** Check if voxel coordinates are valid */
 	bool IsValidVoxelCoord(const FIntVector& Coord) const;
 
+	/** Local space position of a voxel */
+	FVector VoxelToLocal(const FIntVector& VoxelCoord) const;
+
 	/** Draw debug visualization */
 	void DrawDebugVisualization() const;
 
@@ -138,21 +389,35 @@ protected:
 	FBoxSphereBounds GetLocalBounds() const;
 
 private:
-	// 3D voxel grid stored as 1D array: index = X + Y * Resolution + Z * Resolution * Resolution
-	TArray<FSmokeVoxel> VoxelGrid;
+	// Voxel data, owned by USmokeVolumeSubsystem from OnRegister() to OnUnregister()
+	FSmokeVolume* Volume = nullptr;
 
-	// Cached values 
-	int32 CurrentResolution = 0;
-	float CurrentSphereRadius = 0.0f;
-	
-	// Cached voxel colors (randomized per voxel)
-	TArray<FColor> VoxelColors;
-	
 	// Version number to track when voxels change (increments when voxels are regenerated)
 	uint32 VoxelDataVersion = 0;
+
+	// Grid the current scene proxy was created for. Regenerating on the same grid only moves the proxy.
+	int32 ProxyVoxelResolution = 0;
+	float ProxySphereRadius = 0.0f;
 	
-	// Array of voxels that will be filled with smoke
-	TArray<FSmokeVoxel> SmokeVoxelArray;
+	// World to grid transform cached by GetWorldToGrid() and the frame it was built in, MAX_uint64 rebuilds it
+	mutable FSmokeGridTransform CachedWorldToGrid;
+	mutable uint64 WorldToGridFrame = MAX_uint64;
+
+	// Obstacle query counters from the last regeneration
+	FSmokeObstacleQueryStats ObstacleQueryStats;
+
+	// Counters of the static pass against the obstacle cache, merged into ObstacleQueryStats. Kept to reuse its arrays.
+	FSmokeObstacleQueryStats StaticQueryStats;
+
+	// Scene proxy updates, reused once the render thread applied them. Two suffice unless several are sent in a frame.
+	TArray<TSharedRef<FSmokeRenderUpdate, ESPMode::ThreadSafe>> RenderUpdates;
+
+	// The proxy's copy is missing voxels, the next update sends every voxel
+	bool bSendAllVoxels = true;
+
+	// Snapshot of the volume's background writers, see SetVolumeTaskState()
+	bool bVolumeBuilding = false;
+	bool bVolumeClearing = false;
 	
 	// Friend class for scene proxy access
 	friend class FVolumetricSmokeSceneProxy;
@@ -175,21 +440,22 @@ public:
 	virtual void GetDynamicMeshElements(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector& Collector) const override;
 	virtual FPrimitiveViewRelevance GetViewRelevance(const FSceneView* View) const override;
 	virtual uint32 GetMemoryFootprint(void) const override { return sizeof(*this) + GetAllocatedSize(); }
-	uint32 GetAllocatedSize(void) const { return (uint32)FPrimitiveSceneProxy::GetAllocatedSize(); }
+	uint32 GetAllocatedSize(void) const { return (uint32)(FPrimitiveSceneProxy::GetAllocatedSize() + RenderData->GetAllocatedSize()); }
+
+	/** Brings the copy of the voxel data up to date */
+	void UpdateRenderData_RenderThread(FSmokeRenderUpdate& Update);
 	
 
 
 private:
 
-	UVolumetricSmokeComponent* SmokeComp;
-	// Voxel data (cached from component when scene proxy is created)
-	//TArray<FVector> VoxelPositions;
-	//TArray<FColor> VoxelColors;
+	// Material the voxels are drawn with, changing it recreates the proxy
+	UMaterialInterface* Material = nullptr;
+
+	// Copy of the voxel data drawn every frame, updated by UpdateRenderData_RenderThread() whenever the volume changes
+	TUniquePtr<FSmokeRenderData> RenderData;
 	float VoxelSize;
 	int32 VoxelResolution;
 	float SphereRadius;
-	
-	// Version tracking - scene proxy is recreated when this changes
-	uint32 CachedVoxelDataVersion;
 };
 
@@ -0,0 +1,503 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/OverlapResult.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tasks/Task.h"
+#include "Voxel/SmokeObstacleCache.h"
+#include "Voxel/SmokeRegenerationJob.h"
+#include "Voxel/SmokeScratchMemory.h"
+#include "Voxel/SmokeVolume.h"
+#include "Voxel/SmokeVolumeIndex.h"
+#include "SmokeVolumeSubsystem.generated.h"
+
+class USmokeOccupancyAsset;
+class UVolumetricSmokeComponent;
+
+/** World space segment of a batched smoke query */
+struct FSmokeRay
+{
+	FVector Start = FVector::ZeroVector;
+	FVector End = FVector::ZeroVector;
+};
+
+/**
+ * Counters over every smoke volume of a world
+ */
+USTRUCT(BlueprintType)
+struct FSmokeVolumeStats
+{
+	GENERATED_BODY()
+
+	/** Registered smoke volumes */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 NumVolumes = 0;
+
+	/** Preallocated volumes in the pool */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 PoolSize = 0;
+
+	/** Pool volumes currently handed out */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 PoolInUse = 0;
+
+	/** Most volumes registered at the same time since the world started */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 PoolHighWaterMark = 0;
+
+	/** Volumes allocated because the pool was empty. Non-zero means the pool is too small. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 PoolOverflows = 0;
+
+	/** Volumes in the spatial index, the ones components show */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 IndexedVolumes = 0;
+
+	/** Volumes ticked last frame, the others are settled */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 NumActiveVolumes = 0;
+
+	/** Voxels filled with smoke over all volumes */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 NumVoxels = 0;
+
+	/** Bricks allocated over all volumes */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 NumBricks = 0;
+
+	/** Bytes allocated by voxel data over all volumes */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int64 AllocatedBytes = 0;
+
+	/** Bytes held by the generation scratch buffers. Stops growing once the largest volume has been generated. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int64 ScratchBytes = 0;
+
+	/** Regenerations that had to grow the scratch buffers or allocate past the scratch arena. Stays put in steady state. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 ScratchGrowths = 0;
+
+	/** Cells held by the obstacle cache */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 ObstacleCacheEntries = 0;
+
+	/** Most cells the obstacle cache holds, VolumetricSmoke.ObstacleCacheSize */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 ObstacleCacheCapacity = 0;
+
+	/** Share of cached cell lookups answered without a physics query, 0 to 1 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	float ObstacleCacheHitRate = 0.0f;
+
+	/** Cells dropped because the cache was full. Many evictions with a low hit rate call for a larger cache. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int64 ObstacleCacheEvictions = 0;
+
+	/** Cells dropped because geometry around them was destroyed, streamed or edited */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int64 ObstacleCacheInvalidations = 0;
+
+	/** Bytes allocated by the obstacle cache */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int64 ObstacleCacheBytes = 0;
+
+	/** Regenerations waiting for their parameters to settle */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 PendingRegenerations = 0;
+
+	/** Regenerations building on worker threads, cancelled ones included until their worker returns */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 RunningRegenerations = 0;
+
+	/** Volumes whose density simulation has not settled yet */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 SimulatedVolumes = 0;
+
+	/** Voxel updates per second of stencil time over every simulated volume, the solver's throughput */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	float SimulationVoxelUpdatesPerSecond = 0.0f;
+
+	/** Mean residual reduction per V-cycle of the latest pressure projections, lower converges faster */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	float PressureConvergenceRate = 0.0f;
+
+	/** Segments carved through smoke since the previous tick */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 CarvedRays = 0;
+
+	/** Voxels hidden by those carves */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 CarvedVoxels = 0;
+
+	/** Bricks whose voxels those carves changed, counted once per carve */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 CarvedBricks = 0;
+
+	/** Explosions that cleared smoke out of a volume since the previous tick, one per volume they reached */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 ExplosionClears = 0;
+
+	/** Voxels those explosions blew away */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 ExplosionClearedVoxels = 0;
+
+	/** Worker time of those clears, the refill included as it needs no further work */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	float ExplosionClearMs = 0.0f;
+
+	/** Segments whose optical depth was queried since the previous tick */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 OpticalDepthRays = 0;
+
+	/** Game thread time those queries took */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	float OpticalDepthQueryMs = 0.0f;
+
+	/** Positions whose smoke density was sampled since the previous tick */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 DensitySamples = 0;
+
+	/** Game thread time that sampling took */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	float DensitySampleMs = 0.0f;
+
+	/** Game thread time of the last tick */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	float TickMs = 0.0f;
+};
+
+/**
+ * Owns the voxel data of every smoke volume in a world and ticks them in one batch.
+ *
+ * UVolumetricSmokeComponent registers a volume here and generates it, after that the subsystem grows
+ * flood fills and steps the density simulations of all active volumes in parallel each frame. Volumes that have nothing left to do are
+ * not ticked until they are woken up again.
+ *
+ * Game worlds preallocate a pool of VolumetricSmoke.PoolSize volumes with buffers for grids of up to
+ * VolumetricSmoke.PoolResolution voxels per axis. Components take a volume from the pool when they register
+ * and hand it back when they unregister, and smoke with a lifetime is cleared once it has dissipated, so
+ * detonating a grenade reuses memory instead of allocating it.
+ *
+ * If the level has a baked USmokeOccupancyAsset it is loaded with the world, and generation looks static
+ * obstacles up in it instead of querying physics for them. Otherwise static obstacles found by physics
+ * queries are kept in an FSmokeObstacleCache shared by every volume of the world.
+ *
+ * Simulated volumes drift with SetWindVelocity() and are stirred up by AddAirImpulse() and by pawns moving
+ * through them, scaled by VolumetricSmoke.PawnAirPush. CarveRay() clears tunnels through the smoke for projectiles,
+ * which regrow after VolumetricSmoke.CarveRegrowDelay seconds, and ClearSphere() blows smoke away for explosions on
+ * a background task that is done by the next tick. QueryOpticalDepth() tells how much smoke lies between two points,
+ * so AI can treat dense smoke like a wall, and SampleDensities() how dense it is at many points at once. These look
+ * the volumes up in an FSmokeVolumeIndex kept up to date as components generate, move and dissipate smoke, which
+ * other code may cull against from any thread too.
+ *
+ * RequestRegenerate() waits for VolumetricSmoke.RegenerateDelay seconds without another request, then builds the
+ * volume into a second volume from the pool, as a chain of tasks on the worker pool (see FSmokeRegenerationJob).
+ * StartRegeneration() skips the wait and builds into the component's own volume, a detonation replaces its smoke
+ * anyway and takes no second volume from the pool. Otherwise the component keeps its previous voxels until the
+ * build is done and the two are swapped on the game thread, a newer request cancels the build. The subsystem also
+ * ticks in the editor for this.
+ */
+UCLASS()
+class VOLUMETRICSMOKE_API USmokeVolumeSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+	virtual bool IsTickableInEditor() const override { return true; }
+
+	/** Hands out a volume for a component, from the pool while it lasts. The volume is the component's until UnregisterVolume(). */
+	FSmokeVolume* RegisterVolume(UVolumetricSmokeComponent* Component);
+
+	/** Returns the volume to the pool, or frees it if it was allocated beyond the pool */
+	void UnregisterVolume(FSmokeVolume* Volume);
+
+	/** Ticks the volume from the next frame on */
+	void ActivateVolume(FSmokeVolume* Volume);
+
+	bool IsVolumeActive(const FSmokeVolume* Volume) const { return ActiveVolumes.Contains(Volume); }
+
+	/**
+	 * Indexes the volume a component shows under its world bounds, after it was generated or moved. Volumes being
+	 * built, retired or handed back are skipped, dissipated ones leave the index.
+	 */
+	void UpdateVolumeBounds(FSmokeVolume* Volume, const FBox& WorldBounds);
+
+	/**
+	 * Bounds of the volumes components show, for culling point, box and ray queries from any thread. The volumes found
+	 * are not pinned, their voxels are only read through the queries of this subsystem on the game thread.
+	 */
+	const FSmokeVolumeIndex& GetVolumeIndex() const { return VolumeIndex; }
+
+	/**
+	 * Regenerates the volume of a component on a worker thread, once no further request came in for
+	 * VolumetricSmoke.RegenerateDelay seconds. Cancels a regeneration of the component that is still running.
+	 */
+	void RequestRegenerate(UVolumetricSmokeComponent* Component);
+
+	/**
+	 * Starts regenerating the volume of a component on the worker pool right away, for detonations that must not wait
+	 * for parameters to settle. Builds into the component's volume, which reads as empty until the build is done.
+	 * Supersedes pending and running regenerations of the component.
+	 */
+	void StartRegeneration(UVolumetricSmokeComponent* Component);
+
+	/**
+	 * Drops pending and running regenerations of a component, for when it regenerates synchronously or goes away.
+	 * Waits for a build into the component's own volume, so the component may write to it right after.
+	 */
+	void CancelRegeneration(UVolumetricSmokeComponent* Component);
+
+	/**
+	 * Pushes the air inside simulated smoke volumes overlapping a sphere, applied with the next tick. Near the
+	 * centre the air takes on Velocity plus RadialSpeed away from the centre, fading out towards Radius. For
+	 * explosions and the like, moving pawns push the air on their own.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Smoke")
+	void AddAirImpulse(const FVector& WorldLocation, float Radius, const FVector& Velocity, float RadialSpeed = 0.0f);
+
+	/**
+	 * Clears the smoke of every volume a segment passes through, for projectiles flying through it. Voxels along the
+	 * segment stay hidden for VolumetricSmoke.CarveRegrowDelay seconds, then fade back in. The grids are walked voxel
+	 * by voxel and only the arrival times of the voxels hit change, so it is cheap enough for every projectile every
+	 * frame. Game thread only.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Smoke")
+	void CarveRay(const FVector& WorldStart, const FVector& WorldEnd);
+
+	/**
+	 * Blows the smoke of every volume overlapping a sphere away, for explosions. The sphere stays clear for
+	 * HoldSeconds, then refills from its rim inwards over RefillSeconds. Each volume is cleared by a task on the
+	 * worker pool so the blast does not cost the game thread, later explosions in the same volume queue behind it.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Smoke")
+	void ClearSphere(const FVector& WorldLocation, float Radius, float HoldSeconds = 0.5f, float RefillSeconds = 2.0f);
+
+	/**
+	 * Waits for the ClearSphere() tasks writing to a volume. Anything resetting or rewriting a volume outside of the
+	 * subsystem tick must call this first.
+	 */
+	void WaitForClearing(const FSmokeVolume* Volume);
+
+	/**
+	 * Optical depth of the smoke along each ray, over every volume it crosses, into OutOpticalDepth. The light getting
+	 * through is exp(-OpticalDepth). A fully visible voxel of density 1 adds VolumetricSmoke.Extinction per unit of
+	 * length, fading, carved and cleared smoke adds less. Each grid is walked voxel by voxel and a ray stops once its
+	 * transmittance drops below MinTransmittance, as nothing behind that can be seen anyway. Large batches fan out over
+	 * the worker pool. Game thread only.
+	 */
+	void QueryOpticalDepth(TConstArrayView<FSmokeRay> Rays, TArrayView<float> OutOpticalDepth, float MinTransmittance = 0.01f);
+
+	/** Share of the light getting through the smoke between two points, 1 without smoke, see QueryOpticalDepth() */
+	UFUNCTION(BlueprintCallable, Category = "Smoke")
+	float GetSmokeTransmittance(const FVector& Start, const FVector& End, float MinTransmittance = 0.01f);
+
+	/**
+	 * Visible density of the smoke at each world position into OutDensities, summed over the volumes overlapping it
+	 * and trilinearly filtered between voxel centres, 0 outside the smoke. For damage over time, muffling sounds and
+	 * spreading aim at many points without a query each. Each volume transforms the batch with the grid transform its
+	 * component caches for the frame, large batches fan out over the worker pool. Game thread only.
+	 */
+	void SampleDensities(TConstArrayView<FVector> WorldPositions, TArrayView<float> OutDensities);
+
+	/** Visible density of the smoke at each world position, see SampleDensities() */
+	UFUNCTION(BlueprintCallable, Category = "Smoke")
+	void GetSmokeDensities(const TArray<FVector>& WorldPositions, TArray<float>& OutDensities);
+
+	/** Wind every simulated smoke volume drifts with, world space, in units per second */
+	UFUNCTION(BlueprintCallable, Category = "Smoke")
+	void SetWindVelocity(const FVector& InWindVelocity) { WindVelocity = InWindVelocity; }
+
+	UFUNCTION(BlueprintCallable, Category = "Smoke")
+	FVector GetWindVelocity() const { return WindVelocity; }
+
+	/** Counters from the last tick */
+	UFUNCTION(BlueprintCallable, Category = "Smoke")
+	const FSmokeVolumeStats& GetStats() const { return Stats; }
+
+	/** Every volume, registered or waiting in the pool */
+	const TArray<TUniquePtr<FSmokeVolume>>& GetVolumes() const { return Volumes; }
+
+	/**
+	 * Transient buffers for generating a volume. Game thread only, hand them back with ReleaseScratchMemory()
+	 * once the generation is done.
+	 */
+	FSmokeScratchMemory& AcquireScratchMemory();
+
+	/** Ends the use of the scratch buffers, notes whether they had to grow and releases the scratch arena */
+	void ReleaseScratchMemory();
+
+	/** Baked static collision of the level, null if it has none or VolumetricSmoke.UseBakedOccupancy is off */
+	const USmokeOccupancyAsset* GetStaticOccupancy() const;
+
+	/** Cache of static obstacle cells, null if VolumetricSmoke.ObstacleCacheSize is 0. Game thread only. */
+	FSmokeObstacleCache* GetObstacleCache();
+
+	/** True while a ClearSphere() task is writing to the volume */
+	bool IsVolumeClearing(const FSmokeVolume* Volume) const;
+
+	/** True while a regeneration job is writing to the volume, components read it as empty meanwhile */
+	bool IsVolumeBuilding(const FSmokeVolume* Volume) const;
+
+private:
+
+	/** Clears volumes whose smoke has faded out and lets their components know */
+	void ReleaseDissipatedVolumes(double WorldTime);
+
+	/** Static geometry of a destroyed actor no longer blocks smoke. Actors without any leave the cache alone. */
+	void HandleActorDestroyed(AActor* Actor);
+
+	/** Streaming a level in or out changes static geometry anywhere in it */
+	void HandleLevelChanged(ULevel* Level, UWorld* InWorld);
+
+#if WITH_EDITOR
+	/** Static actors moved in the editor empty the cache, their old location is not known */
+	void HandleActorMoved(AActor* Actor);
+#endif
+
+	/** Starts the regenerations whose requests have settled */
+	void StartPendingRegenerations(double Now);
+
+	/**
+	 * Gathers obstacles for a component and launches its regeneration job, into the component's own volume if
+	 * bInPlace, otherwise into a second one from the pool
+	 */
+	void LaunchRegenerationJob(UVolumetricSmokeComponent* Component, bool bInPlace);
+
+	/** Cancels the running regenerations of a component, see CancelRegeneration() */
+	void CancelRegenerationJobs(UVolumetricSmokeComponent* Component);
+
+	/** Swaps finished regenerations in and frees the volumes of cancelled ones */
+	void PublishFinishedRegenerations(double WorldTime);
+
+	/** Waits for every ClearSphere() task and adds up their counters */
+	void CompleteClearing();
+
+	/**
+	 * Has the component showing the volume send its scene proxy the changed voxels at the end of the frame. Also hands
+	 * it whether a job or an explosion is writing the volume, called wherever that changes.
+	 */
+	void MarkRenderDataDirty(const FSmokeVolume* Volume) const;
+
+	/** True if a component shows the volume, it holds smoke and nothing but the game thread writes to it */
+	bool IsVolumeReadable(const FSmokeVolume* Volume) const;
+
+	/** Hands wind, queued impulses and the air pushed by moving pawns to the running simulations, in their grid units */
+	void ApplyAirMotion();
+
+	void UpdateStats(double TickSeconds);
+
+	TArray<TUniquePtr<FSmokeVolume>> Volumes;
+
+	/** Pool volumes not registered to any component */
+	TArray<FSmokeVolume*> FreeVolumes;
+
+	/** Number of volumes kept allocated, volumes registered beyond it are freed again on unregistering */
+	int32 PoolSize = 0;
+
+	/** Grid resolution the buffers of every volume are allocated for */
+	int32 PoolResolution = 0;
+
+	/** Density format the buffers are allocated at, the default of UVolumetricSmokeComponent */
+	ESmokeChannelFormat PoolDensityFormat = ESmokeChannelFormat::UNorm8;
+
+	int32 PoolHighWaterMark = 0;
+	int32 PoolOverflows = 0;
+
+	/** Shared by every regeneration of the world */
+	FSmokeScratchMemory ScratchMemory;
+
+	UPROPERTY()
+	TObjectPtr<USmokeOccupancyAsset> StaticOccupancy;
+
+	FSmokeObstacleCache ObstacleCache;
+
+	FDelegateHandle ActorDestroyedHandle;
+	FDelegateHandle LevelAddedHandle;
+	FDelegateHandle LevelRemovedHandle;
+#if WITH_EDITOR
+	FDelegateHandle ActorMovedHandle;
+#endif
+
+	/** Size and heap allocations of the scratch buffers when they were acquired */
+	SIZE_T ScratchBytesAtAcquire = 0;
+	int32 ScratchHeapAllocationsAtAcquire = 0;
+	int32 ScratchGrowths = 0;
+	bool bScratchMemoryInUse = false;
+
+	/** World bounds of the volumes components show */
+	FSmokeVolumeIndex VolumeIndex;
+
+	/** Volumes ticked each frame */
+	TArray<FSmokeVolume*> ActiveVolumes;
+
+	struct FAirImpulse
+	{
+		FVector Location = FVector::ZeroVector;
+		float Radius = 0.0f;
+		FVector Velocity = FVector::ZeroVector;
+		float RadialSpeed = 0.0f;
+	};
+
+	/** Impulses since the last tick, world space */
+	TArray<FAirImpulse> PendingAirImpulses;
+
+	/** Pawns overlapping a running simulation, kept so the query of every volume and tick reuses the array */
+	TArray<FOverlapResult> PawnOverlaps;
+
+	FVector WindVelocity = FVector::ZeroVector;
+
+	struct FClearTask
+	{
+		FSmokeVolume* Volume = nullptr;
+		UE::Tasks::TTask<FSmokeClearResult> Task;
+	};
+
+	/** ClearSphere() work launched since the last tick, in launch order */
+	TArray<FClearTask> ClearTasks;
+
+	/** Finished clears since the last tick, see FSmokeVolumeStats */
+	int32 ExplosionClears = 0;
+	int32 ExplosionClearedVoxels = 0;
+	double ExplosionClearSeconds = 0.0;
+
+	/** Optical depth queries since the last tick, see FSmokeVolumeStats */
+	int32 OpticalDepthRays = 0;
+	double OpticalDepthQuerySeconds = 0.0;
+
+	/** Density samples since the last tick, see FSmokeVolumeStats */
+	int32 DensitySamples = 0;
+	double DensitySampleSeconds = 0.0;
+
+	/** Carves since the last tick, see FSmokeVolumeStats */
+	int32 CarvedRays = 0;
+	int32 CarvedVoxels = 0;
+	int32 CarvedBricks = 0;
+
+	struct FPendingRegeneration
+	{
+		TWeakObjectPtr<UVolumetricSmokeComponent> Component;
+
+		/** Platform time of the latest request, the editor world's clock does not run */
+		double RequestTime = 0.0;
+	};
+
+	/** Components waiting for their requests to settle, one entry each */
+	TArray<FPendingRegeneration> PendingRegenerations;
+
+	/** Regenerations building on worker threads, in start order */
+	TArray<TUniquePtr<FSmokeRegenerationJob>> RegenerationJobs;
+
+	/** Scratch memory of finished regenerations, handed to the next ones so their arenas are not allocated again */
+	TArray<TUniquePtr<FSmokeScratchMemory>> FreeJobScratchMemory;
+
+	FSmokeVolumeStats Stats;
+};
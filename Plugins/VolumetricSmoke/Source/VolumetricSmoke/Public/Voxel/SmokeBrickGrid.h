@@ -0,0 +1,277 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Voxel/SmokeVoxelChannel.h"
+
+/**
+ * State of a voxel while the volume is generated
+ */
+enum class ESmokeVoxelCell : uint8
+{
+	/** Free space not reached by smoke (yet). Voxels in unallocated bricks are free. */
+	Free,
+	/** Overlaps world geometry */
+	Blocked,
+	/** Reached by the flood fill but outside the current fill radius */
+	Deferred,
+	/** Filled with smoke */
+	Filled
+};
+
+/**
+ * Attributes of the voxels filled with smoke, in structure-of-arrays layout.
+ * Every array is indexed by fill slot, in the order voxels were filled, so per-voxel passes stream
+ * through contiguous memory. Positions are not stored, they follow from VoxelIndex.
+ */
+struct FSmokeFilledVoxels
+{
+	/** Density value (0.0 = empty, 1.0 = fully dense) */
+	FSmokeVoxelChannel Density;
+
+	/** Seconds after the volume spawned at which the voxel was filled and started fading in.
+	 * Visibility is evaluated from it on demand, see SmokeFadeKernel. */
+	FSmokeVoxelChannel ArrivalTime;
+
+	TArray<FColor> Colour;
+
+	/** Grid index of the voxel, X + Y * Resolution + Z * Resolution * Resolution */
+	TArray<int32> VoxelIndex;
+
+	int32 Num() const { return VoxelIndex.Num(); }
+
+	/** Clears all voxels and sets the precision of the density channel. Arrival times are stored as full floats:
+	 * smoke without a lifetime lives on for hours, and carves and clears push its arrival times later by fractions
+	 * of a second, which halves would round away after a few minutes. */
+	void SetFormats(ESmokeChannelFormat DensityFormat)
+	{
+		Density.SetFormat(DensityFormat);
+		ArrivalTime.SetFormat(ESmokeChannelFormat::Float32);
+		Reset();
+	}
+
+	/** Bytes stored per filled voxel */
+	int32 GetBytesPerVoxel() const
+	{
+		return FSmokeVoxelChannel::GetBytesPerValue(Density.GetFormat()) + FSmokeVoxelChannel::GetBytesPerValue(ArrivalTime.GetFormat())
+			+ sizeof(FColor) + sizeof(int32);
+	}
+
+	void Reset()
+	{
+		Density.Reset();
+		ArrivalTime.Reset();
+		Colour.Reset();
+		VoxelIndex.Reset();
+	}
+
+	void Reserve(int32 Number)
+	{
+		Density.Reserve(Number);
+		ArrivalTime.Reserve(Number);
+		Colour.Reserve(Number);
+		VoxelIndex.Reserve(Number);
+	}
+
+	/** Voxels every array holds before one of them has to grow */
+	int32 GetMax() const
+	{
+		return FMath::Min(FMath::Min(Density.GetMax(), ArrivalTime.GetMax()), FMath::Min(Colour.Max(), VoxelIndex.Max()));
+	}
+
+	/** Removes the voxel at Slot by moving the last one into its place, whose slot changes to Slot */
+	void RemoveAtSwap(int32 Slot)
+	{
+		Density.RemoveAtSwap(Slot);
+		ArrivalTime.RemoveAtSwap(Slot);
+		Colour.RemoveAtSwap(Slot, EAllowShrinking::No);
+		VoxelIndex.RemoveAtSwap(Slot, EAllowShrinking::No);
+	}
+
+	/** Appends a voxel filled at InArrivalTime and returns its slot */
+	int32 Add(int32 InVoxelIndex, float InDensity, float InArrivalTime)
+	{
+		Density.Add(InDensity);
+		ArrivalTime.Add(InArrivalTime);
+		Colour.Add(FColor::Black);
+		return VoxelIndex.Add(InVoxelIndex);
+	}
+
+	SIZE_T GetAllocatedSize() const
+	{
+		return Density.GetAllocatedSize() + ArrivalTime.GetAllocatedSize() + Colour.GetAllocatedSize() + VoxelIndex.GetAllocatedSize();
+	}
+};
+
+/**
+ * 8x8x8 block of voxels. Voxels inside a brick are stored X-fastest, like the grid itself.
+ * Bricks only hold the voxel state and, for filled voxels, the slot of their attributes in FSmokeFilledVoxels.
+ */
+struct FSmokeVoxelBrick
+{
+	static constexpr int32 Shift = 3;
+	static constexpr int32 Size = 1 << Shift;
+	static constexpr int32 Mask = Size - 1;
+	static constexpr int32 NumVoxels = Size * Size * Size;
+
+	ESmokeVoxelCell Cells[NumVoxels];
+
+	/** Slot in FSmokeFilledVoxels, only meaningful for Filled voxels */
+	int32 Slots[NumVoxels];
+
+	/** Index of a voxel inside its brick */
+	static int32 GetLocalIndex(const FIntVector& VoxelCoord)
+	{
+		return (VoxelCoord.X & Mask) | ((VoxelCoord.Y & Mask) << Shift) | ((VoxelCoord.Z & Mask) << (2 * Shift));
+	}
+};
+
+/**
+ * Sparse voxel storage. The grid is split into 8x8x8 bricks that are only allocated once a voxel in them
+ * is written, so memory scales with the occupied volume instead of Resolution^3. A dense brick index
+ * (one int32 per brick, 1/512th of the voxel count) maps brick coordinates to allocated bricks.
+ *
+ * Bricks live in fixed pages of BricksPerPage that are allocated as bricks are added and never move, so a brick
+ * stays where it is while the grid grows and is read. Reset() keeps the pages for the next fill.
+ *
+ * Bricks whose filled voxels changed are marked, one bit per brick in its page, so the scene proxy is only sent
+ * those. A reset marks every brick.
+ */
+class VOLUMETRICSMOKE_API FSmokeBrickGrid
+{
+public:
+
+	/** Bricks per page of brick storage, about 80 KB, one bit each in the page's change mask */
+	static constexpr int32 PageShift = 5;
+	static constexpr int32 BricksPerPage = 1 << PageShift;
+
+	/** Clears the grid for a new resolution and marks it all changed. The brick index and the pages are kept for reuse. */
+	void Reset(int32 InResolution);
+
+	/** Allocates the pages for NumBricks bricks up front, so filling that many does not touch the heap */
+	void Reserve(int32 NumBricks);
+
+	int32 GetResolution() const { return Resolution; }
+
+	int32 GetNumBricks() const { return NumBricks; }
+
+	/** Bytes allocated by the brick index and the brick pages */
+	SIZE_T GetAllocatedSize() const
+	{
+		return BrickIndex.GetAllocatedSize() + Pages.GetAllocatedSize() + Pages.Num() * sizeof(FBrickPage);
+	}
+
+	/** Brick holding the voxel, or nullptr if it was never written */
+	FSmokeVoxelBrick* FindBrick(const FIntVector& VoxelCoord)
+	{
+		const int32 Slot = BrickIndex[GetBrickIndex(VoxelCoord)];
+		return Slot != INDEX_NONE ? &GetBrick(Slot) : nullptr;
+	}
+
+	const FSmokeVoxelBrick* FindBrick(const FIntVector& VoxelCoord) const
+	{
+		return const_cast<FSmokeBrickGrid*>(this)->FindBrick(VoxelCoord);
+	}
+
+	/** Brick holding the voxel, allocated and cleared on first use */
+	FSmokeVoxelBrick& FindOrAddBrick(const FIntVector& VoxelCoord);
+
+	/** Voxel state, Free if its brick is not allocated */
+	ESmokeVoxelCell GetCell(const FIntVector& VoxelCoord) const
+	{
+		const FSmokeVoxelBrick* Brick = FindBrick(VoxelCoord);
+		return Brick ? Brick->Cells[FSmokeVoxelBrick::GetLocalIndex(VoxelCoord)] : ESmokeVoxelCell::Free;
+	}
+
+	void SetCell(const FIntVector& VoxelCoord, ESmokeVoxelCell Cell)
+	{
+		FindOrAddBrick(VoxelCoord).Cells[FSmokeVoxelBrick::GetLocalIndex(VoxelCoord)] = Cell;
+	}
+
+	/** Slot of a filled voxel in FSmokeFilledVoxels, INDEX_NONE if the voxel is not filled */
+	int32 GetFilledSlot(const FIntVector& VoxelCoord) const
+	{
+		const FSmokeVoxelBrick* Brick = FindBrick(VoxelCoord);
+		const int32 LocalIndex = FSmokeVoxelBrick::GetLocalIndex(VoxelCoord);
+		return Brick && Brick->Cells[LocalIndex] == ESmokeVoxelCell::Filled ? Brick->Slots[LocalIndex] : INDEX_NONE;
+	}
+
+	/** Marks a voxel filled, its attributes living at Slot, and its brick changed */
+	void SetFilled(const FIntVector& VoxelCoord, int32 Slot)
+	{
+		FSmokeVoxelBrick& Brick = FindOrAddBrick(VoxelCoord);
+		const int32 LocalIndex = FSmokeVoxelBrick::GetLocalIndex(VoxelCoord);
+		Brick.Cells[LocalIndex] = ESmokeVoxelCell::Filled;
+		Brick.Slots[LocalIndex] = Slot;
+		MarkChanged(VoxelCoord);
+	}
+
+	/** Marks the brick holding the voxel changed, if it is allocated. Not thread safe, bricks share their page's mask. */
+	void MarkChanged(const FIntVector& VoxelCoord)
+	{
+		const int32 Slot = BrickIndex[GetBrickIndex(VoxelCoord)];
+		if (!bAllChanged && Slot != INDEX_NONE)
+		{
+			Pages[Slot >> PageShift]->ChangedMask |= 1u << (Slot & (BricksPerPage - 1));
+		}
+	}
+
+	/** True after a reset, until ClearChanged() */
+	bool IsAllChanged() const { return bAllChanged; }
+
+	/** Calls Visitor with every brick marked changed since ClearChanged() */
+	template<typename VisitorType>
+	void ForEachChangedBrick(VisitorType&& Visitor) const
+	{
+		const int32 NumPages = FMath::DivideAndRoundUp(NumBricks, BricksPerPage);
+		for (int32 PageIndex = 0; PageIndex < NumPages; ++PageIndex)
+		{
+			const FBrickPage& Page = *Pages[PageIndex];
+			for (uint32 Mask = Page.ChangedMask; Mask != 0; Mask &= Mask - 1)
+			{
+				Visitor(Page.Bricks[FMath::CountTrailingZeros(Mask)]);
+			}
+		}
+	}
+
+	/** Forgets the changes, once the scene proxy has been sent them */
+	void ClearChanged();
+
+private:
+
+	struct FBrickPage
+	{
+		FSmokeVoxelBrick Bricks[BricksPerPage];
+
+		/** Bit per brick, set while it is marked changed */
+		uint32 ChangedMask = 0;
+	};
+
+	FSmokeVoxelBrick& GetBrick(int32 Slot)
+	{
+		return Pages[Slot >> PageShift]->Bricks[Slot & (BricksPerPage - 1)];
+	}
+
+	int32 GetBrickIndex(const FIntVector& VoxelCoord) const
+	{
+		return (VoxelCoord.X >> FSmokeVoxelBrick::Shift)
+			+ (VoxelCoord.Y >> FSmokeVoxelBrick::Shift) * BricksPerAxis
+			+ (VoxelCoord.Z >> FSmokeVoxelBrick::Shift) * BricksPerAxis * BricksPerAxis;
+	}
+
+	int32 Resolution = 0;
+	int32 BricksPerAxis = 0;
+
+	/** Slot in Bricks for every brick of the grid, INDEX_NONE if not allocated */
+	TArray<int32> BrickIndex;
+
+	/** Brick pages, bricks in allocation order. Pages past the bricks in use are kept from earlier fills. */
+	TArray<TUniquePtr<FBrickPage>> Pages;
+
+	/** Bricks in use */
+	int32 NumBricks = 0;
+
+	/** Every brick counts as changed, the per-brick marks are not kept meanwhile */
+	bool bAllChanged = true;
+};
@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Inputs of a visibility evaluation, shared by every voxel of a volume */
+struct FSmokeFadeParams
+{
+	/** Seconds since the volume was spawned */
+	float ElapsedTime = 0.0f;
+
+	/** Fade rate of a fully dense voxel, scaled by voxel density */
+	float SpawnSpeed = 1.0f;
+
+	/** Seconds since spawn at which every voxel starts fading out together. Never by default. */
+	float DissipationStart = TNumericLimits<float>::Max();
+
+	/** One over the seconds the fade-out takes. 0 never fades out. */
+	float InvDissipationDuration = 0.0f;
+};
+
+/**
+ * Closed-form visibility fade over structure-of-arrays voxel data.
+ *
+ * A voxel starts fading in at its arrival time and follows a cubic ease-out, 1 - (1 - x)^3 with
+ * x = (ElapsedTime - ArrivalTime) * SpawnSpeed * Density / 3. Its initial slope matches the FInterpTo
+ * fade it replaces, but it reaches 1 after 3 / (SpawnSpeed * Density) seconds. Visibility depends only on
+ * time, never on how many frames were simulated, and nothing is stored per voxel.
+ *
+ * Once the volume dissipates, visibility is scaled down linearly from DissipationStart to 0 over the
+ * dissipation duration.
+ */
+namespace SmokeFadeKernel
+{
+	/** Voxels processed per iteration of the vector loop */
+	constexpr int32 VectorWidth = 16;
+
+	/** Seconds a voxel of the given density takes to fade in fully, 0 if it appears instantly */
+	inline float GetFadeDuration(float Density, float SpawnSpeed)
+	{
+		const float Rate = SpawnSpeed * Density;
+		return Rate > 0.0f ? 3.0f / Rate : 0.0f;
+	}
+
+	/** Visibility of Count voxels, VectorWidth at a time with vector instructions and the tail with EvaluateScalar() */
+	VOLUMETRICSMOKE_API void Evaluate(float* RESTRICT OutVisibility, const float* RESTRICT Density, const float* RESTRICT ArrivalTime, int32 Count, const FSmokeFadeParams& Params);
+
+	/** Scalar fallback. Same operations in the same order as Evaluate(), so results are bit-identical. */
+	VOLUMETRICSMOKE_API void EvaluateScalar(float* RESTRICT OutVisibility, const float* RESTRICT Density, const float* RESTRICT ArrivalTime, int32 Count, const FSmokeFadeParams& Params);
+
+	/** Visibility of a single voxel */
+	VOLUMETRICSMOKE_API float EvaluateVoxel(float Density, float ArrivalTime, const FSmokeFadeParams& Params);
+}
@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * World to grid transform of a volume, voxel X centred on X. Positions are made relative to Origin in double
+ * precision first, so the rest fits a single precision matrix that transforms a position with vector instructions.
+ */
+struct VOLUMETRICSMOKE_API FSmokeGridTransform
+{
+	/** World location of the component */
+	FVector Origin = FVector::ZeroVector;
+
+	/** From world space relative to Origin to grid coordinates */
+	FMatrix44f RelativeToGrid = FMatrix44f::Identity;
+
+	/** Transform of a grid of Resolution^3 voxels filling the cube of half size SphereRadius around the component */
+	static FSmokeGridTransform Make(const FTransform& ComponentTransform, float SphereRadius, int32 Resolution);
+
+	FVector3f TransformPosition(const FVector& WorldPosition) const
+	{
+		return RelativeToGrid.TransformPosition(FVector3f(WorldPosition - Origin));
+	}
+
+	/** TransformPosition() into a vector register, W is 1 */
+	VectorRegister4Float TransformPositionVector(const FVector& WorldPosition) const
+	{
+		const FVector3f RelativePosition(WorldPosition - Origin);
+		return VectorTransformVector(VectorLoadFloat3_W1(&RelativePosition), &RelativeToGrid);
+	}
+};
@@ -0,0 +1,107 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Walks the voxels a segment passes through, in order along the segment, with the 3D DDA of Amanatides and Woo.
+ *
+ * Grid positions are in voxels, voxel (X, Y, Z) spans [X, X + 1) on each axis. The segment is clipped to the grid,
+ * then the walk starts in the voxel it enters through and always steps across the voxel face the segment reaches
+ * first. A step is a compare and an add, no voxel is visited twice and a segment crosses at most 3 * Resolution
+ * voxels, however long it is.
+ */
+namespace SmokeGridTraversal
+{
+	/**
+	 * Calls Visitor(const FIntVector& VoxelCoord, float EnterT, float ExitT) for every voxel of a Resolution^3 grid
+	 * between Start and End. EnterT and ExitT bound the part of the segment inside the voxel, as fractions of the
+	 * segment from Start. The walk stops early once Visitor returns false.
+	 */
+	template<typename VisitorType>
+	void Traverse(const FVector3f& Start, const FVector3f& End, int32 Resolution, VisitorType&& Visitor)
+	{
+		const FVector3f Direction = End - Start;
+
+		// Clip to the box of the grid, one slab per axis
+		float EnterT = 0.0f;
+		float ExitT = 1.0f;
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			if (FMath::Abs(Direction[Axis]) < UE_KINDA_SMALL_NUMBER)
+			{
+				if (Start[Axis] < 0.0f || Start[Axis] >= Resolution)
+				{
+					return;
+				}
+				continue;
+			}
+
+			float SlabEnterT = -Start[Axis] / Direction[Axis];
+			float SlabExitT = (Resolution - Start[Axis]) / Direction[Axis];
+			if (SlabEnterT > SlabExitT)
+			{
+				Swap(SlabEnterT, SlabExitT);
+			}
+			EnterT = FMath::Max(EnterT, SlabEnterT);
+			ExitT = FMath::Min(ExitT, SlabExitT);
+		}
+
+		if (EnterT >= ExitT)
+		{
+			return;
+		}
+
+		// Per axis: the direction of a step, the segment fraction of the next face crossing and between two crossings
+		const FVector3f EnterPosition = Start + Direction * EnterT;
+		FIntVector VoxelCoord;
+		int32 Step[3];
+		float NextT[3];
+		float DeltaT[3];
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			VoxelCoord[Axis] = FMath::Clamp(FMath::FloorToInt32(EnterPosition[Axis]), 0, Resolution - 1);
+
+			if (FMath::Abs(Direction[Axis]) < UE_KINDA_SMALL_NUMBER)
+			{
+				Step[Axis] = 0;
+				NextT[Axis] = TNumericLimits<float>::Max();
+				DeltaT[Axis] = 0.0f;
+			}
+			else if (Direction[Axis] > 0.0f)
+			{
+				Step[Axis] = 1;
+				NextT[Axis] = (VoxelCoord[Axis] + 1 - Start[Axis]) / Direction[Axis];
+				DeltaT[Axis] = 1.0f / Direction[Axis];
+			}
+			else
+			{
+				Step[Axis] = -1;
+				NextT[Axis] = (VoxelCoord[Axis] - Start[Axis]) / Direction[Axis];
+				DeltaT[Axis] = -1.0f / Direction[Axis];
+			}
+		}
+
+		float VoxelEnterT = EnterT;
+		while (true)
+		{
+			const int32 Axis = NextT[0] < NextT[1] ? (NextT[0] < NextT[2] ? 0 : 2) : (NextT[1] < NextT[2] ? 1 : 2);
+			const float VoxelExitT = FMath::Min(NextT[Axis], ExitT);
+
+			if (!Visitor(static_cast<const FIntVector&>(VoxelCoord), VoxelEnterT, VoxelExitT) || NextT[Axis] >= ExitT)
+			{
+				return;
+			}
+
+			VoxelCoord[Axis] += Step[Axis];
+			if (VoxelCoord[Axis] < 0 || VoxelCoord[Axis] >= Resolution)
+			{
+				return;
+			}
+
+			VoxelEnterT = NextT[Axis];
+			NextT[Axis] += DeltaT[Axis];
+		}
+	}
+}
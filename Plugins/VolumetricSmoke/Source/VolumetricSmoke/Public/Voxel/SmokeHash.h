@@ -0,0 +1,44 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Counter-based random numbers for per-voxel smoke attributes.
+ *
+ * A value is a pure function of a seed and a counter, usually the voxel's grid index, built from the PCG
+ * output permutation (Jarzynski and Olano, "Hash Functions for GPU Rendering"). There is no generator state,
+ * so voxels can be processed in any order and on any thread, and the same seed gives the same smoke on
+ * every machine without replicating it. Integer operations only, so results do not depend on the compiler
+ * or floating point mode.
+ */
+namespace SmokeHash
+{
+	/** PCG hash of a 32 bit value */
+	inline uint32 Pcg(uint32 Value)
+	{
+		const uint32 State = Value * 747796405u + 2891336453u;
+		const uint32 Word = ((State >> ((State >> 28u) + 4u)) ^ State) * 277803737u;
+		return (Word >> 22u) ^ Word;
+	}
+
+	/** Random value for Counter in the stream Seed */
+	inline uint32 Hash(uint32 Seed, uint32 Counter)
+	{
+		return Pcg(Counter ^ Pcg(Seed));
+	}
+
+	/** Seed for a grid cell, e.g. a world position rounded to whole units */
+	inline uint32 HashCell(const FIntVector& Cell)
+	{
+		return Pcg(static_cast<uint32>(Cell.X) ^ Pcg(static_cast<uint32>(Cell.Y) ^ Pcg(static_cast<uint32>(Cell.Z))));
+	}
+
+	/** Maps a random value to [Min, Max], inclusive, by multiply-shift instead of a division */
+	inline int32 ToRange(uint32 Value, int32 Min, int32 Max)
+	{
+		const uint64 Range = static_cast<uint64>(Max - Min) + 1;
+		return Min + static_cast<int32>((static_cast<uint64>(Value) * Range) >> 32);
+	}
+}
@@ -0,0 +1,156 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Occupancy of one world-aligned cell, as cached by FSmokeObstacleCache
+ */
+struct FSmokeObstacleCacheKey
+{
+	/** Cell coordinates, world position divided by the cell size */
+	FIntVector Cell = FIntVector::ZeroValue;
+
+	/**
+	 * Bit pattern of the cell size in world units. Grids of different voxel sizes cache separately, even when the
+	 * sizes round to the same whole number, since their cells do not line up.
+	 */
+	uint32 CellSizeBits = 0;
+
+	float GetCellSize() const
+	{
+		float CellSize;
+		FMemory::Memcpy(&CellSize, &CellSizeBits, sizeof(CellSize));
+		return CellSize;
+	}
+
+	void SetCellSize(float CellSize)
+	{
+		FMemory::Memcpy(&CellSizeBits, &CellSize, sizeof(CellSizeBits));
+	}
+
+	bool operator==(const FSmokeObstacleCacheKey& Other) const
+	{
+		return Cell == Other.Cell && CellSizeBits == Other.CellSizeBits;
+	}
+
+	friend uint32 GetTypeHash(const FSmokeObstacleCacheKey& Key)
+	{
+		return HashCombineFast(GetTypeHash(Key.Cell), ::GetTypeHash(Key.CellSizeBits));
+	}
+};
+
+/** Result of one cache lookup during a probe, applied to the cache on the game thread afterwards */
+struct FSmokeObstacleCacheUpdate
+{
+	FSmokeObstacleCacheKey Key;
+	bool bBlocked = false;
+
+	/** The result came from the cache and only needs touching, otherwise it was queried and is added */
+	bool bHit = false;
+};
+
+/**
+ * Least-recently-used cache of static obstacle occupancy, keyed by world-aligned cells at the voxel size of
+ * the smoke that queried them. Owned by USmokeVolumeSubsystem and shared by every smoke volume of a world,
+ * so smokes landing in the same spot query physics once.
+ *
+ * Only static and stationary geometry is cached, movable bodies are always queried live. Entries of a region
+ * are invalidated when geometry there is destroyed or streamed, and the whole cache when it is edited.
+ *
+ * Entries live in a fixed array linked in LRU order, so a full cache evicts without allocating.
+ * Find() may be called from several threads as long as nothing modifies the cache at the same time.
+ */
+class VOLUMETRICSMOKE_API FSmokeObstacleCache
+{
+public:
+
+	/** Counters since the cache was created */
+	struct FStats
+	{
+		int64 Hits = 0;
+		int64 Misses = 0;
+		int64 Evictions = 0;
+		int64 Invalidations = 0;
+	};
+
+	/** Key of the cell containing WorldPos */
+	static FSmokeObstacleCacheKey MakeKey(const FVector& WorldPos, float CellSize);
+
+	/** World position of the centre of a cell, the point its occupancy is probed at */
+	static FVector GetCellCenter(const FSmokeObstacleCacheKey& Key);
+
+	/** Empties the cache and allocates room for Capacity entries */
+	void SetCapacity(int32 InCapacity);
+
+	int32 GetCapacity() const { return Capacity; }
+
+	int32 Num() const { return Index.Num(); }
+
+	/** Cached occupancy of a cell, null if it is not cached. Does not count as a use. */
+	const bool* Find(const FSmokeObstacleCacheKey& Key) const
+	{
+		const int32* EntryIndex = Index.Find(Key);
+		return EntryIndex ? &Entries[*EntryIndex].bBlocked : nullptr;
+	}
+
+	/** Adds queried cells and marks looked up ones as most recently used */
+	void Apply(TConstArrayView<FSmokeObstacleCacheUpdate> Updates);
+
+	/**
+	 * Removes every entry whose cell overlaps WorldBounds. Looks up the cells inside the bounds when there are fewer
+	 * of them than entries, so invalidating a small region of a full cache does not walk all of it.
+	 */
+	void Invalidate(const FBox& WorldBounds);
+
+	/** Removes every entry, keeping the memory */
+	void Empty();
+
+	const FStats& GetStats() const { return Stats; }
+
+	SIZE_T GetAllocatedSize() const { return Index.GetAllocatedSize() + Entries.GetAllocatedSize() + CellSizeCounts.GetAllocatedSize(); }
+
+private:
+
+	struct FEntry
+	{
+		FSmokeObstacleCacheKey Key;
+
+		/** Neighbours in LRU order, or the next free entry */
+		int32 Prev = INDEX_NONE;
+		int32 Next = INDEX_NONE;
+
+		bool bBlocked = false;
+	};
+
+	void Add(const FSmokeObstacleCacheKey& Key, bool bBlocked);
+	void Touch(int32 EntryIndex);
+	void Unlink(int32 EntryIndex);
+	void LinkFront(int32 EntryIndex);
+	void Remove(int32 EntryIndex);
+
+	/** Cell size and number of entries of each grid in the cache */
+	struct FCellSizeCount
+	{
+		uint32 CellSizeBits = 0;
+		int32 Num = 0;
+	};
+
+	TMap<FSmokeObstacleCacheKey, int32> Index;
+
+	/** Few entries, one per voxel size of the smokes that queried the cache */
+	TArray<FCellSizeCount> CellSizeCounts;
+	TArray<FEntry> Entries;
+
+	/** Most and least recently used entries */
+	int32 Head = INDEX_NONE;
+	int32 Tail = INDEX_NONE;
+
+	/** Unused entries, linked through Next */
+	int32 FreeList = INDEX_NONE;
+
+	int32 Capacity = 0;
+
+	FStats Stats;
+};
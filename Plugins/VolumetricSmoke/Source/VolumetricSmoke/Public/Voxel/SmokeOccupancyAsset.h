@@ -0,0 +1,113 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "SmokeOccupancyAsset.generated.h"
+
+class UWorld;
+
+/**
+ * Static collision of a level, voxelized into a bitfield of world-aligned cells.
+ *
+ * Cells are grouped into 8x8x8 blocks. A coarse index holds one entry per block and only blocks that
+ * contain occupied cells store their 512 bits, so open space costs 4 bytes per block. Looking up a cell
+ * is two array reads.
+ *
+ * Baked by USmokeOccupancyBakeCommandlet and loaded by USmokeVolumeSubsystem, which lets smoke generation
+ * skip physics queries against static geometry.
+ */
+UCLASS(BlueprintType)
+class VOLUMETRICSMOKE_API USmokeOccupancyAsset : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+
+	/** Cells per block along each axis, as a shift */
+	static constexpr int32 BlockShift = 3;
+	static constexpr int32 BlockSize = 1 << BlockShift;
+	static constexpr int32 BlockMask = BlockSize - 1;
+
+	/** 64-bit words holding the bits of one block */
+	static constexpr int32 WordsPerBlock = (BlockSize * BlockSize * BlockSize) / 64;
+
+	/** Most cells along any axis, a larger level is baked with larger cells */
+	static constexpr int32 MaxResolution = 2048;
+
+	/** Long package name the occupancy of a map is saved to and loaded from, e.g. /Game/SmokeOccupancy/MyMap_SmokeOccupancy */
+	static FString GetPackageNameForMap(const FString& MapPackageName);
+
+	/** Occupancy asset of the map a world was loaded from, works for PIE worlds too */
+	static FString GetObjectPathForWorld(const UWorld* World);
+
+	/**
+	 * Voxelizes every non-movable primitive of World that blocks the visibility channel. Runs the same
+	 * octree-culled physics probe smoke generation uses, chunk by chunk. Must be called on the game thread.
+	 */
+	void Bake(UWorld* World, float InCellSize);
+
+	/** Clears the asset to an empty grid of the given layout */
+	void Initialize(const FVector& InOrigin, float InCellSize, const FIntVector& InResolution);
+
+	void SetCellOccupied(const FIntVector& Cell);
+
+	bool IsCellOccupied(const FIntVector& Cell) const
+	{
+		if (Cell.X < 0 || Cell.Y < 0 || Cell.Z < 0 || Cell.X >= Resolution.X || Cell.Y >= Resolution.Y || Cell.Z >= Resolution.Z)
+		{
+			return false;
+		}
+
+		const int32 Block = BlockIndex[GetBlockIndex(Cell)];
+		if (Block == INDEX_NONE)
+		{
+			return false;
+		}
+
+		const int32 LocalIndex = (Cell.X & BlockMask) | ((Cell.Y & BlockMask) << BlockShift) | ((Cell.Z & BlockMask) << (2 * BlockShift));
+		return (BlockBits[Block + (LocalIndex >> 6)] >> (LocalIndex & 63)) & 1;
+	}
+
+	/** True if any cell overlapping the bounding box of the sphere is occupied */
+	bool IsSphereOccupied(const FVector& WorldPos, float Radius) const;
+
+	bool IsEmpty() const { return NumOccupiedCells == 0; }
+
+	float GetCellSize() const { return CellSize; }
+
+	SIZE_T GetAllocatedSize() const { return BlockIndex.GetAllocatedSize() + BlockBits.GetAllocatedSize(); }
+
+private:
+
+	int32 GetBlockIndex(const FIntVector& Cell) const
+	{
+		return (Cell.X >> BlockShift) + (Cell.Y >> BlockShift) * BlocksPerAxis.X + (Cell.Z >> BlockShift) * BlocksPerAxis.X * BlocksPerAxis.Y;
+	}
+
+	/** World position of the min corner of cell (0, 0, 0) */
+	UPROPERTY(VisibleAnywhere, Category = "Occupancy")
+	FVector Origin = FVector::ZeroVector;
+
+	/** Edge length of a cell in world units */
+	UPROPERTY(VisibleAnywhere, Category = "Occupancy")
+	float CellSize = 0.0f;
+
+	/** Cells along each axis */
+	UPROPERTY(VisibleAnywhere, Category = "Occupancy")
+	FIntVector Resolution = FIntVector::ZeroValue;
+
+	UPROPERTY(VisibleAnywhere, Category = "Occupancy")
+	FIntVector BlocksPerAxis = FIntVector::ZeroValue;
+
+	UPROPERTY(VisibleAnywhere, Category = "Occupancy")
+	int32 NumOccupiedCells = 0;
+
+	/** Per block, the first of its WordsPerBlock words in BlockBits, INDEX_NONE if the block is empty */
+	UPROPERTY()
+	TArray<int32> BlockIndex;
+
+	UPROPERTY()
+	TArray<uint64> BlockBits;
+};
@@ -0,0 +1,121 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Limits of a pressure projection */
+struct FSmokePressureSettings
+{
+	/** Most V-cycles per projection, the iteration budget */
+	int32 MaxCycles = 4;
+
+	/** The solve stops once the residual has dropped to this share of the initial residual */
+	float Tolerance = 0.1f;
+
+	/** Red-black Gauss-Seidel sweeps before and after the coarse grid correction of every level */
+	int32 SmoothingSweeps = 2;
+
+	/** Sweeps on the coarsest level, which is small enough to be smoothed to convergence */
+	int32 CoarseSweeps = 16;
+};
+
+/** Counters of the last projection */
+struct FSmokePressureStats
+{
+	/** Cells of the finest level */
+	int32 NumCells = 0;
+
+	/** Grids of the multigrid hierarchy, the finest included */
+	int32 NumLevels = 0;
+
+	/** V-cycles run, 0 if the flow was divergence-free already */
+	int32 Cycles = 0;
+
+	/** L2 norm of the divergence before and of the residual after the solve */
+	float InitialResidual = 0.0f;
+	float FinalResidual = 0.0f;
+
+	/** Average factor the residual shrinks by per V-cycle, lower converges faster. 0 without cycles. */
+	float ConvergenceRate = 0.0f;
+
+	double SolveSeconds = 0.0;
+};
+
+/**
+ * Pressure projection of a velocity field on a dense grid, making the flow divergence-free so it swirls around
+ * obstacles instead of piling up against them.
+ *
+ * The Poisson equation for pressure is solved with a geometric multigrid: V-cycles that smooth every level with
+ * red-black Gauss-Seidel, restrict the residual to a grid of half the resolution and interpolate the correction back.
+ * Obstacle cells take no pressure and let no air through, the faces of the grid are open air at rest pressure.
+ * Each colour of a sweep runs over Z slices in parallel. Velocity lives at cell centres, the projection is the
+ * approximate one of a collocated grid.
+ */
+class VOLUMETRICSMOKE_API FSmokePressureSolver
+{
+public:
+
+	/** Sizes the finest level and clears velocity and obstacles. Each axis must be a multiple of 8. */
+	void Resize(const FIntVector& InSize);
+
+	const FIntVector& GetSize() const { return Levels[0].Size; }
+
+	int32 GetIndex(int32 X, int32 Y, int32 Z) const { return Levels[0].GetIndex(X, Y, Z); }
+
+	/** Velocity per cell of the finest level, one array per axis, written by the caller and projected in place */
+	TArray<float> Velocity[3];
+
+	/** Per cell of the finest level, 1 for air and 0 for obstacles, written by the caller */
+	TArray<uint8> Fluid;
+
+	/** Removes the divergence from Velocity */
+	const FSmokePressureStats& Project(const FSmokePressureSettings& Settings);
+
+	const FSmokePressureStats& GetStats() const { return Stats; }
+
+	SIZE_T GetAllocatedSize() const;
+
+private:
+
+	struct FLevel
+	{
+		FIntVector Size = FIntVector::ZeroValue;
+		TArray<float> Pressure;
+		TArray<float> Rhs;
+		TArray<float> Residual;
+
+		/** Obstacle mask of this level, a coarse cell is air if any of its children is */
+		TArray<uint8> Fluid;
+
+		int32 GetIndex(int32 X, int32 Y, int32 Z) const { return X + Y * Size.X + Z * Size.X * Size.Y; }
+		int32 Num() const { return Size.X * Size.Y * Size.Z; }
+	};
+
+	/** Builds the coarse obstacle masks from Fluid */
+	void BuildCoarseMasks();
+
+	/** Divergence of Velocity into the right hand side of the finest level */
+	void ComputeDivergence();
+
+	/** Red-black Gauss-Seidel sweeps over a level */
+	void Smooth(int32 LevelIndex, int32 Sweeps);
+
+	/** Residual of a level into its Residual array, returns its L2 norm */
+	float ComputeResidual(int32 LevelIndex);
+
+	/** Residual of a level as the right hand side of the next coarser one */
+	void Restrict(int32 LevelIndex);
+
+	/** Adds the correction of the next coarser level to a level */
+	void Prolongate(int32 LevelIndex);
+
+	void VCycle(int32 LevelIndex, const FSmokePressureSettings& Settings);
+
+	/** Subtracts the pressure gradient from Velocity */
+	void SubtractGradient();
+
+	TArray<FLevel> Levels;
+
+	FSmokePressureStats Stats;
+};
@@ -0,0 +1,156 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/VolumetricSmokeComponent.h"
+#include "Tasks/Task.h"
+#include "Voxel/SmokeScratchMemory.h"
+
+#include <atomic>
+
+class FSmokeVolume;
+class USmokeOccupancyAsset;
+class UWorld;
+
+/** Everything a regeneration reads from its component, copied on the game thread when it starts */
+struct FSmokeGenerationSettings
+{
+	FTransform ComponentTransform;
+	float SphereRadius = 0.0f;
+	int32 VoxelResolution = 0;
+	ESmokeChannelFormat DensityFormat = ESmokeChannelFormat::UNorm8;
+	ESmokeFillMode FillMode = ESmokeFillMode::FloodFill;
+	float FloodFillVolumeScale = 1.0f;
+	double FloodFillBudgetSeconds = 0.0;
+	float SmokeLifetime = 0.0f;
+	float DissipationDuration = 0.0f;
+	uint32 AttributeSeed = 0;
+	FSmokeSimulationSettings Simulation;
+
+	/** Grow the flood fill to the end on the worker thread, for worlds where nothing ticks it afterwards */
+	bool bCompleteFloodFill = false;
+
+	static FSmokeGenerationSettings FromComponent(const UVolumetricSmokeComponent& Component);
+
+	float GetVoxelSize() const { return (SphereRadius * 2.0f) / VoxelResolution; }
+};
+
+/** Stages of a regeneration, in pipeline order */
+enum class ESmokeRegenerationStage : uint8
+{
+	/** Broad-phase overlap, on the game thread in Start() */
+	Gather,
+	/** Narrow-phase and baked obstacle classification, also in Start() while the gathered bodies are alive */
+	Obstacles,
+	/** Sphere classification over parallel Z slices, or the flood fill */
+	Fill,
+	/** Per-voxel attributes and colours */
+	Attributes,
+	/** Swapped in by USmokeVolumeSubsystem, the scene proxy is sent a copy of its voxels at the end of that frame */
+	Publish,
+
+	Num
+};
+
+/**
+ * One regeneration of a smoke volume, built off the game thread.
+ *
+ * Start() runs the obstacle stages on the game thread, the broad-phase overlap and then the narrow phase fanned out
+ * over worker threads. The gathered bodies belong to their components, which game code may destroy as soon as Start()
+ * returns, so nothing after it touches them. The fill stages follow as a chain of UE::Tasks, each stage a task
+ * depending on the previous one. They fan out over worker threads themselves where they can, and the chains of
+ * different volumes interleave on the worker pool, so a burst of detonations is spread over several workers and
+ * frames instead of one game thread frame.
+ *
+ * The job writes into a spare volume, so the component keeps showing its previous voxels in the meantime, or for a
+ * detonation into the component's own volume, which reads as empty until the job is done. Once IsDone(),
+ * USmokeVolumeSubsystem publishes the volume on the game thread in one go and hands it to the render thread.
+ * Cancel() makes the remaining stages return right away, a superseded job is dropped without ever being seen.
+ */
+class VOLUMETRICSMOKE_API FSmokeRegenerationJob
+{
+public:
+
+	/**
+	 * Volume must be reset to the settings' resolution and density format, it is the job's until it is done. The
+	 * scratch memory is handed back by ReleaseScratchMemory(), so it can serve the next job.
+	 */
+	FSmokeRegenerationJob(UVolumetricSmokeComponent* InComponent, FSmokeVolume* InVolume, const FSmokeGenerationSettings& InSettings,
+		TUniquePtr<FSmokeScratchMemory> InScratchMemory);
+
+	/** Cancels the job and waits for the worker thread */
+	~FSmokeRegenerationJob();
+
+	FSmokeRegenerationJob(const FSmokeRegenerationJob&) = delete;
+	FSmokeRegenerationJob& operator=(const FSmokeRegenerationJob&) = delete;
+
+	/** Resolves obstacles and launches the fill stages. Game thread only. StaticOccupancy must outlive the job. */
+	void Start(UWorld* World, const USmokeOccupancyAsset* InStaticOccupancy);
+
+	/** Asks the worker to stop, the result is thrown away */
+	void Cancel() { bCancelled.store(true, std::memory_order_relaxed); }
+
+	bool IsCancelled() const { return bCancelled.load(std::memory_order_relaxed); }
+
+	/** True once the last stage has returned, the volume may be touched again */
+	bool IsDone() const { return !Completion.IsValid() || Completion.IsCompleted(); }
+
+	/** Blocks until IsDone(), Cancel() first to return soon */
+	void Wait();
+
+	/** Empties the scratch memory and hands it back. Only once IsDone(). */
+	TUniquePtr<FSmokeScratchMemory> ReleaseScratchMemory();
+
+	UVolumetricSmokeComponent* GetComponent() const { return Component.Get(); }
+
+	bool IsFor(const UVolumetricSmokeComponent* InComponent) const { return Component.Get() == InComponent; }
+
+	FSmokeVolume* GetVolume() const { return Volume; }
+
+	const FSmokeGenerationSettings& GetSettings() const { return Settings; }
+
+	/** Obstacle counters of the build. Valid once IsDone(). */
+	const FSmokeObstacleQueryStats& GetObstacleQueryStats() const { return ObstacleQueryStats; }
+
+	/** Worker thread time a stage took. Valid once IsDone(). */
+	double GetStageSeconds(ESmokeRegenerationStage Stage) const { return StageSeconds[static_cast<int32>(Stage)]; }
+
+	/** Worker thread time of all stages. Valid once IsDone(). */
+	double GetBuildSeconds() const;
+
+	/** Platform time from Start() until the last stage returned. Valid once IsDone(). */
+	double GetLatencySeconds() const { return FinishTime - StartTime; }
+
+private:
+
+	/** Stages, LaunchStage() checks for cancellation first */
+	void ResolveObstacles();
+	void FillVoxels();
+	void FillAttributes();
+
+	/** Launches a stage that runs once Prerequisite is done and records its time */
+	UE::Tasks::FTask LaunchStage(ESmokeRegenerationStage Stage, void (FSmokeRegenerationJob::*Body)(), const UE::Tasks::FTask& Prerequisite);
+
+	TWeakObjectPtr<UVolumetricSmokeComponent> Component;
+	FSmokeVolume* Volume = nullptr;
+	FSmokeGenerationSettings Settings;
+
+	/** Baked static collision, null to probe static geometry with physics */
+	const USmokeOccupancyAsset* StaticOccupancy = nullptr;
+
+	/** Jobs run side by side, so each has its own buffers instead of the subsystem's, passed on from job to job */
+	TUniquePtr<FSmokeScratchMemory> ScratchMemory;
+
+	FSmokeObstacleQueryStats ObstacleQueryStats;
+
+	// Written by the stages, each entry by one stage only
+	double StageSeconds[static_cast<int32>(ESmokeRegenerationStage::Num)] = {};
+	double StartTime = 0.0;
+	double FinishTime = 0.0;
+
+	std::atomic<bool> bCancelled{ false };
+
+	/** Last stage of the chain */
+	UE::Tasks::FTask Completion;
+};
@@ -0,0 +1,100 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Voxel/SmokeFadeKernel.h"
+#include "Voxel/SmokeVoxelChannel.h"
+
+#include <atomic>
+
+class FSmokeVolume;
+struct FSmokeRenderUpdate;
+
+/**
+ * Copy of the voxel data a scene proxy draws. Taken on the game thread while nothing else writes to the volume and
+ * owned by the proxy from then on, so the volume may be stepped, carved, cleared or handed back to the pool while the
+ * render thread draws the smoke as it was. Kept up to date by applying FSmokeRenderUpdate.
+ */
+struct VOLUMETRICSMOKE_API FSmokeRenderData
+{
+	/** Grid resolution VoxelIndex refers to */
+	int32 Resolution = 0;
+
+	/** World time the volume was spawned at, fade-in is measured from it */
+	double SpawnTime = 0.0;
+
+	/** Fade parameters of the volume, ElapsedTime is filled in for the rendered frame */
+	FSmokeFadeParams FadeParams;
+
+	/** Attributes of the filled voxels, in the encoding and slot order of FSmokeFilledVoxels */
+	FSmokeVoxelChannel Density;
+	FSmokeVoxelChannel ArrivalTime;
+	TArray<int32> VoxelIndex;
+
+	int32 Num() const { return VoxelIndex.Num(); }
+
+	/** Copies the filled voxels of Volume. Nothing may be writing to the volume meanwhile. */
+	void CopyFrom(const FSmokeVolume& Volume, float SpawnSpeed);
+
+	/** Applies an update gathered from the volume this copy was taken from, on the render thread */
+	void Apply(FSmokeRenderUpdate& Update);
+
+	/** Fade parameters at WorldTime */
+	FSmokeFadeParams GetFadeParams(double WorldTime) const
+	{
+		FSmokeFadeParams Result = FadeParams;
+		Result.ElapsedTime = static_cast<float>(WorldTime - SpawnTime);
+		return Result;
+	}
+
+	FIntVector IndexToVoxel(int32 Index) const
+	{
+		return FIntVector(Index % Resolution, (Index / Resolution) % Resolution, Index / (Resolution * Resolution));
+	}
+
+	SIZE_T GetAllocatedSize() const
+	{
+		return Density.GetAllocatedSize() + ArrivalTime.GetAllocatedSize() + VoxelIndex.GetAllocatedSize();
+	}
+};
+
+/**
+ * Voxels a scene proxy is sent to catch up with its volume: every voxel after the volume was reset, otherwise only the
+ * voxels of the bricks changed since the last update. Gathered on the game thread and applied to the proxy's
+ * FSmokeRenderData on the render thread. Components reuse their updates once the render thread is done with them, so
+ * updating the proxy does not allocate once their arrays have grown.
+ */
+struct VOLUMETRICSMOKE_API FSmokeRenderUpdate
+{
+	/** Header of the volume, see FSmokeRenderData */
+	int32 Resolution = 0;
+	double SpawnTime = 0.0;
+	FSmokeFadeParams FadeParams;
+
+	/** Filled voxels of the volume, the proxy's copy is cut or grown to it */
+	int32 NumVoxels = 0;
+
+	/** True if the arrays below hold every voxel in slot order, false if they hold the voxels at Slots */
+	bool bAllVoxels = false;
+
+	/** Slots of the sent voxels, empty if bAllVoxels */
+	TArray<int32> Slots;
+
+	/** Attributes of the sent voxels, in the encoding of FSmokeFilledVoxels */
+	FSmokeVoxelChannel Density;
+	FSmokeVoxelChannel ArrivalTime;
+	TArray<int32> VoxelIndex;
+
+	/** Set while the update is queued for the render thread, which clears it once applied */
+	std::atomic<bool> bQueued{ false };
+
+	/**
+	 * Gathers the voxels of the bricks changed since the last update, or every voxel if bInAllVoxels or the volume was
+	 * reset, and clears the volume's change marks. Nothing may be writing to the volume meanwhile.
+	 */
+	void Gather(FSmokeVolume& Volume, float SpawnSpeed, bool bInAllVoxels);
+
+	/** An update emptying the proxy's copy */
+	void SetEmpty();
+};
@@ -0,0 +1,172 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/ContainerAllocationPolicies.h"
+#include "HAL/CriticalSection.h"
+
+#include <atomic>
+
+/**
+ * Linear allocator for the transient buffers of smoke generation.
+ *
+ * Allocations bump a cursor through one block and are never freed one by one, Reset() releases all of them at once.
+ * Allocating is lock-free, so worker threads filling arrays side by side allocate from the same arena. Whatever does
+ * not fit into the block comes from the heap and is counted, and Reset() then grows the block to everything the pass
+ * asked for. A pass no larger than an earlier one therefore never touches the heap.
+ */
+class VOLUMETRICSMOKE_API FSmokeScratchArena
+{
+public:
+
+	/** Alignment of every allocation, enough for any element type of the scratch arrays */
+	static constexpr uint32 Alignment = 16;
+
+	FSmokeScratchArena() = default;
+	~FSmokeScratchArena();
+
+	FSmokeScratchArena(const FSmokeScratchArena&) = delete;
+	FSmokeScratchArena& operator=(const FSmokeScratchArena&) = delete;
+
+	/** Returns Size bytes, aligned to Alignment. Safe to call from several threads. */
+	void* Allocate(SIZE_T Size);
+
+	/**
+	 * Releases every allocation, growing the block first if the pass did not fit. Nothing allocated before may be used
+	 * afterwards, and nothing may be allocating meanwhile.
+	 */
+	void Reset();
+
+	/** Reset() and frees the block */
+	void Empty();
+
+	/** Bytes of the block and of the heap allocations made since the last Reset() */
+	SIZE_T GetAllocatedSize() const;
+
+	/** Bytes handed out since the last Reset(), alignment included */
+	SIZE_T GetUsedSize() const { return Used.load(std::memory_order_relaxed); }
+
+	/** Heap allocations since the arena was created, allocations that did not fit as well as blocks grown by Reset() */
+	int32 GetNumHeapAllocations() const { return NumHeapAllocations.load(std::memory_order_relaxed); }
+
+private:
+
+	uint8* Block = nullptr;
+	SIZE_T BlockSize = 0;
+
+	/** Bytes handed out, including those that did not fit. Reset() grows the block to this. */
+	std::atomic<SIZE_T> Used{ 0 };
+
+	std::atomic<int32> NumHeapAllocations{ 0 };
+
+	/** Allocations that did not fit into the block, freed by Reset() */
+	mutable FCriticalSection OverflowLock;
+	TArray<void*> Overflows;
+	SIZE_T OverflowBytes = 0;
+};
+
+/**
+ * TArray allocation policy taking its memory from an FSmokeScratchArena. An array must be bound to its arena with
+ * SetArena() before it allocates. Growing it takes a new range from the arena and leaves the old one behind, freeing
+ * it only forgets the memory. Arrays have to be emptied before their arena is reset, see FSmokeScratchMemory::Reset().
+ */
+class FSmokeScratchAllocator
+{
+public:
+
+	using SizeType = int32;
+
+	enum { NeedsElementType = false };
+	enum { RequireRangeCheck = true };
+
+	class ForAnyElementType
+	{
+	public:
+
+		ForAnyElementType() = default;
+
+		/** Arena later allocations come from. The array must not hold an allocation. */
+		void SetArena(FSmokeScratchArena* InArena)
+		{
+			check(!Data);
+			Arena = InArena;
+		}
+
+		FSmokeScratchArena* GetArena() const { return Arena; }
+
+		void MoveToEmpty(ForAnyElementType& Other)
+		{
+			checkSlow(this != &Other);
+			Data = Other.Data;
+			Arena = Other.Arena;
+			Other.Data = nullptr;
+		}
+
+		FScriptContainerElement* GetAllocation() const { return Data; }
+
+		void ResizeAllocation(SizeType CurrentNum, SizeType NewMax, SIZE_T NumBytesPerElement)
+		{
+			FScriptContainerElement* OldData = Data;
+			Data = nullptr;
+
+			if (NewMax > 0)
+			{
+				checkf(Arena, TEXT("Smoke scratch array allocates before it was bound to an arena"));
+				Data = static_cast<FScriptContainerElement*>(Arena->Allocate(static_cast<SIZE_T>(NewMax) * NumBytesPerElement));
+
+				if (OldData && CurrentNum > 0)
+				{
+					FMemory::Memcpy(Data, OldData, static_cast<SIZE_T>(FMath::Min(NewMax, CurrentNum)) * NumBytesPerElement);
+				}
+			}
+		}
+
+		SizeType CalculateSlackReserve(SizeType NewMax, SIZE_T NumBytesPerElement) const
+		{
+			return DefaultCalculateSlackReserve(NewMax, NumBytesPerElement, false);
+		}
+
+		SizeType CalculateSlackShrink(SizeType NewMax, SizeType CurrentMax, SIZE_T NumBytesPerElement) const
+		{
+			return DefaultCalculateSlackShrink(NewMax, CurrentMax, NumBytesPerElement, false);
+		}
+
+		SizeType CalculateSlackGrow(SizeType NewMax, SizeType CurrentMax, SIZE_T NumBytesPerElement) const
+		{
+			return DefaultCalculateSlackGrow(NewMax, CurrentMax, NumBytesPerElement, false);
+		}
+
+		SIZE_T GetAllocatedSize(SizeType CurrentMax, SIZE_T NumBytesPerElement) const
+		{
+			return static_cast<SIZE_T>(CurrentMax) * NumBytesPerElement;
+		}
+
+		bool HasAllocation() const { return Data != nullptr; }
+
+		SizeType GetInitialCapacity() const { return 0; }
+
+	private:
+
+		FScriptContainerElement* Data = nullptr;
+		FSmokeScratchArena* Arena = nullptr;
+	};
+
+	template<typename ElementType>
+	class ForElementType : public ForAnyElementType
+	{
+	public:
+
+		ElementType* GetAllocation() const { return (ElementType*)ForAnyElementType::GetAllocation(); }
+	};
+};
+
+template <>
+struct TAllocatorTraits<FSmokeScratchAllocator> : TAllocatorTraitsBase<FSmokeScratchAllocator>
+{
+	enum { IsZeroConstruct = true };
+};
+
+/** Array of an FSmokeScratchArena */
+template<typename ElementType>
+using TSmokeScratchArray = TArray<ElementType, FSmokeScratchAllocator>;
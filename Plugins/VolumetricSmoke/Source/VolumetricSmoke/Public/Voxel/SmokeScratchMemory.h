@@ -0,0 +1,122 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/OverlapResult.h"
+#include "Voxel/SmokeObstacleCache.h"
+#include "Voxel/SmokeScratchArena.h"
+
+struct FBodyInstance;
+
+/**
+ * Transient buffers of smoke generation: broad-phase overlap results and obstacle probe output.
+ *
+ * Owned by USmokeVolumeSubsystem and reused by every regeneration in its world. Obstacle and fill output lives in
+ * Arena and is released in one go by Reset() at the end of each pass. The arena grows to the largest pass, and the
+ * few buffers handed to the engine stay allocated between passes. Further regenerations of that size do not touch the
+ * heap. Regenerations run on the game thread one at a time, which is the only synchronization there is.
+ * Regenerations running on worker threads each bring their own, see FSmokeRegenerationJob.
+ */
+struct VOLUMETRICSMOKE_API FSmokeScratchMemory
+{
+	/** Memory of every TSmokeScratchArray below, declared first so it outlives them */
+	FSmokeScratchArena Arena;
+
+	/** Overlaps of the broad-phase query, filled by the engine so on the heap */
+	TArray<FOverlapResult> OverlapResults;
+
+	/** Bodies the narrow phase tests against, owned by their components and only valid until game code runs again */
+	TArray<const FBodyInstance*> Bodies;
+
+	/** Blocked voxels of each top-level octree block, filled in parallel */
+	TArray<TSmokeScratchArray<int32>> BlockedPerBlock;
+
+	/** Blocked voxels of the whole grid */
+	TSmokeScratchArray<int32> BlockedVoxels;
+
+	/** Voxels blocked by baked static occupancy */
+	TSmokeScratchArray<int32> StaticBlockedVoxels;
+
+	/** Voxels blocked by live static geometry, when validating baked occupancy */
+	TSmokeScratchArray<int32> ValidationVoxels;
+
+	/** Voxels inside the sphere of each Z slice, filled in parallel by FSmokeVolume::FillSphere() */
+	TArray<TSmokeScratchArray<int32>> SphereVoxelsPerSlice;
+
+	/** Obstacle cache lookups and new cells of each top-level octree block, filled in parallel */
+	TArray<TSmokeScratchArray<FSmokeObstacleCacheUpdate>> CacheUpdatesPerBlock;
+
+	/** Obstacle cache lookups and new cells of the whole grid, applied to the cache on the game thread */
+	TSmokeScratchArray<FSmokeObstacleCacheUpdate> CacheUpdates;
+
+	FSmokeScratchMemory()
+	{
+		BlockedVoxels.GetAllocatorInstance().SetArena(&Arena);
+		StaticBlockedVoxels.GetAllocatorInstance().SetArena(&Arena);
+		ValidationVoxels.GetAllocatorInstance().SetArena(&Arena);
+		CacheUpdates.GetAllocatorInstance().SetArena(&Arena);
+	}
+
+	FSmokeScratchMemory(const FSmokeScratchMemory&) = delete;
+	FSmokeScratchMemory& operator=(const FSmokeScratchMemory&) = delete;
+
+	/** Makes sure there are at least Num arrays, new ones bound to the arena */
+	template<typename ElementType>
+	void SetMinNumArrays(TArray<TSmokeScratchArray<ElementType>>& Arrays, int32 Num)
+	{
+		for (int32 Index = Arrays.Num(); Index < Num; ++Index)
+		{
+			Arrays.AddDefaulted_GetRef().GetAllocatorInstance().SetArena(&Arena);
+		}
+	}
+
+	/**
+	 * Ends a pass: empties every arena array and releases their memory at once. Nothing may be using them. The gathered
+	 * bodies are forgotten too, they are not safe to use past the pass.
+	 */
+	void Reset()
+	{
+		OverlapResults.Reset();
+		Bodies.Reset();
+		BlockedVoxels.Empty();
+		StaticBlockedVoxels.Empty();
+		ValidationVoxels.Empty();
+		CacheUpdates.Empty();
+		for (TSmokeScratchArray<int32>& Blocked : BlockedPerBlock)
+		{
+			Blocked.Empty();
+		}
+		for (TSmokeScratchArray<int32>& Slice : SphereVoxelsPerSlice)
+		{
+			Slice.Empty();
+		}
+		for (TSmokeScratchArray<FSmokeObstacleCacheUpdate>& Updates : CacheUpdatesPerBlock)
+		{
+			Updates.Empty();
+		}
+		Arena.Reset();
+	}
+
+	/** Reset() and frees every buffer */
+	void Empty()
+	{
+		Reset();
+		OverlapResults.Empty();
+		Bodies.Empty();
+		BlockedPerBlock.Empty();
+		SphereVoxelsPerSlice.Empty();
+		CacheUpdatesPerBlock.Empty();
+		Arena.Empty();
+	}
+
+	/** Heap allocations of the arena so far, see FSmokeScratchArena::GetNumHeapAllocations() */
+	int32 GetNumHeapAllocations() const { return Arena.GetNumHeapAllocations(); }
+
+	/** Bytes of the arena and of the buffers kept on the heap */
+	SIZE_T GetAllocatedSize() const
+	{
+		return Arena.GetAllocatedSize() + OverlapResults.GetAllocatedSize() + Bodies.GetAllocatedSize() + BlockedPerBlock.GetAllocatedSize() +
+			SphereVoxelsPerSlice.GetAllocatedSize() + CacheUpdatesPerBlock.GetAllocatedSize();
+	}
+};
@@ -0,0 +1,253 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Voxel/SmokePressureSolver.h"
+
+class FSmokeBrickGrid;
+class FSmokeVolume;
+
+/** Parameters of the density simulation of a smoke volume, in voxel units */
+struct FSmokeSimulationSettings
+{
+	/** Diffusion coefficient in voxels^2 per second */
+	float Diffusion = 0.0f;
+
+	/** Share of the density lost per second */
+	float Decay = 0.0f;
+
+	/** Fixed simulation step. Each step is split further if the diffusion would be unstable otherwise. */
+	float SubStepSeconds = 1.0f / 30.0f;
+
+	/** Most steps per Advance(), time beyond them is dropped so a hitch does not snowball */
+	int32 MaxSubSteps = 4;
+
+	/** Density below which a voxel does not become smoke and a brick stops being simulated */
+	float MinDensity = 0.01f;
+
+	/** Carry the density along with wind and the velocity field. Without diffusion or decay, smoke in still air
+	 * keeps the simulation running until wind or an impulse moves it. */
+	bool bAdvect = false;
+
+	/** Share of the velocity from impulses lost per second */
+	float VelocityDamping = 2.0f;
+
+	/** Make the flow divergence-free before advecting, so air swirls around obstacles and through openings */
+	bool bProjectPressure = false;
+
+	FSmokePressureSettings Pressure;
+
+	bool IsEnabled() const { return SubStepSeconds > 0.0f && (Diffusion > 0.0f || Decay > 0.0f || bAdvect); }
+};
+
+/** Air pushed around inside a volume, in voxel units of its grid */
+struct FSmokeVelocityImpulse
+{
+	/** Grid position of the centre */
+	FVector3f Center = FVector3f::ZeroVector;
+
+	/** Voxels from the centre at which the impulse has faded out */
+	float Radius = 0.0f;
+
+	/** Velocity the air takes on at the centre, voxels per second */
+	FVector3f Velocity = FVector3f::ZeroVector;
+
+	/** Speed away from the centre added to Velocity, voxels per second. Explosions push outwards. */
+	float RadialSpeed = 0.0f;
+};
+
+/** Counters of a simulation since it was initialized */
+struct FSmokeSimulationStats
+{
+	/** Bricks with a density field, awake or asleep */
+	int32 NumBricks = 0;
+
+	/** Bricks updated by the last step */
+	int32 NumAwakeBricks = 0;
+
+	/** Voxel updates over all steps, one per voxel of an awake brick per advection or stencil pass */
+	int64 VoxelUpdates = 0;
+
+	/** Wall time spent in the steps */
+	double ComputeSeconds = 0.0;
+
+	/** Pressure projections and the V-cycles they took */
+	int32 PressureSolves = 0;
+	int32 PressureCycles = 0;
+
+	/** Residual reduction per V-cycle of the last projection, see FSmokePressureStats */
+	float PressureConvergenceRate = 0.0f;
+
+	/** Clusters of awake bricks advected without projection because the step's voxel budget was spent */
+	int32 PressureSkippedBoxes = 0;
+
+	/** Wall time spent in pressure projections, part of ComputeSeconds */
+	double PressureSeconds = 0.0;
+
+	double GetVoxelUpdatesPerSecond() const { return ComputeSeconds > 0.0 ? VoxelUpdates / ComputeSeconds : 0.0; }
+};
+
+/**
+ * Eulerian diffusion, decay and advection of smoke density over the bricks of a volume.
+ *
+ * The density field is kept as floats per 8x8x8 brick, next to the volume's own brick grid, and only bricks with
+ * smoke in or next to them are simulated. Each step applies a 7-point diffusion stencil with exponential decay,
+ * four voxels at a time with vector instructions, to every awake brick in parallel. Obstacles block the flux and
+ * stay empty, the faces of the grid are open and let smoke escape.
+ *
+ * With bAdvect the density is first carried along with a uniform wind plus a velocity field kept per brick, which
+ * impulses from explosions and moving pawns write into and which damps back to rest. Advection is semi-Lagrangian:
+ * each voxel traces back along its velocity and samples the previous density there. Stability relies on clamping that
+ * trace to MaxAdvectBricks (2) bricks per step, the reach of the bricks woken around the smoke: air faster than that
+ * is slowed to it instead of sub-stepping, so a low fixed rate caps how fast smoke can travel.
+ * With bProjectPressure the velocity, wind included, is first made divergence-free by FSmokePressureSolver on a
+ * dense grid over each cluster of touching awake bricks. The boxes of one step share a budget of voxels, clusters past
+ * it are advected unprojected and counted in PressureSkippedBoxes.
+ *
+ * Advance() writes the field back into the volume: filled voxels take the new density and free voxels the smoke
+ * spreads into are filled. Bricks whose smoke has thinned out below MinDensity go to sleep, once all of them
+ * sleep the simulation has settled.
+ */
+class VOLUMETRICSMOKE_API FSmokeSimulation
+{
+public:
+
+	/** Takes the filled voxels of Volume as the initial density field */
+	void Initialize(const FSmokeVolume& Volume, const FSmokeSimulationSettings& InSettings);
+
+	/** Drops the field, keeping the allocations */
+	void Reset();
+
+	bool IsInitialized() const { return bInitialized; }
+
+	/** True while any brick is awake */
+	bool IsRunning() const { return bInitialized && NumAwake > 0; }
+
+	/** Uniform wind in voxels per second, added to the velocity field */
+	void SetWind(const FVector3f& InWind) { Wind = InWind; }
+
+	/** Queues an impulse for the next step. Ignored unless the simulation is running and advects. */
+	void AddImpulse(const FSmokeVelocityImpulse& Impulse);
+
+	/** Runs as many fixed steps as fit into DeltaTime plus the remainder of earlier calls and writes the result to Volume */
+	void Advance(FSmokeVolume& Volume, float DeltaTime, float ElapsedTime);
+
+	const FSmokeSimulationStats& GetStats() const { return Stats; }
+
+	SIZE_T GetAllocatedSize() const;
+
+private:
+
+	/** One fixed step: applies impulses, wakes bricks smoke flows into, advects, then runs the stencil NumPasses times */
+	void Step(const FSmokeBrickGrid& Cells, float StepSeconds);
+
+	/** Writes the queued impulses into the velocity field of the bricks they reach that hold smoke or border it, waking them */
+	void ApplyImpulses(float SleepDensity);
+
+	/** Semi-Lagrangian advection of one brick from Density into NextDensity, damps its velocity */
+	void AdvectBrick(const FSmokeBrickGrid& Cells, int32 Slot, float StepSeconds, float MaxDisplacement, float DampingFactor);
+
+	/** Trilinear density at a grid position, leaving out blocked voxels. Fallback if every neighbour is blocked. */
+	float SampleDensity(const FSmokeBrickGrid& Cells, const FVector3f& Position, float Fallback) const;
+
+	/** Pressure projection of wind plus velocity field over the box of each cluster of awake bricks, within a voxel budget */
+	void ProjectVelocity(const FSmokeBrickGrid& Cells);
+
+	/** Groups the awake slots into clusters connected through faces, into ClusterSlots and ClusterStarts */
+	void GroupAwakeClusters();
+
+	/** Projects the velocity of Slots on a dense grid of Size voxels at Origin, returns their highest field speed */
+	float ProjectBox(const FSmokeBrickGrid& Cells, TConstArrayView<int32> Slots, const FIntVector& Origin, const FIntVector& Size);
+
+	/** Puts the awake bricks whose smoke has thinned out to sleep and clears them */
+	void SleepSettledBricks(float SleepDensity);
+
+	/** Wakes every brick within Radius bricks of Slot, allocating them as needed */
+	void WakeAround(int32 Slot, int32 Radius);
+
+	/** Stencil pass over one brick, from Density into NextDensity */
+	void UpdateBrick(const FSmokeBrickGrid& Cells, int32 Slot, float Alpha, float DecayFactor);
+
+	/** Recomputes the highest density of a slot and of its faces from its values */
+	void UpdateMaxima(int32 Slot, const float* Values);
+
+	/** Slot of the brick at BrickCoord, allocated and zeroed on first use */
+	int32 FindOrAddSlot(const FIntVector& BrickCoord);
+
+	/** Density at a voxel coordinate, 0 outside the grid and in bricks without a field */
+	float GetDensity(const FIntVector& VoxelCoord) const;
+
+	/**
+	 * Writes the densities of the dirty bricks to the volume's filled voxels and fills voxels smoke spread into.
+	 * The filled voxels of bricks that went to sleep hold no smoke any more and are freed.
+	 */
+	void WriteBack(FSmokeVolume& Volume, float ElapsedTime);
+
+	FSmokeSimulationSettings Settings;
+
+	int32 Resolution = 0;
+	int32 BricksPerAxis = 0;
+
+	/** Slot for every brick of the grid, INDEX_NONE without a field */
+	TArray<int32> BrickSlots;
+
+	/** Brick coordinates of each slot */
+	TArray<FIntVector> SlotBricks;
+
+	/** Density per slot, FSmokeVoxelBrick::NumVoxels values each in brick-local order. Swapped after each pass. */
+	TArray<float> Density;
+	TArray<float> NextDensity;
+
+	/** Velocity per slot in voxels per second, one array per axis in the layout of Density */
+	TArray<float> Velocity[3];
+
+	/** Highest density of each slot and of each of its 6 faces (-X, +X, -Y, +Y, -Z, +Z), from the last pass */
+	TArray<float> SlotMaxDensity;
+	TArray<float> SlotFaceMaxDensity;
+
+	/** Slots simulated by the next step */
+	TArray<bool> SlotAwake;
+
+	/** Slots changed since the last write back */
+	TArray<bool> SlotDirty;
+
+	/** Awake slots of the current step */
+	TArray<int32> AwakeSlots;
+
+	/** Awake slots ordered by cluster, ClusterStarts holds where each one starts plus the end */
+	TArray<int32> ClusterSlots;
+	TArray<int32> ClusterStarts;
+
+	/** Slots already in a cluster while grouping */
+	TArray<bool> SlotClustered;
+
+	/** Voxels smoke spread into, per dirty slot, filled in parallel and appended in slot order */
+	TArray<TArray<int32>> NewVoxelsPerSlot;
+
+	/** Filled slots of the voxels of sleeping bricks, per dirty slot, filled in parallel */
+	TArray<TArray<int32>> EmptiedSlotsPerSlot;
+
+	/** Every emptied slot of a write back, freed from the highest down */
+	TArray<int32> EmptiedSlots;
+
+	int32 NumAwake = 0;
+
+	/** Impulses for the next step */
+	TArray<FSmokeVelocityImpulse> PendingImpulses;
+
+	FVector3f Wind = FVector3f::ZeroVector;
+
+	/** Dense grid the velocity is projected on, kept for its allocations */
+	FSmokePressureSolver PressureSolver;
+
+	/** Upper bound of the speed of the velocity field, kept as impulses come in and damp out */
+	float MaxFieldSpeed = 0.0f;
+
+	/** Time not yet simulated, less than one step */
+	float PendingSeconds = 0.0f;
+
+	bool bInitialized = false;
+
+	FSmokeSimulationStats Stats;
+};
@@ -0,0 +1,236 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/WeakObjectPtrTemplates.h"
+#include "Voxel/SmokeBrickGrid.h"
+#include "Voxel/SmokeFadeKernel.h"
+#include "Voxel/SmokeGridTransform.h"
+#include "Voxel/SmokeSimulation.h"
+
+class UVolumetricSmokeComponent;
+struct FSmokeScratchMemory;
+
+/** Voxels changed by FSmokeVolume::CarveRay() */
+struct FSmokeCarveResult
+{
+	/** Filled voxels hidden by the carve */
+	int32 ClearedVoxels = 0;
+
+	/** Bricks holding them, the only ones whose visible voxels changed */
+	int32 TouchedBricks = 0;
+};
+
+/** Voxels changed by FSmokeVolume::ClearSphere() */
+struct FSmokeClearResult
+{
+	/** Filled voxels blown away */
+	int32 ClearedVoxels = 0;
+
+	/** Bricks overlapping the sphere that were scanned */
+	int32 ScannedBricks = 0;
+
+	/** Time the clear took, the whole cost of the refill too */
+	double Seconds = 0.0;
+};
+
+/**
+ * Voxel data of one smoke volume, owned by USmokeVolumeSubsystem. UVolumetricSmokeComponent is the
+ * authoring handle onto it: it generates the volume, the subsystem grows the flood fill every frame.
+ *
+ * Everything here works on grid indices and only touches the volume's own data, so different volumes
+ * can be stepped on different threads at the same time.
+ */
+class VOLUMETRICSMOKE_API FSmokeVolume
+{
+public:
+
+	/** Component the volume belongs to */
+	TWeakObjectPtr<UVolumetricSmokeComponent> Owner;
+
+	/** Sparse voxel storage, 8x8x8 bricks allocated only where smoke or obstacles are */
+	FSmokeBrickGrid VoxelBricks;
+
+	/** Attributes of the voxels filled with smoke, one contiguous array per attribute, in fill order */
+	FSmokeFilledVoxels SmokeVoxels;
+
+	/** World time the volume was spawned at, fade-in is measured from it */
+	double SpawnTime = 0.0;
+
+	/** Game thread time the flood fill may spend per step */
+	double FloodFillBudgetSeconds = 0.0;
+
+	/** Seconds after SpawnTime the smoke starts to dissipate, 0 lives until regenerated */
+	float Lifetime = 0.0f;
+
+	/** Seconds the smoke takes to fade out once its lifetime is over */
+	float DissipationDuration = 0.0f;
+
+	/** Seed of the per-voxel attribute hash. Set before generating, Reset() keeps it. */
+	uint32 Seed = 0;
+
+	/** Diffusion and decay applied once the fill is complete. Set before generating, Reset() keeps it. */
+	FSmokeSimulationSettings SimulationSettings;
+
+	/** Clears the volume for a new resolution. Allocations are kept for reuse. */
+	void Reset(int32 InResolution, ESmokeChannelFormat DensityFormat, double InSpawnTime);
+
+	/**
+	 * Allocates what a volume of up to MaxResolution needs to be filled in either fill mode at DensityFormat, so
+	 * regenerating it afterwards does not grow the filled voxels. A simulation spreading the smoke further grows them
+	 * by the bricks it reaches, wider formats grow the density channel once, and the volume keeps both for its next fill.
+	 * Used by the volume pool of USmokeVolumeSubsystem.
+	 */
+	void Preallocate(int32 MaxResolution, ESmokeChannelFormat DensityFormat);
+
+	/** Removes every voxel and stops the fill, keeping the resolution and the allocations */
+	void Clear();
+
+	/** Most voxels a flood fill of the given grid resolution and volume scale may fill */
+	static int32 GetFloodFillCapacity(int32 InResolution, float VolumeScale);
+
+	/** Fade parameters at WorldTime */
+	FSmokeFadeParams GetFadeParams(double WorldTime, float SpawnSpeed) const;
+
+	/** True once the smoke has faded out completely at WorldTime. Volumes without a lifetime never dissipate. */
+	bool HasDissipated(double WorldTime) const
+	{
+		return Lifetime > 0.0f && WorldTime - SpawnTime >= Lifetime + DissipationDuration;
+	}
+
+	int32 GetResolution() const { return Resolution; }
+
+	/** Convert a grid index to voxel coordinates */
+	FIntVector IndexToVoxel(int32 Index) const
+	{
+		return FIntVector(Index % Resolution, (Index / Resolution) % Resolution, Index / (Resolution * Resolution));
+	}
+
+	int32 VoxelToIndex(const FIntVector& VoxelCoord) const
+	{
+		return VoxelCoord.X + VoxelCoord.Y * Resolution + VoxelCoord.Z * Resolution * Resolution;
+	}
+
+	/** Check if voxel coordinates are valid */
+	bool IsValidVoxelCoord(const FIntVector& Coord) const
+	{
+		return Coord.X >= 0 && Coord.X < Resolution &&
+			   Coord.Y >= 0 && Coord.Y < Resolution &&
+			   Coord.Z >= 0 && Coord.Z < Resolution;
+	}
+
+	/** Fill a voxel with smoke. It starts fading in at ArrivalTime, in seconds after SpawnTime. */
+	void AddVoxel(int32 Index, float Density, float ArrivalTime);
+
+	/** Frees a filled voxel again. The last filled voxel moves into its slot, so slots taken before may change. */
+	void RemoveVoxel(int32 Slot);
+
+	/** Mark voxels, given as grid indices, as blocked by obstacles */
+	void MarkBlocked(TConstArrayView<int32> Indices);
+
+	/**
+	 * Fill every voxel inside the sphere touching the faces of the grid that is not blocked, in grid order.
+	 * Density falls off from 1 at the centre to 0 at the surface and every voxel starts fading in right away.
+	 * Z slices are classified in parallel into one array per slice in the arena of ScratchMemory, then
+	 * appended in order, so the result does not depend on scheduling.
+	 */
+	void FillSphere(FSmokeScratchMemory& ScratchMemory);
+
+	/**
+	 * Seed the flood fill at the free voxel closest to the centre. The fill may fill up to Capacity voxels.
+	 * Obstacles must already be marked Blocked. Returns false if there is no free voxel to start from.
+	 */
+	bool BeginFloodFill(int32 Capacity);
+
+	/** Grow the flood fill until it completes or BudgetSeconds have elapsed. ElapsedTime is the arrival time of new voxels. */
+	void StepFloodFill(double BudgetSeconds, float ElapsedTime);
+
+	bool IsFloodFillRunning() const { return bFloodFillRunning; }
+
+	/** Stop the flood fill where it is */
+	void StopFloodFill() { bFloodFillRunning = false; }
+
+	/**
+	 * Advance the density simulation by DeltaTime. Starts it from the filled voxels once the flood fill is done.
+	 * ElapsedTime is the arrival time of voxels the smoke spreads into.
+	 */
+	void StepSimulation(float DeltaTime, float ElapsedTime);
+
+	/** True while the simulation is enabled and has not settled yet */
+	bool IsSimulating() const
+	{
+		return SimulationSettings.IsEnabled() && (!Simulation.IsInitialized() || Simulation.IsRunning());
+	}
+
+	const FSmokeSimulation& GetSimulation() const { return Simulation; }
+	FSmokeSimulation& GetSimulation() { return Simulation; }
+
+	/**
+	 * Clears the smoke along a segment between two grid positions, voxel (X, Y, Z) spanning [X, X + 1) on each axis.
+	 * Filled voxels the segment passes through are hidden until RegrowTime, in seconds after SpawnTime, and fade back
+	 * in from there like newly filled ones. Only their arrival times change, in place, so the cost is the DDA walk of
+	 * SmokeGridTraversal and the fill order, the bricks and the simulation stay as they are.
+	 */
+	FSmokeCarveResult CarveRay(const FVector3f& Start, const FVector3f& End, float RegrowTime);
+
+	/**
+	 * Blows the smoke out of a sphere, Center in grid coordinates with voxel X centred on X and Radius in voxels.
+	 * The smoke refills it from the rim inwards: voxels on the rim reappear at RefillStart, in seconds after SpawnTime,
+	 * the centre RefillSeconds later, each fading back in from there. Like CarveRay() only arrival times change, so
+	 * the refill costs nothing after this call. Distances and regrowth times are computed four voxels at a time per
+	 * overlapping brick, the bricks in parallel.
+	 */
+	FSmokeClearResult ClearSphere(const FVector3f& Center, float Radius, float RefillStart, float RefillSeconds);
+
+	/**
+	 * Optical depth of the smoke along a segment between two grid positions, voxel (X, Y, Z) spanning [X, X + 1) on
+	 * each axis. Extinction is the optical depth of fully visible smoke of density 1 over the whole segment, each
+	 * voxel adds it times the share of the segment inside it times its density and its visibility at FadeParams, so
+	 * carved and cleared smoke lets the view through like it does on screen. Walks the segment with
+	 * SmokeGridTraversal and stops once MaxOpticalDepth is reached. Reads only, safe to call from several threads.
+	 */
+	float IntegrateOpticalDepth(const FVector3f& Start, const FVector3f& End, float Extinction, float MaxOpticalDepth, const FSmokeFadeParams& FadeParams) const;
+
+	/**
+	 * Adds the visible density of the smoke at each world position to OutDensities, trilinearly filtered between the
+	 * eight voxels around it. A voxel counts with its density times its visibility at FadeParams, free and blocked
+	 * voxels and those outside the grid are empty. Positions are transformed and their corners weighted four at a time
+	 * with vector instructions, and the corners of two positions are faded by one pass of SmokeFadeKernel::Evaluate().
+	 * Reads only, safe to call from several threads.
+	 */
+	void SampleDensities(TConstArrayView<FVector> WorldPositions, const FSmokeGridTransform& WorldToGrid, TArrayView<float> OutDensities, const FSmokeFadeParams& FadeParams) const;
+
+	/**
+	 * Generate randomized colors for the smoke voxels from FirstSlot onwards. Each colour is hashed from Seed and the
+	 * voxel's grid index, so it does not depend on fill order or threading, and large ranges run in parallel.
+	 */
+	void GenerateVoxelColors(int32 FirstSlot = 0);
+
+	/** Bytes allocated by the voxel data and the flood fill */
+	SIZE_T GetAllocatedSize() const;
+
+private:
+
+	/** Find the free voxel closest to the centre of the grid, INDEX_NONE if there is none */
+	int32 FindFloodFillSeed() const;
+
+	int32 Resolution = 0;
+
+	FSmokeSimulation Simulation;
+
+	// Flood fill queue. Cells in [FloodQueueHead, FloodRoundEnd) belong to the round being expanded.
+	// Sized once per regeneration so stepping the fill never allocates.
+	TArray<int32> FloodQueue;
+	int32 FloodQueueHead = 0;
+	int32 FloodRoundEnd = 0;
+	int32 FloodRound = 0;
+
+	// Cells reached by the fill that lie beyond the current round's radius
+	TArray<int32> FloodDeferred;
+
+	// Maximum number of voxels the flood fill may fill
+	int32 FloodFillCapacity = 0;
+
+	bool bFloodFillRunning = false;
+};
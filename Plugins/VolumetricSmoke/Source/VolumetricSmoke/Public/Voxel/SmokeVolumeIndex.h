@@ -0,0 +1,153 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/ScopeRWLock.h"
+
+class FSmokeVolume;
+
+/**
+ * Dynamic AABB tree over the world bounds of the smoke volumes of a world, so point, box and ray queries only look
+ * at the volumes they can touch instead of at every volume.
+ *
+ * Each leaf keeps the exact bounds of its volume inside a box enlarged by a margin, so a volume carried along by a
+ * moving actor only moves in the tree once it leaves the enlarged box. Inserting descends towards the child whose box
+ * grows the least, which keeps the tree shallow for the tens of volumes a world holds without rebalancing. Queries
+ * test the exact bounds, the enlarged boxes only cull.
+ *
+ * Updates take a write lock and queries a read lock, so AI and gameplay code may cull against the bounds from any
+ * thread while the game thread keeps the index up to date. Only the bounds are safe there: the volumes found are not
+ * pinned, and may be cleared, rebuilt or handed back to the pool as soon as the query returns. Their voxels are only
+ * read and written on the game thread and through USmokeVolumeSubsystem.
+ */
+class VOLUMETRICSMOKE_API FSmokeVolumeIndex
+{
+public:
+
+	/** Adds a volume, or updates its bounds and moves it in the tree if it left its enlarged box */
+	void Update(FSmokeVolume* Volume, const FBox& Bounds);
+
+	/** Removes a volume, does nothing if it is not indexed */
+	void Remove(const FSmokeVolume* Volume);
+
+	/** Removes every volume, keeping the allocations */
+	void Reset();
+
+	/** Number of indexed volumes */
+	int32 Num() const;
+
+	/** Bounds a volume was last updated with, false if it is not indexed */
+	bool GetBounds(const FSmokeVolume* Volume, FBox& OutBounds) const;
+
+	/** Appends the volumes whose bounds contain Point */
+	template<typename AllocatorType>
+	void QueryPoint(const FVector& Point, TArray<const FSmokeVolume*, AllocatorType>& OutVolumes) const
+	{
+		Query([&Point](const FBox& Box) { return Box.IsInsideOrOn(Point); }, OutVolumes);
+	}
+
+	/** Appends the volumes whose bounds overlap Box */
+	template<typename AllocatorType>
+	void QueryBox(const FBox& Box, TArray<const FSmokeVolume*, AllocatorType>& OutVolumes) const
+	{
+		Query([&Box](const FBox& NodeBox) { return NodeBox.Intersect(Box); }, OutVolumes);
+	}
+
+	/** Appends the volumes whose bounds the segment from Start to End passes through */
+	template<typename AllocatorType>
+	void QueryRay(const FVector& Start, const FVector& End, TArray<const FSmokeVolume*, AllocatorType>& OutVolumes) const
+	{
+		const FVector Direction = End - Start;
+		Query([&Start, &End, &Direction](const FBox& Box) { return FMath::LineBoxIntersection(Box, Start, End, Direction); }, OutVolumes);
+	}
+
+	/** QueryBox() for the owner of the index, which writes to the volumes it finds on the game thread */
+	template<typename AllocatorType>
+	void QueryBox(const FBox& Box, TArray<FSmokeVolume*, AllocatorType>& OutVolumes)
+	{
+		Query([&Box](const FBox& NodeBox) { return NodeBox.Intersect(Box); }, OutVolumes);
+	}
+
+	/** QueryRay() for the owner of the index, which writes to the volumes it finds on the game thread */
+	template<typename AllocatorType>
+	void QueryRay(const FVector& Start, const FVector& End, TArray<FSmokeVolume*, AllocatorType>& OutVolumes)
+	{
+		const FVector Direction = End - Start;
+		Query([&Start, &End, &Direction](const FBox& Box) { return FMath::LineBoxIntersection(Box, Start, End, Direction); }, OutVolumes);
+	}
+
+	SIZE_T GetAllocatedSize() const;
+
+private:
+
+	struct FNode
+	{
+		/** Enlarged bounds of the volume for leaves, union of the children otherwise */
+		FBox Box = FBox(ForceInit);
+
+		/** Exact bounds of the volume, leaves only */
+		FBox Bounds = FBox(ForceInit);
+
+		FSmokeVolume* Volume = nullptr;
+
+		int32 Parent = INDEX_NONE;
+		int32 Children[2] = { INDEX_NONE, INDEX_NONE };
+
+		bool IsLeaf() const { return Children[0] == INDEX_NONE; }
+	};
+
+	/** Walks the nodes whose boxes Overlaps() accepts and appends the volumes of the leaves whose exact bounds it accepts */
+	template<typename OverlapsType, typename VolumeType, typename AllocatorType>
+	void Query(OverlapsType&& Overlaps, TArray<VolumeType*, AllocatorType>& OutVolumes) const
+	{
+		FReadScopeLock ReadLock(Lock);
+		if (Root == INDEX_NONE)
+		{
+			return;
+		}
+
+		TArray<int32, TInlineAllocator<32>> Stack;
+		Stack.Add(Root);
+		while (Stack.Num() > 0)
+		{
+			const FNode& Node = Nodes[Stack.Pop(EAllowShrinking::No)];
+			if (Node.IsLeaf())
+			{
+				if (Overlaps(Node.Bounds))
+				{
+					OutVolumes.Add(Node.Volume);
+				}
+			}
+			else if (Overlaps(Node.Box))
+			{
+				Stack.Add(Node.Children[0]);
+				Stack.Add(Node.Children[1]);
+			}
+		}
+	}
+
+	int32 AllocateNode();
+	void FreeNode(int32 NodeIndex);
+
+	/** Hangs a leaf next to the node whose box grows the least by it */
+	void InsertLeaf(int32 Leaf);
+
+	/** Unhooks a leaf, its parent is freed and the sibling takes the parent's place */
+	void RemoveLeaf(int32 Leaf);
+
+	/** Recomputes the boxes from NodeIndex up to the root */
+	void Refit(int32 NodeIndex);
+
+	TArray<FNode> Nodes;
+
+	/** Nodes available for reuse */
+	TArray<int32> FreeNodes;
+
+	int32 Root = INDEX_NONE;
+
+	/** Leaf of every indexed volume */
+	TMap<const FSmokeVolume*, int32> Leaves;
+
+	mutable FRWLock Lock;
+};
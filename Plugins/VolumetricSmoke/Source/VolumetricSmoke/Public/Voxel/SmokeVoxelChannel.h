@@ -0,0 +1,132 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SmokeVoxelChannel.generated.h"
+
+/**
+ * Storage precision of a per-voxel smoke attribute. The normalized formats hold values in [0, 1], the float formats any value.
+ */
+UENUM(BlueprintType)
+enum class ESmokeChannelFormat : uint8
+{
+	/** 32-bit float, exact */
+	Float32,
+	/** 16-bit half float, error <= 2^-12 */
+	Half16,
+	/** 16-bit unsigned normalized, error <= 0.5 / 65535 */
+	UNorm16,
+	/** 8-bit unsigned normalized, error <= 0.5 / 255 */
+	UNorm8
+};
+
+/**
+ * One per-voxel attribute stored at a chosen precision, values packed back to back.
+ * Load() and Store() convert whole ranges four values at a time with vector instructions,
+ * so hot loops should work on batches of floats rather than calling Get() and Set() per voxel.
+ */
+class VOLUMETRICSMOKE_API FSmokeVoxelChannel
+{
+public:
+
+	/** Clears the channel and switches it to a new format */
+	void SetFormat(ESmokeChannelFormat InFormat);
+
+	ESmokeChannelFormat GetFormat() const { return Format; }
+
+	int32 Num() const { return NumValues; }
+
+	void Reset()
+	{
+		Data.Reset();
+		NumValues = 0;
+	}
+
+	void Reserve(int32 Number) { Data.Reserve(Number * GetBytesPerValue(Format)); }
+
+	/** Values the channel holds before it has to grow */
+	int32 GetMax() const { return Data.Max() / GetBytesPerValue(Format); }
+
+	SIZE_T GetAllocatedSize() const { return Data.GetAllocatedSize(); }
+
+	/** Appends a value and returns its index */
+	int32 Add(float Value)
+	{
+		Data.AddUninitialized(GetBytesPerValue(Format));
+		const int32 Index = NumValues++;
+		Set(Index, Value);
+		return Index;
+	}
+
+	/** Moves the last value to Index and drops the last, as TArray::RemoveAtSwap() does. Copied encoded, so exact. */
+	void RemoveAtSwap(int32 Index)
+	{
+		const int32 BytesPerValue = GetBytesPerValue(Format);
+		const int32 Last = --NumValues;
+		if (Index != Last)
+		{
+			FMemory::Memcpy(&Data[Index * BytesPerValue], &Data[Last * BytesPerValue], BytesPerValue);
+		}
+		Data.SetNum(Last * BytesPerValue, EAllowShrinking::No);
+	}
+
+	/** Resizes the channel to Number values, values past the previous end are left undefined */
+	void SetNumUninitialized(int32 Number)
+	{
+		Data.SetNumUninitialized(Number * GetBytesPerValue(Format), EAllowShrinking::No);
+		NumValues = Number;
+	}
+
+	/** Copies every value of Source and its format, keeping the allocation when it is large enough */
+	void CopyFrom(const FSmokeVoxelChannel& Source)
+	{
+		Format = Source.Format;
+		Data.Reset();
+		Data.Append(Source.Data);
+		NumValues = Source.NumValues;
+	}
+
+	/** Appends the value at SourceIndex of Source, which must have the same format. Copied encoded, so exact. */
+	int32 AddFrom(const FSmokeVoxelChannel& Source, int32 SourceIndex)
+	{
+		Data.AddUninitialized(GetBytesPerValue(Format));
+		const int32 Index = NumValues++;
+		SetFrom(Index, Source, SourceIndex);
+		return Index;
+	}
+
+	/** Overwrites the value at Index with the one at SourceIndex of Source, which must have the same format. Copied encoded, so exact. */
+	void SetFrom(int32 Index, const FSmokeVoxelChannel& Source, int32 SourceIndex)
+	{
+		check(Format == Source.Format);
+		const int32 BytesPerValue = GetBytesPerValue(Format);
+		FMemory::Memcpy(&Data[Index * BytesPerValue], &Source.Data[SourceIndex * BytesPerValue], BytesPerValue);
+	}
+
+	float Get(int32 Index) const;
+
+	void Set(int32 Index, float Value);
+
+	/** Decodes Count values starting at First into Out */
+	void Load(int32 First, int32 Count, float* RESTRICT Out) const;
+
+	/** Encodes Count values from In into the channel starting at First, rounding to nearest */
+	void Store(int32 First, int32 Count, const float* RESTRICT In);
+
+	/** Spacing between representable values just below 1.0, 0 for Float32 */
+	float GetQuantum() const { return GetQuantum(Format); }
+
+	static int32 GetBytesPerValue(ESmokeChannelFormat InFormat);
+
+	static float GetQuantum(ESmokeChannelFormat InFormat);
+
+	/** Largest difference between a value in [0, 1] and its stored copy (relative error for Half16 outside that range) */
+	static float GetMaxError(ESmokeChannelFormat InFormat) { return 0.5f * GetQuantum(InFormat); }
+
+private:
+
+	TArray<uint8> Data;
+	int32 NumValues = 0;
+	ESmokeChannelFormat Format = ESmokeChannelFormat::Float32;
+};
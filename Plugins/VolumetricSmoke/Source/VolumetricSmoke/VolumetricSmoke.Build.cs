@@ -49,6 +49,7 @@ public class VolumetricSmoke : ModuleRules
 				"RHI",
 				"Renderer",
 				"RenderCore",
+				"AssetRegistry",
 				// ... add private dependencies that you statically link with here ...	
 			}
 			);
@@ -21,7 +21,7 @@ public class CustomShaderProject : ModuleRules
 			"Slate"
 		});
 
-		PrivateDependencyModuleNames.AddRange(new string[] { });
+		PrivateDependencyModuleNames.AddRange(new string[] { "VolumetricSmoke" });
 
 		PublicIncludePaths.AddRange(new string[] {
 			"CustomShaderProject",
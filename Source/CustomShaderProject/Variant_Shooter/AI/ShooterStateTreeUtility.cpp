@@ -9,6 +9,7 @@
 #include "Perception/AIPerceptionComponent.h"
 #include "ShooterAIController.h"
 #include "StateTreeAsyncExecutionContext.h"
+#include "Subsystems/SmokeVolumeSubsystem.h"
 
 bool FStateTreeLineOfSightToTargetCondition::TestCondition(FStateTreeExecutionContext& Context) const
 {
@@ -49,13 +50,34 @@ bool FStateTreeLineOfSightToTargetCondition::TestCondition(FStateTreeExecutionCo
 
 	FHitResult OutHit;
 
-	// run a number of vertically offset line traces to the target location
-	for (int32 i = 0; i < InstanceData.NumberOfVerticalLineOfSightChecks - 1; ++i)
+	// build the vertically offset line of sight checks to the target location
+	const int32 NumChecks = FMath::Max(InstanceData.NumberOfVerticalLineOfSightChecks - 1, 0);
+	TArray<FSmokeRay, TInlineAllocator<8>> SightRays;
+	for (int32 i = 0; i < NumChecks; ++i)
 	{
-		// calculate the endpoint for the trace
-		const FVector End = CenterOfMass + FVector(0.0f, 0.0f, Extent.Z - ExtentZOffset * i);
+		SightRays.Add({ Start, CenterOfMass + FVector(0.0f, 0.0f, Extent.Z - ExtentZOffset * i) });
+	}
+
+	// ask how much smoke lies along all of them in one batch
+	TArray<float, TInlineAllocator<8>> SmokeDepths;
+	SmokeDepths.SetNumZeroed(NumChecks);
+
+	USmokeVolumeSubsystem* SmokeSubsystem = InstanceData.Character->GetWorld()->GetSubsystem<USmokeVolumeSubsystem>();
+	if (SmokeSubsystem && InstanceData.MinSmokeTransmittance > 0.0f)
+	{
+		SmokeSubsystem->QueryOpticalDepth(SightRays, SmokeDepths, InstanceData.MinSmokeTransmittance);
+	}
+
+	// run a line trace for each check the smoke doesn't hide
+	for (int32 i = 0; i < NumChecks; ++i)
+	{
+		// dense smoke blocks the view like a wall, so don't bother tracing
+		if (FMath::Exp(-SmokeDepths[i]) < InstanceData.MinSmokeTransmittance)
+		{
+			continue;
+		}
 
-		InstanceData.Character->GetWorld()->LineTraceSingleByChannel(OutHit, Start, End, ECC_Visibility, QueryParams);
+		InstanceData.Character->GetWorld()->LineTraceSingleByChannel(OutHit, SightRays[i].Start, SightRays[i].End, ECC_Visibility, QueryParams);
 
 		// is the trace unobstructed?
 		if (!OutHit.bBlockingHit)
@@ -251,6 +273,14 @@ EStateTreeRunStatus FStateTreeSenseEnemiesTask::EnterState(FStateTreeExecutionCo
 							// we have direct line of sight if this trace is unobstructed
 							bDirectLOS = !LambdaInstanceData->Character->GetWorld()->LineTraceSingleByChannel(OutHit, LambdaInstanceData->Character->GetActorLocation(), SensedActor->GetActorLocation(), ECC_Visibility, QueryParams);
 
+							// dense smoke between us hides the sensed actor too
+							USmokeVolumeSubsystem* SmokeSubsystem = LambdaInstanceData->Character->GetWorld()->GetSubsystem<USmokeVolumeSubsystem>();
+							if (bDirectLOS && SmokeSubsystem && LambdaInstanceData->MinSmokeTransmittance > 0.0f)
+							{
+								const float Transmittance = SmokeSubsystem->GetSmokeTransmittance(LambdaInstanceData->Character->GetActorLocation(), SensedActor->GetActorLocation(), LambdaInstanceData->MinSmokeTransmittance);
+								bDirectLOS = Transmittance >= LambdaInstanceData->MinSmokeTransmittance;
+							}
+
 						}
 
 						// check if we have a direct line of sight to the stimulus
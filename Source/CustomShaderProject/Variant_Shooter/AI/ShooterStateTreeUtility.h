@@ -39,6 +39,10 @@ struct FStateTreeLineOfSightToTargetConditionInstanceData
 	/** If true, the condition passes if the character has line of sight */
 	UPROPERTY(EditAnywhere, Category = "Condition")
 	bool bMustHaveLineOfSight = true;
+
+	/** Line of sight checks through smoke letting less light than this through are blocked. 0 sees through smoke. */
+	UPROPERTY(EditAnywhere, Category = "Condition", meta = (ClampMin = 0, ClampMax = 1))
+	float MinSmokeTransmittance = 0.2f;
 };
 STATETREE_POD_INSTANCEDATA(FStateTreeLineOfSightToTargetConditionInstanceData);
 
@@ -278,6 +282,10 @@ struct FStateTreeSenseEnemiesInstanceData
 	UPROPERTY(EditAnywhere, Category = Parameter)
 	float DirectLineOfSightCone = 85.0f;
 
+	/** Smoke letting less light than this through blocks direct line of sight. 0 sees through smoke. */
+	UPROPERTY(EditAnywhere, Category = Parameter, meta = (ClampMin = 0, ClampMax = 1))
+	float MinSmokeTransmittance = 0.2f;
+
 	/** Strength of the last processed stimulus */
 	UPROPERTY(EditAnywhere)
 	float LastStimulusStrength = 0.0f;
@@ -12,6 +12,7 @@
 #include "Engine/OverlapResult.h"
 #include "Engine/World.h"
 #include "TimerManager.h"
+#include "Subsystems/SmokeVolumeSubsystem.h"
 
 AShooterProjectile::AShooterProjectile()
 {
@@ -42,6 +43,20 @@ void AShooterProjectile::BeginPlay()
 	
 	// ignore the pawn that shot this projectile
 	CollisionComponent->IgnoreActorWhenMoving(GetInstigator(), true);
+
+	// the flight path through smoke is carved from the spawn point on
+	SmokeCarveStart = GetActorLocation();
+}
+
+void AShooterProjectile::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	// carve the path flown since the last tick, the hit carves the final stretch
+	if (!bHit)
+	{
+		CarveSmoke();
+	}
 }
 
 void AShooterProjectile::EndPlay(EEndPlayReason::Type EndPlayReason)
@@ -62,6 +77,9 @@ void AShooterProjectile::NotifyHit(class UPrimitiveComponent* MyComp, AActor* Ot
 
 	bHit = true;
 
+	// clear the smoke up to the point of impact
+	CarveSmoke();
+
 	// disable collision on the projectile
 	CollisionComponent->SetCollisionEnabled(ECollisionEnabled::NoCollision);
 
@@ -118,6 +136,13 @@ void AShooterProjectile::ExplosionCheck(const FVector& ExplosionCenter)
 
 	GetWorld()->OverlapMultiByObjectType(Overlaps, ExplosionCenter, FQuat::Identity, ObjectParams, OverlapShape, QueryParams);
 
+	// blow away the smoke in range and push the air of any simulated smoke away from the explosion
+	if (USmokeVolumeSubsystem* SmokeSubsystem = GetWorld()->GetSubsystem<USmokeVolumeSubsystem>())
+	{
+		SmokeSubsystem->ClearSphere(ExplosionCenter, ExplosionRadius, SmokeClearTime, SmokeRefillTime);
+		SmokeSubsystem->AddAirImpulse(ExplosionCenter, ExplosionRadius, FVector::ZeroVector, SmokeImpulseSpeed);
+	}
+
 	TArray<AActor*> DamagedActors;
 
 	// process the overlap results
@@ -139,6 +164,21 @@ void AShooterProjectile::ExplosionCheck(const FVector& ExplosionCenter)
 	}
 }
 
+void AShooterProjectile::CarveSmoke()
+{
+	const FVector CarveEnd = GetActorLocation();
+
+	if (bCarveSmoke)
+	{
+		if (USmokeVolumeSubsystem* SmokeSubsystem = GetWorld()->GetSubsystem<USmokeVolumeSubsystem>())
+		{
+			SmokeSubsystem->CarveRay(SmokeCarveStart, CarveEnd);
+		}
+	}
+
+	SmokeCarveStart = CarveEnd;
+}
+
 void AShooterProjectile::ProcessHit(AActor* HitActor, UPrimitiveComponent* HitComp, const FVector& HitLocation, const FVector& HitDirection)
 {
 	// have we hit a character?
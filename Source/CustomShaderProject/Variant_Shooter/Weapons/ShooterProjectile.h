@@ -65,6 +65,25 @@ protected:
 	UPROPERTY(EditAnywhere, Category="Projectile|Explosion", meta = (ClampMin = 0, ClampMax = 5000, Units = "cm"))
 	float ExplosionRadius = 500.0f;	
 
+	/** Speed at which the explosion pushes the air of nearby simulated smoke away from its center */
+	UPROPERTY(EditAnywhere, Category="Projectile|Explosion", meta = (ClampMin = 0, ClampMax = 10000, Units = "cm/s"))
+	float SmokeImpulseSpeed = 1500.0f;
+
+	/** How long the explosion keeps the smoke within its radius blown away before it starts to refill */
+	UPROPERTY(EditAnywhere, Category="Projectile|Explosion", meta = (ClampMin = 0, ClampMax = 30, Units = "s"))
+	float SmokeClearTime = 0.5f;
+
+	/** How long the surrounding smoke takes to refill the cleared sphere, from its rim to the center */
+	UPROPERTY(EditAnywhere, Category="Projectile|Explosion", meta = (ClampMin = 0, ClampMax = 30, Units = "s"))
+	float SmokeRefillTime = 2.0f;
+
+	/** If true, the projectile clears a tunnel through any smoke it flies through, which regrows after a while */
+	UPROPERTY(EditAnywhere, Category="Projectile|Smoke")
+	bool bCarveSmoke = true;
+
+	/** Where the smoke was last carved up to, the start of the next flight segment */
+	FVector SmokeCarveStart = FVector::ZeroVector;
+
 	/** If true, this projectile has already hit another surface */
 	bool bHit = false;
 
@@ -85,6 +104,9 @@ protected:
 	/** Gameplay initialization */
 	virtual void BeginPlay() override;
 
+	/** Carves smoke along the flight path */
+	virtual void Tick(float DeltaSeconds) override;
+
 	/** Gameplay cleanup */
 	virtual void EndPlay(EEndPlayReason::Type EndPlayReason) override;
 
@@ -96,6 +118,9 @@ protected:
 	/** Looks up actors within the explosion radius and damages them */
 	void ExplosionCheck(const FVector& ExplosionCenter);
 
+	/** Clears the smoke between the previous carve and the current location */
+	void CarveSmoke();
+
 	/** Processes a projectile hit for the given actor */
 	void ProcessHit(AActor* HitActor, UPrimitiveComponent* HitComp, const FVector& HitLocation, const FVector& HitDirection);
 